@@ -0,0 +1,213 @@
+/*
+   Album Shuffle
+
+   Plays whole albums in a random order, each album's songs in track
+   order. The albums are those of the album index tools/libprep.cpp
+   writes (see BrowseIndex.h), a group of library index track numbers
+   per album folder. They're played in a random permutation of the
+   albums, so none repeats until all have played. The next round is
+   shuffled again without starting on the album just played.
+
+   Moving to a song reads its path and record from the library index
+   by track number, two seeks. During an album's last song prefetch()
+   reads the next album and its first song's record ahead so moving on
+   to it reads nothing.
+
+   tools/hostplayer.cpp albumbench checks the coverage and times it.
+
+   Last Update: 10/18/2026
+*/
+
+#ifndef ALBUMSHUFFLE_H
+#define ALBUMSHUFFLE_H
+
+#include <vector>
+
+#include "BrowseIndex.h"
+#include "FrontCodedList.h"
+#include "Hal.h"
+#include "LibraryIndex.h"
+
+class AlbumShuffle {
+
+public:
+
+  AlbumShuffle() {
+    index = NULL;
+    close();
+  }
+
+  // Shuffle the albums of the album index. Returns false if there
+  // isn't one or it has no albums.
+  boolean open(HalFileSystem *fs, LibraryIndex *_index, const char *path = BROWSE_ALBUM_PATH) {
+
+    close();
+    index = _index;
+    if (!albums.open(fs, path, albumNames) || (albums.getGroupCount() == 0)) {
+      close();
+      return false;
+    }
+    order.resize(albums.getGroupCount());
+    for (uint32_t i = 0; i < order.size(); i++) {
+      order[i] = i;
+    }
+    shuffle(UINT32_MAX);
+    return true;
+  }
+
+  void close() {
+    albums.close();
+    albumNames.clear();
+    order.clear();
+    songs.clear();
+    position = UINT32_MAX;
+    album = 0;
+    song = 0;
+    prefetched = false;
+  }
+
+  uint32_t getAlbumCount() {
+    return order.size();
+  }
+
+  // Move to the next song, the first of the next album after the last
+  // one of an album, reading its record into track
+  boolean nextSong(LIBRARY_TRACK *track) {
+    if (song + 1 < (int) songs.size()) {
+      return readSong(song + 1, track);
+    }
+    return nextAlbum(track);
+  }
+
+  // Move to the song before, staying on the album's first
+  boolean previousSong(LIBRARY_TRACK *track) {
+    return readSong(max(song - 1, 0), track);
+  }
+
+  // Move to the first song of the next album
+  boolean nextAlbum(LIBRARY_TRACK *track) {
+
+    if (!prefetched && !readAlbum()) {
+      return false;
+    }
+    prefetched = false;
+    album = order[position];
+    songs.swap(nextSongs);
+    song = 0;
+    strcpy(path, nextPath);
+    memcpy(track, &nextTrack, sizeof(nextTrack));
+    return true;
+  }
+
+  boolean isLastSong() {
+    return song + 1 >= (int) songs.size();
+  }
+
+  // Read the next album and its first song's record ahead. Does
+  // nothing unless the last song of an album is playing.
+  boolean prefetch() {
+    if (prefetched || !isLastSong() || order.empty()) {
+      return true;
+    }
+    return readAlbum();
+  }
+
+  boolean isPrefetched() {
+    return prefetched;
+  }
+
+  // Path of the song moved to
+  const char *getPath() {
+    return path;
+  }
+
+  // Album index group of the song moved to, and its folder
+  uint32_t getAlbum() {
+    return album;
+  }
+
+  const char *getAlbumName() {
+    return albumNames.get(album);
+  }
+
+  // Library index track number of the song moved to
+  uint32_t getTrackNumber() {
+    return songs.empty() ? UINT32_MAX : songs[song];
+  }
+
+  int getSongNumber() {
+    return song;
+  }
+
+  int getSongCount() {
+    return songs.size();
+  }
+
+protected:
+  BrowseIndex albums;
+  FrontCodedList albumNames;
+  FrontCodedList labels;
+  LibraryIndex *index;
+
+  // The permutation of albums and the place in it of the album playing
+  // or prefetched
+  std::vector<uint32_t> order;
+  uint32_t position;
+
+  // The album playing, its songs' track numbers and the song playing
+  uint32_t album;
+  std::vector<uint32_t> songs;
+  int song;
+  char path[256];
+
+  // The next album read ahead
+  boolean prefetched;
+  std::vector<uint32_t> nextSongs;
+  char nextPath[256];
+  LIBRARY_TRACK nextTrack;
+
+  // Fisher-Yates shuffle of order not starting with album last
+  void shuffle(uint32_t last) {
+    for (uint32_t i = order.size() - 1; i > 0; i--) {
+      std::swap(order[i], order[halRandom(i + 1)]);
+    }
+    if ((order.size() > 1) && (order[0] == last)) {
+      std::swap(order[0], order[order.size() - 1]);
+    }
+  }
+
+  boolean readSong(int i, LIBRARY_TRACK *track) {
+    if ((i >= (int) songs.size()) || !index->getTrack(songs[i], path, track)) {
+      return false;
+    }
+    song = i;
+    return true;
+  }
+
+  // Read the next album of the permutation and its first song into
+  // the prefetch
+  boolean readAlbum() {
+
+    uint32_t next = position + 1;
+    if (next >= order.size()) {
+      shuffle((position == UINT32_MAX) ? UINT32_MAX : order[position]);
+      next = 0;
+    }
+    if (!albums.openGroup(order[next], labels) || (albums.getEntryCount() == 0)) {
+      return false;
+    }
+    nextSongs.clear();
+    for (int i = 0; i < albums.getEntryCount(); i++) {
+      nextSongs.push_back(albums.getTrack(i));
+    }
+    labels.clear();
+    if (!index->getTrack(nextSongs[0], nextPath, &nextTrack)) {
+      return false;
+    }
+    position = next;
+    prefetched = true;
+    return true;
+  }
+};
+
+#endif
@@ -10,7 +10,225 @@
 #define USE_SDFAT 1
 #include "AudioTools/Disk/SDDirect.h"
 
+#include "FatExtents.h"
+#include "Trace.h"
+
 namespace audio_tools {
+
+// Sectors read ahead at a time for raw reads
+#ifndef SD_PREFETCH_SECTORS
+#define SD_PREFETCH_SECTORS 8
+#endif
+
+/**
+ * @brief Stream handed to the player for the selected file. Forwards to
+ * the file and traces each block read.
+ *
+ * The first time the file is read its cluster chain is mapped into
+ * extents (see FatExtents.h) and from then on it is read straight from
+ * the card: SD_PREFETCH_SECTORS at a time, never past the end of an
+ * extent, with multi-sector reads into a prefetch buffer. This skips
+ * SdFat's cluster chain walk and sector cache, and a seek is a binary
+ * search of the extents. Files in too many extents, and a failed raw
+ * read, fall back to reading the file.
+ */
+template<typename AudioFile = File32>
+class SDFileStream : public Stream {
+public:
+  /// fs is the volume the file is on, used for raw reads
+  template<typename AudioFs>
+  void setFile(AudioFile *_file, AudioFs *fs) {
+    p_file = _file;
+    p_card = nullptr;
+    if (fs != nullptr) {
+      p_card = fs->card();
+      extents.setVolume(fs->fatType(), fs->fatStartSector(), fs->dataStartSector(),
+                        fs->sectorsPerCluster(), fs->clusterCount());
+    }
+    raw = false;
+    raw_checked = false;
+    raw_pos = 0;
+    prefetch_pos = 0;
+    prefetch_count = 0;
+    extents.clear();
+  }
+
+  /// True while the file is being read straight from the card
+  bool isRaw() {
+    checkRaw();
+    return raw;
+  }
+
+  /// Byte position within the file
+  uint32_t position() {
+    return isRaw() ? raw_pos : p_file->curPosition();
+  }
+
+  /// Move to a byte position within the file
+  bool seek(uint32_t pos) {
+    if (!isRaw()) {
+      return p_file->seekSet(pos);
+    }
+    if (pos > raw_size) {
+      return false;
+    }
+
+    // Keep the prefetched sectors if pos is within them
+    uint32_t start = raw_pos - prefetch_pos;
+    if ((pos >= start) && (pos < start + prefetch_count)) {
+      prefetch_pos = pos - start;
+    } else {
+      prefetch_pos = 0;
+      prefetch_count = 0;
+    }
+    raw_pos = pos;
+    return true;
+  }
+
+  int available() override {
+    return isRaw() ? raw_size - raw_pos : p_file->available();
+  }
+
+  int read() override {
+    if (isRaw()) {
+      uint8_t c;
+      if (readRaw(&c, 1) == 1) {
+        return c;
+      }
+      if (raw) {
+        return -1;  // end of file
+      }
+    }
+    return p_file->read();
+  }
+
+  int peek() override {
+    if (isRaw()) {
+      if ((prefetch_pos < prefetch_count) || prefetch()) {
+        return prefetch_buffer[prefetch_pos];
+      }
+      if (raw) {
+        return -1;  // end of file
+      }
+    }
+    return p_file->peek();
+  }
+
+  using Stream::readBytes;
+
+  // Block reads go straight to the file instead of byte by byte
+  size_t readBytes(char *buffer, size_t length) override {
+    TRACE_BEGIN(TE_SD_READ, (uint16_t) length);
+    size_t result = 0;
+    if (isRaw()) {
+      result = readRaw((uint8_t *) buffer, length);
+    }
+    if (!raw && (result < length)) {
+      int n = p_file->read(buffer + result, length - result);
+      if (n < 0) {
+        read_errors++;
+      } else {
+        result += n;
+      }
+    }
+    TRACE_END(TE_SD_READ, (uint16_t) result);
+    return result;
+  }
+
+  size_t write(uint8_t) override {
+    return 0;
+  }
+
+  /// Number of failed reads since startup
+  uint32_t read_errors = 0;
+
+protected:
+  AudioFile *p_file = nullptr;
+  SdCard *p_card = nullptr;
+  bool raw = false;
+  bool raw_checked = false;
+  uint32_t raw_size = 0;
+  uint32_t raw_pos = 0;
+  FatExtents extents;
+  uint8_t prefetch_buffer[SD_PREFETCH_SECTORS * 512];
+  size_t prefetch_pos = 0;    // of raw_pos in the buffer
+  size_t prefetch_count = 0;  // bytes in the buffer
+
+  static boolean readSector(void *context, uint32_t sector, uint8_t *buffer) {
+    return ((SdCard *) context)->readSectors(sector, buffer, 1);
+  }
+
+  // Map the file's extents the first time it is used
+  void checkRaw() {
+    if (raw_checked) {
+      return;
+    }
+    raw_checked = true;
+    if ((p_card == nullptr) || !p_file->isOpen() || (p_file->fileSize() == 0)) {
+      return;
+    }
+
+    // exFAT marks files allocated in one run, whose FAT entries are
+    // unused, so those are mapped without reading the FAT
+    uint32_t first = extents.clusterOf(p_file->firstSector());
+    bool ok;
+    if (p_file->isContiguous()) {
+      ok = extents.setContiguous(first, p_file->fileSize());
+    } else {
+      ok = extents.build(first, p_file->fileSize(), readSector, p_card);
+    }
+    if (!ok) {
+      LOGI("Reading the file, not raw");
+      return;
+    }
+    LOGI("Reading raw, %d extent(s)", extents.getCount());
+    raw = true;
+    raw_size = p_file->fileSize();
+    raw_pos = p_file->curPosition();
+  }
+
+  // Copy from the prefetch buffer, refilling it as it empties
+  size_t readRaw(uint8_t *dst, size_t length) {
+    size_t result = 0;
+    while (result < length) {
+      if ((prefetch_pos >= prefetch_count) && !prefetch()) {
+        break;
+      }
+      size_t n = min(length - result, prefetch_count - prefetch_pos);
+      memcpy(dst + result, prefetch_buffer + prefetch_pos, n);
+      prefetch_pos += n;
+      raw_pos += n;
+      result += n;
+    }
+    return result;
+  }
+
+  // Read the sectors from raw_pos on, up to the end of its extent.
+  // Returns false at the end of the file or after falling back to file
+  // reads.
+  bool prefetch() {
+    prefetch_pos = 0;
+    prefetch_count = 0;
+    if (raw_pos >= raw_size) {
+      return false;
+    }
+    uint32_t offset = raw_pos % 512;
+    uint32_t left = raw_size - raw_pos + offset;
+    uint32_t run;
+    uint32_t sector = extents.sector(raw_pos, &run);
+    uint32_t sectors = min(min((uint32_t) SD_PREFETCH_SECTORS, run), (left + 511) / 512);
+    if (!p_card->readSectors(sector, prefetch_buffer, sectors)) {
+      LOGE("Raw read failed at %lu, reading the file", (unsigned long) raw_pos);
+      read_errors++;
+      raw = false;
+      p_file->seekSet(raw_pos);
+      return false;
+    }
+    prefetch_pos = offset;
+    prefetch_count = min(left, sectors * 512);
+    return true;
+  }
+};
 /**
  * @brief ESP32 AudioSource for AudioPlayer using an SD card as data source.
  * This class is based on the Arduino SD implementation
@@ -65,7 +283,7 @@ public:
   }
 
   // Log the SdFat instance for reading data
-  void setSd(SdFat32 *_ptrSd) {
+  void setSd(AudioFs *_ptrSd) {
     sd = *_ptrSd;
   }
 
@@ -116,7 +334,8 @@ public:
     LOGI("-> selectStream: %s", path);
     strncpy(file_name, path, MAX_FILE_LEN);
     // file = new_file;
-    return &file;
+    stream.setFile(&file, &sd);
+    return &stream;
   }
 
   /// Defines the regex filter criteria for selecting files. E.g. ".*Bob
@@ -125,6 +344,11 @@ public:
     file_name_pattern = filter;
   }
 
+  /// Number of failed file reads since startup
+  uint32_t getReadErrors() {
+    return stream.read_errors;
+  }
+
   /// Provides the current index position
   int index() {
     return idx_pos;
@@ -156,10 +380,31 @@ public:
     return sd;
   }
 
+  /// Byte position within the currently selected file
+  uint32_t position() {
+    return file.isOpen() ? stream.position() : 0;
+  }
+
+  /// Move to a byte position within the currently selected file
+  bool seek(uint32_t pos) {
+    return file.isOpen() && stream.seek(pos);
+  }
+
+  /// Size of the currently selected file
+  uint32_t fileSize() {
+    return file.isOpen() ? file.fileSize() : 0;
+  }
+
+  /// Close the currently selected file, before the card is restarted
+  void closeFile() {
+    file.close();
+  }
+
 protected:
   SdSpiConfig *p_cfg = nullptr;
   AudioFs sd;
   AudioFile file;
+  SDFileStream<AudioFile> stream;
   SDDirect<AudioFs, AudioFile> idx{ sd };
   size_t idx_pos = 0;
   char file_name[MAX_FILE_LEN];
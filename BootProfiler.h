@@ -0,0 +1,117 @@
+/*
+   Boot Phase Profiler
+
+   Records a timestamp at the end of each startup phase so the time from
+   power on to the first menu can be broken down. Timestamps are micros()
+   since the ESP32 started, so the first mark also shows how long the
+   bootloader and Arduino core took before setup() ran.
+
+   The marks are kept in a static array, printed as a table on the serial
+   port and appended to a log on the SD card. Each boot adds one line
+
+     B,<firmware version>,<total us>
+
+   followed by a line per phase
+
+     P,<phase>,<end us>,<duration us>
+
+   tools/bootcompare.py compares the logs of two firmware versions and
+   flags phases that got slower.
+
+   Past BOOT_MAX_MARKS the latest mark replaces the last one kept, so
+   the final "menu" mark and the total are always there. The table says
+   how many phases were dropped that way.
+
+   Last Update: 10/18/2026
+*/
+
+#ifndef BOOTPROFILER_H
+#define BOOTPROFILER_H
+
+#include "SdFsConfig.h"
+
+// Max number of phases recorded per boot
+#define BOOT_MAX_MARKS 16
+
+typedef struct {
+  const char *phase;
+  uint32_t atUs;
+} BOOT_MARK;
+
+class BootProfiler {
+
+public:
+
+  // Class Constructor
+  BootProfiler(void) {
+    count = 0;
+    dropped = 0;
+  }
+
+  // Record the end of a phase. phase must be a string literal.
+  void mark(const char *phase) {
+
+    if (count == BOOT_MAX_MARKS) {
+      // The last slot holds the latest mark
+      count--;
+      dropped++;
+    }
+    marks[count].phase = phase;
+    marks[count].atUs = micros();
+    count++;
+  }
+
+  // Time from power on to the latest mark
+  uint32_t totalUs(void) {
+    return (count > 0) ? marks[count - 1].atUs : 0;
+  }
+
+  // Print a table of the phases
+  void printTable(Print *out) {
+
+    out->printf("%-14s %9s %9s\n", "boot phase", "end ms", "took ms");
+
+    uint32_t previousUs = 0;
+    for (int i = 0; i < count; i++) {
+      out->printf("%-14s %9.1f %9.1f\n", marks[i].phase,
+                  marks[i].atUs / 1000.0, (marks[i].atUs - previousUs) / 1000.0);
+      previousUs = marks[i].atUs;
+    }
+    if (dropped != 0) {
+      out->printf("%d phase(s) dropped, their time is in %s\n",
+                  dropped, marks[count - 1].phase);
+    }
+  }
+
+  // Append this boot's phases to the log file at path
+  // Returns false if the log couldn't be written
+  boolean appendLog(CardFs *ptrSd, const char *path, const char *version) {
+
+    CardFile log = ptrSd->open(path, O_WRONLY | O_CREAT | O_APPEND);
+    if (!log) {
+      return false;
+    }
+
+    log.printf("B,%s,%lu\n", version, (unsigned long) totalUs());
+
+    uint32_t previousUs = 0;
+    for (int i = 0; i < count; i++) {
+      log.printf("P,%s,%lu,%lu\n", marks[i].phase,
+                 (unsigned long) marks[i].atUs,
+                 (unsigned long) (marks[i].atUs - previousUs));
+      previousUs = marks[i].atUs;
+    }
+
+    boolean ok = !log.getWriteError();
+    log.close();
+    return ok;
+  }
+
+protected:
+
+  BOOT_MARK marks[BOOT_MAX_MARKS];
+  int count;
+  int dropped;  // marks replaced by a later one
+};
+
+#endif
@@ -0,0 +1,242 @@
+/*
+   Browse Index
+
+   Secondary indexes over the library index (see LibraryIndex.h) for
+   browsing by genre, by decade and by when songs were added. Each one
+   is a file of groups (a genre, a decade or a month), each group a
+   block of entries holding a track number, the song's position in the
+   library index, and the label the list box shows for it. The group
+   table at the start of the file gives each block's offset, so opening
+   a group is one seek and a sequential read of its block however large
+   the library is.
+
+   The album index is one more in the same layout with a group per
+   album folder and its songs in track order, for album shuffle (see
+   AlbumShuffle.h).
+
+   File layout, little endian:
+
+     magic "CYDB", version, group count, entry count  (uint32 each)
+     groups: offset of the block, entries, name
+     blocks: track number, label                        per entry
+
+   Names and labels are a uint8 length and that many UTF-8 bytes, as in
+   the library index. tools/libprep.cpp writes these with the index.
+   tools/hostplayer.cpp browsebench times them against walking the
+   library.
+
+   Last Update: 10/18/2026
+*/
+
+#ifndef BROWSEINDEX_H
+#define BROWSEINDEX_H
+
+#include <string>
+#include <vector>
+
+#include "FrontCodedList.h"
+#include "Hal.h"
+
+#define BROWSE_GENRE_PATH "/.library/genre.bin"
+#define BROWSE_DECADE_PATH "/.library/decade.bin"
+#define BROWSE_RECENT_PATH "/.library/recent.bin"
+#define BROWSE_ALBUM_PATH "/.library/album.bin"
+
+#define BROWSE_INDEX_MAGIC 0x42445943  // "CYDB"
+#define BROWSE_INDEX_VERSION 1
+#define BROWSE_INDEX_HEADER 16
+
+// A group and its entries as the host tool builds them
+typedef struct {
+  std::string name;
+  std::vector<uint32_t> tracks;
+  std::vector<std::string> labels;
+} BROWSE_GROUP;
+
+class BrowseIndex {
+
+public:
+
+  BrowseIndex() {
+    file = NULL;
+  }
+
+  ~BrowseIndex() {
+    close();
+  }
+
+  // Read the names of the groups. Returns false if there's no index.
+  boolean open(HalFileSystem *fs, const char *path, FrontCodedList &names) {
+
+    close();
+    names.clear();
+    file = fs->open(path, HOM_READ);
+    if (file == NULL) {
+      return false;
+    }
+    rewind();
+    uint8_t header[BROWSE_INDEX_HEADER];
+    if (!readBytes(header, sizeof(header)) || (get32(header) != BROWSE_INDEX_MAGIC) ||
+        (get32(header + 4) != BROWSE_INDEX_VERSION)) {
+      close();
+      return false;
+    }
+
+    uint32_t count = get32(header + 8);
+    std::vector<std::string> groupNames;
+    for (uint32_t i = 0; i < count; i++) {
+      uint8_t b[8];
+      char name[HAL_NAME_SIZE];
+      if (!readBytes(b, 8) || !readString(name)) {
+        close();
+        return false;
+      }
+      offsets.push_back(get32(b));
+      counts.push_back(get32(b + 4));
+      groupNames.push_back(name);
+    }
+    names.assign(groupNames);
+    return true;
+  }
+
+  void close() {
+    if (file != NULL) {
+      delete file;
+      file = NULL;
+    }
+    offsets.clear();
+    counts.clear();
+    tracks.clear();
+  }
+
+  int getGroupCount() {
+    return offsets.size();
+  }
+
+  // Read the labels of group i's entries
+  boolean openGroup(int i, FrontCodedList &labels) {
+
+    labels.clear();
+    tracks.clear();
+    if ((file == NULL) || (i < 0) || (i >= (int) offsets.size()) || !file->seek(offsets[i])) {
+      return false;
+    }
+    rewind();
+    std::vector<std::string> entryLabels;
+    for (uint32_t e = 0; e < counts[i]; e++) {
+      uint8_t b[4];
+      char label[HAL_NAME_SIZE];
+      if (!readBytes(b, 4) || !readString(label)) {
+        tracks.clear();
+        return false;
+      }
+      tracks.push_back(get32(b));
+      entryLabels.push_back(label);
+    }
+    labels.assign(entryLabels);
+    return true;
+  }
+
+  int getEntryCount() {
+    return tracks.size();
+  }
+
+  // Library index track number of entry i of the open group
+  uint32_t getTrack(int i) {
+    return ((i >= 0) && (i < (int) tracks.size())) ? tracks[i] : UINT32_MAX;
+  }
+
+  // The file for groups in the order given
+  static void encode(const std::vector<BROWSE_GROUP> &groups, std::vector<uint8_t> &out) {
+
+    uint32_t entries = 0;
+    uint32_t tableBytes = 0;
+    for (const BROWSE_GROUP &g : groups) {
+      entries += g.tracks.size();
+      tableBytes += 9 + min(g.name.size(), (size_t)(HAL_NAME_SIZE - 1));
+    }
+    out.clear();
+    put32(out, BROWSE_INDEX_MAGIC);
+    put32(out, BROWSE_INDEX_VERSION);
+    put32(out, groups.size());
+    put32(out, entries);
+
+    std::vector<uint8_t> blocks;
+    uint32_t base = BROWSE_INDEX_HEADER + tableBytes;
+    for (const BROWSE_GROUP &g : groups) {
+      put32(out, base + blocks.size());
+      put32(out, g.tracks.size());
+      putString(out, g.name);
+      for (size_t e = 0; e < g.tracks.size(); e++) {
+        put32(blocks, g.tracks[e]);
+        putString(blocks, g.labels[e]);
+      }
+    }
+    out.insert(out.end(), blocks.begin(), blocks.end());
+  }
+
+protected:
+  HalFile *file;
+  std::vector<uint32_t> offsets;  // of each group's block
+  std::vector<uint32_t> counts;   // of each group's entries
+  std::vector<uint32_t> tracks;   // of the open group
+
+  // Reads go through a buffer as the entries are a few bytes each
+  uint8_t buffer[512];
+  size_t have;
+  size_t used;
+
+  // Drop what's buffered after a seek
+  void rewind() {
+    have = 0;
+    used = 0;
+  }
+
+  boolean readBytes(void *data, size_t length) {
+    uint8_t *p = (uint8_t *) data;
+    while (length > 0) {
+      if (used == have) {
+        int n = file->read(buffer, sizeof(buffer));
+        if (n <= 0) {
+          return false;
+        }
+        have = n;
+        used = 0;
+      }
+      size_t n = min(length, have - used);
+      memcpy(p, buffer + used, n);
+      used += n;
+      p += n;
+      length -= n;
+    }
+    return true;
+  }
+
+  // A string into HAL_NAME_SIZE bytes
+  boolean readString(char *s) {
+    uint8_t length;
+    if (!readBytes(&length, 1) || (length >= HAL_NAME_SIZE) || !readBytes(s, length)) {
+      return false;
+    }
+    s[length] = '\0';
+    return true;
+  }
+
+  static uint32_t get32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+  }
+
+  static void put32(std::vector<uint8_t> &out, uint32_t v) {
+    for (int i = 0; i < 4; i++) {
+      out.push_back(v >> (8 * i));
+    }
+  }
+
+  static void putString(std::vector<uint8_t> &out, const std::string &s) {
+    size_t length = min(s.size(), (size_t)(HAL_NAME_SIZE - 1));
+    out.push_back(length);
+    out.insert(out.end(), s.begin(), s.begin() + length);
+  }
+};
+
+#endif
@@ -8,6 +8,8 @@
 #ifndef BUTTONMANAGER_H
 #define BUTTONMANAGER_H
 
+#include "Hal.h"
+
 // On screen touch button attributes
 #define BUTTON_WIDTH          54
 #define BUTTON_HEIGHT         30
@@ -19,15 +21,10 @@
 #define BUTTON_SURROUND_Y     218
 #define BUTTON_SURROUND_COLOR ILI9341_BLUE
 
-// Button IDs
-enum BUTTON_STATE {
-  BS_NONE,
-  BS_MINUS, BS_MINUSP, BS_MINUSPP,
-  BS_PLUS, BS_PLUSP, BS_PLUSPP,
-  BS_SELECT, BS_SELECTP, BS_SELECTPP,
-  BS_BACK, BS_BACKP, BS_BACKPP,
-  BS_TOUCHED, BS_TOUCHEDP, BS_TOUCHEDPP
-};
+// Number of button events from other sources that can be queued
+#define BUTTON_QUEUE_SIZE     8
+
+// Button IDs are the BUTTON_STATE values in Hal.h
 
 // Instantiate the required buttons
 static Adafruit_GFX_Button minusButton;
@@ -69,6 +66,30 @@ class ButtonManager {
       selectButton.initButtonUL(_pLcd, bX, 281, BUTTON_WIDTH, BUTTON_HEIGHT,
                                 BUTTON_OUTLINE_COLOR, BUTTON_FILL_COLOR, BUTTON_TEXT_COLOR,
                                 (char *) "Sel", BUTTON_TEXT_SIZE);
+
+      queueHead = 0;
+      queueTail = 0;
+      queuedEvent = false;
+    }
+
+    // Queue a button event from a source other than the touch screen
+    // (e.g. the UDP remote). It is returned by a later pollButtons() call.
+    // Returns false if the queue is full.
+    boolean queueButton(enum BUTTON_STATE bs) {
+
+      uint8_t next = (queueTail + 1) % BUTTON_QUEUE_SIZE;
+      if (next == queueHead) {
+        return false;
+      }
+      queue[queueTail] = bs;
+      queueTail = next;
+      return true;
+    }
+
+    // Determine if the last event returned by pollButtons() came from
+    // the queue rather than the touch screen
+    boolean wasQueuedEvent() {
+      return queuedEvent;
     }
 
     // Draw the buttons on the screen
@@ -102,6 +123,14 @@ class ButtonManager {
     // Get button status
     enum BUTTON_STATE pollButtons() {
 
+      // Queued events are handled first
+      queuedEvent = (queueHead != queueTail);
+      if (queuedEvent) {
+        enum BUTTON_STATE bs = queue[queueHead];
+        queueHead = (queueHead + 1) % BUTTON_QUEUE_SIZE;
+        return bs;
+      }
+
       if (minusSB.isSingleClick()) {
         return BS_MINUS;
       } else if (minusSB.isDoubleClick()) {
@@ -144,6 +173,12 @@ class ButtonManager {
   protected:
     ILI9341 *_pLcd;
     Touch *_pTouch;
+
+    // Queue of button events from other sources
+    enum BUTTON_STATE queue[BUTTON_QUEUE_SIZE];
+    uint8_t queueHead;
+    uint8_t queueTail;
+    boolean queuedEvent;
 };
 
 #endif
@@ -26,6 +26,9 @@
 
   See the README.txt file for program configuration and operation
 
+  The player's states and their handlers are in PlayerFsm.h, which
+  reaches the hardware through the HAL adapters in HalEsp32.h.
+
   Concept, Design and Implementation: Craig A. Lindley
   Last Update: 11/06/2025
 */
@@ -50,10 +53,172 @@
 #define ENABLE_FTP_REMOTE 1
 #endif
 
-#if ENABLE_FTP_REMOTE
+// 1 = also serve the SD card over HTTP/WebDAV on port 80 during remote access
+// 0 = FTP only (saves flash). Requires ENABLE_FTP_REMOTE.
+#ifndef ENABLE_WEBDAV_REMOTE
+#define ENABLE_WEBDAV_REMOTE 1
+#endif
+
+// 1 = keep WiFi connected and accept UDP remote control/now playing requests
+//     signed with REMOTE_SECRET from Secrets.h (see RemoteProtocol.h and
+//     tools/cyd_remote.cpp). WiFi staying on costs battery and shares the
+//     radio with Bluetooth.
+// 0 = WiFi stays off except during remote access (saves flash, RAM and battery)
+#ifndef ENABLE_UDP_REMOTE
+#define ENABLE_UDP_REMOTE 0
+#endif
+
+// 1 = append boot phase timings to BOOT_LOG_PATH on the SD card
+//     (compare logs with tools/bootcompare.py)
+// 0 = boot phase timings are only printed on the serial port
+#ifndef ENABLE_BOOT_LOG
+#define ENABLE_BOOT_LOG 1
+#endif
+
+// 1 = record per state loop latency histograms. Type l on the serial
+//     port to dump them, r to reset, o (or hold Back) for the overlay.
+// 0 = no latency recording (saves about 3K of RAM)
+#ifndef ENABLE_LOOP_STATS
+#define ENABLE_LOOP_STATS 1
+#endif
+
+// 1 = compile in the event trace ring (8K of RAM). Type t on the serial
+//     port to start/stop tracing, d to dump it to TRACE_DUMP_PATH and
+//     c to measure the cost per event. Convert the dump with
+//     tools/trace2json.cpp.
+// 0 = trace points compile to nothing
+#ifndef ENABLE_TRACE
+#define ENABLE_TRACE 0
+#endif
+
+// 1 = record each session from the first visit to the Operations menu
+//     on to SESSION_LOG_PATH: buttons, display timeouts, song ends, state
+//     changes, listbox screens and songs played. Copy a log to
+//     REPLAY_LOG_PATH and type y on the serial port to replay it, or
+//     replay it on a host with tools/hostplayer.cpp.
+// 0 = no session recording or replay
+#ifndef ENABLE_SESSION_LOG
+#define ENABLE_SESSION_LOG 1
+#endif
+
+// 1 = run the SD card at the fastest SPI clock that passes a read check
+//     (saved in SD_CLOCK_PATH and re-checked at boot) and add an
+//     SD Card Test operation that re-tunes and benchmarks the card
+// 0 = fixed 12 MHz clock from SD_CONFIG
+#ifndef ENABLE_SD_TUNING
+#define ENABLE_SD_TUNING 1
+#endif
+
+// 1 = read exFAT cards (the format of cards of 64 GB and up) as well as
+//     FAT16/FAT32, using SdFs/FsFile (see SdFsConfig.h)
+// 0 = FAT16/FAT32 only using SdFat32/File32 (saves flash)
+#ifndef ENABLE_EXFAT
+#define ENABLE_EXFAT 1
+#endif
+
+// 1 = keep recently listed artist, album and song directories in RAM
+//     (DIR_CACHE_BYTES) so browsing back and forth doesn't re-read them.
+//     FTP and WebDAV changes drop the affected directories.
+// 0 = read every directory from the card each time
+#ifndef ENABLE_DIR_CACHE
+#define ENABLE_DIR_CACHE 1
+#endif
+
+// 1 = list library directories by reading their entries straight from
+//     the card's sectors (see FatDirScanner.h)
+// 0 = open every entry with openNextFile()
+#ifndef ENABLE_RAW_DIR_SCAN
+#define ENABLE_RAW_DIR_SCAN 1
+#endif
+
+// 1 = when the card has a library index made by tools/libprep.cpp, show
+//     song titles and artists from their tags and skip within songs by
+//     time using its seek tables (see LibraryIndex.h)
+// 0 = show file names and skip by bytes
+#ifndef ENABLE_LIBRARY_INDEX
+#define ENABLE_LIBRARY_INDEX 1
+#endif
+
+// 1 = add Genres, Decades and Recently Added to the operations menu,
+//     browsing the indexes tools/libprep.cpp makes with the library
+//     index (see BrowseIndex.h). Requires ENABLE_LIBRARY_INDEX.
+// 0 = browse by folder only
+#ifndef ENABLE_BROWSE_INDEX
+#define ENABLE_BROWSE_INDEX 1
+#endif
+
+// 1 = add Playlists to the operations menu, browsing the .m3u, .m3u8
+//     and .pls playlists in the card's root folder. Their songs are
+//     found in the library index the first time each is opened and kept
+//     in /.library/playlists (see Playlist.h). Requires
+//     ENABLE_BROWSE_INDEX.
+// 0 = no playlists
+#ifndef ENABLE_PLAYLISTS
+#define ENABLE_PLAYLISTS 1
+#endif
+
+// 1 = add Album Shuffle to the operations menu, playing whole albums in
+//     a random order from the album index tools/libprep.cpp makes (see
+//     AlbumShuffle.h). Requires ENABLE_LIBRARY_INDEX.
+// 0 = shuffle songs only
+#ifndef ENABLE_ALBUM_SHUFFLE
+#define ENABLE_ALBUM_SHUFFLE 1
+#endif
+
+// 1 = count how often each song of the library index is played and
+//     skipped, when it was last played and how much of it is heard, in
+//     every play mode. Counts are appended to a log on the card and
+//     moved into a table by a background task (see PlayStats.h).
+//     Requires ENABLE_LIBRARY_INDEX.
+// 0 = no play statistics
+#ifndef ENABLE_PLAY_STATS
+#define ENABLE_PLAY_STATS 1
+#endif
+
+// 1 = add Smart Shuffle to the operations menu, picking songs of the
+//     library index weighted by how often they've been played to the
+//     end and skipped (see SmartShuffle.h). Takes 4 bytes of RAM a
+//     song while playing. Requires ENABLE_PLAY_STATS.
+// 0 = uniform shuffle only
+#ifndef ENABLE_SMART_SHUFFLE
+#define ENABLE_SMART_SHUFFLE 1
+#endif
+
+// 1 = remember the last songs shuffle play played, kept on the card
+//     across reboots, so - goes back through them and + forward again
+//     before picking new ones (see ShuffleHistory.h). Requires
+//     ENABLE_LIBRARY_INDEX for the songs' track numbers.
+// 0 = - and + both pick another song
+#ifndef ENABLE_SHUFFLE_HISTORY
+#define ENABLE_SHUFFLE_HISTORY 1
+#endif
+
+#if !ENABLE_LIBRARY_INDEX
+#undef ENABLE_BROWSE_INDEX
+#define ENABLE_BROWSE_INDEX 0
+#undef ENABLE_ALBUM_SHUFFLE
+#define ENABLE_ALBUM_SHUFFLE 0
+#undef ENABLE_PLAY_STATS
+#define ENABLE_PLAY_STATS 0
+#undef ENABLE_SHUFFLE_HISTORY
+#define ENABLE_SHUFFLE_HISTORY 0
+#endif
+
+#if !ENABLE_BROWSE_INDEX
+#undef ENABLE_PLAYLISTS
+#define ENABLE_PLAYLISTS 0
+#endif
+
+#if !ENABLE_PLAY_STATS
+#undef ENABLE_SMART_SHUFFLE
+#define ENABLE_SMART_SHUFFLE 0
+#endif
+
+#if ENABLE_FTP_REMOTE || ENABLE_UDP_REMOTE
 #include "Secrets.h"
 #endif
 
+#include "SdFsConfig.h"
 #include "SongManager.h"
 #include "BluetoothA2DPSource.h"
 #include "Hardware.h"
@@ -61,48 +226,53 @@
 #include "Touch.h"
 #include "MultiButton.h"
 #include "ButtonManager.h"
-#include "ListBox.h"
+#include "Scheduler.h"
+#include "BootProfiler.h"
+#include "Trace.h"
+
+#if ENABLE_LOOP_STATS
+#include "LoopStats.h"
+#endif
+
+#if ENABLE_SD_TUNING
+#include "SdClockTuner.h"
+#endif
 
 #if ENABLE_FTP_REMOTE
 #include "FTPUploader.h"
 #endif
 
-// Application title
-#define APP_TITLE "CYD BT Music Player 2"
+#if ENABLE_UDP_REMOTE
+#include "UDPRemote.h"
+#endif
+
+#include "HalEsp32.h"
+#include "PlayerFsm.h"
 
-// Misc screen attributes
+// Screen orientation
 #define SCREEN_ROTATION 0
-#define SCREEN_COLOR ILI9341_BLACK
-#define SCREEN_BORDER_COLOR ILI9341_BLUE
-#define SCREEN_TITLE_COLOR ILI9341_GREEN
-#define SCREEN_TEXT_COLOR ILI9341_WHITE
-
-// Listbox attributes
-#define LISTBOX_RECT_X 2
-#define LISTBOX_RECT_Y 10
-#define LISTBOX_CONTENT_START LISTBOX_RECT_Y + 6
-#define LISTBOX_RECT_WIDTH 236
-#define LISTBOX_RECT_HEIGHT 208
-#define LISTBOX_LINES 10
-#define LISTBOX_CHARS 19
-
-// Timeout for LCD display
-#define DISPLAY_TIMEOUT_MIN 1
-#define DISPLAY_TIMEOUT_MS (DISPLAY_TIMEOUT_MIN * 60 * 1000)
-
-// Duration of info screen display
-#define INFO_SCREEN_DELAY_MS 1500
-
-// Program version numbers
-#define MAJOR_VERSION 2
-#define MINOR_VERSION 2
+
+// Boot phase timing log on the SD card
+#define BOOT_LOG_PATH "/bootlog.csv"
+
+// Event trace dump on the SD card
+#define TRACE_DUMP_PATH "/trace.bin"
+
+// How often the session recording is written to the card
+#define SESSION_FLUSH_MS 1000
+
+// How often the background task checks whether the play statistics
+// log is due to be compacted
+#define PLAY_STATS_COMPACT_MS 1000
+
+// Tuned SD clock
+#define SD_CLOCK_PATH "/sdclock.txt"
 
 // Global instances of SdFat constants and variables
-SdFat32 sd;
-File32 file;
+CardFs sd;
+CardFile file;
 
 #define USE_SDFAT 1
-#define SD_CONFIG SdSpiConfig(SD_CS, DEDICATED_SPI, SD_SCK_MHZ(12))
 
 /****************************************************************/
 /***                 Driver Object Instantiation              ***/
@@ -120,9 +290,6 @@ Touch touch;
 // Instantiate the button manager
 ButtonManager bm(&lcd, &touch);
 
-// Pointer to ListBox instance
-ListBox *listBox;
-
 #if ENABLE_FTP_REMOTE
 // Create FTPUploader instance
 FTPUploader ftpUploader;
@@ -131,191 +298,63 @@ FTPUploader ftpUploader;
 // Create SongManager instance
 SongManager songManager;
 
-/****************************************************************/
-/***                       Misc Variables                     ***/
-/****************************************************************/
-
-uint32_t displayTimeout;
-
-boolean playing;
-boolean looping;
-boolean skipInput;
-
+// Startup phase timings, reported once the menu is up
+BootProfiler bootProfiler;
+void reportBootProfile(void);
+
+// Hardware abstraction used by the player's FSM
+Esp32Time halTime;
+Esp32Gpio halGpio;
+Esp32Spi halSpi(&h_SPI);
+SdFatFileSystem halFs(&sd);
+Esp32Udp halUdp;
+A2dpAudioOut halAudio(&out);
+Ili9341Display halDisplay(&lcd, SCREEN_ROTATION);
+ButtonManagerInput halInput(&bm);
+SongManagerPlayer halPlayer(&songManager, &sd);
+SdFatCard halCard(&sd, SD_CS, SD_CLOCK_PATH);
 #if ENABLE_FTP_REMOTE
-boolean uploading;
+FtpUploaderRemote halRemote(&ftpUploader, &sd);
 #endif
+Esp32System halSystem(&bootProfiler, reportBootProfile);
 
-enum PLAY_MODE { SEQUENTIAL,
-                 RANDOM };
-enum PLAY_MODE playMode;
-
-// Buffer for building paths to song files on SD card
-char songPath[120];
-
-// Finite State Machine (FSM) states
-enum STATES {
-  INITIAL,
-
-  // Operation states
-  OP_POPULATE_LB,
-  OP_BUTTON_CHECK,
-  OP_DISPATCH,
-
-  // Bluetooth states
-  BT_START,
-  BT_CONNECT_WAIT,
-
-  // Artist states
-  AR_POPULATE_LB,
-  AR_BUTTON_CHECK,
-
-  // Album states
-  AL_POPULATE_LB,
-  AL_BUTTON_CHECK,
-
-  // Song states
-  SG_POPULATE_LB,
-  SG_BUTTON_CHECK,
-  SG_PLAY,
-  SG_SONGSTATUS_CHECK,
-  SG_PATH_RESET,
-
-  // Action states
-  AC_DISPLAY,
-  AC_BUTTON_CHECK,
+HAL esp32Hal = { &halTime, &halGpio, &halSpi, &halFs, &halUdp, &halAudio, &halDisplay,
+                 &halInput, &halPlayer, &halCard,
+#if ENABLE_FTP_REMOTE
+                 &halRemote,
+#else
+                 NULL,
+#endif
+                 &halSystem };
 
-  // Shuffle states
-  SH_PICKANDPLAY,
-  SH_BUTTONSTATUS_CHECK,
+#if ENABLE_UDP_REMOTE
+// Create UDP remote control instance
+UDPRemote udpRemote(&bm, &songManager);
+#endif
 
-  // Remote access states
-  RA_WIFI_CONNECT,
-  RA_DISPLAY,
-  RA_BUTTON_CHECK,
-};
+#if ENABLE_LOOP_STATS
+// Loop pass latency per state
+LoopStats<STATE_COUNT> loopStats;
 
-// Set the initial start state
-STATES state = INITIAL;
+// Set when the latency overlay is shown in the title area
+boolean latencyOverlay;
+#endif
 
 /****************************************************************/
 /***                       Misc Functions                     ***/
 /****************************************************************/
 
-// Determine if a char strings starts with specified prefix
-boolean startsWith(const char *pre, const char *str) {
-
-  size_t lenpre = strlen(pre),
-         lenstr = strlen(str);
-  return lenstr < lenpre ? false : strncmp(pre, str, lenpre) == 0;
-}
-
-// Gather up all the artist names into string vector
-// This only needs to be done once because it doesn't change
-boolean populateArtistsVector() {
-
-  char NAME_BUFFER[128];
-
-  // Clear any previous data
-  artists.clear();
-
-  // Open the root directory of SD card
-  File32 root = sd.open("/");
-  if (!root) {
-    Serial.println("\nFailed to open directory\n\n");
-    return false;
-  }
-
-  // Populate listbox with directory/artist names
-  File32 file = root.openNextFile();
-  while (file) {
-    file.getName(NAME_BUFFER, sizeof(NAME_BUFFER));
-
-    if (file.isDirectory() && !startsWith(".", NAME_BUFFER)) {
-      artists.push_back(NAME_BUFFER);
-    }
-    file.close();
-    file = root.openNextFile();
-  }
-  // Close the files
-  file.close();
-  root.close();
-
-  // Sort the artists
-  std::sort(artists.begin(), artists.end());
-
-  return true;
-}
-
-// Gather up all the artist albums into string vector
-// artistPath is "/artist1"
-boolean populateArtistAlbumsVector(char *artistPath) {
-
-  char NAME_BUFFER[50];
-
-  // Clear any previous data
-  albums.clear();
-
-  // Open the root directory of SD card
-  File32 root = sd.open(artistPath);
-  if (!root) {
-    Serial.println("\nFailed to open directory\n\n");
-    return false;
-  }
-
-  // Populate vector with directory/artist/album names
-  File32 file = root.openNextFile();
-  while (file) {
-    file.getName(NAME_BUFFER, sizeof(NAME_BUFFER));
-    if (file.isDirectory() && !startsWith(".", NAME_BUFFER)) {
-      albums.push_back(NAME_BUFFER);
-    }
-    file.close();
-    file = root.openNextFile();
-  }
-  // Close the files
-  file.close();
-  root.close();
-
-  // Sort the albums
-  std::sort(albums.begin(), albums.end());
-
-  return true;
+// Scheduler clock in microseconds
+uint32_t schedulerClock(void) {
+  return micros();
 }
 
-// Gather up all the artist album songs into string vector
-// albumPath is "/artist1/album1"
-boolean populateArtistAlbumSongsVector(char *albumPath) {
-
-  char NAME_BUFFER[50];
-
-  // Clear any previous data
-  songs.clear();
-
-  // Open the root directory of SD card
-  File32 root = sd.open(albumPath);
-  if (!root) {
-    Serial.println("\nFailed to open directory\n\n");
-    return false;
-  }
-
-  // Populate vector with directory/artist names
-  File32 file = root.openNextFile();
-  while (file) {
-    file.getName(NAME_BUFFER, sizeof(NAME_BUFFER));
-    if (!file.isDirectory() && !startsWith(".", NAME_BUFFER)) {
-      songs.push_back(NAME_BUFFER);
-    }
-    file.close();
-    file = root.openNextFile();
-  }
-  // Close the files
-  file.close();
-  root.close();
-
-  // Sort the songs
-  std::sort(songs.begin(), songs.end());
+// Create the task scheduler instance
+Scheduler scheduler(schedulerClock);
 
-  return true;
+// Keep the audio fed while the library reads large directories
+void libraryIdle(void) {
+  scheduler.runCritical();
 }
 
 // Optional logging function
@@ -323,227 +362,72 @@ void audio_info(const char *info) {
   // Serial.println(info);
 }
 
-// Calculate y pixel position corresponding to a text line
-int calcLineOffset(int line) {
-  return (line * 30) + 25;
-}
-
-// Clear the list box area of screen
-void clearListboxArea(void) {
-
-  // Draw rectangular outline
-  lcd.drawRoundRect(0, 0, lcd.width(), lcd.height(), 10, SCREEN_BORDER_COLOR);
-
-  // Clear listbox on screen area
-  lcd.fillRect(LISTBOX_RECT_X, LISTBOX_RECT_Y,
-               LISTBOX_RECT_WIDTH, LISTBOX_RECT_HEIGHT, SCREEN_COLOR);
-
-  // Draw the program's title although it should be OK
-  lcd.setTextSize(1);
-  lcd.drawCenteredText(4, APP_TITLE);
-  lcd.setTextSize(2);
-}
-
-// Display Bluetooth connection screen
-void displayBluetoothConnectionScreen(void) {
-
-  // Clear screen area, draw outline and title
-  clearListboxArea();
-
-  // Display credit sequence
-  lcd.drawCenteredText(calcLineOffset(1), "- Waiting For -");
-  lcd.drawCenteredText(calcLineOffset(2), "Bluetooth");
-  lcd.drawCenteredText(calcLineOffset(3), "Connection");
-}
-
-// Display welcome screen
-void displayWelcomeScreen(void) {
-
-  char buffer[20];
-  sprintf(buffer, "Version: %d.%d", MAJOR_VERSION, MINOR_VERSION);
-
-  // Clear screen area, draw outline and title
-  clearListboxArea();
-
-  // Display credit sequence
-  lcd.drawCenteredText(calcLineOffset(0), "ESP32");
-  lcd.drawCenteredText(calcLineOffset(1), "CYD");
-  lcd.drawCenteredText(calcLineOffset(2), "Bluetooth");
-  lcd.drawCenteredText(calcLineOffset(3), "Music Player");
-  lcd.drawCenteredText(calcLineOffset(4), buffer);
-  lcd.drawCenteredText(calcLineOffset(5), "- Written by -");
-  lcd.drawCenteredText(calcLineOffset(6), "Craig A. Lindley");
-  delay(4000);
-}
-
-void displayWiFiScreen() {
-
-  // Clear screen area
-  clearListboxArea();
-
-  // Draw string
-  lcd.drawCenteredText(calcLineOffset(0), "WiFi Connecting");
-}
-
 #if ENABLE_FTP_REMOTE
-void displayUploadScreen() {
-
-  // Clear screen area
-  clearListboxArea();
-
-  // Draw title
-  lcd.drawCenteredText(calcLineOffset(0), "Preparing For");
-  lcd.drawCenteredText(calcLineOffset(1), "Remote Access");
-
-  // Show IP address for FTP
-  lcd.drawCenteredText(calcLineOffset(2), "IP Address");
-  lcd.drawCenteredText(calcLineOffset(3),
-                       ftpUploader.getIPAddressString().c_str());
-}
+// Called by the FTP and WebDAV servers whenever they change the card
+void remotePathChanged(const char *path) {
+  libraryChanged = true;
+#if ENABLE_DIR_CACHE
+  dirCache.invalidate(path);
+#endif
+#if ENABLE_PLAYLISTS
+  // A playlist written in place may keep its size, which is all its
+  // cache checks
+  Playlist::removeCache(&halFs, path);
+#endif
+#if ENABLE_LIBRARY_INDEX
+  // A new index from libprep
+  if (strncmp(path, "/.library", 9) == 0) {
+    libraryIndex.open(&halFs);
+#if ENABLE_SHUFFLE_HISTORY
+    shuffleHistory.begin(&halFs, libraryIndex.getCount());
+#endif
+#if ENABLE_PLAY_STATS
+    openPlayStats();
 #endif
-
-// Now playing screen
-void displaySongNowPlayingScreen(const char *songName) {
-
-  // Remove the mp3 file extension
-  String str(songName);
-
-  int indx = str.lastIndexOf('.');
-  if (indx != -1) {
-    str = str.substring(0, indx);
   }
-
-  // Clear screen area
-  clearListboxArea();
-
-  lcd.drawCenteredText(calcLineOffset(2), "- Now Playing -");
-  lcd.setTextColor(SCREEN_TEXT_COLOR, ILI9341_BLUE);
-  lcd.drawCenteredText(calcLineOffset(4), str.c_str());
-  lcd.setTextColor(SCREEN_TEXT_COLOR, SCREEN_COLOR);
+#endif
 }
+#endif
 
-// Action screen
-void displayActionScreen(boolean _looping) {
-
-  // Clear screen area
-  clearListboxArea();
-
-  lcd.setTextColor(SCREEN_TITLE_COLOR, SCREEN_COLOR);
-  lcd.drawCenteredText(calcLineOffset(0), "- Actions -");
-
-  lcd.setTextColor(SCREEN_TEXT_COLOR, SCREEN_COLOR);
-  lcd.drawCenteredText(calcLineOffset(1), "- is volume down");
-  lcd.drawCenteredText(calcLineOffset(2), "+ is volume up");
+#if ENABLE_UDP_REMOTE
+// Describe what is playing for UDP remote status datagrams
+void remoteNowPlaying(REMOTE_NOW_PLAYING *info) {
 
-  if (_looping) {
-    lcd.setTextColor(ILI9341_YELLOW, SCREEN_COLOR);
-  }
-  lcd.drawCenteredText(calcLineOffset(3), "Back is loop off/on");
+  info->playing = playing;
+  info->state = state;
 
-  lcd.setTextColor(SCREEN_TEXT_COLOR, SCREEN_COLOR);
-  lcd.drawCenteredText(calcLineOffset(4), "Sel is done");
+  // Song name is the last component of the song path
+  const char *lastSlash = strrchr(songPath, '/');
+  info->name = (playing && lastSlash != NULL) ? lastSlash + 1 : "";
 }
+#endif
 
-// Paint the listbox on the screen
-void paintListBox(int b) {
-
-  // Clear screen area
-  clearListboxArea();
-
-  lcd.setTextColor(SCREEN_TITLE_COLOR, SCREEN_COLOR);
-
-  // Draw the listbox title
-  lcd.drawCenteredText(LISTBOX_CONTENT_START, listBox->getTitle());
-
-  // Moves strings over to avoid rect
-  const byte xOffset = 3;
-
-  int fontHeight = lcd.getTextHeight("A") + 2;
-  int yOffset = 33;
-
-  // Extract listbox data from argument
-  int selectIndex = (b >> 16) & 0xFF;
-  int windowIndex = (b >> 8) & 0xFF;
-  int numberOfEntries = b & 0xFF;
-
-  // Serial.printf("B: %d, SI: %d, WI: %d, NE: %d\n",
-  //              b, selectIndex, windowIndex, numberOfEntries);
-
-  // Fetch the centering flag
-  boolean centerFlag = listBox->getCenterFlag();
+// Print the boot phase timings and log them on the SD card
+void reportBootProfile() {
 
-  for (int i = 0; i < numberOfEntries; i++) {
-    char *line = listBox->getEntry(i + windowIndex, true);
+  bootProfiler.mark("menu");
+  bootProfiler.printTable(&Serial);
 
-    // If we are dealing with filenames, strip extension
-    String str = String(line);
-    int indx = str.lastIndexOf('.');
-    if (indx != -1) {
-      str = str.substring(0, indx);
-    }
+#if ENABLE_BOOT_LOG
+  char version[12];
+  sprintf(version, "%d.%d", MAJOR_VERSION, MINOR_VERSION);
 
-    if ((i + windowIndex) == selectIndex) {
-      // This is the selected item. Change its colors
-      lcd.setTextColor(SCREEN_COLOR, SCREEN_TEXT_COLOR);
-      if (!centerFlag) {
-        lcd.drawText(xOffset, yOffset, str.c_str());
-      } else {
-        lcd.drawCenteredText(yOffset, str.c_str());
-      }
-
-    } else {
-      // Non selected item
-      lcd.setTextColor(SCREEN_TEXT_COLOR, SCREEN_COLOR);
-      if (!centerFlag) {
-        // This is a non-selected item
-        lcd.drawText(xOffset, yOffset, str.c_str());
-      } else {
-        lcd.drawCenteredText(yOffset, str.c_str());
-      }
-    }
-    // Calculate y offset for next line of display
-    yOffset += fontHeight;
+  if (!bootProfiler.appendLog(&sd, BOOT_LOG_PATH, version)) {
+    Serial.println("Boot log write failed");
   }
-  lcd.setTextColor(SCREEN_TEXT_COLOR, SCREEN_COLOR);
-}
-
-// Called anytime a button is clicked to stop backlight from turning off
-// or to turn it back on
-void updateTimeOut() {
-  displayTimeout = millis() + DISPLAY_TIMEOUT_MS;
-  lcd.backlight(true);
+#endif
 }
 
-// Pick a shuffled song and place it in songPath
-void pickShuffledSong() {
-
-  // Root directory path
-  // Root directory contains the artists
-  strcpy(songPath, "/");
-
-  // Pick a random artist
-  int artistIndex = random(artists.size());
-  strcat(songPath, artists.at(artistIndex).c_str());
-
-  if (!populateArtistAlbumsVector(songPath)) {
-    Serial.println("Artist Read Failed");
-    while (true) {};
+// Sees each button event before the FSM's state handler
+boolean fsmButton(enum BUTTON_STATE result) {
+#if ENABLE_LOOP_STATS
+  // Holding Back toggles the latency overlay in any state
+  if (result == BS_BACKPP) {
+    toggleLatencyOverlay();
+    return true;
   }
-
-  // Pick a random album
-  int albumIndex = random(albums.size());
-  strcat(songPath, "/");
-  strcat(songPath, albums.at(albumIndex).c_str());
-
-  if (!populateArtistAlbumSongsVector(songPath)) {
-    Serial.println("Song Read Failed");
-    while (true) {};
-  }
-
-  // Pick a random song
-  int songIndex = random(songs.size());
-  strcat(songPath, "/");
-  strcat(songPath, songs.at(songIndex).c_str());
+#endif
+  return false;
 }
 
 /****************************************************************/
@@ -552,22 +436,28 @@ void pickShuffledSong() {
 
 void setup() {
 
+  // Time spent in the bootloader and core before setup()
+  bootProfiler.mark("core init");
+
   Serial.begin(115200);
   Serial.println("\n\nStarting Up");
 
   // Initialize the random number generator
-  randomSeed(analogRead(34));
+  halRandomSeed(esp_random());
 
-  // Initialize control variables
-  playing = false;
-  looping = false;
-  skipInput = false;
+  // Start the FSM at BOOT_SD_INIT
+  fsmBegin(&esp32Hal, libraryIdle, fsmButton);
 #if ENABLE_FTP_REMOTE
-  uploading = false;
+  setPathChangedCallback(remotePathChanged);
 #endif
 
+#if ENABLE_UDP_REMOTE
+  // Start connecting to WiFi for the UDP remote
+  udpRemote.begin(remoteNowPlaying);
+#else
   // Turn off the wifi to possibly save battery life
   WiFi.mode(WIFI_OFF);
+#endif
 
   // Do GPIO initialization here
   // Pull all chip selects high to avoid SPI contention
@@ -588,793 +478,247 @@ void setup() {
   // Initialize HSPI interface for LCD
   h_SPI.begin(LCD_SCLK, LCD_MISO, LCD_MOSI);
 
-  // Initialize LCD ILI9341 display controller
-  lcd.begin(&h_SPI);
-  lcd.setRotation(SCREEN_ROTATION);
-  lcd.setTextSize(2);
-  lcd.clearScreen();
-  lcd.setTextColor(SCREEN_TEXT_COLOR, SCREEN_COLOR);
-
-  // Initialize the SD.
-  if (!sd.begin(SD_CONFIG)) {
-    sd.initErrorHalt(&Serial);
-  }
+  // Start the LCD ILI9341 display controller. The boot states finish
+  // its initialization while the SD card and Bluetooth start up.
+  lcd.beginAsync(&h_SPI);
+#if ENABLE_LOOP_STATS
+  latencyOverlay = false;
+#endif
 
   // Initialize touch screen controller
   touch.begin();
 
-
-  // Display welcome screen while artists are being loaded
-  displayWelcomeScreen();
-
-  // Populate operation data source
-  operations.push_back(std::string("Bluetooth"));
-  operations.push_back(std::string("Sequential Play"));
-  operations.push_back(std::string("Random Play"));
-  operations.push_back(std::string("Shuffle"));
-#if ENABLE_FTP_REMOTE
-  operations.push_back(std::string("Remote Access"));
+  // Register the tasks run by loop() in priority order
+  //                  name       function     priority     period  deadline  budget (us)
+  scheduler.addTask("audio",   audioTask,   TP_AUDIO,         0,    20000,  10000);
+  scheduler.addTask("input",   inputTask,   TP_INPUT,      5000,    20000,   2000);
+  scheduler.addTask("ui",      uiTask,      TP_UI,            0,   100000,  20000);
+  scheduler.addTask("network", networkTask, TP_NETWORK,       0,        0,  25000);
+#if ENABLE_LOOP_STATS || ENABLE_TRACE || ENABLE_SESSION_LOG
+  scheduler.addTask("debug",   debugTask,   TP_BACKGROUND, 250000,        0,   5000);
+#endif
+#if ENABLE_SESSION_LOG
+  scheduler.addTask("session", sessionTask, TP_BACKGROUND, SESSION_FLUSH_MS * 1000UL, 0, 20000);
+#endif
+#if ENABLE_PLAY_STATS
+  scheduler.addTask("stats",   statsTask,   TP_BACKGROUND, PLAY_STATS_COMPACT_MS * 1000UL, 0, 5000);
 #endif
 
-  // Read in all available artists
-  if (!populateArtistsVector()) {
-    Serial.println("Artist Read Failed");
-    while (true) {};
-  }
-
-  // Instantiate the list box
-  listBox = new ListBox(LISTBOX_LINES, LISTBOX_CHARS, paintListBox);
+  bootProfiler.mark("setup");
 }
 
+#if ENABLE_LOOP_STATS
 /****************************************************************/
-/***         Program Loop Finite State Machine (FSM)          ***/
+/***                   Loop Latency Overlay                   ***/
 /****************************************************************/
 
-void loop() {
+// Clear the title line of the screen
+void clearTitleLine(void) {
+  halDisplay.fillRect(10, 2, halDisplay.width() - 20, 8, SCREEN_COLOR);
+}
 
-  // Yield to OS tasks to help prevent drop outs
-  yield();
+// Show the worst offending state in place of the title
+void drawLatencyOverlay(void) {
 
-  // Update button state
-  bm.update();
+  int worst = loopStats.getWorstState();
+  if (worst < 0) {
+    return;
+  }
+  const LatencyHistogram &h = loopStats.get(worst);
+
+  char buffer[48];
+  snprintf(buffer, sizeof(buffer), "%s max %.1f p99 %.1f ms",
+           stateName(worst), h.getMax() / 1000.0, h.percentile(990) / 1000.0);
+
+  clearTitleLine();
+  halDisplay.setTextSize(1);
+  halDisplay.setTextColor(COLOR_YELLOW, SCREEN_COLOR);
+  halDisplay.drawCenteredText(4, buffer);
+  halDisplay.setTextColor(SCREEN_TEXT_COLOR, SCREEN_COLOR);
+  halDisplay.setTextSize(2);
+}
 
-#if ENABLE_FTP_REMOTE
-  if (uploading) {
-    // Feed the FTP server
-    ftpUploader.handleFTP();
+// Turn the overlay on or off
+void toggleLatencyOverlay(void) {
+
+  latencyOverlay = !latencyOverlay;
+
+  if (lcdReady && !latencyOverlay) {
+    // Put the program's title back
+    clearTitleLine();
+    halDisplay.setTextSize(1);
+    halDisplay.drawCenteredText(4, APP_TITLE);
+    halDisplay.setTextSize(2);
   }
+}
 #endif
 
+/****************************************************************/
+/***                      Scheduler Tasks                     ***/
+/****************************************************************/
+
+// Feed the BT driver. Runs ahead of every other task.
+void audioTask() {
   if (playing) {
-    // Feed the BT driver
     songManager.loop();
   }
+}
 
-  // Runs the FSM
-  switch (state) {
-
-    // Start States
-    case INITIAL:
-      {
-        // Turn off the wifi to possibly save battery life
-        WiFi.mode(WIFI_OFF);
-
-        // Initialize the display timeout
-        displayTimeout = millis() + DISPLAY_TIMEOUT_MS;
-
-        skipInput = false;
-
-        // Next state
-        state = OP_POPULATE_LB;
-      }
-      break;
-
-    case OP_POPULATE_LB:
-      {
-        // Display the on screen buttons
-        bm.drawButtons();
-
-        listBox->setDataSource(OPERATION_DS);
-
-        // Initialize list box
-        listBox->clear();
-        listBox->setCenterFlag(true);
-        listBox->setTitle("- Operations -");
-
-        // Paint list box
-        listBox->doRepaint();
-
-        // Next state
-        state = OP_BUTTON_CHECK;
-      }
-      break;
-
-    case OP_BUTTON_CHECK:
-      {
-        // Poll the buttons
-        enum BUTTON_STATE result = bm.pollButtons();
-        if (result != BS_NONE) {
-          updateTimeOut();
-        }
-
-        if (result == BS_MINUS) {
-          listBox->selectionUp(true);
-        }
-
-        else if (result == BS_SELECT) {
-          // An action has been selected
-          // Save current listbox state
-          listBox->push();
-
-          // Load artist data
-          listBox->setDataSource(ARTIST_DS);
+// Update button state
+void inputTask() {
+  bm.update();
+}
 
-          // Next state
-          state = OP_DISPATCH;
-        }
+// Run the FSM handler for the current state
+void uiTask() {
+  fsmRun();
+}
 
-        else if (result == BS_PLUS) {
-          listBox->selectionDown(true);
-        }
+// Service the remote access servers
+void networkTask() {
 
-        else if (result == BS_BACK) {
-          // Nothing to do here
-        }
-      }
-      break;
-
-    case OP_DISPATCH:
-      {
-        // Get selection index
-        switch (listBox->getSelectionIndex()) {
-          case 0:
-            // Bluetooth selected
-            // Next state
-            state = BT_START;
-            break;
-          case 1:
-            // Sequential play selected
-            playMode = SEQUENTIAL;
-            // Next state
-            state = AR_POPULATE_LB;
-            break;
-          case 2:
-            // Random play selected
-            playMode = RANDOM;
-            // Next state
-            state = AR_POPULATE_LB;
-            break;
-          case 3:
-            // Shuffle play selected
-            // Next state
-            state = SH_PICKANDPLAY;
-            break;
 #if ENABLE_FTP_REMOTE
-          case 4:
-            // Remote access selected
-            // Next state
-            state = RA_WIFI_CONNECT;
-            break;
+  if (uploading) {
+    // Feed the FTP and WebDAV servers
+    ftpUploader.handleClients();
+  }
 #endif
-        }
-      }
-      break;
-
-    case BT_START:
-      {
-        // Display BT connection screen
-        displayBluetoothConnectionScreen();
-
-        // Start the Song Manager which does the Bluetooth connection
-        // Give it SdFat instance
-        songManager.begin(&sd);
-
-        // Next state
-        state = BT_CONNECT_WAIT;
-      }
-      break;
-
-    case BT_CONNECT_WAIT:
-      {
-        // Wait for BT connection
-        while (!songManager.btConnected()) {
-          delay(50);
-        }
-
-        // Pop previous menu
-        listBox->pop();
-
-        // Advance to next selection
-        listBox->selectionDown(true);
-
-        // Display the on screen buttons
-        bm.drawButtons();
-
-        // Next state
-        state = OP_BUTTON_CHECK;
-      }
-      break;
-
-    case AR_POPULATE_LB:
-      {
-        // Root directory path
-        strcpy(songPath, "/");
-
-        listBox->clear();
-        listBox->setTitle("- Artists -");
-        listBox->setCenterFlag(true);
-        listBox->setDataSource(ARTIST_DS);
-
-        // Paint list box
-        listBox->doRepaint();
-
-        // Next state
-        state = AR_BUTTON_CHECK;
-      }
-      break;
-
-    case AR_BUTTON_CHECK:
-      {
-        // Determine how many artists there are
-        int count = listBox->getListBoxCount();
-        int quarterCount = count / 4;
-        int halfCount = count / 2;
-
-        // Poll the buttons
-        enum BUTTON_STATE result = bm.pollButtons();
-        if (result != BS_NONE) {
-          updateTimeOut();
-        }
-
-        if (result == BS_MINUS) {
-          listBox->selectionUp(true);
-        }
 
-        else if (result == BS_MINUSP) {
-          for (int i = 0; i < quarterCount; i++) {
-            listBox->selectionUp(false);
-          }
-          listBox->doRepaint();
-        }
-
-        else if (result == BS_MINUSPP) {
-          for (int i = 0; i < halfCount; i++) {
-            listBox->selectionUp(false);
-          }
-          listBox->doRepaint();
-        }
-
-        else if (result == BS_PLUS) {
-          listBox->selectionDown(true);
-        }
-
-        else if (result == BS_PLUSP) {
-          for (int i = 0; i < quarterCount; i++) {
-            listBox->selectionDown(false);
-          }
-          listBox->doRepaint();
-        }
-
-        else if (result == BS_PLUSPP) {
-          for (int i = 0; i < halfCount; i++) {
-            listBox->selectionDown(false);
-          }
-          listBox->doRepaint();
-        }
-
-        else if (result == BS_BACK) {
-          // Null out song path
-          *songPath = '\0';
-
-          // Back to operation selection
-          listBox->pop();
-
-          // Next state
-          state = OP_BUTTON_CHECK;
-        }
-
-        else if (result == BS_SELECT) {
-          // An artist has been selected so save list box state
-          listBox->push();
-
-          // Next state
-          state = AL_POPULATE_LB;
-        }
-      }
-      break;
-
-    case AL_POPULATE_LB:
-      {
-        // Add artist to song path
-        strcat(songPath, listBox->getSelection());
-        Serial.printf("SP: %s\n", songPath);
-
-        if (!populateArtistAlbumsVector(songPath)) {
-          Serial.println("Album Read Failed");
-          while (true) {};
-        }
-
-        listBox->setDataSource(ALBUM_DS);
-
-        listBox->clear();
-        listBox->setTitle("- Albums/CDs -");
-        listBox->setCenterFlag(true);
-
-        // Paint list box
-        listBox->doRepaint();
-
-        // Next state
-        state = AL_BUTTON_CHECK;
-      }
-      break;
-
-    case AL_BUTTON_CHECK:
-      {
-        // Determine how many albums there are
-        int count = listBox->getListBoxCount();
-        int quarterCount = count / 4;
-        int halfCount = count / 2;
-
-        // Poll the buttons
-        enum BUTTON_STATE result = bm.pollButtons();
-        if (result != BS_NONE) {
-          updateTimeOut();
-        }
-
-        if (result == BS_MINUS) {
-          listBox->selectionUp(true);
-        }
-
-        else if (result == BS_MINUSP) {
-          for (int i = 0; i < quarterCount; i++) {
-            listBox->selectionUp(false);
-          }
-          listBox->doRepaint();
-        }
-
-        else if (result == BS_MINUSPP) {
-          for (int i = 0; i < halfCount; i++) {
-            listBox->selectionUp(false);
-          }
-          listBox->doRepaint();
-        }
-
-        else if (result == BS_PLUS) {
-          listBox->selectionDown(true);
-        }
-
-        else if (result == BS_PLUSP) {
-          for (int i = 0; i < quarterCount; i++) {
-            listBox->selectionDown(false);
-          }
-          listBox->doRepaint();
-        }
-
-        else if (result == BS_PLUSPP) {
-          for (int i = 0; i < halfCount; i++) {
-            listBox->selectionDown(false);
-          }
-          listBox->doRepaint();
-        }
-
-        else if (result == BS_BACK) {
-          // Root directory path
-          strcpy(songPath, "/");
-
-          // Back to artist selection
-          listBox->pop();
-
-          // Next state
-          state = AR_BUTTON_CHECK;
-        }
-
-        else if (result == BS_SELECT) {
-          // An album has been selected so save list box state
-          listBox->push();
-
-          // Next state
-          state = SG_POPULATE_LB;
-        }
-      }
-      break;
-
-    case SG_POPULATE_LB:
-      {
-        // Add album to song path
-        strcat(songPath, "/");
-        strcat(songPath, listBox->getSelection());
-
-        if (!populateArtistAlbumSongsVector(songPath)) {
-          Serial.println("Song Read Failed");
-          while (true) {};
-        }
-        listBox->setDataSource(SONG_DS);
-
-        listBox->clear();
-        listBox->setTitle("- Songs -");
-        listBox->setCenterFlag(true);
-
-        // Paint list box
-        listBox->doRepaint();
-
-        // Next state
-        state = SG_BUTTON_CHECK;
-      }
-      break;
-
-    case SG_BUTTON_CHECK:
-      {
-        // Poll the buttons
-        enum BUTTON_STATE result = bm.pollButtons();
-        if (result != BS_NONE) {
-          updateTimeOut();
-        }
-
-        if (result == BS_MINUS) {
-          listBox->selectionUp(true);
-        }
-
-        else if (result == BS_PLUS) {
-          listBox->selectionDown(true);
-        }
-
-        else if (result == BS_BACK) {
-          // Find last forward slash in file path
-          char *lastSlash = strrchr(songPath, 0x2F);
-
-          // Terminate song path there
-          *lastSlash = '\0';
-
-          // Back to album selection
-          listBox->pop();
-
-          // Next state
-          state = AL_BUTTON_CHECK;
-        }
-
-        else if (result == BS_SELECT) {
-          // An song has been selected so save list box state
-          listBox->push();
-
-          // Next state
-          state = SG_PLAY;
-        }
-      }
-      break;
-
-    case SG_PLAY:
-      {
-        // Stop any song playing
-        playing = false;
-        songManager.stopSong();
-
-        // Add song filename to song path
-        strcat(songPath, "/");
-        strcat(songPath, listBox->getSelection());
-
-        Serial.printf("File to play: %s\n", songPath);
-
-        // Display the song to play
-        displaySongNowPlayingScreen(listBox->getSelection());
-
-        // Turn display back on if off for song change
-        updateTimeOut();
-
-        // Play the song
-        songManager.playSong(songPath);
-
-        playing = true;
-
-        // Next state
-        state = SG_SONGSTATUS_CHECK;
-      }
-      break;
-
-    case SG_SONGSTATUS_CHECK:
-      {
-        // Has the song ended ?
-        if (!songManager.isActive()) {
-          // Song has ended
-
-          // Stop any song playing
-          playing = false;
-          songManager.stopSong();
-
-          // Are we looping on this song ?
-          if (looping) {
-            // Looping
-          } else {
-            // Not looping
-            if (playMode == SEQUENTIAL) {
-              listBox->selectionDown(false);
-            } else {
-              listBox->selectRandomEntry(false);
-            }
-            listBox->updatePush();
-          }
-
-          // Next state
-          state = SG_PATH_RESET;
-          break;
-        }
-        // Song is playing so read buttons
-        enum BUTTON_STATE result = bm.pollButtons();
-
-        // If skipInput is true we are trying to consume
-        // the first button press because it should just
-        // turn the backlight back on
-
-        if (skipInput) {
-          if (result != 0) {
-            skipInput = false;
-            updateTimeOut();
-
-            // Stay in this state
-            break;
-          }
-        }
-        if (result != BS_NONE) {
-          updateTimeOut();
-        }
-
-        if (result == BS_MINUS) {
-          // Stop any song playing
-          playing = false;
-          songManager.stopSong();
-
-          listBox->selectionUp(false);
-          listBox->updatePush();
-          
-          // Next state
-          state = SG_PATH_RESET;
-        }
-
-        else if (result == BS_PLUS) {
-          // Stop any song playing
-          playing = false;
-          songManager.stopSong();
-
-          listBox->selectionDown(false);
-          listBox->updatePush();
-          
-          // Next state
-          state = SG_PATH_RESET;
-        }
-
-        else if (result == BS_BACK) {
-          songManager.stopSong();
-          playing = false;
-
-          // Back to song selection
-          listBox->pop();
-
-          // Remove previous song from song path
-          char *lastSlash = strrchr(songPath, 0x2F);
-          *lastSlash = '\0';
-
-          // Next state
-          state = SG_BUTTON_CHECK;
-        }
-
-        else if ((result == BS_SELECT) || (result == BS_TOUCHED)) {
-          // Select button during song playback brings up actions screen
-          // Pause the music
-          songManager.stopSong();
-          playing = false;
-
-          // Next state
-          state = AC_DISPLAY;
-        }
-
-        else if (millis() > displayTimeout) {
-          // If skipInput is true
-          // Ignore the button press that turns the display backlight on
-          skipInput = true;
-          lcd.backlight(LOW);
-        }
-      }
-      break;
-
-    case SG_PATH_RESET:
-      {
-        // Remove previous song from song path
-        char *lastSlash = strrchr(songPath, 0x2F);
-        *lastSlash = '\0';
-
-        // Next state
-        state = SG_PLAY;
-      }
-      break;
-
-    case AC_DISPLAY:
-      {
-        // Display the action screen
-        displayActionScreen(looping);
-
-        // Next state
-        state = AC_BUTTON_CHECK;
-      }
-      break;
-
-    case AC_BUTTON_CHECK:
-      {
-        // Poll the buttons
-        enum BUTTON_STATE result = bm.pollButtons();
-        if (result != BS_NONE) {
-          updateTimeOut();
-        }
-
-        if (result == BS_MINUS) {
-          songManager.volumeDown();
-        }
-
-        else if (result == BS_PLUS) {
-          songManager.volumeUp();
-        }
-
-        else if (result == BS_BACK) {
-          looping = !looping;
-
-          // Next state
-          state = AC_DISPLAY;
-        }
-
-        else if (result == BS_SELECT) {
-          // Turn music back on
-          songManager.resume();
-          playing = true;
-
-          // Display song now playing
-          displaySongNowPlayingScreen(listBox->getSelection());
-
-          // Next state
-          state = SG_SONGSTATUS_CHECK;
-        }
-      }
-      break;
-
-    case SH_PICKANDPLAY:
-      {
-        // Stop any song playing
-        playing = false;
-        songManager.stopSong();
-
-        // Pick a shuffled song
-        pickShuffledSong();
-
-        // Extract the song's name from the song's path
-        String sps = String(songPath);
-
-        String fileName = sps.substring(sps.lastIndexOf('/') + 1,
-                                        sps.length());
-        // Display song now playing
-        displaySongNowPlayingScreen(fileName.c_str());
-
-        // Play the song
-        songManager.playSong(songPath);
-
-        playing = true;
-
-        // Next state
-        state = SH_BUTTONSTATUS_CHECK;
-      }
-      break;
-
-    case SH_BUTTONSTATUS_CHECK:
-      {
-        // Has the song ended ?
-        if (!songManager.isActive()) {
-          // Song has ended
-          // Pick a new song to play
-          state = SH_PICKANDPLAY;
-          break;
-        }
+#if ENABLE_UDP_REMOTE
+  // Handle remote control datagrams
+  udpRemote.loop();
+#endif
+}
 
-        // Song is playing so read buttons
-        enum BUTTON_STATE result = bm.pollButtons();
+#if ENABLE_SESSION_LOG
+// Write the recording to the card and report on a finished replay
+void sessionTask() {
 
-        // If skipInput is true we are trying to consume
-        // the first button press because it should just
-        // turn the backlight back on
+  if (!replaying) {
+    sessionRecorder.flush();
+    return;
+  }
 
-        if (skipInput) {
-          if (result != 0) {
-            skipInput = false;
-            updateTimeOut();
-            // Stay in this state
-            break;
-          }
-        }
-        if (result != BS_NONE) {
-          updateTimeOut();
-        }
+  sessionReplay.checkStall(millis());
+  if (sessionReplay.isActive()) {
+    return;
+  }
 
-        if (result == BS_MINUS) {
-          // Next state
-          state = SH_PICKANDPLAY;
-        }
+  replaying = false;
+  Serial.printf("Replay %s: %lu outputs matched, %lu mismatched\n",
+                sessionReplay.isStalled() ? "stalled" : "done",
+                (unsigned long) sessionReplay.getMatched(),
+                (unsigned long) sessionReplay.getMismatched());
+  if (sessionReplay.getMismatched() != 0) {
+    Serial.printf("First mismatch: %s\n", sessionReplay.getFirstMismatch());
+  }
+  if (sessionReplay.isTruncated()) {
+    Serial.println("The log was cut short, the rest wasn't checked");
+  }
 
-        else if (result == BS_PLUS) {
-          // Next state
-          state = SH_PICKANDPLAY;
-        }
+  // The next visit to INITIAL records a new session
+  sessionStarted = false;
+}
+#endif
 
-        else if (result == BS_BACK) {
-          songManager.stopSong();
-          playing = false;
+#if ENABLE_PLAY_STATS
+// Move the logged plays and skips into the statistics table, a record
+// at a time until the task's budget is spent
+void statsTask() {
 
-          // Back to song selection
-          listBox->pop();
+  while (playStats.isCompactDue() && !scheduler.shouldYield()) {
+    if (!playStats.compact(1)) {
+      Serial.println("Can't compact play statistics");
+      playStats.close();
+      return;
+    }
+  }
+}
+#endif
 
-          // Next state
-          state = OP_BUTTON_CHECK;
-        }
+#if ENABLE_LOOP_STATS || ENABLE_TRACE || ENABLE_SESSION_LOG
+// Handle serial debug commands and refresh the overlay
+void debugTask() {
+
+  while (Serial.available() > 0) {
+    switch (Serial.read()) {
+#if ENABLE_TRACE
+      case 't':
+        traceRing.setEnabled(!traceRing.isEnabled());
+        Serial.printf("Tracing %s\n", traceRing.isEnabled() ? "on" : "off");
+        break;
+
+      case 'd':
+        if (traceRing.dump(&sd, TRACE_DUMP_PATH, stateName, STATE_COUNT)) {
+          Serial.println("Trace written to " TRACE_DUMP_PATH);
+        } else {
+          Serial.println("Trace write failed");
+        }
+        break;
+
+      case 'c':
+        Serial.printf("Trace cost: %lu ns per event\n",
+                      (unsigned long) traceRing.measureCostNs(TRACE_RING_SIZE));
+        break;
+#endif
 
-        else if (result == BS_SELECT) {
-          // Select button doesn't do anything
-        }
+#if ENABLE_LOOP_STATS
+      case 'l':
+        loopStats.printTable(&Serial, stateName);
+        scheduler.printStats(&Serial);
+#if ENABLE_DIR_CACHE
+        Serial.printf("Dir cache: %lu hits, %lu misses, %d dirs in %lu bytes\n",
+                      (unsigned long) dirCache.getHits(), (unsigned long) dirCache.getMisses(),
+                      dirCache.getCount(), (unsigned long) dirCache.getUsed());
+#endif
+        break;
 
-        else if (millis() > displayTimeout) {
-          // If skipInput is true
-          // Ignore the button press that turns the display backlight on
-          skipInput = true;
-          lcd.backlight(LOW);
-        }
-      }
-      break;
+      case 'r':
+        loopStats.reset();
+        scheduler.resetStats();
+        Serial.println("Stats reset");
+        break;
 
-#if ENABLE_FTP_REMOTE
-    case RA_WIFI_CONNECT:
-      {
-        // Display the WiFi screen
-        displayWiFiScreen();
-
-        // Attempt WiFi connection
-        if (!ftpUploader.begin(&sd)) {
-
-          lcd.setTextColor(ILI9341_RED, SCREEN_COLOR);
-
-          for (int i = 0; i < 7; i++) {
-            lcd.drawCenteredText(calcLineOffset(2), "Connect Failed");
-            delay(500);
-            lcd.clearScreen();
-            delay(500);
-          }
-          // Reboot the ESP32
-          ESP.restart();
-        }
+      case 'o':
+        toggleLatencyOverlay();
+        break;
+#endif
 
-        // Next state
-        state = RA_DISPLAY;
-      }
-      break;
+#if ENABLE_SESSION_LOG
+      case 'y':
+        startReplay(&halFs, REPLAY_LOG_PATH);
+        break;
+#endif
+    }
+  }
 
-    case RA_DISPLAY:
-      {
-        displayUploadScreen();
+#if ENABLE_LOOP_STATS
+  if (latencyOverlay && lcdReady) {
+    drawLatencyOverlay();
+  }
+#endif
+}
+#endif
 
-        // Indicating we are uploading
-        uploading = true;
+/****************************************************************/
+/***                        Program Loop                      ***/
+/****************************************************************/
 
-        // Next state
-        state = RA_BUTTON_CHECK;
-      }
-      break;
+void loop() {
 
-    case RA_BUTTON_CHECK:
-      {
-        // Poll the switches. Any switch press cancels FTP
-        enum BUTTON_STATE result = bm.pollButtons();
-        if (result != BS_NONE) {
+#if ENABLE_LOOP_STATS
+  // Charge this pass to the state it started in
+  uint32_t passStartUs = micros();
+  int passState = state;
+#endif
 
-          // Indicate not uploading
-          uploading = false;
+  // Run each due task once
+  scheduler.runPass();
 
-          // Next state is complete restart
-          state = INITIAL;
-        }
-      }
-      break;
+#if ENABLE_LOOP_STATS
+  loopStats.record(passState, micros() - passStartUs);
 #endif
-  };
+
+  // Yield to OS tasks to help prevent drop outs
+  yield();
 }
@@ -0,0 +1,175 @@
+/*
+   Directory Cache
+
+   Keeps the names of recently listed directories, front coded, so
+   browsing back and forth, e.g. Back from an album's songs then Select
+   on the same album, doesn't read and sort the directory again. Entries
+   are kept within a byte budget and the least recently used ones are
+   dropped to make room.
+
+   invalidate() drops a path, everything below it and its parent. The
+   player calls it from the path changed hook when the FTP or WebDAV
+   server changes the card.
+
+   It only uses Hal.h so it runs on a host (see tools/hostplayer.cpp).
+
+   Last Update: 10/18/2026
+*/
+
+#ifndef DIRCACHE_H
+#define DIRCACHE_H
+
+#include <list>
+#include <string>
+#include <vector>
+
+#include "FrontCodedList.h"
+#include "Hal.h"
+
+class DirCache {
+
+public:
+
+  // Class Constructor. budget is the most bytes the entries may take.
+  DirCache(size_t budget) {
+    _budget = budget;
+    used = 0;
+    resetStats();
+  }
+
+  // Copy the cached names of path into names. Returns false if path
+  // isn't cached.
+  boolean lookup(const char *path, boolean directories, FrontCodedList &names) {
+
+    for (std::list<DIR_CACHE_ENTRY>::iterator it = entries.begin(); it != entries.end(); ++it) {
+      if ((it->directories == directories) && (it->path == path)) {
+        names = it->names;
+        // Most recently used go first
+        entries.splice(entries.begin(), entries, it);
+        hits++;
+        return true;
+      }
+    }
+    misses++;
+    return false;
+  }
+
+  // Add the sorted names of path, dropping the least recently used
+  // entries if over budget. Directories too large for the whole
+  // budget aren't kept.
+  void store(const char *path, boolean directories, const FrontCodedList &names) {
+
+    for (std::list<DIR_CACHE_ENTRY>::iterator it = entries.begin(); it != entries.end(); ++it) {
+      if ((it->directories == directories) && (it->path == path)) {
+        used -= it->bytes;
+        entries.erase(it);
+        break;
+      }
+    }
+
+    size_t bytes = sizeof(DIR_CACHE_ENTRY) + strlen(path) + 1 + names.bytes();
+    if (bytes > _budget) {
+      return;
+    }
+
+    while (used + bytes > _budget) {
+      used -= entries.back().bytes;
+      entries.pop_back();
+      evictions++;
+    }
+
+    entries.push_front(DIR_CACHE_ENTRY());
+    DIR_CACHE_ENTRY &entry = entries.front();
+    entry.path = path;
+    entry.directories = directories;
+    entry.names = names;
+    entry.bytes = bytes;
+    used += bytes;
+  }
+
+  // Drop path, the directories below it and the directory holding it.
+  // Called with the path of anything created, written, renamed or
+  // deleted.
+  void invalidate(const char *path) {
+
+    std::string p = path;
+    while ((p.size() > 1) && (p.back() == '/')) {
+      p.pop_back();
+    }
+    if (p.empty() || (p == "/")) {
+      clear();
+      invalidations++;
+      return;
+    }
+
+    size_t slash = p.find_last_of('/');
+    std::string parent = ((slash == 0) || (slash == std::string::npos)) ? "/" : p.substr(0, slash);
+    std::string below = p + "/";
+
+    for (std::list<DIR_CACHE_ENTRY>::iterator it = entries.begin(); it != entries.end();) {
+      if ((it->path == p) || (it->path == parent) || (it->path.compare(0, below.size(), below) == 0)) {
+        used -= it->bytes;
+        it = entries.erase(it);
+        invalidations++;
+      } else {
+        ++it;
+      }
+    }
+  }
+
+  void clear() {
+    entries.clear();
+    used = 0;
+  }
+
+  void resetStats() {
+    hits = 0;
+    misses = 0;
+    evictions = 0;
+    invalidations = 0;
+  }
+
+  uint32_t getHits() {
+    return hits;
+  }
+
+  uint32_t getMisses() {
+    return misses;
+  }
+
+  uint32_t getEvictions() {
+    return evictions;
+  }
+
+  uint32_t getInvalidations() {
+    return invalidations;
+  }
+
+  // Directories cached and the bytes they take
+  int getCount() {
+    return entries.size();
+  }
+
+  size_t getUsed() {
+    return used;
+  }
+
+protected:
+
+  typedef struct {
+    std::string path;
+    boolean directories;  // names are of directories, not files
+    FrontCodedList names;
+    size_t bytes;         // counted against the budget
+  } DIR_CACHE_ENTRY;
+
+  size_t _budget;
+  size_t used;
+  std::list<DIR_CACHE_ENTRY> entries;
+  uint32_t hits;
+  uint32_t misses;
+  uint32_t evictions;
+  uint32_t invalidations;
+};
+
+#endif
@@ -47,8 +47,10 @@ class DisplayHelper : public ILI9341 {
 
     // Draw a text string at specified location
     void drawText(int x, int y, const char *text) {
+      TRACE_BEGIN(TE_LCD_TEXT, strlen(text));
       setCursor(x, y);
       print(text);
+      TRACE_END(TE_LCD_TEXT, strlen(text));
     }
 
     // Draw a text string centered on display with y position
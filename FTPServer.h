@@ -22,17 +22,26 @@
 
 #include <WiFi.h>
 #include <WiFiClient.h>
+#include <errno.h>
+#include <lwip/sockets.h>
+
+#include "FileTransferHelpers.h"
 
 #define FTP_SERVER_VERSION "FTP-2018-08-10"
 
+#ifndef FTP_CTRL_PORT
 #define FTP_CTRL_PORT 21          // Command port on wich server is listening
+#endif
+#ifndef FTP_DATA_PORT_PASV
 #define FTP_DATA_PORT_PASV 50009  // Data port in passive mode
+#endif
 
 #define FTP_TIME_OUT 15        // Disconnect client after 15 minutes of inactivity
 #define FTP_CMD_SIZE 255 + 8   // max size of a command
 #define FTP_CWD_SIZE 255 + 8   // max size of a directory name
 #define FTP_FIL_SIZE 255       // max size of a file name
-#define FTP_BUF_SIZE 2 * 1460  // size of file buffer for read/write
+#define FTP_BUF_SIZE 4096      // size of file buffer for read/write (multiple of 512 byte sectors)
+#define FTP_RETR_BUDGET_MS 20  // max time spent sending RETR data per handleFTP() call
 
 // Instantiate the FTP control and data servers
 WiFiServer controlServer(FTP_CTRL_PORT);
@@ -44,7 +53,7 @@ class FTPServer {
 
 public:
 
-  void begin(String uname, String pword, SdFat32 *ptrSd) {
+  void begin(String uname, String pword, CardFs *ptrSd) {
 
     // Tells the ftp server to begin listening for incoming connection
     _FTP_USER = uname;
@@ -53,9 +62,7 @@ public:
     _ptrSd = ptrSd;
 
     controlServer.begin();
-    delay(10);
     dataServer.begin();
-    delay(10);
     millisTimeOut = (uint32_t)FTP_TIME_OUT * 60 * 1000;
     millisDelay = 0;
     cmdStatus = 0;
@@ -379,9 +386,10 @@ private:
         if (!_ptrSd->exists(path))
           client.println("550 File " + String(parameters) + " not found");
         else {
-          if (_ptrSd->remove(path))
+          if (_ptrSd->remove(path)) {
             client.println("250 Deleted " + String(parameters));
-          else
+            notifyPathChanged(path);
+          } else
             client.println("450 Can't delete " + String(parameters));
         }
       }
@@ -396,7 +404,7 @@ private:
       else {
         client.println("150 Accepted data connection");
         uint16_t nm = 0;
-        File32 root = _ptrSd->open(cwdName);
+        CardFile root = _ptrSd->open(cwdName);
         if (!root) {
           client.println("550 Can't open directory " + String(cwdName));
           // return;
@@ -406,7 +414,7 @@ private:
           //    return;
           // }
 
-          File32 file = root.openNextFile();
+          CardFile file = root.openNextFile();
           while (file) {
             if (file.isDirectory()) {
               file.getName(NAME_BUFFER, sizeof(NAME_BUFFER));
@@ -441,11 +449,11 @@ private:
       else {
         client.println("150 Accepted data connection");
         uint16_t nm = 0;
-        File32 root = _ptrSd->open(cwdName);
+        CardFile root = _ptrSd->open(cwdName);
         if (!root) {
           client.println("550 Can't open directory " + String(cwdName));
         } else {
-          File32 file = root.openNextFile();
+          CardFile file = root.openNextFile();
           while (file) {
             // Get filename then remove all references to its path
             file.getName(NAME_BUFFER, sizeof(NAME_BUFFER));
@@ -478,12 +486,12 @@ private:
         client.println("150 Accepted data connection");
         uint16_t nm = 0;
 
-        File32 root = _ptrSd->open(cwdName);
+        CardFile root = _ptrSd->open(cwdName);
         if (!root) {
           client.println("550 Can't open directory " + String(cwdName));
         } else {
 
-          File32 file = root.openNextFile();
+          CardFile file = root.openNextFile();
           while (file) {
             file.getName(NAME_BUFFER, sizeof(NAME_BUFFER));
             data.println(NAME_BUFFER);
@@ -527,6 +535,9 @@ private:
           client.println("150 " + String(file.size()) + " bytes to download");
           millisBeginTrans = millis();
           bytesTransfered = 0;
+          bytesPerCluster = _ptrSd->bytesPerCluster();
+          bufPos = 0;
+          bufLen = 0;
           transferStatus = 1;
         }
       }
@@ -553,6 +564,8 @@ private:
           client.println("150 Connected to port " + String(dataPort));
           millisBeginTrans = millis();
           bytesTransfered = 0;
+          strcpy(transferPath, path);
+          writeBehind.begin(&file, (uint8_t *)buf, FTP_BUF_SIZE);
           transferStatus = 2;
         }
       }
@@ -572,9 +585,10 @@ private:
 #ifdef FTP_DEBUG
           Serial.println("Creating directory " + String(parameters));
 #endif
-          if (_ptrSd->mkdir(path))
+          if (_ptrSd->mkdir(path)) {
             client.println("257 \"" + String(parameters) + "\" created");
-          else
+            notifyPathChanged(path);
+          } else
             client.println("550 Can't create \"" + String(parameters) + "\"");
         }
       }
@@ -593,9 +607,10 @@ private:
 #endif
         if (!_ptrSd->exists(path))
           client.println("550 File " + String(parameters) + " not found");
-        else if (_ptrSd->rmdir(path))
+        else if (_ptrSd->rmdir(path)) {
           client.println("250 \"" + String(parameters) + "\" deleted");
-        else
+          notifyPathChanged(path);
+        } else
           client.println("501 Can't delete \"" + String(parameters) + "\"");
       }
     }
@@ -625,7 +640,6 @@ private:
     //
     else if (!strcmp(command, "RNTO")) {
       char path[FTP_CWD_SIZE];
-      char dir[FTP_FIL_SIZE];
       if (strlen(buf) == 0 || !rnfrCmd)
         client.println("503 Need RNFR before RNTO");
       else if (strlen(parameters) == 0)
@@ -637,9 +651,11 @@ private:
 #ifdef FTP_DEBUG
           Serial.println("Renaming " + String(buf) + " to " + String(path));
 #endif
-          if (_ptrSd->rename(buf, path))
+          if (_ptrSd->rename(buf, path)) {
             client.println("250 File successfully renamed or moved");
-          else
+            notifyPathChanged(buf);
+            notifyPathChanged(path);
+          } else
             client.println("451 Rename/move failure");
         }
       }
@@ -722,13 +738,54 @@ private:
     return data.connected();
   }
 
+  // Send file data until the data socket's send buffer is full or the
+  // time budget for this call is used up. Reads go straight to the file
+  // with read() (no Stream timeout logic) and never cross a cluster
+  // boundary so the SD card sees whole sector, cluster aligned transfers.
+  // Sends don't block (WiFiClient::write() retries until everything is
+  // taken), so whatever the socket doesn't take waits in buf for the
+  // next call. tools/ftpbench.cpp measures this on a host.
   boolean doRetrieve() {
 
-    if (data.connected()) {
-      int16_t nb = file.readBytes(buf, FTP_BUF_SIZE);
-      if (nb > 0) {
-        data.write((uint8_t *)buf, nb);
-        bytesTransfered += nb;
+    uint32_t startMs = millis();
+
+    while (data.connected()) {
+      // Refill the buffer once everything in it has been sent
+      if (bufPos >= bufLen) {
+        uint32_t toRead = FTP_BUF_SIZE;
+        if (bytesPerCluster >= FTP_BUF_SIZE) {
+          uint32_t toBoundary = bytesPerCluster - (file.curPosition() % bytesPerCluster);
+          if (toBoundary < toRead) {
+            toRead = toBoundary;
+          }
+        }
+        int nb = file.read(buf, toRead);
+        if (nb <= 0) {
+          // End of file or read error
+          break;
+        }
+        bufPos = 0;
+        bufLen = nb;
+      }
+
+      int nw = ::send(data.fd(), buf + bufPos, bufLen - bufPos, MSG_DONTWAIT);
+      if (nw < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+          // Send buffer full
+          return true;
+        }
+        // Connection lost
+        abortTransfer();
+        return false;
+      }
+      bufPos += nw;
+      bytesTransfered += nw;
+      if (bufPos < bufLen) {
+        // Part was taken, so the send buffer is full now
+        return true;
+      }
+
+      if ((millis() - startMs) >= FTP_RETR_BUDGET_MS) {
         return true;
       }
     }
@@ -742,13 +799,14 @@ private:
       // Avoid blocking by never reading more bytes than are available
       int navail = data.available();
       if (navail <= 0) return true;
-      // And be sure not to overflow buf.
-      if (navail > FTP_BUF_SIZE) navail = FTP_BUF_SIZE;
-      int16_t nb = data.read((uint8_t *)buf, navail);
-      // int16_t nb = data.readBytes((uint8_t*) buf, FTP_BUF_SIZE );
+      // Read straight into the write-behind buffer without overflowing it.
+      // The file only sees whole buffers of sectors until the final flush.
+      size_t space = writeBehind.space();
+      if ((size_t)navail > space) navail = space;
+      int16_t nb = data.read(writeBehind.writePtr(), navail);
       if (nb > 0) {
         // Serial.println( millis() << " " << nb << endl;
-        file.write((uint8_t *)buf, nb);
+        writeBehind.commit(nb);
         bytesTransfered += nb;
       }
       return true;
@@ -766,14 +824,26 @@ private:
     } else
       client.println("226 File successfully transferred");
 
-    file.close();
+    finishFile();
     data.stop();
   }
 
+  // Close the transfer file, writing out any buffered upload data
+  void finishFile() {
+
+    if (transferStatus == 2) {
+      writeBehind.flush();
+      file.close();
+      notifyPathChanged(transferPath);
+    } else {
+      file.close();
+    }
+  }
+
   void abortTransfer() {
 
     if (transferStatus > 0) {
-      file.close();
+      finishFile();
       data.stop();
       client.println("426 Transfer aborted");
 #ifdef FTP_DEBUG
@@ -887,7 +957,7 @@ private:
               if (parameters - cmdLine > 4)
                 rc = -2;  // Syntax error
               else {
-                strncpy(command, cmdLine, parameters - cmdLine);
+                memcpy(command, cmdLine, parameters - cmdLine);
                 command[parameters - cmdLine] = 0;
 
                 while (*(++parameters) == ' ')
@@ -916,13 +986,18 @@ private:
   WiFiClient client;
   WiFiClient data;
 
-  File32 file;
+  CardFile file;
+  FileWriteBehind writeBehind;  // sector aligned buffering for STOR
 
   boolean dataPassiveConn;
   uint16_t dataPort;
   char buf[FTP_BUF_SIZE];      // data buffer for transfers
+  uint16_t bufPos,             // next byte of buf to send during RETR
+    bufLen;                    // number of valid bytes in buf during RETR
+  uint32_t bytesPerCluster;    // cluster size of the SD volume
   char cmdLine[FTP_CMD_SIZE];  // where to store incoming char from client
   char cwdName[FTP_CWD_SIZE];  // name of current directory
+  char transferPath[FTP_CWD_SIZE];  // full path of the file being stored
   char command[5];             // command sent by client
   boolean rnfrCmd;             // previous command was RNFR
   char *parameters;            // point to begin of parameters sent by client
@@ -937,7 +1012,7 @@ private:
   String _FTP_USER;
   String _FTP_PASS;
 
-  SdFat32 *_ptrSd;
+  CardFs *_ptrSd;
 
 };
 
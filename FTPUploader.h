@@ -1,5 +1,6 @@
 /*
-   This class controls the operation of the FTPServer for accessing music files
+   This class controls the operation of the FTPServer (and optionally the
+   HTTP/WebDAV server) for accessing music files
 
    Concept, design and implementation by: Craig A. Lindley
    Last Update: 11/06/2025
@@ -8,8 +9,15 @@
 #ifndef FTPUPLOADER_H
 #define FTPUPLOADER_H
 
+#include "Hal.h"
 #include "FTPServer.h"
 
+#if ENABLE_WEBDAV_REMOTE
+#include "WebDAVServer.h"
+#endif
+
+// WiFi connection progress is a WIFI_CONNECT_STATUS from Hal.h
+
 class FTPUploader {
 
   public:
@@ -19,18 +27,45 @@ class FTPUploader {
       connected = false;
     }
 
-    // Connect to WiFi and initialize FTP server
-    boolean begin(SdFat32 *ptrSd) {
+    // Start connecting to WiFi. Call pollConnect() until it stops
+    // returning WCS_CONNECTING.
+    void startConnect(CardFs *ptrSd) {
+
+      _ptrSd = ptrSd;
+      connected = false;
 
-      // Establish WiFi connection
-      if (! canConnect()) {
-        return false;
+      // WiFi may already be up for the UDP remote
+      if (WiFi.status() != WL_CONNECTED) {
+        WiFi.mode(WIFI_STA);
+        WiFi.begin(WIFI_NAME, WIFI_PSWD);
       }
 
-      // Initialize the FTP server with username and password for connection
-      ftpServer.begin(FTP_USER, FTP_PSWD, ptrSd);
+      // Same overall timeout as the old blocking connect
+      connectDeadlineMs = millis() + 200 + (WIFI_ATTEMPTS * 500);
+    }
+
+    // Check on the WiFi connection and start the servers once connected
+    enum WIFI_CONNECT_STATUS pollConnect(void) {
+
+      if (WiFi.status() == WL_CONNECTED) {
+        Serial.printf("WiFi connected\n");
+        connected = true;
+
+        // Initialize the FTP server with username and password for connection
+        ftpServer.begin(FTP_USER, FTP_PSWD, _ptrSd);
+
+#if ENABLE_WEBDAV_REMOTE
+        // The HTTP/WebDAV server uses the same credentials
+        webDAVServer.begin(FTP_USER, FTP_PSWD, _ptrSd);
+#endif
+        return WCS_CONNECTED;
+      }
 
-      return true;
+      if ((int32_t)(millis() - connectDeadlineMs) >= 0) {
+        Serial.printf("Could not connect to WiFi network\n");
+        return WCS_FAILED;
+      }
+      return WCS_CONNECTING;
     }
 
     boolean isConnected(void) {
@@ -45,48 +80,29 @@ class FTPUploader {
       }
     }
 
-    void handleFTP(void) {
+    // Give each server a bounded slice of time
+    void handleClients(void) {
       if (connected) {
         ftpServer.handleFTP();
+#if ENABLE_WEBDAV_REMOTE
+        webDAVServer.handleHTTP();
+#endif
       }
     }
 
   protected:
 
-    // Attempt connection to WiFi
-    // Returns true if successful
-    boolean canConnect(void) {
-      
-      WiFi.mode(WIFI_STA);
-      delay(100);
-      WiFi.begin(WIFI_NAME, WIFI_PSWD);
-      delay(100);
-
-      // Number of connection attempts before failure
-      int attempts = WIFI_ATTEMPTS;
-
-      while ((WiFi.status() != WL_CONNECTED) && attempts--) {
-        delay(500);
-      }
-
-      // Did we connect ?
-      if (attempts <= 0) {
-        Serial.printf("Could not connect to WiFi network\n");
-        connected = false;
-        // No connection so return indication
-        return false;
-      } else  {
-        Serial.printf("WiFi connected\n");
-        connected = true;
-        return true;
-      }
-    }
-
-
     boolean connected;
+    CardFs *_ptrSd;
+    uint32_t connectDeadlineMs;
 
     // Declare FTP server instance
     FTPServer ftpServer;
+
+#if ENABLE_WEBDAV_REMOTE
+    // Declare HTTP/WebDAV server instance
+    WebDAVServer webDAVServer;
+#endif
 };
 
 #endif
@@ -0,0 +1,412 @@
+/*
+   FAT Directory Scanner
+
+   Lists a directory by walking its 32 byte entries in a sector buffer
+   instead of opening every entry with openNextFile(). Long file names
+   are put together from their LFN entries as they go by and checked
+   against the short entry's checksum. exFAT entry sets (file, stream
+   extension and name entries) are read the same way.
+
+   Deleted, hidden and system entries, volume labels, dot entries and
+   names starting with a period are skipped, as are files without one
+   of the extensions given to setExtensions(). Long names that don't fit
+   in HAL_NAME_SIZE are returned as their 8.3 short name so they can
+   still be opened. exFAT has no short names so those are skipped.
+
+   Sectors are read through a callback, one at a time, which with a
+   dedicated SPI bus keeps the card's multi block read going along the
+   directory. SdFatHalDir in HalEsp32.h uses it when ENABLE_RAW_DIR_SCAN
+   is set. tools/fatstream.cpp -d compares it with the openNextFile()
+   loop on large folders and tools/fatpack.cpp walks cards with it.
+
+   Last Update: 10/18/2026
+*/
+
+#ifndef FATDIRSCANNER_H
+#define FATDIRSCANNER_H
+
+#include "FatExtents.h"
+#include "Hal.h"
+
+// Longest long name in UTF-16 characters
+#define FAT_DIR_LFN_CHARS 255
+
+class FatDirScanner {
+
+public:
+
+  FatDirScanner() {
+    setVolume(32, 0, 0, 1, 0);
+    _reader = NULL;
+    _context = NULL;
+    _extensions = NULL;
+    done = true;
+    error = false;
+    entryCluster = 0;
+    entryContiguous = false;
+  }
+
+  // Layout of the volume. fatType is 16, 32 or FAT_EXTENTS_EXFAT.
+  void setVolume(uint8_t fatType, uint32_t fatStart, uint32_t dataStart,
+                 uint32_t sectorsPerCluster, uint32_t clusterCount) {
+    _fatType = fatType;
+    _fatStart = fatStart;
+    _dataStart = dataStart;
+    _sectorsPerCluster = sectorsPerCluster;
+    _clusterCount = clusterCount;
+  }
+
+  void setReader(fatSectorReader reader, void *context) {
+    _reader = reader;
+    _context = context;
+  }
+
+  // Only return files with these extensions (see halHasExtension())
+  void setExtensions(const char *const *extensions) {
+    _extensions = extensions;
+  }
+
+  // Start on the directory at firstCluster. An exFAT directory flagged
+  // contiguous has no FAT chain and is length bytes long.
+  boolean begin(uint32_t firstCluster, boolean contiguous = false, uint32_t length = 0) {
+
+    done = true;
+    error = false;
+    skipped = 0;
+    sectorReads = 0;
+    if ((_reader == NULL) || !validCluster(firstCluster) ||
+        ((_fatType != 16) && (_fatType != 32) && (_fatType != FAT_EXTENTS_EXFAT))) {
+      return false;
+    }
+    cluster = firstCluster;
+    _contiguous = contiguous;
+    left = contiguous ? (length + 511) / 512 : UINT32_MAX;
+    sectorOfCluster = 0;
+    entryOfSector = 16;  // read a sector first
+    fatSector = UINT32_MAX;
+    pending = 0;
+    done = false;
+    return true;
+  }
+
+  // Fetch the next entry. Returns false at the end of the directory or
+  // on a read error (see isError()).
+  boolean next(HAL_DIR_ENTRY *entry) {
+
+    const uint8_t *d;
+    while (!done && ((d = nextEntry()) != NULL)) {
+      boolean found = (_fatType == FAT_EXTENTS_EXFAT) ? exfatEntry(d, entry) : fatEntry(d, entry);
+      if (found) {
+        if (wanted(entry)) {
+          return true;
+        }
+        skipped++;
+      }
+    }
+    done = true;
+    return false;
+  }
+
+  boolean isError() {
+    return error;
+  }
+
+  // Entries left out by the filters since begin()
+  uint32_t getSkipped() {
+    return skipped;
+  }
+
+  uint32_t getSectorReads() {
+    return sectorReads;
+  }
+
+  // First cluster of the entry last returned by next(), and for exFAT
+  // whether it's flagged as having no FAT chain
+  uint32_t getCluster() {
+    return entryCluster;
+  }
+
+  boolean isContiguous() {
+    return entryContiguous;
+  }
+
+protected:
+  uint8_t _fatType;
+  uint32_t _fatStart;
+  uint32_t _dataStart;
+  uint32_t _sectorsPerCluster;
+  uint32_t _clusterCount;
+  fatSectorReader _reader;
+  void *_context;
+  const char *const *_extensions;
+
+  boolean done;
+  boolean error;
+  boolean _contiguous;
+  uint32_t cluster;
+  uint32_t left;  // sectors of a contiguous directory
+  uint32_t sectorOfCluster;
+  int entryOfSector;
+  uint8_t sector[512];
+  uint32_t fatSector;
+  uint8_t fat[512];
+  uint32_t skipped;
+  uint32_t sectorReads;
+  uint32_t entryCluster;
+  boolean entryContiguous;
+
+  // Long name being put together. For FAT, pending is the LFN entries
+  // still expected and checksum their short name's checksum. For exFAT,
+  // pending is the secondary entries left in the set.
+  uint16_t lfn[FAT_DIR_LFN_CHARS + 15];
+  int lfnLength;
+  int pending;
+  uint8_t checksum;
+  uint8_t nameLength;
+  uint16_t attributes;
+  uint32_t size;
+  uint32_t setCluster;
+  boolean setContiguous;
+  boolean wantSet;
+
+  boolean validCluster(uint32_t c) {
+    return (c >= 2) && (c < _clusterCount + 2);
+  }
+
+  boolean wanted(const HAL_DIR_ENTRY *entry) {
+    return (entry->name[0] != '.') &&
+           (entry->isDirectory || halHasExtension(entry->name, _extensions));
+  }
+
+  // The next 32 byte entry, NULL at the end of the directory
+  const uint8_t *nextEntry() {
+
+    if (entryOfSector == 16) {
+      if (sectorOfCluster == _sectorsPerCluster) {
+        if (!nextCluster()) {
+          return NULL;
+        }
+        sectorOfCluster = 0;
+      }
+      if (left == 0) {
+        return NULL;
+      }
+      uint32_t s = _dataStart + (cluster - 2) * _sectorsPerCluster + sectorOfCluster;
+      if (!_reader(_context, s, sector)) {
+        error = true;
+        return NULL;
+      }
+      sectorReads++;
+      sectorOfCluster++;
+      left--;
+      entryOfSector = 0;
+    }
+    return sector + 32 * entryOfSector++;
+  }
+
+  boolean nextCluster() {
+
+    if (_contiguous) {
+      cluster++;
+      return validCluster(cluster);
+    }
+
+    uint32_t perSector = (_fatType == 16) ? 256 : 128;
+    uint32_t s = _fatStart + cluster / perSector;
+    if (s != fatSector) {
+      if (!_reader(_context, s, fat)) {
+        error = true;
+        return false;
+      }
+      fatSector = s;
+      sectorReads++;
+    }
+    const uint8_t *p = fat + (cluster % perSector) * ((_fatType == 16) ? 2 : 4);
+    if (_fatType == 16) {
+      cluster = p[0] | (p[1] << 8);
+    } else {
+      cluster = p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+      if (_fatType == 32) {
+        cluster &= 0x0FFFFFFF;
+      }
+    }
+    return validCluster(cluster);
+  }
+
+  // Handle a FAT entry. Returns true with entry filled in for a visible
+  // file or directory.
+  boolean fatEntry(const uint8_t *d, HAL_DIR_ENTRY *entry) {
+
+    if (d[0] == 0x00) {
+      done = true;
+      return false;
+    }
+    if (d[0] == 0xE5) {
+      pending = 0;
+      return false;
+    }
+
+    uint8_t attr = d[11];
+    if ((attr & 0x3F) == 0x0F) {
+      // Long name entry, 13 characters each. The last part of the name
+      // comes first.
+      int order = d[0] & 0x1F;
+      boolean last = (d[0] & 0x40) != 0;
+      if ((order == 0) || (order > 20) ||
+          (!last && ((pending != order + 1) || (d[13] != checksum)))) {
+        pending = 0;
+        return false;
+      }
+      pending = order;
+      checksum = d[13];
+
+      uint16_t *p = lfn + (order - 1) * 13;
+      static const uint8_t offsets[13] = { 1, 3, 5, 7, 9, 14, 16, 18, 20, 22, 24, 28, 30 };
+      for (int i = 0; i < 13; i++) {
+        p[i] = d[offsets[i]] | (d[offsets[i] + 1] << 8);
+      }
+      if (last) {
+        // NUL terminated unless it fills the entry
+        int i = 0;
+        while ((i < 13) && (p[i] != 0x0000)) {
+          i++;
+        }
+        lfnLength = (order - 1) * 13 + i;
+      }
+      return false;
+    }
+
+    boolean haveLfn = (pending == 1) && (shortChecksum(d) == checksum);
+    pending = 0;
+    if ((attr & 0x0E) || (d[0] == '.')) {
+      return false;  // hidden, system, volume label or dot
+    }
+
+    entry->isDirectory = (attr & 0x10) != 0;
+    entry->size = d[28] | (d[29] << 8) | (d[30] << 16) | ((uint32_t) d[31] << 24);
+    entryCluster = ((uint32_t)(d[20] | (d[21] << 8)) << 16) | d[26] | (d[27] << 8);
+    entryContiguous = false;
+    if (!haveLfn || !utf8Name(entry->name, sizeof(entry->name))) {
+      shortName(d, entry->name);
+    }
+    return true;
+  }
+
+  // Handle an exFAT entry
+  boolean exfatEntry(const uint8_t *d, HAL_DIR_ENTRY *entry) {
+
+    uint8_t type = d[0];
+    if (type == 0x00) {
+      done = true;
+      return false;
+    }
+
+    if (type == 0x85) {
+      pending = d[1];
+      attributes = d[4] | (d[5] << 8);
+      lfnLength = 0;
+      wantSet = false;
+      return false;
+    }
+    if (pending == 0) {
+      return false;  // bitmap, up-case table, label or unused
+    }
+    pending--;
+
+    if (type == 0xC0) {
+      wantSet = true;
+      nameLength = d[3];
+      size = d[24] | (d[25] << 8) | (d[26] << 16) | ((uint32_t) d[27] << 24);
+      setCluster = d[20] | (d[21] << 8) | (d[22] << 16) | ((uint32_t) d[23] << 24);
+      setContiguous = (d[1] & 0x02) != 0;
+    } else if ((type == 0xC1) && wantSet) {
+      for (int i = 0; (i < 15) && (lfnLength < nameLength); i++) {
+        lfn[lfnLength++] = d[2 + i * 2] | (d[3 + i * 2] << 8);
+      }
+    } else if ((type & 0x80) == 0) {
+      pending = 0;  // deleted part of the set
+      return false;
+    }
+
+    if ((pending > 0) || !wantSet || (lfnLength < nameLength) || (attributes & 0x06)) {
+      return false;
+    }
+    entry->isDirectory = (attributes & 0x10) != 0;
+    entry->size = size;
+    entryCluster = setCluster;
+    entryContiguous = setContiguous;
+    if (!utf8Name(entry->name, sizeof(entry->name))) {
+      skipped++;
+      return false;
+    }
+    return true;
+  }
+
+  static uint8_t shortChecksum(const uint8_t *d) {
+    uint8_t sum = 0;
+    for (int i = 0; i < 11; i++) {
+      sum = ((sum & 1) << 7) + (sum >> 1) + d[i];
+    }
+    return sum;
+  }
+
+  // 8.3 name with the lower case flags Windows sets
+  static void shortName(const uint8_t *d, char *name) {
+    int n = 0;
+    for (int i = 0; (i < 8) && (d[i] != ' '); i++) {
+      name[n++] = (d[12] & 0x08) ? tolower(d[i]) : d[i];
+    }
+    if (name[0] == 0x05) {
+      name[0] = 0xE5;
+    }
+    if (d[8] != ' ') {
+      name[n++] = '.';
+      for (int i = 8; (i < 11) && (d[i] != ' '); i++) {
+        name[n++] = (d[12] & 0x10) ? tolower(d[i]) : d[i];
+      }
+    }
+    name[n] = '\0';
+  }
+
+  // The long name in UTF-8. Returns false if it doesn't fit.
+  boolean utf8Name(char *name, size_t size) {
+
+    size_t n = 0;
+    for (int i = 0; i < lfnLength; i++) {
+      uint32_t c = lfn[i];
+      if ((c >= 0xD800) && (c < 0xDC00) && (i + 1 < lfnLength)) {
+        c = 0x10000 + ((c - 0xD800) << 10) + (lfn[++i] - 0xDC00);
+      }
+      uint8_t bytes[4];
+      int count;
+      if (c < 0x80) {
+        bytes[0] = c;
+        count = 1;
+      } else if (c < 0x800) {
+        bytes[0] = 0xC0 | (c >> 6);
+        bytes[1] = 0x80 | (c & 0x3F);
+        count = 2;
+      } else if (c < 0x10000) {
+        bytes[0] = 0xE0 | (c >> 12);
+        bytes[1] = 0x80 | ((c >> 6) & 0x3F);
+        bytes[2] = 0x80 | (c & 0x3F);
+        count = 3;
+      } else {
+        bytes[0] = 0xF0 | (c >> 18);
+        bytes[1] = 0x80 | ((c >> 12) & 0x3F);
+        bytes[2] = 0x80 | ((c >> 6) & 0x3F);
+        bytes[3] = 0x80 | (c & 0x3F);
+        count = 4;
+      }
+      if (n + count >= size) {
+        return false;
+      }
+      memcpy(name + n, bytes, count);
+      n += count;
+    }
+    name[n] = '\0';
+    return n > 0;
+  }
+};
+
+#endif
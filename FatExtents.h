@@ -0,0 +1,221 @@
+/*
+   FAT Extents
+
+   The cluster chain of a file as a list of extents, runs of consecutive
+   clusters, so a byte position maps to a card sector with a binary
+   search instead of a walk along the chain. The list is built with one
+   walk of the FAT, reading FAT sectors through a callback, and takes 8
+   bytes per extent. A file copied to a fresh card is usually a single
+   extent. FAT16, FAT32 and exFAT volumes are handled. exFAT files
+   flagged as contiguous have no FAT chain and are set up with
+   setContiguous() instead.
+
+   SDFileStream in AudioSourceSDFAT.h builds one for each song the first
+   time it is read and uses it for raw reads and seeks.
+   tools/fatstream.cpp checks it against fragmented FAT32 images.
+
+   Last Update: 10/18/2026
+*/
+
+#ifndef FATEXTENTS_H
+#define FATEXTENTS_H
+
+#include "Hal.h"
+
+// Files in more extents than this are left to SdFat
+#define FAT_EXTENTS_MAX 256
+
+// fatType of an exFAT volume, as SdFat reports it
+#define FAT_EXTENTS_EXFAT 64
+
+// An extent runs up to the fileCluster of the next one
+typedef struct {
+  uint32_t fileCluster;  // index of its first cluster within the file
+  uint32_t cluster;      // its first cluster on the volume
+} FAT_EXTENT;
+
+// Read one sector of the volume. Returns false on a read error.
+typedef boolean (*fatSectorReader)(void *context, uint32_t sector, uint8_t *buffer);
+
+class FatExtents {
+
+public:
+
+  FatExtents() {
+    setVolume(32, 0, 0, 1, 0);
+    clear();
+  }
+
+  // Layout of the volume. fatType is 16, 32 or FAT_EXTENTS_EXFAT.
+  void setVolume(uint8_t fatType, uint32_t fatStart, uint32_t dataStart,
+                 uint32_t sectorsPerCluster, uint32_t clusterCount) {
+    _fatType = fatType;
+    _fatStart = fatStart;
+    _dataStart = dataStart;
+    _sectorsPerCluster = sectorsPerCluster;
+    _clusterCount = clusterCount;
+  }
+
+  void clear() {
+    count = 0;
+    clusters = 0;
+    last = 0;
+    fatReads = 0;
+  }
+
+  // Walk the chain from firstCluster for as many clusters as size bytes
+  // take. Fails on a read error, a broken chain or too many extents.
+  boolean build(uint32_t firstCluster, uint32_t size, fatSectorReader reader, void *context) {
+
+    clear();
+    if (((_fatType != 16) && (_fatType != 32) && (_fatType != FAT_EXTENTS_EXFAT)) || (size == 0)) {
+      return false;
+    }
+
+    uint32_t clusterBytes = _sectorsPerCluster * 512;
+    uint32_t needed = (size - 1) / clusterBytes + 1;
+    uint32_t perSector = (_fatType == 16) ? 256 : 128;
+    uint8_t fat[512];
+    uint32_t fatSector = 0;
+    boolean haveSector = false;
+
+    uint32_t cluster = firstCluster;
+    for (uint32_t i = 0; i < needed; i++) {
+      if ((cluster < 2) || (cluster >= _clusterCount + 2)) {
+        count = 0;
+        return false;  // chain ends early or is damaged
+      }
+
+      // Start a new extent unless the cluster follows on
+      if ((count == 0) || (extents[count - 1].cluster + (i - extents[count - 1].fileCluster) != cluster)) {
+        if (count == FAT_EXTENTS_MAX) {
+          count = 0;
+          return false;
+        }
+        extents[count].fileCluster = i;
+        extents[count].cluster = cluster;
+        count++;
+      }
+
+      if (i + 1 == needed) {
+        break;
+      }
+
+      // Next cluster from the FAT
+      uint32_t s = _fatStart + cluster / perSector;
+      if (!haveSector || (s != fatSector)) {
+        if (!reader(context, s, fat)) {
+          count = 0;
+          return false;
+        }
+        fatSector = s;
+        haveSector = true;
+        fatReads++;
+      }
+      uint32_t entry = cluster % perSector;
+      if (_fatType == 16) {
+        const uint8_t *p = fat + entry * 2;
+        cluster = p[0] | (p[1] << 8);
+      } else {
+        const uint8_t *p = fat + entry * 4;
+        cluster = p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+        if (_fatType == 32) {
+          cluster &= 0x0FFFFFFF;
+        }
+      }
+    }
+    clusters = needed;
+    return true;
+  }
+
+  // A file of size bytes in one run of clusters from firstCluster
+  boolean setContiguous(uint32_t firstCluster, uint32_t size) {
+
+    clear();
+    uint32_t clusterBytes = _sectorsPerCluster * 512;
+    uint32_t needed = (size == 0) ? 0 : (size - 1) / clusterBytes + 1;
+    if ((needed == 0) || (firstCluster < 2) || (firstCluster - 2 + needed > _clusterCount)) {
+      return false;
+    }
+    extents[0].fileCluster = 0;
+    extents[0].cluster = firstCluster;
+    count = 1;
+    clusters = needed;
+    return true;
+  }
+
+  // Cluster holding a sector of the data area
+  uint32_t clusterOf(uint32_t sector) {
+    return (sector < _dataStart) ? 0 : (sector - _dataStart) / _sectorsPerCluster + 2;
+  }
+
+  boolean isValid() {
+    return count > 0;
+  }
+
+  int getCount() {
+    return count;
+  }
+
+  const FAT_EXTENT *getExtent(int i) {
+    return &extents[i];
+  }
+
+  // Clusters in extent i
+  uint32_t getLength(int i) {
+    return ((i + 1 < count) ? extents[i + 1].fileCluster : clusters) - extents[i].fileCluster;
+  }
+
+  // FAT sectors read by the last build()
+  uint32_t getFatReads() {
+    return fatReads;
+  }
+
+  // Card sector holding byte position of the file. sectors gets the
+  // number of sectors from there to the end of the extent.
+  uint32_t sector(uint32_t position, uint32_t *sectors) {
+
+    uint32_t clusterBytes = _sectorsPerCluster * 512;
+    uint32_t fileCluster = position / clusterBytes;
+
+    // Reads are mostly sequential so try the last extent used first
+    if (!contains(last, fileCluster)) {
+      int lo = 0;
+      int hi = count - 1;
+      while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        if (extents[mid].fileCluster <= fileCluster) {
+          lo = mid;
+        } else {
+          hi = mid - 1;
+        }
+      }
+      last = lo;
+    }
+
+    const FAT_EXTENT *e = &extents[last];
+    uint32_t offset = (fileCluster - e->fileCluster) * _sectorsPerCluster +
+                      (position % clusterBytes) / 512;
+    *sectors = getLength(last) * _sectorsPerCluster - offset;
+    return _dataStart + (e->cluster - 2) * _sectorsPerCluster + offset;
+  }
+
+protected:
+  uint8_t _fatType;
+  uint32_t _fatStart;
+  uint32_t _dataStart;
+  uint32_t _sectorsPerCluster;
+  uint32_t _clusterCount;
+  FAT_EXTENT extents[FAT_EXTENTS_MAX];
+  int count;
+  uint32_t clusters;  // in all the extents
+  int last;
+  uint32_t fatReads;
+
+  boolean contains(int i, uint32_t fileCluster) {
+    return (i < count) && (extents[i].fileCluster <= fileCluster) &&
+           (fileCluster < extents[i].fileCluster + getLength(i));
+  }
+};
+
+#endif
@@ -0,0 +1,117 @@
+/*
+   Helpers shared by the remote file access servers (FTP and HTTP/WebDAV)
+
+   FileWriteBehind collects incoming network data in a caller supplied
+   buffer and only hands it to the SD card in whole 512 byte sectors, so
+   uploads arriving as odd sized TCP segments never cause partial sector
+   read-modify-write cycles.
+
+   The path changed hook lets the player learn that a remote client has
+   modified the card so its library data can be refreshed.
+
+   Last Update: 10/18/2026
+*/
+
+#ifndef FILETRANSFERHELPERS_H
+#define FILETRANSFERHELPERS_H
+
+#include "SdFsConfig.h"
+
+#define SD_SECTOR_SIZE 512
+
+// Callback invoked with the full path of any file or directory that
+// was created, written, renamed or deleted by a remote client
+typedef void (*pathChangedCallback)(const char *path);
+
+pathChangedCallback onPathChanged = NULL;
+
+// Register the function to call when a remote client changes the card
+void setPathChangedCallback(pathChangedCallback callback) {
+  onPathChanged = callback;
+}
+
+// Report a change made by a remote client
+void notifyPathChanged(const char *path) {
+  if (onPathChanged != NULL) {
+    onPathChanged(path);
+  }
+}
+
+class FileWriteBehind {
+
+public:
+
+  // Start buffering writes for an open file. size should be a
+  // multiple of SD_SECTOR_SIZE.
+  void begin(CardFile *pFile, uint8_t *buffer, size_t size) {
+    _pFile = pFile;
+    _buffer = buffer;
+    _size = size;
+    _count = 0;
+    _error = false;
+  }
+
+  // Where the next incoming bytes should be placed
+  uint8_t *writePtr() {
+    return _buffer + _count;
+  }
+
+  // How many bytes can be placed at writePtr()
+  size_t space() {
+    return _size - _count;
+  }
+
+  // Account for bytes placed at writePtr(). Writes the buffer to
+  // the file once it is full. Returns false on a write error.
+  boolean commit(size_t n) {
+    _count += n;
+    if (_count >= _size) {
+      return writeBuffer();
+    }
+    return !_error;
+  }
+
+  // Copy data into the buffer, writing full buffers to the file
+  boolean write(const uint8_t *data, size_t n) {
+    while (n > 0) {
+      size_t chunk = min(n, space());
+      memcpy(writePtr(), data, chunk);
+      data += chunk;
+      n -= chunk;
+      if (!commit(chunk)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Write whatever is buffered. Call before closing the file.
+  boolean flush() {
+    if (_count > 0) {
+      writeBuffer();
+    }
+    return !_error;
+  }
+
+  boolean hasError() {
+    return _error;
+  }
+
+protected:
+
+  boolean writeBuffer() {
+    if (_pFile->write(_buffer, _count) != _count) {
+      _error = true;
+    }
+    _count = 0;
+    return !_error;
+  }
+
+  CardFile *_pFile;
+  uint8_t *_buffer;
+  size_t _size;
+  size_t _count;
+  boolean _error;
+};
+
+#endif
@@ -0,0 +1,143 @@
+/*
+   Front Coded List
+
+   A sorted list of names stored front coded in blocks of
+   FRONT_CODED_BLOCK. The first name of a block is stored whole and each
+   one after it as the length of the prefix it shares with the name
+   before it and the rest of its bytes. A table gives the offset of each
+   block, so reading name i decodes at most one block. Sorted artist and
+   album names share long prefixes ("The ...", "Disc 1", "Disc 2") so
+   this takes a fraction of the memory of a vector of strings.
+
+   get() decodes into a buffer held by the list and returns it, so the
+   pointer is good until the next get(). Reading on from the last name
+   got in the same block carries on from it rather than starting the
+   block again, which makes painting a window of consecutive lines
+   cheap.
+
+   The artists, albums and songs the ListBox shows are kept in these.
+   tools/hostplayer.cpp namebench compares one with a vector of
+   strings.
+
+   Last Update: 10/18/2026
+*/
+
+#ifndef FRONTCODEDLIST_H
+#define FRONTCODEDLIST_H
+
+#include <string>
+#include <vector>
+
+#include "Hal.h"
+
+// Names per block
+#define FRONT_CODED_BLOCK 16
+
+class FrontCodedList {
+
+public:
+
+  FrontCodedList() {
+    clear();
+  }
+
+  void clear() {
+    data.clear();
+    offsets.clear();
+    count = 0;
+    decoded = -1;
+  }
+
+  // Store names, which must be sorted for the prefixes to be shared.
+  // Names are cut to HAL_NAME_SIZE - 1 bytes.
+  void assign(const std::vector<std::string> &names) {
+
+    clear();
+    const std::string *previous = NULL;
+    for (const std::string &name : names) {
+      size_t length = min(name.size(), (size_t)(HAL_NAME_SIZE - 1));
+      size_t shared = 0;
+      if ((count % FRONT_CODED_BLOCK) == 0) {
+        offsets.push_back(data.size());
+      } else {
+        size_t most = min(length, min(previous->size(), (size_t)(HAL_NAME_SIZE - 1)));
+        while ((shared < most) && (name[shared] == (*previous)[shared])) {
+          shared++;
+        }
+        data.push_back(shared);
+      }
+      data.push_back(length - shared);
+      data.insert(data.end(), name.begin() + shared, name.begin() + length);
+      previous = &name;
+      count++;
+    }
+    data.shrink_to_fit();
+    offsets.shrink_to_fit();
+  }
+
+  size_t size() const {
+    return count;
+  }
+
+  boolean empty() const {
+    return count == 0;
+  }
+
+  // Name i, good until the next call
+  const char *get(size_t i) {
+
+    if (i >= count) {
+      return "";
+    }
+    size_t block = i / FRONT_CODED_BLOCK;
+    if ((decoded < 0) || ((size_t) decoded > i) || ((size_t) decoded / FRONT_CODED_BLOCK != block)) {
+      // Start at the block's first name
+      next = offsets[block];
+      decoded = block * FRONT_CODED_BLOCK;
+      decodeNext(0);
+    }
+    while ((size_t) decoded < i) {
+      decoded++;
+      decodeNext(data[next++]);
+    }
+    return current;
+  }
+
+  std::string at(size_t i) {
+    return get(i);
+  }
+
+  // All the names decoded
+  std::vector<std::string> names() {
+    std::vector<std::string> all;
+    for (size_t i = 0; i < count; i++) {
+      all.push_back(get(i));
+    }
+    return all;
+  }
+
+  // Bytes of memory the names take besides the list itself
+  size_t bytes() const {
+    return data.capacity() + offsets.capacity() * sizeof(uint32_t);
+  }
+
+protected:
+  std::vector<uint8_t> data;
+  std::vector<uint32_t> offsets;  // of each block in data
+  size_t count;
+
+  // The last name decoded and where the one after it starts
+  int decoded;
+  uint32_t next;
+  char current[HAL_NAME_SIZE];
+
+  // Decode the name at next keeping shared bytes of the current one
+  void decodeNext(size_t shared) {
+    size_t length = data[next++];
+    memcpy(current + shared, &data[next], length);
+    current[shared + length] = '\0';
+    next += length;
+  }
+};
+
+#endif
@@ -0,0 +1,469 @@
+/*
+   Hardware Abstraction Layer
+
+   Interfaces for the hardware the player logic touches so that logic
+   can be built and run on a host as well as on the ESP32:
+
+     HalTime        millis/micros
+     HalGpio        digital pins
+     HalSpi         an SPI bus
+     HalFileSystem  files and directories (HalFile, HalDir)
+     HalUdp         datagram networking
+     HalAudioOut    PCM audio sink
+     HalDisplay     a color display
+     HalInput       the on screen buttons and any queued by a remote
+     HalSongPlayer  plays songs from the card
+     HalCard        starts the SD card and sets its clock
+     HalRemote      network file access to the card
+     HalSystem      log output, restart, hardware random numbers
+
+   PlayerFsm.h, the player's state machine, only uses these, so the
+   same FSM runs on the ESP32 and on a host.
+
+   HalEsp32.h implements them with the Arduino core, SdFat, WiFi, A2DP,
+   the ILI9341 driver and the sketch's SongManager, ButtonManager,
+   SdClockTuner and FTPUploader. HalLinux.h implements them with POSIX
+   files, sockets, a WAV file sink, an in memory framebuffer and a song
+   player that plays silence for as long as the song lasts.
+
+   Off the ESP32 this header also supplies the few Arduino helpers the
+   portable code uses (boolean, min/max, random).
+
+   halRandom() and halHash() give the same results on every build so a
+   recorded session (see SessionLog.h) replays identically on a host.
+
+   Last Update: 10/18/2026
+*/
+
+#ifndef HAL_H
+#define HAL_H
+
+#include <ctype.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#else
+#include <algorithm>
+#include <stdlib.h>
+
+typedef bool boolean;
+using std::max;
+using std::min;
+
+inline long random(long howBig) {
+  return (howBig <= 0) ? 0 : (rand() % howBig);
+}
+
+inline long random(long howSmall, long howBig) {
+  return (howSmall >= howBig) ? howSmall : howSmall + random(howBig - howSmall);
+}
+
+inline void randomSeed(unsigned long seed) {
+  srand(seed);
+}
+#endif
+
+// Seedable xorshift32 random numbers, identical on the ESP32 and a host
+static uint32_t halRandomState = 1;
+
+inline void halRandomSeed(uint32_t seed) {
+  halRandomState = (seed != 0) ? seed : 1;
+}
+
+// Returns 0 .. howBig - 1
+inline long halRandom(long howBig) {
+  uint32_t x = halRandomState;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  halRandomState = x;
+  return (howBig <= 0) ? 0 : (long)(x % (uint32_t) howBig);
+}
+
+// FNV-1a hash. Pass HAL_HASH_SEED to start and the previous result to
+// continue a hash across several pieces of data.
+#define HAL_HASH_SEED 2166136261UL
+
+inline uint32_t halHash(uint32_t hash, const void *data, size_t length) {
+  const uint8_t *p = (const uint8_t *) data;
+  while (length--) {
+    hash = (hash ^ *p++) * 16777619UL;
+  }
+  return hash;
+}
+
+inline uint32_t halHash(uint32_t hash, const char *str) {
+  return halHash(hash, str, strlen(str) + 1);
+}
+
+// Longest file or directory name returned by HalDir
+#define HAL_NAME_SIZE 128
+
+// Time since startup
+class HalTime {
+public:
+  virtual ~HalTime() {}
+  virtual uint32_t millis() = 0;
+  virtual uint32_t micros() = 0;
+};
+
+// Digital pins
+enum HAL_PIN_MODE {
+  HPM_INPUT,
+  HPM_OUTPUT,
+  HPM_INPUT_PULLUP
+};
+
+class HalGpio {
+public:
+  virtual ~HalGpio() {}
+  virtual void pinMode(uint8_t pin, enum HAL_PIN_MODE mode) = 0;
+  virtual void write(uint8_t pin, boolean high) = 0;
+  virtual boolean read(uint8_t pin) = 0;
+};
+
+// An SPI bus. Chip selects are handled with HalGpio.
+class HalSpi {
+public:
+  virtual ~HalSpi() {}
+  virtual void beginTransaction(uint32_t frequency) = 0;
+  virtual void endTransaction() = 0;
+  virtual uint8_t transfer(uint8_t data) = 0;
+  virtual void write(const uint8_t *data, size_t length) = 0;
+};
+
+// An open file. Deleting it closes it.
+class HalFile {
+public:
+  virtual ~HalFile() {}
+  virtual int read(void *buffer, size_t length) = 0;
+  virtual size_t write(const void *data, size_t length) = 0;
+  // Write out what's buffered
+  virtual void flush() = 0;
+  virtual boolean seek(uint32_t position) = 0;
+  virtual uint32_t position() = 0;
+  virtual uint32_t size() = 0;
+};
+
+typedef struct {
+  char name[HAL_NAME_SIZE];
+  boolean isDirectory;
+  uint32_t size;
+} HAL_DIR_ENTRY;
+
+// True if name ends in one of extensions, a NULL terminated list of
+// extensions without the period compared ignoring case. A NULL list
+// matches every name.
+inline boolean halHasExtension(const char *name, const char *const *extensions) {
+  if (extensions == NULL) {
+    return true;
+  }
+  const char *dot = strrchr(name, '.');
+  if (dot == NULL) {
+    return false;
+  }
+  for (; *extensions != NULL; extensions++) {
+    const char *a = dot + 1;
+    const char *b = *extensions;
+    while ((*a != '\0') && (tolower((uint8_t) *a) == tolower((uint8_t) *b))) {
+      a++;
+      b++;
+    }
+    if ((*a == '\0') && (*b == '\0')) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// An open directory. Deleting it closes it.
+class HalDir {
+public:
+  HalDir() {
+    _extensions = NULL;
+  }
+  virtual ~HalDir() {}
+  // Fetch the next entry. Returns false at the end.
+  virtual boolean next(HAL_DIR_ENTRY *entry) = 0;
+  // Only return files with these extensions (see halHasExtension()).
+  // Directories are always returned.
+  void setExtensions(const char *const *extensions) {
+    _extensions = extensions;
+  }
+
+protected:
+  const char *const *_extensions;
+
+  boolean wanted(const HAL_DIR_ENTRY *entry) {
+    return entry->isDirectory || halHasExtension(entry->name, _extensions);
+  }
+};
+
+enum HAL_OPEN_MODE {
+  HOM_READ,
+  HOM_WRITE,    // create or truncate
+  HOM_APPEND,   // create or append
+  HOM_UPDATE    // read and write an existing file
+};
+
+// Paths are absolute, "/" is the root of the card
+class HalFileSystem {
+public:
+  virtual ~HalFileSystem() {}
+  // Return NULL on failure
+  virtual HalFile *open(const char *path, enum HAL_OPEN_MODE mode) = 0;
+  virtual HalDir *openDir(const char *path) = 0;
+  virtual boolean exists(const char *path) = 0;
+  virtual boolean remove(const char *path) = 0;
+  virtual boolean mkdir(const char *path) = 0;
+  virtual boolean rmdir(const char *path) = 0;
+  virtual boolean rename(const char *from, const char *to) = 0;
+};
+
+// IPv4 address and port. ip is in network byte order.
+typedef struct {
+  uint32_t ip;
+  uint16_t port;
+} HAL_ADDRESS;
+
+// Non-blocking datagrams
+class HalUdp {
+public:
+  virtual ~HalUdp() {}
+  virtual boolean isNetworkUp() = 0;
+  virtual boolean begin(uint16_t port) = 0;
+  virtual void stop() = 0;
+  // Returns the datagram length or 0 if none is waiting
+  virtual int receive(uint8_t *buffer, size_t size, HAL_ADDRESS *from) = 0;
+  virtual boolean send(const HAL_ADDRESS *to, const uint8_t *data, size_t length) = 0;
+};
+
+// 16 bit interleaved PCM sink
+class HalAudioOut {
+public:
+  virtual ~HalAudioOut() {}
+  virtual boolean begin(uint32_t sampleRate, uint8_t channels) = 0;
+  virtual void end() = 0;
+  virtual boolean isConnected() = 0;
+  virtual size_t availableForWrite() = 0;
+  virtual size_t write(const uint8_t *pcm, size_t length) = 0;
+};
+
+// RGB565 color display with the built in 6x8 font scaled by size
+class HalDisplay {
+public:
+  HalDisplay() {
+    textSize = 1;
+    textFg = 0xFFFF;
+    textBg = 0x0000;
+  }
+  virtual ~HalDisplay() {}
+  // Carry on starting the display. Returns true once it is ready.
+  virtual boolean initStep() = 0;
+  virtual int16_t width() = 0;
+  virtual int16_t height() = 0;
+  virtual void fillRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color) = 0;
+  virtual void drawRoundRect(int16_t x, int16_t y, int16_t w, int16_t h, int16_t r, uint16_t color) = 0;
+  virtual void drawText(int16_t x, int16_t y, const char *text, uint8_t size,
+                        uint16_t fg, uint16_t bg) = 0;
+  virtual void backlight(boolean on) = 0;
+  // Push any buffered drawing to the screen
+  virtual void flush() = 0;
+
+  void clearScreen() {
+    fillRect(0, 0, width(), height(), 0x0000);
+  }
+
+  // Text in the current size and colors, as the Arduino GFX drivers
+  // draw it
+  void setTextSize(uint8_t size) {
+    textSize = size;
+  }
+
+  void setTextColor(uint16_t fg, uint16_t bg) {
+    textFg = fg;
+    textBg = bg;
+  }
+
+  // Text wider than the screen wraps, so it is only as wide as the
+  // characters that fit on a line
+  uint16_t getTextWidth(const char *text) {
+    size_t perLine = width() / (6 * textSize);
+    return min(strlen(text), perLine) * 6 * textSize;
+  }
+
+  uint16_t getTextHeight() {
+    return 8 * textSize;
+  }
+
+  void drawText(int16_t x, int16_t y, const char *text) {
+    drawText(x, y, text, textSize, textFg, textBg);
+  }
+
+  void drawCenteredText(int16_t y, const char *text) {
+    drawText((width() - getTextWidth(text)) / 2, y, text);
+  }
+
+protected:
+  uint8_t textSize;
+  uint16_t textFg;
+  uint16_t textBg;
+};
+
+// Button events. Each on screen button and a touch elsewhere on the
+// screen is clicked, double clicked (P) or held (PP).
+enum BUTTON_STATE {
+  BS_NONE,
+  BS_MINUS, BS_MINUSP, BS_MINUSPP,
+  BS_PLUS, BS_PLUSP, BS_PLUSPP,
+  BS_SELECT, BS_SELECTP, BS_SELECTPP,
+  BS_BACK, BS_BACKP, BS_BACKPP,
+  BS_TOUCHED, BS_TOUCHEDP, BS_TOUCHEDPP
+};
+
+class HalInput {
+public:
+  virtual ~HalInput() {}
+  // The next button event or BS_NONE. queued is set when it came from
+  // a queue (e.g. the UDP remote) rather than the touch screen.
+  virtual enum BUTTON_STATE poll(boolean *queued) = 0;
+  // Draw the on screen buttons
+  virtual void drawButtons() = 0;
+};
+
+// A song's library index entry (see LibraryIndex.h)
+struct LIBRARY_TRACK;
+
+// Plays songs from the card to the speaker
+class HalSongPlayer {
+public:
+  virtual ~HalSongPlayer() {}
+  // Start connecting to the speaker. Safe to call more than once.
+  virtual void begin() = 0;
+  virtual boolean isConnected() = 0;
+  virtual boolean playSong(const char *path) = 0;
+  // The playing song's library index entry, so skip() moves by time
+  virtual void setTrack(const struct LIBRARY_TRACK *track) = 0;
+  // Pause and carry on
+  virtual void stopSong() = 0;
+  virtual void resume() = 0;
+  // Stop and close the song's file before the card is restarted
+  virtual void closeSong() = 0;
+  // False once the song has ended or while paused
+  virtual boolean isActive() = 0;
+  // Move by percent of the song
+  virtual boolean skip(int percent) = 0;
+  virtual void volumeUp() = 0;
+  virtual void volumeDown() = 0;
+  // Byte position within and size of the song
+  virtual uint32_t getPosition() = 0;
+  virtual uint32_t getSize() = 0;
+  // Failed card reads while playing since startup
+  virtual uint32_t getReadErrors() = 0;
+  // Incremented each time a song is started
+  virtual uint32_t getSongNumber() = 0;
+  // PCM bytes decoded for the song before the current one
+  virtual uint32_t getLastSongBytes() = 0;
+};
+
+// Results of HalCard::test()
+#define HAL_CARD_PROBES 8
+
+typedef struct {
+  uint8_t mhz;
+  boolean ok;
+  uint32_t readKBps;
+} HAL_CARD_PROBE;
+
+typedef struct {
+  HAL_CARD_PROBE probes[HAL_CARD_PROBES];
+  int probeCount;
+  uint8_t mhz;          // the clock chosen
+  char format[8];       // "FAT32", "exFAT" ...
+  uint32_t clusterKB;
+  uint32_t seqKBps;
+  uint32_t randomAvgUs;
+  uint32_t randomMaxUs;
+  uint32_t errors;
+} HAL_CARD_TEST;
+
+// The SD card. Restarting it leaves files open on it invalid, so the
+// caller closes its files first and opens them again after.
+class HalCard {
+public:
+  virtual ~HalCard() {}
+  // Start the card. Returns false if it won't start.
+  virtual boolean begin() = 0;
+  // Drop to a slower clock. Returns false if already slowest.
+  virtual boolean stepDown() = 0;
+  virtual uint8_t getMHz() = 0;
+  // Find the fastest clock again and benchmark it
+  virtual boolean test(HAL_CARD_TEST *result) = 0;
+};
+
+// WiFi connection progress
+enum WIFI_CONNECT_STATUS {
+  WCS_CONNECTING,
+  WCS_CONNECTED,
+  WCS_FAILED
+};
+
+// Network file access to the card
+class HalRemote {
+public:
+  virtual ~HalRemote() {}
+  // Start connecting. Poll until it isn't WCS_CONNECTING. The servers
+  // are started once connected.
+  virtual void startConnect() = 0;
+  virtual enum WIFI_CONNECT_STATUS pollConnect() = 0;
+  // The address clients connect to
+  virtual const char *getAddress() = 0;
+};
+
+// The rest of the board
+class HalSystem {
+public:
+  virtual ~HalSystem() {}
+  // Log output, the serial port on the ESP32
+  virtual void print(const char *text) = 0;
+  // A random number from a hardware source
+  virtual uint32_t trueRandom() = 0;
+  // Turn the WiFi radio off to save power
+  virtual void radioOff() = 0;
+  // The end of a startup phase, and startup reaching the menu
+  virtual void bootPhase(const char *name) = 0;
+  virtual void bootDone() = 0;
+  virtual void restart() = 0;
+
+  void printf(const char *format, ...) __attribute__((format(printf, 2, 3))) {
+    char text[192];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(text, sizeof(text), format, args);
+    va_end(args);
+    print(text);
+  }
+};
+
+// The hardware a build runs on
+typedef struct {
+  HalTime *time;
+  HalGpio *gpio;
+  HalSpi *spi;
+  HalFileSystem *fs;
+  HalUdp *udp;
+  HalAudioOut *audio;
+  HalDisplay *display;
+  HalInput *input;
+  HalSongPlayer *player;
+  HalCard *card;
+  HalRemote *remote;  // NULL without remote access
+  HalSystem *system;
+} HAL;
+
+#endif
@@ -0,0 +1,617 @@
+/*
+   ESP32 Hardware Abstraction Layer
+
+   Implements the Hal.h interfaces with the Arduino core, SdFat,
+   WiFiUDP, the A2DP output stream and the ILI9341 display driver, and
+   adapts the player's drivers (SongManager, ButtonManager, the SD clock
+   tuner and FTPUploader) to the interfaces PlayerFsm.h uses.
+
+   With ENABLE_RAW_DIR_SCAN directories are listed with FatDirScanner,
+   reading the card's sectors directly, falling back to openNextFile()
+   for directories it can't walk (the FAT16 root).
+
+   Last Update: 10/18/2026
+*/
+
+#ifndef HALESP32_H
+#define HALESP32_H
+
+#include <SPI.h>
+#include "SdFsConfig.h"
+#include <WiFi.h>
+#include <WiFiUdp.h>
+
+#include "Hal.h"
+#include "BootProfiler.h"
+#include "ButtonManager.h"
+#include "DisplayHelpers.h"
+#include "SongManager.h"
+#include "FatDirScanner.h"
+#include "AudioTools.h"
+#include "AudioTools/AudioLibs/A2DPStream.h"
+
+#if ENABLE_SD_TUNING
+#include "SdClockTuner.h"
+#endif
+
+#if ENABLE_FTP_REMOTE
+#include "FTPUploader.h"
+#endif
+
+class Esp32Time : public HalTime {
+public:
+  uint32_t millis() override {
+    return ::millis();
+  }
+
+  uint32_t micros() override {
+    return ::micros();
+  }
+};
+
+class Esp32Gpio : public HalGpio {
+public:
+  void pinMode(uint8_t pin, enum HAL_PIN_MODE mode) override {
+    ::pinMode(pin, (mode == HPM_OUTPUT) ? OUTPUT :
+                   (mode == HPM_INPUT_PULLUP) ? INPUT_PULLUP : INPUT);
+  }
+
+  void write(uint8_t pin, boolean high) override {
+    ::digitalWrite(pin, high ? HIGH : LOW);
+  }
+
+  boolean read(uint8_t pin) override {
+    return ::digitalRead(pin) == HIGH;
+  }
+};
+
+class Esp32Spi : public HalSpi {
+public:
+  Esp32Spi(SPIClass *spi) {
+    _spi = spi;
+  }
+
+  void beginTransaction(uint32_t frequency) override {
+    _spi->beginTransaction(SPISettings(frequency, MSBFIRST, SPI_MODE0));
+  }
+
+  void endTransaction() override {
+    _spi->endTransaction();
+  }
+
+  uint8_t transfer(uint8_t data) override {
+    return _spi->transfer(data);
+  }
+
+  void write(const uint8_t *data, size_t length) override {
+    _spi->writeBytes(data, length);
+  }
+
+protected:
+  SPIClass *_spi;
+};
+
+class SdFatHalFile : public HalFile {
+public:
+  SdFatHalFile(CardFile file) {
+    _file = file;
+  }
+
+  ~SdFatHalFile() {
+    _file.close();
+  }
+
+  int read(void *buffer, size_t length) override {
+    return _file.read(buffer, length);
+  }
+
+  size_t write(const void *data, size_t length) override {
+    return _file.write(data, length);
+  }
+
+  void flush() override {
+    _file.sync();
+  }
+
+  boolean seek(uint32_t position) override {
+    return _file.seekSet(position);
+  }
+
+  uint32_t position() override {
+    return _file.curPosition();
+  }
+
+  uint32_t size() override {
+    return _file.fileSize();
+  }
+
+protected:
+  CardFile _file;
+};
+
+// Card sector reads for FatDirScanner
+static boolean readDirSector(void *context, uint32_t sector, uint8_t *buffer) {
+  return ((SdCard *) context)->readSectors(sector, buffer, 1);
+}
+
+class SdFatHalDir : public HalDir {
+public:
+  SdFatHalDir(CardFs *ptrSd, CardFile dir) {
+    _dir = dir;
+    raw = false;
+#if ENABLE_RAW_DIR_SCAN
+    uint32_t first = dir.firstSector();
+    if (first >= ptrSd->dataStartSector()) {
+      scanner.setVolume(ptrSd->fatType(), ptrSd->fatStartSector(), ptrSd->dataStartSector(),
+                        ptrSd->sectorsPerCluster(), ptrSd->clusterCount());
+      scanner.setReader(readDirSector, ptrSd->card());
+      raw = scanner.begin((first - ptrSd->dataStartSector()) / ptrSd->sectorsPerCluster() + 2,
+                          dir.isContiguous(), dir.fileSize());
+    }
+#endif
+  }
+
+  ~SdFatHalDir() {
+    _dir.close();
+  }
+
+  boolean next(HAL_DIR_ENTRY *entry) override {
+
+    if (raw) {
+      scanner.setExtensions(_extensions);
+      if (scanner.next(entry)) {
+        return true;
+      }
+      if (scanner.isError()) {
+        Serial.println("Directory read error");
+      }
+      return false;
+    }
+
+    CardFile file;
+    while (file = _dir.openNextFile()) {
+      file.getName(entry->name, sizeof(entry->name));
+      entry->isDirectory = file.isDirectory();
+      entry->size = file.fileSize();
+      boolean hidden = file.isHidden();
+      file.close();
+      if (!hidden && wanted(entry)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+protected:
+  CardFile _dir;
+  boolean raw;
+  FatDirScanner scanner;
+};
+
+class SdFatFileSystem : public HalFileSystem {
+public:
+  SdFatFileSystem(CardFs *ptrSd) {
+    _ptrSd = ptrSd;
+  }
+
+  HalFile *open(const char *path, enum HAL_OPEN_MODE mode) override {
+    oflag_t flags = (mode == HOM_READ) ? O_RDONLY :
+                    (mode == HOM_WRITE) ? (O_WRONLY | O_CREAT | O_TRUNC) :
+                    (mode == HOM_UPDATE) ? O_RDWR :
+                    (O_WRONLY | O_CREAT | O_APPEND);
+    CardFile file = _ptrSd->open(path, flags);
+    if (!file || file.isDirectory()) {
+      return NULL;
+    }
+    return new SdFatHalFile(file);
+  }
+
+  HalDir *openDir(const char *path) override {
+    CardFile dir = _ptrSd->open(path);
+    if (!dir || !dir.isDirectory()) {
+      return NULL;
+    }
+    return new SdFatHalDir(_ptrSd, dir);
+  }
+
+  boolean exists(const char *path) override {
+    return _ptrSd->exists(path);
+  }
+
+  boolean remove(const char *path) override {
+    return _ptrSd->remove(path);
+  }
+
+  boolean mkdir(const char *path) override {
+    return _ptrSd->mkdir(path);
+  }
+
+  boolean rmdir(const char *path) override {
+    return _ptrSd->rmdir(path);
+  }
+
+  boolean rename(const char *from, const char *to) override {
+    return _ptrSd->rename(from, to);
+  }
+
+protected:
+  CardFs *_ptrSd;
+};
+
+class Esp32Udp : public HalUdp {
+public:
+  boolean isNetworkUp() override {
+    return WiFi.status() == WL_CONNECTED;
+  }
+
+  boolean begin(uint16_t port) override {
+    return udp.begin(port);
+  }
+
+  void stop() override {
+    udp.stop();
+  }
+
+  int receive(uint8_t *buffer, size_t size, HAL_ADDRESS *from) override {
+    int length = udp.parsePacket();
+    if (length <= 0) {
+      return 0;
+    }
+    from->ip = (uint32_t) udp.remoteIP();
+    from->port = udp.remotePort();
+    return udp.read(buffer, size);
+  }
+
+  boolean send(const HAL_ADDRESS *to, const uint8_t *data, size_t length) override {
+    udp.beginPacket(IPAddress(to->ip), to->port);
+    udp.write(data, length);
+    return udp.endPacket();
+  }
+
+protected:
+  WiFiUDP udp;
+};
+
+// Audio goes to the A2DP stream, which is fixed at 44.1 kHz stereo
+class A2dpAudioOut : public HalAudioOut {
+public:
+  A2dpAudioOut(A2DPStream *stream) {
+    _stream = stream;
+  }
+
+  boolean begin(uint32_t sampleRate, uint8_t channels) override {
+    return (sampleRate == 44100) && (channels == 2);
+  }
+
+  void end() override {
+  }
+
+  boolean isConnected() override {
+    return _stream->isConnected();
+  }
+
+  size_t availableForWrite() override {
+    return _stream->availableForWrite();
+  }
+
+  size_t write(const uint8_t *pcm, size_t length) override {
+    return _stream->write(pcm, length);
+  }
+
+protected:
+  A2DPStream *_stream;
+};
+
+class Ili9341Display : public HalDisplay {
+public:
+  Ili9341Display(DisplayHelper *lcd, uint8_t rotation) {
+    _lcd = lcd;
+    _rotation = rotation;
+    rotated = false;
+  }
+
+  using HalDisplay::drawText;
+
+  // Set the rotation once the panel is ready
+  boolean initStep() override {
+    if (!_lcd->initStep()) {
+      return false;
+    }
+    if (!rotated) {
+      rotated = true;
+      _lcd->setRotation(_rotation);
+    }
+    return true;
+  }
+
+  int16_t width() override {
+    return _lcd->width();
+  }
+
+  int16_t height() override {
+    return _lcd->height();
+  }
+
+  void fillRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color) override {
+    _lcd->fillRect(x, y, w, h, color);
+  }
+
+  void drawRoundRect(int16_t x, int16_t y, int16_t w, int16_t h, int16_t r,
+                     uint16_t color) override {
+    _lcd->drawRoundRect(x, y, w, h, r, color);
+  }
+
+  void drawText(int16_t x, int16_t y, const char *text, uint8_t size,
+                uint16_t fg, uint16_t bg) override {
+    int oldSize = _lcd->getTextSize();
+    _lcd->setTextSize(size);
+    _lcd->setTextColor(fg, bg);
+    _lcd->drawText(x, y, text);
+    _lcd->setTextSize(oldSize);
+  }
+
+  void backlight(boolean on) override {
+    _lcd->backlight(on);
+  }
+
+  // Drawing goes straight to the panel
+  void flush() override {
+  }
+
+protected:
+  DisplayHelper *_lcd;
+  uint8_t _rotation;
+  boolean rotated;
+};
+
+class ButtonManagerInput : public HalInput {
+public:
+  ButtonManagerInput(ButtonManager *bm) {
+    _bm = bm;
+  }
+
+  enum BUTTON_STATE poll(boolean *queued) override {
+    enum BUTTON_STATE result = _bm->pollButtons();
+    *queued = _bm->wasQueuedEvent();
+    return result;
+  }
+
+  void drawButtons() override {
+    _bm->drawButtons();
+  }
+
+protected:
+  ButtonManager *_bm;
+};
+
+class SongManagerPlayer : public HalSongPlayer {
+public:
+  SongManagerPlayer(SongManager *songManager, CardFs *ptrSd) {
+    _songManager = songManager;
+    _ptrSd = ptrSd;
+  }
+
+  void begin() override {
+    _songManager->begin(_ptrSd);
+  }
+
+  boolean isConnected() override {
+    return _songManager->btConnected();
+  }
+
+  boolean playSong(const char *path) override {
+    return _songManager->playSong(path);
+  }
+
+  void setTrack(const struct LIBRARY_TRACK *track) override {
+    _songManager->setTrack(track);
+  }
+
+  void stopSong() override {
+    _songManager->stopSong();
+  }
+
+  void resume() override {
+    _songManager->resume();
+  }
+
+  void closeSong() override {
+    _songManager->closeSong();
+  }
+
+  boolean isActive() override {
+    return _songManager->isActive();
+  }
+
+  boolean skip(int percent) override {
+    return _songManager->skip(percent);
+  }
+
+  void volumeUp() override {
+    _songManager->volumeUp();
+  }
+
+  void volumeDown() override {
+    _songManager->volumeDown();
+  }
+
+  uint32_t getPosition() override {
+    return _songManager->getPosition();
+  }
+
+  uint32_t getSize() override {
+    return _songManager->getSize();
+  }
+
+  uint32_t getReadErrors() override {
+    return _songManager->getReadErrors();
+  }
+
+  uint32_t getSongNumber() override {
+    return _songManager->getSongNumber();
+  }
+
+  uint32_t getLastSongBytes() override {
+    return _songManager->getLastSongBytes();
+  }
+
+protected:
+  SongManager *_songManager;
+  CardFs *_ptrSd;
+};
+
+// The SD card at the fastest clock SdClockTuner finds, or at 12 MHz
+// without ENABLE_SD_TUNING. The audio source keeps its own copy of the
+// card, so it's given the card again after each restart.
+class SdFatCard : public HalCard {
+public:
+  SdFatCard(CardFs *ptrSd, uint8_t csPin, const char *savePath)
+#if ENABLE_SD_TUNING
+    : tuner(csPin)
+#endif
+  {
+    _ptrSd = ptrSd;
+    _csPin = csPin;
+    _savePath = savePath;
+  }
+
+  boolean begin() override {
+#if ENABLE_SD_TUNING
+    boolean ok = tuner.begin(_ptrSd, _savePath);
+#else
+    boolean ok = _ptrSd->begin(SdSpiConfig(_csPin, DEDICATED_SPI, SD_SCK_MHZ(12)));
+#endif
+    if (!ok) {
+      _ptrSd->initErrorPrint(&Serial);
+    }
+    return ok;
+  }
+
+  boolean stepDown() override {
+#if ENABLE_SD_TUNING
+    boolean lowered = tuner.stepDown();
+    source.setSd(_ptrSd);
+    return lowered;
+#else
+    return false;
+#endif
+  }
+
+  uint8_t getMHz() override {
+#if ENABLE_SD_TUNING
+    return tuner.getMHz();
+#else
+    return 12;
+#endif
+  }
+
+  boolean test(HAL_CARD_TEST *result) override {
+    memset(result, 0, sizeof(HAL_CARD_TEST));
+#if ENABLE_SD_TUNING
+    SD_BENCH_RESULT bench;
+    boolean ok = tuner.probe() && tuner.bench(&bench);
+    source.setSd(_ptrSd);
+
+    result->probeCount = min(tuner.getProbeCount(), HAL_CARD_PROBES);
+    for (int i = 0; i < result->probeCount; i++) {
+      const SD_CLOCK_PROBE *p = tuner.getProbe(i);
+      result->probes[i].mhz = p->mhz;
+      result->probes[i].ok = p->ok;
+      result->probes[i].readKBps = p->readKBps;
+    }
+    if (!ok) {
+      return false;
+    }
+    result->mhz = tuner.getMHz();
+    if (_ptrSd->fatType() == FAT_TYPE_EXFAT) {
+      strcpy(result->format, "exFAT");
+    } else {
+      sprintf(result->format, "FAT%d", _ptrSd->fatType());
+    }
+    result->clusterKB = _ptrSd->sectorsPerCluster() / 2;
+    result->seqKBps = bench.seqKBps;
+    result->randomAvgUs = bench.randomAvgUs;
+    result->randomMaxUs = bench.randomMaxUs;
+    result->errors = bench.errors;
+    return true;
+#else
+    return false;
+#endif
+  }
+
+protected:
+  CardFs *_ptrSd;
+  uint8_t _csPin;
+  const char *_savePath;
+#if ENABLE_SD_TUNING
+  SdClockTuner tuner;
+#endif
+};
+
+#if ENABLE_FTP_REMOTE
+class FtpUploaderRemote : public HalRemote {
+public:
+  FtpUploaderRemote(FTPUploader *uploader, CardFs *ptrSd) {
+    _uploader = uploader;
+    _ptrSd = ptrSd;
+  }
+
+  void startConnect() override {
+    _uploader->startConnect(_ptrSd);
+  }
+
+  enum WIFI_CONNECT_STATUS pollConnect() override {
+    return _uploader->pollConnect();
+  }
+
+  const char *getAddress() override {
+    address = _uploader->getIPAddressString();
+    return address.c_str();
+  }
+
+protected:
+  FTPUploader *_uploader;
+  CardFs *_ptrSd;
+  String address;
+};
+#endif
+
+// Log output on the serial port. Boot phases are timed by the boot
+// profiler and bootReport is called once the player is ready.
+class Esp32System : public HalSystem {
+public:
+  Esp32System(BootProfiler *profiler, void (*bootReport)(void)) {
+    _profiler = profiler;
+    _bootReport = bootReport;
+  }
+
+  void print(const char *text) override {
+    Serial.print(text);
+  }
+
+  uint32_t trueRandom() override {
+    return esp_random();
+  }
+
+  void radioOff() override {
+    WiFi.mode(WIFI_OFF);
+  }
+
+  void bootPhase(const char *name) override {
+    _profiler->mark(name);
+  }
+
+  void bootDone() override {
+    _bootReport();
+  }
+
+  void restart() override {
+    ESP.restart();
+  }
+
+protected:
+  BootProfiler *_profiler;
+  void (*_bootReport)(void);
+};
+
+#endif
@@ -0,0 +1,793 @@
+/*
+   Linux Hardware Abstraction Layer
+
+   Implements the Hal.h interfaces for host builds:
+
+     LinuxTime           CLOCK_MONOTONIC since construction
+     VirtualTime         a clock that only moves when it is set
+     LinuxGpio           pin levels kept in memory
+     LinuxSpi            counts the bytes a driver would send
+     PosixFileSystem     a directory on the host stands in for the card
+     LinuxUdp            non-blocking UDP socket
+     WavAudioOut         writes the PCM to a .wav file
+     FramebufferDisplay  RGB565 framebuffer that can be saved as a PPM.
+                         Text is drawn as solid cells and kept as a list
+                         of strings so tests can check what is on screen.
+     QueueInput          button events pushed by the caller
+     SilentSongPlayer    "plays" a song for its length in silence
+     LinuxCard           a card that always starts and has no clock
+     LinuxRemote         remote access that connects at once
+     LinuxSystem         log output on stdout, restarts are counted
+
+   Last Update: 10/18/2026
+*/
+
+#ifndef HALLINUX_H
+#define HALLINUX_H
+
+#ifdef ARDUINO
+#error "HalLinux.h is for host builds"
+#endif
+
+#include <arpa/inet.h>
+#include <deque>
+#include <dirent.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <string>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+#include "Hal.h"
+#include "LibraryIndex.h"
+
+class LinuxTime : public HalTime {
+public:
+  LinuxTime() {
+    start = nowUs();
+  }
+
+  uint32_t millis() override {
+    return (uint32_t)((nowUs() - start) / 1000);
+  }
+
+  uint32_t micros() override {
+    return (uint32_t)(nowUs() - start);
+  }
+
+protected:
+  uint64_t start;
+
+  static uint64_t nowUs() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+  }
+};
+
+// Replays and benchmarks drive this clock themselves
+class VirtualTime : public HalTime {
+public:
+  uint64_t nowUs = 0;
+
+  void setMillis(uint32_t ms) {
+    nowUs = (uint64_t) ms * 1000;
+  }
+
+  void advanceMicros(uint32_t us) {
+    nowUs += us;
+  }
+
+  uint32_t millis() override {
+    return (uint32_t)(nowUs / 1000);
+  }
+
+  uint32_t micros() override {
+    return (uint32_t) nowUs;
+  }
+};
+
+#define LINUX_GPIO_PINS 64
+
+class LinuxGpio : public HalGpio {
+public:
+  LinuxGpio() {
+    memset(levels, 0, sizeof(levels));
+  }
+
+  void pinMode(uint8_t pin, enum HAL_PIN_MODE mode) override {
+    if (pin < LINUX_GPIO_PINS && mode == HPM_INPUT_PULLUP) {
+      levels[pin] = true;
+    }
+  }
+
+  void write(uint8_t pin, boolean high) override {
+    if (pin < LINUX_GPIO_PINS) {
+      levels[pin] = high;
+    }
+  }
+
+  boolean read(uint8_t pin) override {
+    return (pin < LINUX_GPIO_PINS) ? levels[pin] : false;
+  }
+
+protected:
+  boolean levels[LINUX_GPIO_PINS];
+};
+
+class LinuxSpi : public HalSpi {
+public:
+  uint64_t bytesSent = 0;
+  uint32_t transactions = 0;
+
+  void beginTransaction(uint32_t /* frequency */) override {
+    transactions++;
+  }
+
+  void endTransaction() override {
+  }
+
+  uint8_t transfer(uint8_t /* data */) override {
+    bytesSent++;
+    return 0xFF;
+  }
+
+  void write(const uint8_t * /* data */, size_t length) override {
+    bytesSent += length;
+  }
+};
+
+class PosixHalFile : public HalFile {
+public:
+  PosixHalFile(FILE *file) {
+    _file = file;
+  }
+
+  ~PosixHalFile() {
+    fclose(_file);
+  }
+
+  int read(void *buffer, size_t length) override {
+    size_t n = fread(buffer, 1, length, _file);
+    return (n == 0 && ferror(_file)) ? -1 : (int) n;
+  }
+
+  size_t write(const void *data, size_t length) override {
+    return fwrite(data, 1, length, _file);
+  }
+
+  void flush() override {
+    fflush(_file);
+  }
+
+  boolean seek(uint32_t position) override {
+    return fseek(_file, position, SEEK_SET) == 0;
+  }
+
+  uint32_t position() override {
+    return (uint32_t) ftell(_file);
+  }
+
+  uint32_t size() override {
+    struct stat st;
+    return (fstat(fileno(_file), &st) == 0) ? (uint32_t) st.st_size : 0;
+  }
+
+protected:
+  FILE *_file;
+};
+
+class PosixHalDir : public HalDir {
+public:
+  PosixHalDir(DIR *dir, const std::string &path) {
+    _dir = dir;
+    _path = path;
+  }
+
+  ~PosixHalDir() {
+    closedir(_dir);
+  }
+
+  boolean next(HAL_DIR_ENTRY *entry) override {
+    struct dirent *d;
+    while ((d = readdir(_dir)) != NULL) {
+      // The card has no . and .. entries outside of subdirectories
+      if (!strcmp(d->d_name, ".") || !strcmp(d->d_name, "..")) {
+        continue;
+      }
+      struct stat st;
+      std::string full = _path + "/" + d->d_name;
+      if (stat(full.c_str(), &st) != 0) {
+        continue;
+      }
+      strncpy(entry->name, d->d_name, sizeof(entry->name) - 1);
+      entry->name[sizeof(entry->name) - 1] = '\0';
+      entry->isDirectory = S_ISDIR(st.st_mode);
+      entry->size = (uint32_t) st.st_size;
+      if (wanted(entry)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+protected:
+  DIR *_dir;
+  std::string _path;
+};
+
+// Serves a host directory as the root of the card
+class PosixFileSystem : public HalFileSystem {
+public:
+  PosixFileSystem(const char *root) {
+    _root = root;
+    while (_root.size() > 1 && _root.back() == '/') {
+      _root.pop_back();
+    }
+  }
+
+  HalFile *open(const char *path, enum HAL_OPEN_MODE mode) override {
+    const char *fmode = (mode == HOM_READ) ? "rb" : (mode == HOM_WRITE) ? "wb" :
+                        (mode == HOM_UPDATE) ? "r+b" : "ab";
+    std::string full = hostPath(path);
+    struct stat st;
+    if (stat(full.c_str(), &st) == 0 && S_ISDIR(st.st_mode)) {
+      return NULL;
+    }
+    FILE *file = fopen(full.c_str(), fmode);
+    return (file != NULL) ? new PosixHalFile(file) : NULL;
+  }
+
+  HalDir *openDir(const char *path) override {
+    std::string full = hostPath(path);
+    DIR *dir = opendir(full.c_str());
+    return (dir != NULL) ? new PosixHalDir(dir, full) : NULL;
+  }
+
+  boolean exists(const char *path) override {
+    struct stat st;
+    return stat(hostPath(path).c_str(), &st) == 0;
+  }
+
+  boolean remove(const char *path) override {
+    return unlink(hostPath(path).c_str()) == 0;
+  }
+
+  boolean mkdir(const char *path) override {
+    return ::mkdir(hostPath(path).c_str(), 0755) == 0;
+  }
+
+  boolean rmdir(const char *path) override {
+    return ::rmdir(hostPath(path).c_str()) == 0;
+  }
+
+  boolean rename(const char *from, const char *to) override {
+    return ::rename(hostPath(from).c_str(), hostPath(to).c_str()) == 0;
+  }
+
+protected:
+  std::string _root;
+
+  std::string hostPath(const char *path) {
+    return _root + ((path[0] == '/') ? "" : "/") + path;
+  }
+};
+
+class LinuxUdp : public HalUdp {
+public:
+  LinuxUdp() {
+    sock = -1;
+  }
+
+  ~LinuxUdp() {
+    stop();
+  }
+
+  boolean isNetworkUp() override {
+    return true;
+  }
+
+  boolean begin(uint16_t port) override {
+    stop();
+    sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock < 0) {
+      return false;
+    }
+    fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK);
+
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (bind(sock, (sockaddr *) &addr, sizeof(addr)) != 0) {
+      stop();
+      return false;
+    }
+    return true;
+  }
+
+  void stop() override {
+    if (sock >= 0) {
+      close(sock);
+      sock = -1;
+    }
+  }
+
+  int receive(uint8_t *buffer, size_t size, HAL_ADDRESS *from) override {
+    if (sock < 0) {
+      return 0;
+    }
+    sockaddr_in addr;
+    socklen_t addrLength = sizeof(addr);
+    ssize_t n = recvfrom(sock, buffer, size, 0, (sockaddr *) &addr, &addrLength);
+    if (n <= 0) {
+      return 0;
+    }
+    from->ip = addr.sin_addr.s_addr;
+    from->port = ntohs(addr.sin_port);
+    return (int) n;
+  }
+
+  boolean send(const HAL_ADDRESS *to, const uint8_t *data, size_t length) override {
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(to->port);
+    addr.sin_addr.s_addr = to->ip;
+    return sendto(sock, data, length, 0, (sockaddr *) &addr, sizeof(addr)) == (ssize_t) length;
+  }
+
+protected:
+  int sock;
+};
+
+// Writes everything played to a 16 bit PCM .wav file
+class WavAudioOut : public HalAudioOut {
+public:
+  WavAudioOut(const char *path) {
+    _path = path;
+    file = NULL;
+    dataBytes = 0;
+  }
+
+  ~WavAudioOut() {
+    end();
+  }
+
+  boolean begin(uint32_t sampleRate, uint8_t channels) override {
+    end();
+    file = fopen(_path.c_str(), "wb");
+    if (file == NULL) {
+      return false;
+    }
+    _sampleRate = sampleRate;
+    _channels = channels;
+    dataBytes = 0;
+    writeHeader();
+    return true;
+  }
+
+  // Patch the sizes into the header and close the file
+  void end() override {
+    if (file != NULL) {
+      fseek(file, 0, SEEK_SET);
+      writeHeader();
+      fclose(file);
+      file = NULL;
+    }
+  }
+
+  boolean isConnected() override {
+    return file != NULL;
+  }
+
+  size_t availableForWrite() override {
+    return (file != NULL) ? 4096 : 0;
+  }
+
+  size_t write(const uint8_t *pcm, size_t length) override {
+    if (file == NULL) {
+      return 0;
+    }
+    size_t n = fwrite(pcm, 1, length, file);
+    dataBytes += n;
+    return n;
+  }
+
+  uint32_t getDataBytes() {
+    return dataBytes;
+  }
+
+protected:
+  std::string _path;
+  FILE *file;
+  uint32_t _sampleRate;
+  uint8_t _channels;
+  uint32_t dataBytes;
+
+  void put32(uint32_t v) {
+    uint8_t b[4] = { (uint8_t) v, (uint8_t)(v >> 8), (uint8_t)(v >> 16), (uint8_t)(v >> 24) };
+    fwrite(b, 1, 4, file);
+  }
+
+  void put16(uint16_t v) {
+    uint8_t b[2] = { (uint8_t) v, (uint8_t)(v >> 8) };
+    fwrite(b, 1, 2, file);
+  }
+
+  void writeHeader() {
+    fwrite("RIFF", 1, 4, file);
+    put32(36 + dataBytes);
+    fwrite("WAVEfmt ", 1, 8, file);
+    put32(16);
+    put16(1);                               // PCM
+    put16(_channels);
+    put32(_sampleRate);
+    put32(_sampleRate * _channels * 2);     // byte rate
+    put16(_channels * 2);                   // block align
+    put16(16);                              // bits per sample
+    fwrite("data", 1, 4, file);
+    put32(dataBytes);
+  }
+};
+
+// In memory RGB565 display
+class FramebufferDisplay : public HalDisplay {
+public:
+  // Strings drawn since the last clearText(), in drawing order
+  std::vector<std::string> text;
+  uint32_t flushes = 0;
+  boolean backlightOn = true;
+
+  FramebufferDisplay(int16_t w, int16_t h) : pixels(w * h, 0) {
+    _width = w;
+    _height = h;
+  }
+
+  using HalDisplay::drawText;
+
+  boolean initStep() override {
+    return true;
+  }
+
+  int16_t width() override {
+    return _width;
+  }
+
+  int16_t height() override {
+    return _height;
+  }
+
+  void fillRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color) override {
+    int16_t x2 = std::min<int>(x + w, _width);
+    int16_t y2 = std::min<int>(y + h, _height);
+    for (int16_t row = std::max<int16_t>(y, 0); row < y2; row++) {
+      for (int16_t col = std::max<int16_t>(x, 0); col < x2; col++) {
+        pixels[row * _width + col] = color;
+      }
+    }
+  }
+
+  // Square corners
+  void drawRoundRect(int16_t x, int16_t y, int16_t w, int16_t h, int16_t /* r */,
+                     uint16_t color) override {
+    fillRect(x, y, w, 1, color);
+    fillRect(x, y + h - 1, w, 1, color);
+    fillRect(x, y, 1, h, color);
+    fillRect(x + w - 1, y, 1, h, color);
+  }
+
+  // Each character is a solid 6x8 cell (scaled by size) in the
+  // foreground color with a one pixel background gap
+  void drawText(int16_t x, int16_t y, const char *str, uint8_t size,
+                uint16_t fg, uint16_t bg) override {
+    text.push_back(str);
+    for (const char *p = str; *p; p++) {
+      fillRect(x, y, 6 * size, 8 * size, bg);
+      if (*p != ' ') {
+        fillRect(x, y, 5 * size, 7 * size, fg);
+      }
+      x += 6 * size;
+    }
+  }
+
+  void backlight(boolean on) override {
+    backlightOn = on;
+  }
+
+  void flush() override {
+    flushes++;
+  }
+
+  void clearText() {
+    text.clear();
+  }
+
+  uint16_t getPixel(int16_t x, int16_t y) {
+    return pixels[y * _width + x];
+  }
+
+  // Save the framebuffer as a binary PPM image
+  boolean savePPM(const char *path) {
+    FILE *out = fopen(path, "wb");
+    if (out == NULL) {
+      return false;
+    }
+    fprintf(out, "P6\n%d %d\n255\n", _width, _height);
+    for (uint16_t c : pixels) {
+      uint8_t rgb[3] = { (uint8_t)((c >> 8) & 0xF8), (uint8_t)((c >> 3) & 0xFC), (uint8_t)((c << 3) & 0xF8) };
+      fwrite(rgb, 1, 3, out);
+    }
+    fclose(out);
+    return true;
+  }
+
+protected:
+  int16_t _width;
+  int16_t _height;
+  std::vector<uint16_t> pixels;
+};
+
+class QueueInput : public HalInput {
+public:
+  std::deque<enum BUTTON_STATE> events;
+  uint32_t buttonDraws = 0;
+
+  void push(enum BUTTON_STATE bs) {
+    events.push_back(bs);
+  }
+
+  enum BUTTON_STATE poll(boolean *queued) override {
+    *queued = false;
+    if (events.empty()) {
+      return BS_NONE;
+    }
+    enum BUTTON_STATE bs = events.front();
+    events.pop_front();
+    return bs;
+  }
+
+  void drawButtons() override {
+    buttonDraws++;
+  }
+};
+
+// Plays each song for as long as it lasts by time, with no decoder.
+// loop() writes the 44.1 kHz stereo PCM the player would have made, as
+// silence, to the audio sink. A song lasts its library index duration
+// when a track is set, else as long as it would at 128 kbit/s.
+class SilentSongPlayer : public HalSongPlayer {
+public:
+  SilentSongPlayer(HalTime *time, HalFileSystem *fs, HalAudioOut *audio) {
+    _time = time;
+    _fs = fs;
+    _audio = audio;
+  }
+
+  void begin() override {
+    if (!begun) {
+      begun = true;
+      _audio->begin(44100, 2);
+    }
+  }
+
+  boolean isConnected() override {
+    return begun;
+  }
+
+  boolean playSong(const char *path) override {
+    update();
+    lastSongBytes = songBytes;
+    songBytes = 0;
+    songNumber++;
+    track = NULL;
+    playedUs = 0;
+    size = 0;
+    HalFile *file = _fs->open(path, HOM_READ);
+    if (file != NULL) {
+      size = file->size();
+      delete file;
+    }
+    active = (file != NULL);
+    lastUs = _time->micros();
+    return active;
+  }
+
+  void setTrack(const struct LIBRARY_TRACK *_track) override {
+    track = ((_track != NULL) && (_track->size == size)) ? _track : NULL;
+  }
+
+  void stopSong() override {
+    update();
+    active = false;
+  }
+
+  void resume() override {
+    update();
+    active = size != 0;
+  }
+
+  void closeSong() override {
+    stopSong();
+    size = 0;
+    track = NULL;
+  }
+
+  boolean isActive() override {
+    update();
+    return active;
+  }
+
+  boolean skip(int percent) override {
+    update();
+    int64_t us = (int64_t) playedUs + (int64_t) durationUs() * percent / 100;
+    playedUs = (uint64_t) std::max<int64_t>(0, std::min<int64_t>(us, durationUs()));
+    return true;
+  }
+
+  void volumeUp() override {
+    volume = std::min(volume + 1, 10);
+  }
+
+  void volumeDown() override {
+    volume = std::max(volume - 1, 0);
+  }
+
+  uint32_t getPosition() override {
+    update();
+    if (track != NULL) {
+      return LibraryIndex::positionAt(track, playedUs / 1000);
+    }
+    return (uint32_t) std::min<uint64_t>(playedUs * 16 / 1000, size);
+  }
+
+  uint32_t getSize() override {
+    return size;
+  }
+
+  uint32_t getReadErrors() override {
+    return 0;
+  }
+
+  uint32_t getSongNumber() override {
+    return songNumber;
+  }
+
+  uint32_t getLastSongBytes() override {
+    return lastSongBytes;
+  }
+
+  // Catch up with the clock and write the silence owed
+  void loop() {
+    update();
+    static const uint8_t silence[1024] = { 0 };
+    while (owed > 0) {
+      size_t n = _audio->write(silence, std::min<uint64_t>(owed, sizeof(silence)));
+      if (n == 0) {
+        break;
+      }
+      owed -= n;
+    }
+  }
+
+  int getVolume() {
+    return volume;
+  }
+
+protected:
+  HalTime *_time;
+  HalFileSystem *_fs;
+  HalAudioOut *_audio;
+  boolean begun = false;
+  boolean active = false;
+  const LIBRARY_TRACK *track = NULL;
+  uint32_t size = 0;
+  uint64_t playedUs = 0;
+  uint32_t lastUs = 0;
+  uint32_t songNumber = 0;
+  uint32_t songBytes = 0;
+  uint32_t lastSongBytes = 0;
+  uint64_t owed = 0;
+  int volume = 5;
+
+  uint64_t durationUs() {
+    return (track != NULL) ? (uint64_t) track->durationMs * 1000 : (uint64_t) size * 1000 / 16;
+  }
+
+  // Move the song on by the time since the last call and end it at its
+  // end. PCM bytes are whole 4 byte frames.
+  void update() {
+    uint32_t now = _time->micros();
+    uint32_t us = now - lastUs;
+    lastUs = now;
+    if (!active) {
+      return;
+    }
+    us = (uint32_t) std::min<uint64_t>(us, durationUs() - playedUs);
+    uint32_t before = (uint32_t)(playedUs * 44100 / 1000000) * 4;
+    playedUs += us;
+    uint32_t bytes = (uint32_t)(playedUs * 44100 / 1000000) * 4 - before;
+    songBytes += bytes;
+    owed += bytes;
+    if (playedUs >= durationUs()) {
+      active = false;
+    }
+  }
+};
+
+class LinuxCard : public HalCard {
+public:
+  boolean begin() override {
+    return true;
+  }
+
+  // There's no SPI clock on a host
+  boolean stepDown() override {
+    return false;
+  }
+
+  uint8_t getMHz() override {
+    return 0;
+  }
+
+  boolean test(HAL_CARD_TEST *result) override {
+    memset(result, 0, sizeof(HAL_CARD_TEST));
+    return false;
+  }
+};
+
+class LinuxRemote : public HalRemote {
+public:
+  uint32_t connects = 0;
+
+  void startConnect() override {
+    connects++;
+  }
+
+  enum WIFI_CONNECT_STATUS pollConnect() override {
+    return WCS_CONNECTED;
+  }
+
+  const char *getAddress() override {
+    return "127.0.0.1";
+  }
+};
+
+class LinuxSystem : public HalSystem {
+public:
+  // Log output goes here, or nowhere if NULL
+  FILE *log = stdout;
+  uint32_t restarts = 0;
+
+  void print(const char *text) override {
+    if (log != NULL) {
+      fputs(text, log);
+    }
+  }
+
+  uint32_t trueRandom() override {
+    timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint32_t)(ts.tv_sec * 1000003 + ts.tv_nsec);
+  }
+
+  void radioOff() override {
+  }
+
+  void bootPhase(const char * /* name */) override {
+  }
+
+  void bootDone() override {
+  }
+
+  void restart() override {
+    restarts++;
+  }
+};
+
+#endif
@@ -14,6 +14,8 @@
 #include "SPI.h"
 #include "Adafruit_GFX.h"
 
+#include "Trace.h"
+
 #define ILI9341_WIDTH      240
 #define ILI9341_HEIGHT     320
 
@@ -36,6 +38,9 @@
 #define ILI9341_MADCTL_BGR 0x08
 #define ILI9341_MADCTL_MH  0x04
 
+// Pin value meaning "not connected" (-1 as a byte)
+#define ILI9341_NO_PIN     0xFF
+
 #define ILI9341_DEFAULT_FREQ  20000000
 #define ILI9341_MAX_PIXELS_AT_ONCE  32
 
@@ -98,6 +103,16 @@ const rotation_data_t ILI9341_ROTATIONS[4] = {
 #define ILI9341_GREENYELLOW 0xAFE5 /* 173, 255,  47 */
 #define ILI9341_PINK        0xF81F
 
+// Initialization steps
+enum LCD_INIT_STEP {
+  LI_RESET_HIGH,
+  LI_RESET_LOW,
+  LI_RESET_DONE,
+  LI_SLEEP_OUT,
+  LI_DISPLAY_ON,
+  LI_DONE
+};
+
 class ILI9341 : public Adafruit_GFX {
 
   public:
@@ -114,9 +129,22 @@ class ILI9341 : public Adafruit_GFX {
       _width  = ILI9341_WIDTH;
       _height = ILI9341_HEIGHT;
       _freq   = ILI9341_DEFAULT_FREQ;
+
+      _initStep = LI_RESET_HIGH;
     }
 
+    // Blocking initialization
     void begin(SPIClass *h_SPI) {
+      beginAsync(h_SPI);
+      while (!initStep()) {
+        yield();
+      }
+    }
+
+    // Start a non-blocking initialization. Call initStep() until it
+    // returns true. The reset and wake up waits are timed rather than
+    // delayed so other startup work can run while the panel wakes up.
+    void beginAsync(SPIClass *h_SPI) {
       // Save incoming
       _h_SPI = h_SPI;
 
@@ -127,22 +155,65 @@ class ILI9341 : public Adafruit_GFX {
       pinMode(_BL, OUTPUT);
       digitalWrite(_BL, BL_OFF);
 
-      pinMode(_RST, OUTPUT);
-      digitalWrite(_RST, HIGH);
-      delay(100);
-      digitalWrite(_RST, LOW);
-      delay(100);
-      digitalWrite(_RST, HIGH);
-      delay(200);
+      _stepAtMs = millis();
 
-      startWrite();
-      writeInitData(ILI9341_INIT_DATA);
-      writeCommand(ILI9341_SLPOUT);
-      delay(120);
-      writeCommand(ILI9341_DISPON);
-      delay(120);
-      endWrite();
-      digitalWrite(_BL, BL_ON);
+      // Skip the reset pulse if the reset pin isn't connected
+      if (_RST != ILI9341_NO_PIN) {
+        pinMode(_RST, OUTPUT);
+        digitalWrite(_RST, HIGH);
+        _stepAtMs += 100;
+        _initStep = LI_RESET_HIGH;
+      } else {
+        _initStep = LI_RESET_DONE;
+      }
+    }
+
+    // Advance the initialization when its current wait is over
+    // Returns true once the display is ready
+    boolean initStep() {
+
+      if (_initStep == LI_DONE) {
+        return true;
+      }
+      if ((int32_t)(millis() - _stepAtMs) < 0) {
+        return false;
+      }
+
+      switch (_initStep) {
+        case LI_RESET_HIGH:
+          digitalWrite(_RST, LOW);
+          nextInitStep(LI_RESET_LOW, 100);
+          break;
+
+        case LI_RESET_LOW:
+          digitalWrite(_RST, HIGH);
+          nextInitStep(LI_RESET_DONE, 200);
+          break;
+
+        case LI_RESET_DONE:
+          startWrite();
+          writeInitData(ILI9341_INIT_DATA);
+          writeCommand(ILI9341_SLPOUT);
+          endWrite();
+          nextInitStep(LI_SLEEP_OUT, 120);
+          break;
+
+        case LI_SLEEP_OUT:
+          startWrite();
+          writeCommand(ILI9341_DISPON);
+          endWrite();
+          nextInitStep(LI_DISPLAY_ON, 120);
+          break;
+
+        case LI_DISPLAY_ON:
+          digitalWrite(_BL, BL_ON);
+          _initStep = LI_DONE;
+          return true;
+
+        default:
+          break;
+      }
+      return false;
     }
 
     // Control the backlight state
@@ -208,9 +279,17 @@ class ILI9341 : public Adafruit_GFX {
     }
 
     void fillRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color) {
+      // Only trace large fills. Text draws many tiny ones.
+      uint32_t pixels = (uint32_t) w * h;
+      if (pixels >= 256) {
+        TRACE_BEGIN(TE_LCD_FILL, pixels >> 8);
+      }
       startWrite();
       writeFillRect(x, y, w, h, color);
       endWrite();
+      if (pixels >= 256) {
+        TRACE_END(TE_LCD_FILL, pixels >> 8);
+      }
     }
 
     void clearScreen() {
@@ -316,7 +395,16 @@ class ILI9341 : public Adafruit_GFX {
     byte      _size;
     uint32_t  _freq;
 
+    // Non-blocking initialization state
+    enum LCD_INIT_STEP _initStep;
+    uint32_t  _stepAtMs;
+
     // Private functions
+    void nextInitStep(enum LCD_INIT_STEP step, uint32_t waitMs) {
+      _initStep = step;
+      _stepAtMs = millis() + waitMs;
+    }
+
     void writeInitData(const uint8_t * data) {
       uint8_t cmd, len, i;
       while (true) {
@@ -0,0 +1,451 @@
+/*
+   Library Index
+
+   An index of every song on the card made on a host by
+   tools/libprep.cpp, which reads the tags and walks the MP3 frames of
+   each song far faster than the player could. It's kept in
+   LIBRARY_INDEX_PATH, a folder the library doesn't list.
+
+   File layout, little endian:
+
+     magic "CYDL", version, track count   (uint32 each)
+     offset of each track's record         (uint32 each, in path order)
+     records
+
+   Record:
+
+     record length                         uint16
+     path                                  string
+     size, mtime, duration ms, first frame uint32 each
+     average kbps, sample rate, year       uint16 each
+     track number, flags                   uint8 each
+     seek seconds, seek count              uint8 each
+     seek table                            uint32 each
+     title, artist, album, genre, sort key string each
+
+   Strings are a uint8 length and that many UTF-8 bytes, at most
+   HAL_NAME_SIZE - 1 but for the path. Entry i of the seek table is the
+   position of the frame playing at i * seek seconds, so seeking a VBR
+   song by time lands where it should. The sort key is the folded artist, album,
+   track number and title for ordering songs by their tags.
+
+   Paths are sorted by byte so find() is a binary search reading one
+   path per step. findNear() tries the songs just past a hint first,
+   for songs looked up in index order as a playlist's albums often
+   are, and cacheTop() keeps the paths every search reads first for a
+   batch of lookups. The host tool decodes records with the same code to
+   reuse those of unchanged songs.
+
+   Last Update: 10/18/2026
+*/
+
+#ifndef LIBRARYINDEX_H
+#define LIBRARYINDEX_H
+
+#include <string>
+#include <vector>
+
+#include "Hal.h"
+
+#define LIBRARY_INDEX_PATH "/.library/index.bin"
+#define LIBRARY_INDEX_MAGIC 0x4C445943  // "CYDL"
+#define LIBRARY_INDEX_VERSION 1
+#define LIBRARY_INDEX_HEADER 12
+
+// Songs past its hint findNear() compares before searching
+#define LIBRARY_NEAR_STEPS 2
+
+// Seek table entries at most, and their spacing in seconds at least
+#define LIBRARY_SEEK_MAX 255
+#define LIBRARY_SEEK_SECONDS 10
+
+// Track flags
+#define LTF_VBR 0x01  // frames of more than one bit rate
+
+typedef struct LIBRARY_TRACK {
+  uint32_t size;        // bytes
+  uint32_t mtime;       // host modification time
+  uint32_t durationMs;
+  uint32_t audioStart;  // first MP3 frame
+  uint16_t kbps;        // average
+  uint16_t sampleRate;
+  uint16_t year;        // 0 if not tagged
+  uint8_t track;        // 0 if not tagged
+  uint8_t flags;
+  uint8_t seekSeconds;
+  uint8_t seekCount;
+  uint32_t seek[LIBRARY_SEEK_MAX];
+  char title[HAL_NAME_SIZE];
+  char artist[HAL_NAME_SIZE];
+  char album[HAL_NAME_SIZE];
+  char genre[HAL_NAME_SIZE];
+  char sortKey[HAL_NAME_SIZE];
+} LIBRARY_TRACK;
+
+class LibraryIndex {
+
+public:
+
+  LibraryIndex() {
+    file = NULL;
+    count = 0;
+  }
+
+  ~LibraryIndex() {
+    close();
+  }
+
+  // Returns false if there's no index or it isn't this version
+  boolean open(HalFileSystem *fs, const char *path = LIBRARY_INDEX_PATH) {
+
+    close();
+    file = fs->open(path, HOM_READ);
+    if (file == NULL) {
+      return false;
+    }
+    uint8_t header[LIBRARY_INDEX_HEADER];
+    if ((file->read(header, sizeof(header)) != sizeof(header)) ||
+        (get32(header) != LIBRARY_INDEX_MAGIC) || (get32(header + 4) != LIBRARY_INDEX_VERSION) ||
+        (file->size() < LIBRARY_INDEX_HEADER + 4 * get32(header + 8))) {
+      close();
+      return false;
+    }
+    count = get32(header + 8);
+    return true;
+  }
+
+  void close() {
+    if (file != NULL) {
+      delete file;
+      file = NULL;
+    }
+    count = 0;
+    cacheTop(0);
+  }
+
+  boolean isOpen() {
+    return file != NULL;
+  }
+
+  uint32_t getCount() {
+    return count;
+  }
+
+  // Bytes in the index file, which changes with nearly every rebuild
+  uint32_t getSize() {
+    return (file != NULL) ? file->size() : 0;
+  }
+
+  // Look up the song at path, and its track number if number isn't
+  // NULL. Returns false if it isn't in the index.
+  boolean find(const char *path, LIBRARY_TRACK *track, uint32_t *number = NULL) {
+
+    uint32_t found;
+    if (!search(path, 0, count, &found)) {
+      return false;
+    }
+    if (number != NULL) {
+      *number = found;
+    }
+    uint32_t offset;
+    return readOffset(found, &offset) && readTrack(offset, track);
+  }
+
+  // Track number of the song at path, comparing it with the songs at
+  // hint and a few past it first. Songs found one after another in
+  // index order take a read or two. Returns false if it isn't in the
+  // index.
+  boolean findNear(const char *path, uint32_t hint, uint32_t *number) {
+
+    if (count == 0) {
+      return false;
+    }
+    hint = min(hint, count - 1);
+    uint32_t low = 0;
+    uint32_t high = count;
+    for (uint32_t step = 0; step <= LIBRARY_NEAR_STEPS; step = max(2 * step, (uint32_t) 1)) {
+      uint32_t probe = hint + step;
+      if ((probe < low) || (probe >= high)) {
+        break;
+      }
+      int c;
+      if (!compareAt(probe, path, &c)) {
+        return false;
+      }
+      if (c == 0) {
+        *number = probe;
+        return true;
+      }
+      if (c < 0) {
+        high = probe;
+        break;
+      }
+      low = probe + 1;
+    }
+    return search(path, low, high, number);
+  }
+
+  // Keep the paths the first levels of a binary search read in memory,
+  // as every lookup of a batch reads them. 0 levels frees them.
+  void cacheTop(int levels) {
+    top.clear();
+    top.resize((1 << levels) - 1);
+    topLoaded.assign(top.size(), false);
+  }
+
+  // Path of track i, its place in the index, into a 256 byte buffer
+  boolean getPath(uint32_t i, char *path) {
+    uint32_t offset;
+    return (i < count) && readPath(i, &offset, path);
+  }
+
+  // Path and record of track i without searching for it
+  boolean getTrack(uint32_t i, char *path, LIBRARY_TRACK *track) {
+    uint32_t offset;
+    return (i < count) && readPath(i, &offset, path) && readTrack(offset, track);
+  }
+
+  // Song time in ms at a byte position
+  static uint32_t timeAt(const LIBRARY_TRACK *track, uint32_t position) {
+
+    uint32_t ms0 = 0, ms1 = track->durationMs;
+    uint32_t p0 = track->audioStart, p1 = track->size;
+    for (int i = 0; i < track->seekCount; i++) {
+      if (track->seek[i] > position) {
+        ms1 = i * track->seekSeconds * 1000;
+        p1 = track->seek[i];
+        break;
+      }
+      ms0 = i * track->seekSeconds * 1000;
+      p0 = track->seek[i];
+    }
+    if ((position <= p0) || (p1 <= p0)) {
+      return ms0;
+    }
+    return ms0 + (uint64_t)(min(position, p1) - p0) * (ms1 - ms0) / (p1 - p0);
+  }
+
+  // Byte position of the frame playing at ms, interpolated between
+  // seek table entries
+  static uint32_t positionAt(const LIBRARY_TRACK *track, uint32_t ms) {
+
+    if ((track->seekCount == 0) || (track->seekSeconds == 0)) {
+      return track->audioStart;
+    }
+    uint32_t step = track->seekSeconds * 1000;
+    uint32_t i = ms / step;
+    if (i >= track->seekCount) {
+      i = track->seekCount - 1;
+    }
+    uint32_t ms0 = i * step;
+    uint32_t p0 = track->seek[i];
+    uint32_t ms1 = (i + 1 < track->seekCount) ? ms0 + step : track->durationMs;
+    uint32_t p1 = (i + 1 < track->seekCount) ? track->seek[i + 1] : track->size;
+    if ((ms <= ms0) || (ms1 <= ms0) || (p1 <= p0)) {
+      return p0;
+    }
+    return p0 + (uint64_t)(min(ms, ms1) - ms0) * (p1 - p0) / (ms1 - ms0);
+  }
+
+  // Append the record of the song at path to out
+  static void encode(const char *path, const LIBRARY_TRACK *track, std::vector<uint8_t> &out) {
+
+    size_t start = out.size();
+    put16(out, 0);
+    putString(out, path, 255);
+    put32(out, track->size);
+    put32(out, track->mtime);
+    put32(out, track->durationMs);
+    put32(out, track->audioStart);
+    put16(out, track->kbps);
+    put16(out, track->sampleRate);
+    put16(out, track->year);
+    out.push_back(track->track);
+    out.push_back(track->flags);
+    out.push_back(track->seekSeconds);
+    out.push_back(track->seekCount);
+    for (int i = 0; i < track->seekCount; i++) {
+      put32(out, track->seek[i]);
+    }
+    putString(out, track->title);
+    putString(out, track->artist);
+    putString(out, track->album);
+    putString(out, track->genre);
+    putString(out, track->sortKey);
+
+    size_t length = out.size() - start;
+    out[start] = length;
+    out[start + 1] = length >> 8;
+  }
+
+  // Read a record of length bytes into path (256 bytes) and track.
+  // Returns false if it's cut short.
+  static boolean decode(const uint8_t *p, size_t length, char *path, LIBRARY_TRACK *track) {
+
+    const uint8_t *end = p + length;
+    p += 2;
+    if (!getString(p, end, path, 256) || (end - p < 26)) {
+      return false;
+    }
+    track->size = get32(p);
+    track->mtime = get32(p + 4);
+    track->durationMs = get32(p + 8);
+    track->audioStart = get32(p + 12);
+    track->kbps = get16(p + 16);
+    track->sampleRate = get16(p + 18);
+    track->year = get16(p + 20);
+    track->track = p[22];
+    track->flags = p[23];
+    track->seekSeconds = p[24];
+    track->seekCount = p[25];
+    p += 26;
+    if (end - p < 4 * track->seekCount) {
+      return false;
+    }
+    for (int i = 0; i < track->seekCount; i++, p += 4) {
+      track->seek[i] = get32(p);
+    }
+    return getString(p, end, track->title, sizeof(track->title)) &&
+           getString(p, end, track->artist, sizeof(track->artist)) &&
+           getString(p, end, track->album, sizeof(track->album)) &&
+           getString(p, end, track->genre, sizeof(track->genre)) &&
+           getString(p, end, track->sortKey, sizeof(track->sortKey));
+  }
+
+protected:
+  HalFile *file;
+  uint32_t count;
+
+  // Paths of the first levels of the binary search, see cacheTop()
+  std::vector<std::string> top;
+  std::vector<bool> topLoaded;
+
+  // Binary search of the whole index for path, known to be in
+  // low..high - 1 if anywhere, so steps outside that read nothing. It
+  // always takes the same steps for a path, so the paths of its first
+  // levels can be kept.
+  boolean search(const char *path, uint32_t low, uint32_t high, uint32_t *number) {
+
+    uint32_t l = 0;
+    uint32_t h = count;
+    size_t node = 0;
+    while ((l < h) && (low < high)) {
+      uint32_t mid = l + (h - l) / 2;
+      int c;
+      if (mid < low) {
+        c = 1;
+      } else if (mid >= high) {
+        c = -1;
+      } else if (node < top.size()) {
+        if (!topLoaded[node]) {
+          uint32_t offset;
+          char name[256];
+          if (!readPath(mid, &offset, name)) {
+            return false;
+          }
+          top[node] = name;
+          topLoaded[node] = true;
+        }
+        c = strcmp(path, top[node].c_str());
+      } else if (!compareAt(mid, path, &c)) {
+        return false;
+      }
+      if (c == 0) {
+        *number = mid;
+        return true;
+      }
+      if (c < 0) {
+        h = mid;
+        node = 2 * node + 1;
+      } else {
+        l = mid + 1;
+        node = 2 * node + 2;
+      }
+    }
+    return false;
+  }
+
+  // Path of track i, a 256 byte buffer, and where its record is
+  boolean readPath(uint32_t i, uint32_t *offset, char *name) {
+
+    uint8_t b[1];
+    if (!readOffset(i, offset) || !file->seek(*offset + 2) || (file->read(b, 1) != 1) ||
+        (file->read(name, b[0]) != b[0])) {
+      return false;
+    }
+    name[b[0]] = '\0';
+    return true;
+  }
+
+  // Where track i's record is
+  boolean readOffset(uint32_t i, uint32_t *offset) {
+    uint8_t b[4];
+    if (!file->seek(LIBRARY_INDEX_HEADER + 4 * i) || (file->read(b, 4) != 4)) {
+      return false;
+    }
+    *offset = get32(b);
+    return true;
+  }
+
+  // Compare path with the path of track i as strcmp() does
+  boolean compareAt(uint32_t i, const char *path, int *c) {
+    uint32_t offset;
+    char name[256];
+    if (!readPath(i, &offset, name)) {
+      return false;
+    }
+    *c = strcmp(path, name);
+    return true;
+  }
+
+  boolean readTrack(uint32_t offset, LIBRARY_TRACK *track) {
+
+    uint8_t b[2];
+    if (!file->seek(offset) || (file->read(b, 2) != 2)) {
+      return false;
+    }
+    std::vector<uint8_t> record(get16(b));
+    if ((record.size() < 2) || !file->seek(offset) ||
+        (file->read(record.data(), record.size()) != (int) record.size())) {
+      return false;
+    }
+    char path[256];
+    return decode(record.data(), record.size(), path, track);
+  }
+
+  static uint16_t get16(const uint8_t *p) {
+    return p[0] | (p[1] << 8);
+  }
+
+  static uint32_t get32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+  }
+
+  static void put16(std::vector<uint8_t> &out, uint16_t v) {
+    out.push_back(v);
+    out.push_back(v >> 8);
+  }
+
+  static void put32(std::vector<uint8_t> &out, uint32_t v) {
+    put16(out, v);
+    put16(out, v >> 16);
+  }
+
+  static void putString(std::vector<uint8_t> &out, const char *s, size_t most = HAL_NAME_SIZE - 1) {
+    size_t length = min(strlen(s), most);
+    out.push_back(length);
+    out.insert(out.end(), s, s + length);
+  }
+
+  static boolean getString(const uint8_t *&p, const uint8_t *end, char *s, size_t size) {
+    if ((p >= end) || (p[0] >= size) || (end - p - 1 < p[0])) {
+      return false;
+    }
+    memcpy(s, p + 1, p[0]);
+    s[p[0]] = '\0';
+    p += 1 + p[0];
+    return true;
+  }
+};
+
+#endif
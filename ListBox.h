@@ -8,19 +8,27 @@
 #ifndef LISTBOX_H
 #define LISTBOX_H
 
+#include <string.h>
 #include <string>
 #include <vector>
 
+#include "FrontCodedList.h"
+#include "Hal.h"
+
 // Storage for operation data
 std::vector<std::string> operations;
 
-// Storage for the music data
-std::vector<std::string> artists;
-std::vector<std::string> albums;
-std::vector<std::string> songs;
+// Storage for the music data, sorted and front coded
+FrontCodedList artists;
+FrontCodedList albums;
+FrontCodedList songs;
+
+// Storage for the groups of a browse index and the songs of one group
+FrontCodedList browseGroups;
+FrontCodedList browseEntries;
 
 // Data source identifer for List Box
-enum DATA_SOURCE {OPERATION_DS, ARTIST_DS, ALBUM_DS, SONG_DS};
+enum DATA_SOURCE {OPERATION_DS, ARTIST_DS, ALBUM_DS, SONG_DS, BROWSE_GROUP_DS, BROWSE_ENTRY_DS};
 
 #define MAX_LINE_LENGTH    40
 #define MAX_TITLE_LENGTH   18
@@ -114,10 +122,21 @@ class ListBox {
         case SONG_DS:
           dataSourceCount = songs.size();
           break;
+        case BROWSE_GROUP_DS:
+          dataSourceCount = browseGroups.size();
+          break;
+        case BROWSE_ENTRY_DS:
+          dataSourceCount = browseEntries.size();
+          break;
       }
       // Serial.printf("C: %d\n", dataSourceCount);
     }
 
+    // Where the listbox is getting its backing data
+    enum DATA_SOURCE getDataSource() {
+      return dataSourceID;
+    }
+
     // Get a count of the listbox entries
     int getListBoxCount() {
       return dataSourceCount;
@@ -146,6 +165,11 @@ class ListBox {
       pState->savedWindowIndex = windowIndex;
     }
 
+    // Discard all saved listbox contexts
+    void clearStack() {
+      stackIndex = 0;
+    }
+
     // Restore the current listbox context from the stack
     void pop() {
 
@@ -188,8 +212,24 @@ class ListBox {
       return centerFlag;
     }
 
+    // Hash of everything the listbox shows. The same screens hash the
+    // same on every build so replays can check them.
+    uint32_t getScreenHash() {
+
+      uint32_t hash = halHash(HAL_HASH_SEED, title);
+      int32_t layout[5] = { dataSourceID, selectIndex, windowIndex, centerFlag,
+                            min(dataSourceCount, numberOfLines) };
+      hash = halHash(hash, layout, sizeof(layout));
+      for (int i = 0; i < layout[4]; i++) {
+        hash = halHash(hash, getEntry(i + windowIndex, false));
+      }
+      return hash;
+    }
+
+    // The selection is passed as its line in the window so lists of up
+    // to 65535 entries fit
     void doRepaint() {
-      repaint(selectIndex << 16 | windowIndex << 8 | min(dataSourceCount, numberOfLines));
+      repaint((selectIndex - windowIndex) << 24 | windowIndex << 8 | min(dataSourceCount, numberOfLines));
     }
 
     void selectionUp(boolean repaint) {
@@ -251,7 +291,7 @@ class ListBox {
       boolean done = false;
       while (! done) {
         // Random count of steps to scroll down in list box
-        int steps = random(dataSourceCount);
+        int steps = halRandom(dataSourceCount);
         for (int i = 0; i < steps; i++) {
           selectionDown(false);
         }
@@ -285,11 +325,15 @@ class ListBox {
         case OPERATION_DS:
           return operations.at(selectIndex).c_str();
         case ARTIST_DS:
-          return artists.at(selectIndex).c_str();
+          return artists.get(selectIndex);
         case ALBUM_DS:
-          return albums.at(selectIndex).c_str();
+          return albums.get(selectIndex);
         case SONG_DS:
-          return songs.at(selectIndex).c_str();
+          return songs.get(selectIndex);
+        case BROWSE_GROUP_DS:
+          return browseGroups.get(selectIndex);
+        case BROWSE_ENTRY_DS:
+          return browseEntries.get(selectIndex);
       }
       return "";
     }
@@ -302,20 +346,26 @@ class ListBox {
     // Retrieve a pointer to the string in the listbox with specified index
     char *getEntry(int index, boolean clip) {
 
-      char *str;
+      char *str = (char *) "";
       
       switch (dataSourceID) {
         case OPERATION_DS:
           str = (char *) operations.at(index).c_str();
           break;
         case ARTIST_DS:
-          str = (char *) artists.at(index).c_str();
+          str = (char *) artists.get(index);
           break;
         case ALBUM_DS:
-          str = (char *) albums.at(index).c_str();
+          str = (char *) albums.get(index);
           break;
         case SONG_DS:
-          str = (char *) songs.at(index).c_str();
+          str = (char *) songs.get(index);
+          break;
+        case BROWSE_GROUP_DS:
+          str = (char *) browseGroups.get(index);
+          break;
+        case BROWSE_ENTRY_DS:
+          str = (char *) browseEntries.get(index);
           break;
       }
 
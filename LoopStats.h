@@ -0,0 +1,205 @@
+/*
+   Per-State Loop Latency Histograms
+
+   Records how long each loop() pass took, keyed by the FSM state that
+   was current when the pass started. Each state gets a histogram with
+   power of two microsecond buckets:
+
+     bucket 0      0 us
+     bucket n      2^(n-1) .. 2^n - 1 us
+     last bucket   everything longer
+
+   so p50/p99 are reported as the upper edge of the bucket they fall in
+   (never more than the exact max, which is kept separately).
+
+   The loop is the only writer. Counters are relaxed atomics so the
+   serial dump or screen overlay can read them at any time without
+   locks. A reading taken mid update may be one sample behind.
+
+   Only standard headers are used so the histogram can be exercised on
+   a host.
+
+   Last Update: 10/18/2026
+*/
+
+#ifndef LOOPSTATS_H
+#define LOOPSTATS_H
+
+#include <atomic>
+#include <stdint.h>
+
+// 24 buckets cover up to 2^23 us (about 8 seconds)
+#define LATENCY_BUCKETS 24
+
+class LatencyHistogram {
+
+public:
+
+  LatencyHistogram() {
+    reset();
+  }
+
+  void reset() {
+    for (int i = 0; i < LATENCY_BUCKETS; i++) {
+      buckets[i].store(0, std::memory_order_relaxed);
+    }
+    count.store(0, std::memory_order_relaxed);
+    maxUs.store(0, std::memory_order_relaxed);
+  }
+
+  // Add a sample. Single writer only.
+  void record(uint32_t us) {
+
+    int bucket = bucketOf(us);
+    buckets[bucket].store(buckets[bucket].load(std::memory_order_relaxed) + 1,
+                          std::memory_order_relaxed);
+    if (us > maxUs.load(std::memory_order_relaxed)) {
+      maxUs.store(us, std::memory_order_relaxed);
+    }
+    count.store(count.load(std::memory_order_relaxed) + 1,
+                std::memory_order_release);
+  }
+
+  uint32_t getCount() const {
+    return count.load(std::memory_order_acquire);
+  }
+
+  uint32_t getMax() const {
+    return maxUs.load(std::memory_order_relaxed);
+  }
+
+  uint32_t getBucket(int bucket) const {
+    return buckets[bucket].load(std::memory_order_relaxed);
+  }
+
+  // Latency below which permille/1000 of the samples fall
+  uint32_t percentile(uint32_t permille) const {
+
+    uint32_t total = 0;
+    for (int i = 0; i < LATENCY_BUCKETS; i++) {
+      total += getBucket(i);
+    }
+    if (total == 0) {
+      return 0;
+    }
+
+    // Rank of the sample we want, 1 based and rounded up
+    uint32_t rank = (uint32_t)(((uint64_t) total * permille + 999) / 1000);
+    if (rank == 0) {
+      rank = 1;
+    }
+
+    uint32_t seen = 0;
+    for (int i = 0; i < LATENCY_BUCKETS; i++) {
+      seen += getBucket(i);
+      if (seen >= rank) {
+        uint32_t upper = bucketUpper(i);
+        uint32_t largest = getMax();
+        return (upper < largest) ? upper : largest;
+      }
+    }
+    return getMax();
+  }
+
+  // Bucket index for a latency
+  static int bucketOf(uint32_t us) {
+
+    int bucket = 0;
+    while (us != 0 && bucket < LATENCY_BUCKETS - 1) {
+      us >>= 1;
+      bucket++;
+    }
+    return bucket;
+  }
+
+  // Largest latency that lands in a bucket
+  static uint32_t bucketUpper(int bucket) {
+
+    if (bucket >= LATENCY_BUCKETS - 1) {
+      return UINT32_MAX;
+    }
+    return (bucket == 0) ? 0 : (((uint32_t) 1 << bucket) - 1);
+  }
+
+protected:
+
+  std::atomic<uint32_t> buckets[LATENCY_BUCKETS];
+  std::atomic<uint32_t> count;
+  std::atomic<uint32_t> maxUs;
+};
+
+template<int NUM_STATES> class LoopStats {
+
+public:
+
+  LoopStats() {
+    reset();
+  }
+
+  void reset() {
+    for (int i = 0; i < NUM_STATES; i++) {
+      histograms[i].reset();
+    }
+    worstState.store(-1, std::memory_order_relaxed);
+    worstUs.store(0, std::memory_order_relaxed);
+  }
+
+  // Record one loop pass that started in state
+  void record(int state, uint32_t us) {
+
+    if (state < 0 || state >= NUM_STATES) {
+      return;
+    }
+    histograms[state].record(us);
+
+    // Worst single pass seen in any state
+    if (us > worstUs.load(std::memory_order_relaxed)) {
+      worstUs.store(us, std::memory_order_relaxed);
+      worstState.store(state, std::memory_order_relaxed);
+    }
+  }
+
+  const LatencyHistogram &get(int state) const {
+    return histograms[state];
+  }
+
+  // State with the longest single pass, -1 if nothing recorded
+  int getWorstState() const {
+    return worstState.load(std::memory_order_relaxed);
+  }
+
+  uint32_t getWorstUs() const {
+    return worstUs.load(std::memory_order_relaxed);
+  }
+
+#ifdef ARDUINO
+  // Print a table of every state that has run
+  void printTable(Print *out, const char *(*stateName)(int state)) {
+
+    out->printf("%-22s %9s %8s %8s %8s\n", "state", "passes", "p50 us", "p99 us", "max us");
+    for (int i = 0; i < NUM_STATES; i++) {
+      const LatencyHistogram &h = histograms[i];
+      if (h.getCount() == 0) {
+        continue;
+      }
+      out->printf("%-22s %9lu %8lu %8lu %8lu\n", stateName(i),
+                  (unsigned long) h.getCount(),
+                  (unsigned long) h.percentile(500),
+                  (unsigned long) h.percentile(990),
+                  (unsigned long) h.getMax());
+    }
+    int worst = getWorstState();
+    if (worst >= 0) {
+      out->printf("Worst pass: %lu us in %s\n", (unsigned long) getWorstUs(), stateName(worst));
+    }
+  }
+#endif
+
+protected:
+
+  LatencyHistogram histograms[NUM_STATES];
+  std::atomic<int> worstState;
+  std::atomic<uint32_t> worstUs;
+};
+
+#endif
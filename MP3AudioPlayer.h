@@ -11,8 +11,27 @@
 #include "AudioTools/Disk/AudioSource.h"
 #include "AudioToolsConfig.h"
 
+#include "Trace.h"
+
 namespace audio_tools {
 
+/**
+ * @brief VolumeStream which traces each decoded frame written toward A2DP
+ * and counts the PCM bytes written
+ */
+class TracedVolumeStream : public VolumeStream {
+public:
+  size_t write(const uint8_t *data, size_t len) override {
+    TRACE_BEGIN(TE_A2DP_WRITE, (uint16_t) len);
+    size_t result = VolumeStream::write(data, len);
+    TRACE_END(TE_A2DP_WRITE, (uint16_t) result);
+    bytes_written += result;
+    return result;
+  }
+
+  uint32_t bytes_written = 0;
+};
+
 /**
  * @brief Implements a simple mp3 audio player which supports the following
  * commands:
@@ -109,6 +128,7 @@ public:
   bool playMP3(const char *path) {
 
     writeEnd();
+    volume_out.bytes_written = 0;
 
     if (!setStream(p_source->selectStream(path))) {
       LOGW("Could not open file: %s", path);
@@ -135,6 +155,11 @@ public:
     return result;
   }
 
+  /// PCM bytes decoded since the last playMP3()
+  uint32_t getBytesDecoded() {
+    return volume_out.bytes_written;
+  }
+
   /// start selected input stream
   bool setStream(Stream *input) {
     end();
@@ -186,12 +211,13 @@ public:
     if (active) {
 
       if (delay_if_full != 0 && ((p_final_print != nullptr && p_final_print->availableForWrite() == 0) || (p_final_stream != nullptr && p_final_stream->availableForWrite() == 0))) {
-        // not ready to do anything - so we wait a bit
-        delay(delay_if_full);
+        // not ready to do anything - return so the other tasks can run
         return 0;
       }
       // handle sound
+      TRACE_BEGIN(TE_DECODE, (uint16_t) bytes);
       result = copier.copyBytes(bytes);
+      TRACE_END(TE_DECODE, (uint16_t) result);
       if (result > 0 || timeout == 0) {
 
         // reset timeout if we had any data
@@ -238,7 +264,7 @@ protected:
   bool active = false;
   bool silence_on_inactive = false;
   AudioSource *p_source = nullptr;
-  VolumeStream volume_out;          // Volume control
+  TracedVolumeStream volume_out;    // Volume control
   EncodedAudioOutput out_decoding;  // Decoding stream
   CopyDecoder no_decoder{ true };
   AudioDecoder *p_decoder = &no_decoder;
@@ -248,7 +274,7 @@ protected:
   StreamCopy copier;  // copies sound into i2s
   uint32_t timeout = 0;
   float current_volume = -1.0f;  // illegal value which will trigger an update
-  int delay_if_full = 100;
+  int delay_if_full = 100;  // non zero skips copying while the output is full
 
   void checkForSongEnd() {
     if (p_final_stream != nullptr && p_final_stream->availableForWrite() == 0)
@@ -0,0 +1,145 @@
+/*
+   Music Library
+
+   Reads the /artist/album/song directory tree through the HAL file
+   system into the artists, albums and songs lists the ListBox shows,
+   and picks shuffled songs. It only uses Hal.h so it runs on the ESP32
+   and on a host (see tools/hostplayer.cpp).
+
+   With a DirCache set, directories listed recently are taken from it
+   instead of the card.
+
+   Last Update: 10/18/2026
+*/
+
+#ifndef MUSICLIBRARY_H
+#define MUSICLIBRARY_H
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "DirCache.h"
+#include "Hal.h"
+#include "ListBox.h"
+
+// Song file extensions listed, see halHasExtension()
+static const char *const LIBRARY_SONG_EXTENSIONS[] = { "mp3", NULL };
+
+// Called for every directory entry read so lengthy scans can keep
+// other work (the audio feed) going
+typedef void (*libraryIdleCallback)(void);
+
+class MusicLibrary {
+
+public:
+
+  // Class Constructor
+  MusicLibrary(HalFileSystem *fs, libraryIdleCallback idle = NULL) {
+    _fs = fs;
+    _idle = idle;
+    _cache = NULL;
+  }
+
+  // Keep recently listed directories in cache (NULL for none)
+  void setCache(DirCache *cache) {
+    _cache = cache;
+  }
+
+  // Gather up all the artist names
+  boolean populateArtists() {
+    return listDirectory("/", true, artists);
+  }
+
+  // Gather up all the artist albums
+  // artistPath is "/artist1"
+  boolean populateAlbums(const char *artistPath) {
+    return listDirectory(artistPath, true, albums);
+  }
+
+  // Gather up all the artist album songs
+  // albumPath is "/artist1/album1"
+  boolean populateSongs(const char *albumPath) {
+    return listDirectory(albumPath, false, songs);
+  }
+
+  // Pick a shuffled song and place its path in songPath
+  // Returns false if the card couldn't be read or is empty
+  boolean pickShuffledSong(char *songPath, size_t size) {
+
+    if (artists.empty()) {
+      return false;
+    }
+
+    // Pick a random artist
+    std::string path = "/" + artists.at(halRandom(artists.size()));
+
+    if (!populateAlbums(path.c_str()) || albums.empty()) {
+      return false;
+    }
+
+    // Pick a random album
+    path += "/" + albums.at(halRandom(albums.size()));
+
+    if (!populateSongs(path.c_str()) || songs.empty()) {
+      return false;
+    }
+
+    // Pick a random song
+    path += "/" + songs.at(halRandom(songs.size()));
+
+    if (path.size() >= size) {
+      return false;
+    }
+    strcpy(songPath, path.c_str());
+    return true;
+  }
+
+protected:
+
+  HalFileSystem *_fs;
+  libraryIdleCallback _idle;
+  DirCache *_cache;
+
+  // Read the sorted names of the directories (or songs) in path.
+  // Names starting with a period are skipped.
+  boolean listDirectory(const char *path, boolean directories, FrontCodedList &list) {
+
+    if ((_cache != NULL) && _cache->lookup(path, directories, list)) {
+      return true;
+    }
+
+    // Clear any previous data
+    list.clear();
+
+    HalDir *dir = _fs->openDir(path);
+    if (dir == NULL) {
+      return false;
+    }
+    dir->setExtensions(directories ? NULL : LIBRARY_SONG_EXTENSIONS);
+
+    std::vector<std::string> names;
+    HAL_DIR_ENTRY entry;
+    while (dir->next(&entry)) {
+      if ((entry.isDirectory == directories) && (entry.name[0] != '.')) {
+        names.push_back(entry.name);
+      }
+
+      // Keep the audio fed while reading large directories
+      if (_idle != NULL) {
+        _idle();
+      }
+    }
+    delete dir;
+
+    std::sort(names.begin(), names.end());
+    list.assign(names);
+
+    if (_cache != NULL) {
+      _cache->store(path, directories, list);
+    }
+    return true;
+  }
+};
+
+#endif
@@ -0,0 +1,462 @@
+/*
+   Play Statistics
+
+   How often each song of the library index (see LibraryIndex.h) has
+   been played and skipped, when it was last played and how much of it
+   is heard on average, kept on the card in PLAY_STATS_PATH. Records are
+   addressed by track number.
+
+   A play or skip isn't written into its record. It's appended to the
+   log in PLAY_LOG_PATH as one fixed size event and merged into a copy
+   of the record kept in memory, so counting it is one short sequential
+   write. Once PLAY_LOG_COMPACT events are logged compact() writes the
+   changed records into the table in track order, a few at a time from
+   a background task, then starts the log again. open() replays the log
+   so nothing counted is lost if the player is turned off first.
+
+   The log file is made PLAY_LOG_MAX events long up front and events
+   are written into it from the start, so logging one never changes the
+   file's size, its directory entry or the FAT. Starting it again just
+   raises the table's sequence number: replay stops at the first event
+   that isn't newer.
+
+   The player has no clock, so "when" is the play sequence number: each
+   play or skip counts one up and the song gets the count. Sequence
+   numbers start at 1 so 0 is never played. An event is only applied to
+   a record last played before it, so replaying a log whose compaction
+   was cut short doesn't count its events twice.
+
+   Table layout, little endian:
+
+     magic "CYDS", version, track count, sequence    (uint32 each)
+     plays, skips (uint16 each), last played (uint32),
+     average completion (uint16)                      per track
+
+   Log layout:
+
+     magic "CYDE", version, track count              (uint32 each)
+     track, sequence (uint32 each), completion (uint16),
+     event, check (uint8 each)                 PLAY_LOG_MAX events
+
+   Completion is the fraction of the song's bytes heard, of 65535. The
+   check byte finds an event cut short by a power loss, which ends the
+   replay like an old one. A table or log for a different track count
+   or version is started again empty. tools/libprep.cpp compacts the
+   log and carries the records of songs still on the card over to
+   their new track numbers when it rebuilds the index.
+   tools/hostplayer.cpp statsbench checks it against a model and
+   measures the writes.
+
+   Last Update: 10/18/2026
+*/
+
+#ifndef PLAYSTATS_H
+#define PLAYSTATS_H
+
+#include <algorithm>
+#include <vector>
+
+#include "Hal.h"
+
+#define PLAY_STATS_PATH "/.library/stats.bin"
+#define PLAY_STATS_MAGIC 0x53445943  // "CYDS"
+#define PLAY_STATS_VERSION 2
+#define PLAY_STATS_HEADER 16
+#define PLAY_STATS_RECORD 10
+
+#define PLAY_LOG_PATH "/.library/stats.log"
+#define PLAY_LOG_MAGIC 0x45445943  // "CYDE"
+#define PLAY_LOG_VERSION 1
+#define PLAY_LOG_HEADER 12
+#define PLAY_LOG_EVENT 12
+
+// Events logged before compaction is due, and at most. add() compacts
+// first when the log is full. Compacting more at once writes fewer
+// sectors when songs are played again in between.
+#define PLAY_LOG_COMPACT 64
+#define PLAY_LOG_MAX 128
+
+// Completion at which a song stopped counts as played, of 65535
+#define PLAY_STATS_PLAYED 58982  // 90%
+
+typedef struct {
+  uint16_t plays;       // heard at least PLAY_STATS_PLAYED
+  uint16_t skips;
+  uint32_t lastPlayed;  // sequence number, 0 if never
+  uint16_t completion;  // average of the plays and skips
+} PLAY_STATS;
+
+enum PLAY_EVENT {
+  PE_PLAY = 1,
+  PE_SKIP
+};
+
+class PlayStats {
+
+public:
+
+  PlayStats() {
+    table = NULL;
+    log = NULL;
+    close();
+  }
+
+  ~PlayStats() {
+    close();
+  }
+
+  // Open the table for count tracks, making an empty one if there's
+  // none for that many, and replay the events logged since it was
+  // last compacted
+  boolean open(HalFileSystem *_fs, uint32_t _count, const char *_path = PLAY_STATS_PATH,
+               const char *_logPath = PLAY_LOG_PATH) {
+
+    close();
+    fs = _fs;
+    path = _path;
+    logPath = _logPath;
+    count = _count;
+    if (!openTable() || !openLog() || !replayLog()) {
+      close();
+      return false;
+    }
+    return true;
+  }
+
+  // Logged events not yet compacted stay in the log for the next open()
+  void close() {
+    if (table != NULL) {
+      delete table;
+      table = NULL;
+    }
+    if (log != NULL) {
+      delete log;
+      log = NULL;
+    }
+    count = 0;
+    sequence = 0;
+    logged = 0;
+    compacting = false;
+    pending.clear();
+  }
+
+  uint32_t getCount() {
+    return count;
+  }
+
+  // The last play sequence number given
+  uint32_t getSequence() {
+    return sequence;
+  }
+
+  // Events in the log, and the records they changed
+  uint32_t getLogged() {
+    return logged;
+  }
+
+  uint32_t getPending() {
+    return pending.size();
+  }
+
+  // Read n records from track first on into stats, with the events
+  // logged
+  boolean read(uint32_t first, PLAY_STATS *stats, uint32_t n) {
+
+    if ((table == NULL) || (first + n > count) ||
+        !table->seek(PLAY_STATS_HEADER + PLAY_STATS_RECORD * first)) {
+      return false;
+    }
+    uint8_t b[PLAY_STATS_RECORD * 32];
+    for (uint32_t done = 0; done < n;) {
+      uint32_t chunk = min(n - done, (uint32_t) 32);
+      if (table->read(b, PLAY_STATS_RECORD * chunk) != (int)(PLAY_STATS_RECORD * chunk)) {
+        return false;
+      }
+      for (uint32_t i = 0; i < chunk; i++) {
+        decode(b + PLAY_STATS_RECORD * i, &stats[done + i]);
+      }
+      done += chunk;
+    }
+    for (std::vector<PENDING>::iterator it = findPending(first);
+         (it != pending.end()) && (it->track < first + n); it++) {
+      stats[it->track - first] = it->stats;
+    }
+    return true;
+  }
+
+  // Count a play or skip of track having heard completion of it
+  boolean add(uint32_t track, enum PLAY_EVENT event, uint16_t completion) {
+
+    if ((log == NULL) || (track >= count)) {
+      return false;
+    }
+    if ((logged >= PLAY_LOG_MAX) && !compact()) {
+      return false;
+    }
+    uint8_t b[PLAY_LOG_EVENT];
+    encodeEvent(track, sequence + 1, completion, event, b);
+    if (!log->seek(PLAY_LOG_HEADER + PLAY_LOG_EVENT * logged) ||
+        (log->write(b, sizeof(b)) != sizeof(b))) {
+      return false;
+    }
+    log->flush();
+    logged++;
+    return apply(track, sequence + 1, completion, event);
+  }
+
+  // True once the log holds PLAY_LOG_COMPACT events and until a
+  // compaction started has finished
+  boolean isCompactDue() {
+    return compacting || (logged >= PLAY_LOG_COMPACT);
+  }
+
+  // Write at most most changed records into the table, and once all
+  // are, the sequence number, which empties the log. Returns false if
+  // the card can't be written.
+  boolean compact(uint32_t most = UINT32_MAX) {
+
+    if (table == NULL) {
+      return false;
+    }
+    compacting = true;
+    uint8_t b[PLAY_STATS_RECORD];
+    for (PENDING &p : pending) {
+      if (!p.dirty) {
+        continue;
+      }
+      if (most-- == 0) {
+        return true;
+      }
+      encode(&p.stats, b);
+      if (!table->seek(PLAY_STATS_HEADER + PLAY_STATS_RECORD * p.track) ||
+          (table->write(b, sizeof(b)) != sizeof(b))) {
+        return false;
+      }
+      p.dirty = false;
+    }
+
+    // The table holds every event logged, so the log can start again
+    table->flush();
+    put32(b, sequence);
+    if (!table->seek(12) || (table->write(b, 4) != 4)) {
+      return false;
+    }
+    table->flush();
+    pending.clear();
+    logged = 0;
+    compacting = false;
+    return true;
+  }
+
+  static void encode(const PLAY_STATS *stats, uint8_t *p) {
+    p[0] = stats->plays;
+    p[1] = stats->plays >> 8;
+    p[2] = stats->skips;
+    p[3] = stats->skips >> 8;
+    put32(p + 4, stats->lastPlayed);
+    p[8] = stats->completion;
+    p[9] = stats->completion >> 8;
+  }
+
+  static void decode(const uint8_t *p, PLAY_STATS *stats) {
+    stats->plays = p[0] | (p[1] << 8);
+    stats->skips = p[2] | (p[3] << 8);
+    stats->lastPlayed = get32(p + 4);
+    stats->completion = p[8] | (p[9] << 8);
+  }
+
+protected:
+  HalFileSystem *fs;
+  const char *path;
+  const char *logPath;
+  HalFile *table;
+  HalFile *log;
+  uint32_t count;
+  uint32_t sequence;
+  uint32_t logged;
+  boolean compacting;
+
+  // The records the log changed, by track, and whether they've been
+  // written into the table since
+  typedef struct {
+    uint32_t track;
+    PLAY_STATS stats;
+    boolean dirty;
+  } PENDING;
+  std::vector<PENDING> pending;
+
+  std::vector<PENDING>::iterator findPending(uint32_t track) {
+    return std::lower_bound(pending.begin(), pending.end(), track,
+                            [](const PENDING &p, uint32_t t) { return p.track < t; });
+  }
+
+  boolean openTable() {
+
+    table = fs->open(path, HOM_UPDATE);
+    uint8_t header[PLAY_STATS_HEADER];
+    if ((table != NULL) && (table->read(header, sizeof(header)) == sizeof(header)) &&
+        (get32(header) == PLAY_STATS_MAGIC) && (get32(header + 4) == PLAY_STATS_VERSION) &&
+        (get32(header + 8) == count) && (table->size() >= PLAY_STATS_HEADER + PLAY_STATS_RECORD * count)) {
+      sequence = get32(header + 12);
+      return true;
+    }
+
+    // Start again with every record zero
+    delete table;
+    table = fs->open(path, HOM_WRITE);
+    if (table == NULL) {
+      return false;
+    }
+    put32(header, PLAY_STATS_MAGIC);
+    put32(header + 4, PLAY_STATS_VERSION);
+    put32(header + 8, count);
+    put32(header + 12, 0);
+    boolean ok = table->write(header, sizeof(header)) == sizeof(header);
+    uint8_t zeros[512];
+    memset(zeros, 0, sizeof(zeros));
+    for (uint32_t left = PLAY_STATS_RECORD * count; ok && (left > 0);) {
+      size_t n = min(left, (uint32_t) sizeof(zeros));
+      ok = table->write(zeros, n) == n;
+      left -= n;
+    }
+    delete table;
+    table = ok ? fs->open(path, HOM_UPDATE) : NULL;
+    sequence = 0;
+    return table != NULL;
+  }
+
+  // Open the log, making an empty one if there's none for the table
+  boolean openLog() {
+
+    log = fs->open(logPath, HOM_UPDATE);
+    uint8_t header[PLAY_LOG_HEADER];
+    if ((log != NULL) && (log->read(header, sizeof(header)) == sizeof(header)) &&
+        (get32(header) == PLAY_LOG_MAGIC) && (get32(header + 4) == PLAY_LOG_VERSION) &&
+        (get32(header + 8) == count) && (log->size() >= PLAY_LOG_HEADER + PLAY_LOG_EVENT * PLAY_LOG_MAX)) {
+      return true;
+    }
+
+    delete log;
+    log = fs->open(logPath, HOM_WRITE);
+    if (log == NULL) {
+      return false;
+    }
+    put32(header, PLAY_LOG_MAGIC);
+    put32(header + 4, PLAY_LOG_VERSION);
+    put32(header + 8, count);
+    boolean ok = log->write(header, sizeof(header)) == sizeof(header);
+    uint8_t zeros[512];
+    memset(zeros, 0, sizeof(zeros));
+    for (uint32_t left = PLAY_LOG_EVENT * PLAY_LOG_MAX; ok && (left > 0);) {
+      size_t n = min(left, (uint32_t) sizeof(zeros));
+      ok = log->write(zeros, n) == n;
+      left -= n;
+    }
+    delete log;
+    log = ok ? fs->open(logPath, HOM_UPDATE) : NULL;
+    return log != NULL;
+  }
+
+  // Apply the events logged since the table's sequence number, which
+  // run from the start of the log to the first older or broken one
+  boolean replayLog() {
+
+    uint8_t b[PLAY_LOG_EVENT * 32];
+    if (!log->seek(PLAY_LOG_HEADER)) {
+      return false;
+    }
+    while (logged < PLAY_LOG_MAX) {
+      uint32_t n = min((uint32_t) PLAY_LOG_MAX - logged, (uint32_t) 32);
+      if (log->read(b, PLAY_LOG_EVENT * n) != (int)(PLAY_LOG_EVENT * n)) {
+        return false;
+      }
+      for (uint32_t i = 0; i < n; i++) {
+        uint32_t track, eventSequence;
+        uint16_t completion;
+        enum PLAY_EVENT event;
+        if (!decodeEvent(b + PLAY_LOG_EVENT * i, &track, &eventSequence, &completion, &event) ||
+            (track >= count) || (eventSequence <= sequence)) {
+          return true;
+        }
+        if (!apply(track, eventSequence, completion, event)) {
+          return false;
+        }
+        logged++;
+      }
+    }
+    return true;
+  }
+
+  // Merge an event into its record unless the record already has it
+  boolean apply(uint32_t track, uint32_t eventSequence, uint16_t completion, enum PLAY_EVENT event) {
+
+    PLAY_STATS s;
+    if (!read(track, &s, 1)) {
+      return false;
+    }
+    sequence = max(sequence, eventSequence);
+    if (eventSequence <= s.lastPlayed) {
+      return true;
+    }
+    uint32_t heard = s.plays + s.skips;
+    s.completion = ((uint64_t) s.completion * heard + completion) / (heard + 1);
+    if (event == PE_PLAY) {
+      s.plays += (s.plays < UINT16_MAX) ? 1 : 0;
+    } else {
+      s.skips += (s.skips < UINT16_MAX) ? 1 : 0;
+    }
+    s.lastPlayed = eventSequence;
+
+    std::vector<PENDING>::iterator it = findPending(track);
+    if ((it == pending.end()) || (it->track != track)) {
+      PENDING p = { track, s, true };
+      pending.insert(it, p);
+    } else {
+      it->stats = s;
+      it->dirty = true;
+    }
+    return true;
+  }
+
+  static void encodeEvent(uint32_t track, uint32_t eventSequence, uint16_t completion,
+                          enum PLAY_EVENT event, uint8_t *p) {
+    put32(p, track);
+    put32(p + 4, eventSequence);
+    p[8] = completion;
+    p[9] = completion >> 8;
+    p[10] = event;
+    p[11] = check(p);
+  }
+
+  static boolean decodeEvent(const uint8_t *p, uint32_t *track, uint32_t *eventSequence,
+                             uint16_t *completion, enum PLAY_EVENT *event) {
+    if ((p[11] != check(p)) || ((p[10] != PE_PLAY) && (p[10] != PE_SKIP))) {
+      return false;
+    }
+    *track = get32(p);
+    *eventSequence = get32(p + 4);
+    *completion = p[8] | (p[9] << 8);
+    *event = (enum PLAY_EVENT) p[10];
+    return true;
+  }
+
+  static uint8_t check(const uint8_t *p) {
+    uint8_t c = 0x5A;
+    for (int i = 0; i < PLAY_LOG_EVENT - 1; i++) {
+      c = (c << 1 | c >> 7) ^ p[i];
+    }
+    return c;
+  }
+
+  static uint32_t get32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+  }
+
+  static void put32(uint8_t *p, uint32_t v) {
+    for (int i = 0; i < 4; i++) {
+      p[i] = v >> (8 * i);
+    }
+  }
+};
+
+#endif
@@ -0,0 +1,2606 @@
+/*
+   Player Finite State Machine
+
+   The player's screens, menus and playback control: the FSM states,
+   their handlers and the state table, with the globals they share.
+   They only reach the hardware through the HAL (see Hal.h), so the
+   sketch runs this on the ESP32 and tools/hostplayer.cpp runs the same
+   code on a host.
+
+   fsmBegin() starts it on a HAL and fsmRun() runs the handler of the
+   current state once. The sketch calls fsmRun() from its UI task.
+
+   The ENABLE_* settings are the includer's and must be defined before
+   this header.
+
+   Last Update: 10/18/2026
+*/
+
+#ifndef PLAYERFSM_H
+#define PLAYERFSM_H
+
+#include <string>
+
+#include "Hal.h"
+#include "ListBox.h"
+#include "MusicLibrary.h"
+#include "LibraryIndex.h"
+#include "BrowseIndex.h"
+#include "Playlist.h"
+#include "AlbumShuffle.h"
+#include "PlayStats.h"
+#include "SmartShuffle.h"
+#include "ShuffleHistory.h"
+#include "Trace.h"
+
+#if ENABLE_SESSION_LOG
+#include "SessionLog.h"
+#endif
+
+// Application title
+#define APP_TITLE "CYD BT Music Player 2"
+
+// RGB565 colors, as in ILI9341.h
+#define COLOR_BLACK 0x0000
+#define COLOR_BLUE 0x001F
+#define COLOR_RED 0xF800
+#define COLOR_GREEN 0x07E0
+#define COLOR_YELLOW 0xFFE0
+#define COLOR_WHITE 0xFFFF
+
+// Misc screen attributes
+#define SCREEN_COLOR COLOR_BLACK
+#define SCREEN_BORDER_COLOR COLOR_BLUE
+#define SCREEN_TITLE_COLOR COLOR_GREEN
+#define SCREEN_TEXT_COLOR COLOR_WHITE
+
+// Listbox attributes
+#define LISTBOX_RECT_X 2
+#define LISTBOX_RECT_Y 10
+#define LISTBOX_CONTENT_START LISTBOX_RECT_Y + 6
+#define LISTBOX_RECT_WIDTH 236
+#define LISTBOX_RECT_HEIGHT 208
+#define LISTBOX_LINES 10
+#define LISTBOX_CHARS 19
+
+// Timeout for LCD display
+#define DISPLAY_TIMEOUT_MIN 1
+#define DISPLAY_TIMEOUT_MS (DISPLAY_TIMEOUT_MIN * 60 * 1000)
+
+// Double clicking - or + while a song plays skips back or forward this
+// much of the song
+#define SCRUB_PERCENT 5
+
+// Minimum time the welcome screen is shown. Any button skips the rest.
+#define WELCOME_SCREEN_MS 4000
+
+// Blink period and count of the remote access connect failure message
+#define CONNECT_FAIL_BLINK_MS 500
+#define CONNECT_FAIL_BLINKS 14
+
+// Program version numbers
+#define MAJOR_VERSION 2
+#define MINOR_VERSION 2
+
+// Session recording and the log replayed
+#define SESSION_LOG_PATH "/session.log"
+#define REPLAY_LOG_PATH "/replay.log"
+
+// Memory for the directory cache
+#define DIR_CACHE_BYTES 16384
+
+// The hardware the FSM runs on
+HAL *hal;
+
+// Called with each button event before the state handler. Returns true
+// if it used the event, which the handler then doesn't get.
+typedef boolean (*fsmButtonHook)(enum BUTTON_STATE result);
+fsmButtonHook buttonHook;
+
+// Pointer to ListBox instance
+ListBox *listBox;
+
+/****************************************************************/
+/***                       Misc Variables                     ***/
+/****************************************************************/
+
+uint32_t displayTimeout;
+
+boolean playing;
+boolean looping;
+boolean skipInput;
+
+// Set when the last button event came from the queue rather than
+// the touch screen
+boolean inputQueued;
+
+#if ENABLE_FTP_REMOTE
+boolean uploading;
+
+// Set when a remote client changes the card so the artist list is re-read
+boolean libraryChanged;
+#endif
+
+enum PLAY_MODE { SEQUENTIAL,
+                 RANDOM };
+enum PLAY_MODE playMode;
+
+// Startup progress
+boolean sdReady;
+boolean lcdReady;
+uint32_t welcomeEndMs;
+
+// Set once the boot phase timings have been reported
+boolean bootProfiled;
+
+#if ENABLE_SD_TUNING
+// Read errors during playback already acted on
+uint32_t sdReadErrors;
+
+// Operations menu index of the SD card test
+#define OP_SD_TEST (ENABLE_FTP_REMOTE ? 5 : 4)
+#endif
+
+#if ENABLE_BROWSE_INDEX
+// Operations menu index of the first browse mode
+#define OP_BROWSE (4 + ENABLE_FTP_REMOTE + ENABLE_SD_TUNING)
+
+// Index and list box title of each browse mode in menu order
+const char *const BROWSE_PATHS[] = { BROWSE_GENRE_PATH, BROWSE_DECADE_PATH, BROWSE_RECENT_PATH };
+const char *const BROWSE_TITLES[] = { "- Genres -", "- Decades -", "- Recently Added -" };
+
+// The browse index being shown
+BrowseIndex browseIndex;
+int browseMode;
+#endif
+
+#if ENABLE_PLAYLISTS
+// Browse mode of the playlists, after those of BROWSE_PATHS
+#define BROWSE_PLAYLISTS 3
+
+// Folder the playlists are listed from
+#define PLAYLIST_DIR "/"
+
+// The playlist being shown
+Playlist playlist;
+#endif
+
+#if ENABLE_ALBUM_SHUFFLE
+// Operations menu index of album shuffle
+#define OP_ALBUM_SHUFFLE (4 + ENABLE_FTP_REMOTE + ENABLE_SD_TUNING + 3 * ENABLE_BROWSE_INDEX + \
+                          ENABLE_PLAYLISTS)
+
+// Album shuffle and how AS_PLAY moves on from the song playing
+AlbumShuffle albumShuffle;
+enum ALBUM_MOVE {AM_NEXT_SONG, AM_PREVIOUS_SONG, AM_NEXT_ALBUM};
+enum ALBUM_MOVE albumMove;
+#endif
+
+#if ENABLE_SMART_SHUFFLE
+// Operations menu index of smart shuffle
+#define OP_SMART_SHUFFLE (4 + ENABLE_FTP_REMOTE + ENABLE_SD_TUNING + 3 * ENABLE_BROWSE_INDEX + \
+                          ENABLE_PLAYLISTS + ENABLE_ALBUM_SHUFFLE)
+
+// Smart shuffle
+SmartShuffle smartShuffle;
+#endif
+
+#if ENABLE_SHUFFLE_HISTORY
+// Songs shuffle play played and how SH_PICKANDPLAY moves on from the
+// one playing
+ShuffleHistory shuffleHistory;
+enum SHUFFLE_MOVE {SM_BACK, SM_FORWARD};
+enum SHUFFLE_MOVE shuffleMove;
+#endif
+
+// Error screen message and the state a button press retries
+const char *errorMessage;
+
+#if ENABLE_FTP_REMOTE
+// Remote access connect failure blinking
+int blinkCount;
+uint32_t blinkAtMs;
+#endif
+
+// Buffer for building paths to song files on SD card
+char songPath[120];
+
+// Finite State Machine (FSM) states
+enum STATES {
+  // Boot states
+  BOOT_SD_INIT,
+  BOOT_BT_INIT,
+  BOOT_LCD_WAIT,
+  BOOT_SCAN,
+  BOOT_WELCOME_WAIT,
+
+  INITIAL,
+
+  // Operation states
+  OP_POPULATE_LB,
+  OP_BUTTON_CHECK,
+  OP_DISPATCH,
+
+  // Bluetooth states
+  BT_START,
+  BT_CONNECT_WAIT,
+
+  // Artist states
+  AR_POPULATE_LB,
+  AR_BUTTON_CHECK,
+
+  // Album states
+  AL_POPULATE_LB,
+  AL_BUTTON_CHECK,
+
+  // Song states
+  SG_POPULATE_LB,
+  SG_BUTTON_CHECK,
+  SG_PLAY,
+  SG_SONGSTATUS_CHECK,
+  SG_PATH_RESET,
+
+  // Action states
+  AC_DISPLAY,
+  AC_BUTTON_CHECK,
+
+  // Shuffle states
+  SH_PICKANDPLAY,
+  SH_BUTTONSTATUS_CHECK,
+
+  // Error states
+  ER_DISPLAY,
+  ER_BUTTON_CHECK,
+
+  // SD card test states
+  SD_TEST,
+  SD_TEST_WAIT,
+
+  // Remote access states
+  RA_WIFI_CONNECT,
+  RA_WIFI_WAIT,
+  RA_CONNECT_FAILED,
+  RA_DISPLAY,
+  RA_BUTTON_CHECK,
+
+  // Browse index states
+  BX_OPEN,
+  BX_GROUP_CHECK,
+  BX_ENTRIES_POPULATE_LB,
+  BX_ENTRY_CHECK,
+  BX_PLAY,
+  BX_SONGSTATUS_CHECK,
+
+  // Album shuffle states
+  AS_START,
+  AS_PLAY,
+  AS_SONGSTATUS_CHECK,
+
+  // Smart shuffle states
+  SS_START,
+  SS_PICKANDPLAY,
+  SS_SONGSTATUS_CHECK,
+
+  // Number of states
+  STATE_COUNT
+};
+
+// Set the initial start state
+STATES state = BOOT_SD_INIT;
+
+// State retried when a button is pressed on the error screen
+STATES errorRetryState;
+
+// Get the name of a state
+const char *stateName(int s);
+
+#if ENABLE_SESSION_LOG
+// Session recording and replay
+SessionRecorder sessionRecorder;
+SessionReplay sessionReplay;
+
+// Set once a session is recording or replaying
+boolean sessionStarted;
+
+// Set while a replay is running
+boolean replaying;
+
+// Last state and song logged, and the song number when the session began
+int sessionState;
+uint32_t sessionSong;
+uint32_t sessionFirstSong;
+#endif
+
+// The music library on the SD card
+MusicLibrary *library;
+
+#if ENABLE_DIR_CACHE
+// Recently listed library directories
+DirCache dirCache(DIR_CACHE_BYTES);
+#endif
+
+#if ENABLE_LIBRARY_INDEX
+// Song tags and seek tables made on a host, and the playing song's
+// with its track number and first frame
+LibraryIndex libraryIndex;
+LIBRARY_TRACK indexedTrack;
+boolean trackIndexed = false;
+uint32_t indexedNumber = UINT32_MAX;
+uint32_t indexedStart;
+
+// Use indexedTrack, track number number, for the song just started if
+// found and it's the same song
+void useIndexedTrack(boolean found, uint32_t number) {
+  trackIndexed = found && (indexedTrack.size == hal->player->getSize());
+  indexedNumber = trackIndexed ? number : UINT32_MAX;
+  indexedStart = indexedTrack.audioStart;
+  hal->player->setTrack(trackIndexed ? &indexedTrack : NULL);
+}
+
+// Look the song just started up in the index
+void findIndexedTrack(const char *path) {
+  uint32_t number = UINT32_MAX;
+  boolean found = libraryIndex.find(path, &indexedTrack, &number);
+  useIndexedTrack(found, number);
+}
+#endif
+
+#if ENABLE_PLAY_STATS
+// Plays and skips of the songs of the library index, and whether the
+// song playing was heard to its end
+PlayStats playStats;
+boolean songFinished = false;
+
+// Count the song that was playing, once, as played or skipped by how
+// much of it was heard. Called before the next song starts while the
+// last one's file is still open.
+void countPlay() {
+  uint32_t size = hal->player->getSize();
+  uint32_t position = songFinished ? size : hal->player->getPosition();
+  if ((indexedNumber != UINT32_MAX) && (size > indexedStart)) {
+    uint16_t completion = (position <= indexedStart) ? 0 :
+                          (uint64_t) min(position - indexedStart, size - indexedStart) * 65535 / (size - indexedStart);
+    playStats.add(indexedNumber, (completion >= PLAY_STATS_PLAYED) ? PE_PLAY : PE_SKIP, completion);
+#if ENABLE_SMART_SHUFFLE
+    smartShuffle.counted(indexedNumber);
+#endif
+  }
+  indexedNumber = UINT32_MAX;
+  songFinished = false;
+}
+
+// Open the statistics of the library index just opened
+void openPlayStats() {
+  indexedNumber = UINT32_MAX;
+  if (!libraryIndex.isOpen() || !playStats.open(hal->fs, libraryIndex.getCount())) {
+    playStats.close();
+    return;
+  }
+  hal->system->printf("Play statistics: %lu events logged\n", (unsigned long) playStats.getLogged());
+}
+#endif
+
+// Close every file kept open on the card, counting the song stopped
+// last first, before the card is restarted
+void closeCardFiles() {
+#if ENABLE_PLAY_STATS
+  countPlay();
+  playStats.close();
+#endif
+  hal->player->closeSong();
+#if ENABLE_LIBRARY_INDEX
+  libraryIndex.close();
+#endif
+#if ENABLE_DIR_CACHE
+  dirCache.clear();
+#endif
+}
+
+// Open them again once the card has started
+void openCardFiles() {
+#if ENABLE_LIBRARY_INDEX
+  if (libraryIndex.open(hal->fs)) {
+    hal->system->printf("Library index: %lu songs\n", (unsigned long) libraryIndex.getCount());
+#if ENABLE_SHUFFLE_HISTORY
+    shuffleHistory.begin(hal->fs, libraryIndex.getCount());
+#endif
+  }
+#endif
+#if ENABLE_PLAY_STATS
+  openPlayStats();
+#endif
+}
+
+#if ENABLE_SESSION_LOG
+// Record an FSM output or check it against the replay
+void sessionOutput(enum SESSION_RECORD_TYPE type, uint8_t a, uint32_t value) {
+  if (sessionReplay.isActive()) {
+    sessionReplay.observe(hal->time->millis(), type, a, 0, value);
+  } else {
+    sessionRecorder.add(hal->time->millis(), type, a, 0, value);
+  }
+}
+
+// Write the rest of the recording and say if it was cut short
+void endRecording() {
+
+  if (sessionRecorder.isRecording() && (sessionRecorder.getLost() != 0)) {
+    hal->system->printf("Session log cut short, %lu records lost\n",
+                        (unsigned long) sessionRecorder.getLost());
+  }
+  sessionRecorder.end();
+}
+
+// Start recording a session
+void startRecording() {
+
+  endRecording();
+  uint32_t seed = hal->system->trueRandom();
+  if (!sessionRecorder.begin(hal->fs, SESSION_LOG_PATH, hal->time->millis(),
+                             stateName, STATE_COUNT, operations)) {
+    hal->system->print("Can't create " SESSION_LOG_PATH "\n");
+  }
+  sessionRecorder.add(hal->time->millis(), SR_SEED, 0, 0, seed);
+  sessionStarted = true;
+
+  // Shuffle and random play pick the same songs in a replay
+  halRandomSeed(seed);
+
+  sessionState = INITIAL;
+  sessionSong = hal->player->getSongNumber();
+  sessionFirstSong = sessionSong;
+}
+
+// Replay the session log at path on fs. A replay restarts the FSM from
+// INITIAL like the recording did.
+boolean startReplay(HalFileSystem *fs, const char *path) {
+
+  endRecording();
+  if (!sessionReplay.begin(fs, path, hal->time->millis())) {
+    hal->system->printf("Can't read %s\n", path);
+    return false;
+  }
+  replaying = true;
+
+  // Don't start recording when the replay reaches INITIAL
+  sessionStarted = true;
+
+  // Put the player back the way it was when the recording started
+  if (playing) {
+    playing = false;
+    hal->player->stopSong();
+  }
+  looping = false;
+  hal->display->backlight(true);
+  state = INITIAL;
+  hal->system->printf("Replaying %s\n", path);
+
+  // Shuffle and random play pick the same songs as the recording
+  halRandomSeed(sessionReplay.getSeed());
+
+  sessionState = INITIAL;
+  sessionSong = hal->player->getSongNumber();
+  sessionFirstSong = sessionSong;
+  return true;
+}
+#endif
+
+// Get the button event for the FSM
+enum BUTTON_STATE pollInput(void) {
+
+  enum BUTTON_STATE result = hal->input->poll(&inputQueued);
+
+#if ENABLE_SESSION_LOG
+  if (sessionReplay.isActive()) {
+    // Recorded input replaces the touch screen and remote
+    result = (enum BUTTON_STATE) sessionReplay.pollButton(state, hal->time->millis(), &inputQueued);
+  } else if (result != BS_NONE) {
+    sessionRecorder.add(hal->time->millis(), SR_BUTTON, result, state,
+                        inputQueued ? SR_FLAG_QUEUED : 0);
+  }
+#endif
+  return result;
+}
+
+// Has the display timeout expired ?
+boolean displayTimedOut(void) {
+
+#if ENABLE_SESSION_LOG
+  if (sessionReplay.isActive()) {
+    return sessionReplay.pollTimeout(state, hal->time->millis());
+  }
+
+  // Record the first expiry only. Later checks find skipInput set.
+  if ((hal->time->millis() > displayTimeout) && !skipInput) {
+    sessionRecorder.add(hal->time->millis(), SR_TIMEOUT, 0, state);
+  }
+#endif
+  return hal->time->millis() > displayTimeout;
+}
+
+// Has the playing song ended ?
+boolean songEnded(void) {
+
+  boolean ended;
+#if ENABLE_SESSION_LOG
+  if (sessionReplay.isActive()) {
+    ended = sessionReplay.pollSongEnd(state, hal->time->millis());
+  } else {
+    ended = !hal->player->isActive();
+    if (ended) {
+      sessionRecorder.add(hal->time->millis(), SR_SONG_END, 0, state);
+    }
+  }
+#else
+  ended = !hal->player->isActive();
+#endif
+#if ENABLE_PLAY_STATS
+  songFinished = songFinished || ended;
+#endif
+  return ended;
+}
+
+// Calculate y pixel position corresponding to a text line
+int calcLineOffset(int line) {
+  return (line * 30) + 25;
+}
+
+// Clear the list box area of screen
+void clearListboxArea(void) {
+
+  // Draw rectangular outline
+  hal->display->drawRoundRect(0, 0, hal->display->width(), hal->display->height(), 10, SCREEN_BORDER_COLOR);
+
+  // Clear listbox on screen area
+  hal->display->fillRect(LISTBOX_RECT_X, LISTBOX_RECT_Y,
+                         LISTBOX_RECT_WIDTH, LISTBOX_RECT_HEIGHT, SCREEN_COLOR);
+
+  // Draw the program's title although it should be OK
+  hal->display->setTextSize(1);
+  hal->display->drawCenteredText(4, APP_TITLE);
+  hal->display->setTextSize(2);
+}
+
+// Display Bluetooth connection screen
+void displayBluetoothConnectionScreen(void) {
+
+  // Clear screen area, draw outline and title
+  clearListboxArea();
+
+  // Display credit sequence
+  hal->display->drawCenteredText(calcLineOffset(1), "- Waiting For -");
+  hal->display->drawCenteredText(calcLineOffset(2), "Bluetooth");
+  hal->display->drawCenteredText(calcLineOffset(3), "Connection");
+}
+
+// Display welcome screen
+void displayWelcomeScreen(void) {
+
+  char buffer[20];
+  sprintf(buffer, "Version: %d.%d", MAJOR_VERSION, MINOR_VERSION);
+
+  // Clear screen area, draw outline and title
+  clearListboxArea();
+
+  // Display credit sequence
+  hal->display->drawCenteredText(calcLineOffset(0), "ESP32");
+  hal->display->drawCenteredText(calcLineOffset(1), "CYD");
+  hal->display->drawCenteredText(calcLineOffset(2), "Bluetooth");
+  hal->display->drawCenteredText(calcLineOffset(3), "Music Player");
+  hal->display->drawCenteredText(calcLineOffset(4), buffer);
+  hal->display->drawCenteredText(calcLineOffset(5), "- Written by -");
+  hal->display->drawCenteredText(calcLineOffset(6), "Craig A. Lindley");
+
+  // Boot states continue while the welcome screen is up
+  welcomeEndMs = hal->time->millis() + WELCOME_SCREEN_MS;
+}
+
+// Display an error with instructions for retrying
+void displayErrorScreen(void) {
+
+  // Clear screen area, draw outline and title
+  clearListboxArea();
+
+  hal->display->setTextColor(COLOR_RED, SCREEN_COLOR);
+  hal->display->drawCenteredText(calcLineOffset(1), "- Error -");
+  hal->display->drawCenteredText(calcLineOffset(2), errorMessage);
+  hal->display->setTextColor(SCREEN_TEXT_COLOR, SCREEN_COLOR);
+  hal->display->drawCenteredText(calcLineOffset(4), "Press any button");
+  hal->display->drawCenteredText(calcLineOffset(5), "to try again");
+}
+
+void displayWiFiScreen() {
+
+  // Clear screen area
+  clearListboxArea();
+
+  // Draw string
+  hal->display->drawCenteredText(calcLineOffset(0), "WiFi Connecting");
+}
+
+#if ENABLE_FTP_REMOTE
+void displayUploadScreen() {
+
+  // Clear screen area
+  clearListboxArea();
+
+  // Draw title
+  hal->display->drawCenteredText(calcLineOffset(0), "Preparing For");
+  hal->display->drawCenteredText(calcLineOffset(1), "Remote Access");
+
+  // Show IP address for FTP
+  hal->display->drawCenteredText(calcLineOffset(2), "IP Address");
+  hal->display->drawCenteredText(calcLineOffset(3), hal->remote->getAddress());
+
+#if ENABLE_WEBDAV_REMOTE
+  // Same address serves HTTP/WebDAV
+  hal->display->drawCenteredText(calcLineOffset(4), "FTP or WebDAV");
+#endif
+}
+#endif
+
+// Copy name to buffer without its extension
+void stripExtension(char *buffer, size_t size, const char *name) {
+  snprintf(buffer, size, "%s", name);
+  char *dot = strrchr(buffer, '.');
+  if (dot != NULL) {
+    *dot = '\0';
+  }
+}
+
+// Now playing screen
+void displaySongNowPlayingScreen(const char *songName) {
+
+  // Remove the mp3 file extension
+  char name[HAL_NAME_SIZE];
+  stripExtension(name, sizeof(name), songName);
+
+  // Clear screen area
+  clearListboxArea();
+
+  hal->display->drawCenteredText(calcLineOffset(2), "- Now Playing -");
+  hal->display->setTextColor(SCREEN_TEXT_COLOR, COLOR_BLUE);
+#if ENABLE_LIBRARY_INDEX
+  // Title and artist from the song's tags
+  if (trackIndexed) {
+    hal->display->drawCenteredText(calcLineOffset(4), indexedTrack.title);
+    hal->display->setTextColor(SCREEN_TEXT_COLOR, SCREEN_COLOR);
+    if (indexedTrack.artist[0] != '\0') {
+      hal->display->drawCenteredText(calcLineOffset(5), indexedTrack.artist);
+    }
+    return;
+  }
+#endif
+  hal->display->drawCenteredText(calcLineOffset(4), name);
+  hal->display->setTextColor(SCREEN_TEXT_COLOR, SCREEN_COLOR);
+}
+
+// Action screen
+void displayActionScreen(boolean _looping) {
+
+  // Clear screen area
+  clearListboxArea();
+
+  hal->display->setTextColor(SCREEN_TITLE_COLOR, SCREEN_COLOR);
+  hal->display->drawCenteredText(calcLineOffset(0), "- Actions -");
+
+  hal->display->setTextColor(SCREEN_TEXT_COLOR, SCREEN_COLOR);
+  hal->display->drawCenteredText(calcLineOffset(1), "- is volume down");
+  hal->display->drawCenteredText(calcLineOffset(2), "+ is volume up");
+
+  if (_looping) {
+    hal->display->setTextColor(COLOR_YELLOW, SCREEN_COLOR);
+  }
+  hal->display->drawCenteredText(calcLineOffset(3), "Back is loop off/on");
+
+  hal->display->setTextColor(SCREEN_TEXT_COLOR, SCREEN_COLOR);
+  hal->display->drawCenteredText(calcLineOffset(4), "Sel is done");
+}
+
+// Whether the listbox shows playlist file names
+boolean playlistNames() {
+#if ENABLE_PLAYLISTS
+  return (listBox->getDataSource() == BROWSE_GROUP_DS) && (browseMode == BROWSE_PLAYLISTS);
+#else
+  return false;
+#endif
+}
+
+// Paint the listbox on the screen
+void paintListBox(int b) {
+
+  TRACE_BEGIN(TE_LCD_PAINT, b & 0xFF);
+
+  // Clear screen area
+  clearListboxArea();
+
+  hal->display->setTextColor(SCREEN_TITLE_COLOR, SCREEN_COLOR);
+
+  // Draw the listbox title
+  hal->display->drawCenteredText(LISTBOX_CONTENT_START, listBox->getTitle());
+
+  // Moves strings over to avoid rect
+  const int xOffset = 3;
+
+  int fontHeight = hal->display->getTextHeight() + 2;
+  int yOffset = 33;
+
+  // Extract listbox data from argument
+  int windowIndex = (b >> 8) & 0xFFFF;
+  int selectIndex = windowIndex + ((b >> 24) & 0xFF);
+  int numberOfEntries = b & 0xFF;
+
+  // hal->system->printf("B: %d, SI: %d, WI: %d, NE: %d\n",
+  //                     b, selectIndex, windowIndex, numberOfEntries);
+
+  // Fetch the centering flag
+  boolean centerFlag = listBox->getCenterFlag();
+
+  for (int i = 0; i < numberOfEntries; i++) {
+    char *line = listBox->getEntry(i + windowIndex, true);
+
+    // If we are dealing with filenames, strip extension
+    char str[HAL_NAME_SIZE];
+    if ((listBox->getDataSource() < BROWSE_GROUP_DS) || playlistNames()) {
+      stripExtension(str, sizeof(str), line);
+    } else {
+      snprintf(str, sizeof(str), "%s", line);
+    }
+
+    if ((i + windowIndex) == selectIndex) {
+      // This is the selected item. Change its colors
+      hal->display->setTextColor(SCREEN_COLOR, SCREEN_TEXT_COLOR);
+      if (!centerFlag) {
+        hal->display->drawText(xOffset, yOffset, str);
+      } else {
+        hal->display->drawCenteredText(yOffset, str);
+      }
+
+    } else {
+      // Non selected item
+      hal->display->setTextColor(SCREEN_TEXT_COLOR, SCREEN_COLOR);
+      if (!centerFlag) {
+        // This is a non-selected item
+        hal->display->drawText(xOffset, yOffset, str);
+      } else {
+        hal->display->drawCenteredText(yOffset, str);
+      }
+    }
+    // Calculate y offset for next line of display
+    yOffset += fontHeight;
+  }
+  hal->display->setTextColor(SCREEN_TEXT_COLOR, SCREEN_COLOR);
+
+#if ENABLE_SESSION_LOG
+  sessionOutput(SR_SCREEN, 0, listBox->getScreenHash());
+#endif
+
+  TRACE_END(TE_LCD_PAINT, b & 0xFF);
+}
+
+// Called anytime a button is clicked to stop backlight from turning off
+// or to turn it back on
+void updateTimeOut() {
+  displayTimeout = hal->time->millis() + DISPLAY_TIMEOUT_MS;
+  hal->display->backlight(true);
+}
+
+// Stop playback and switch to the error screen. A button press
+// moves on to retryState.
+void showError(const char *message, STATES retryState) {
+
+  hal->system->printf("%s\n", message);
+
+  if (playing) {
+    playing = false;
+    hal->player->stopSong();
+  }
+
+  errorMessage = message;
+  errorRetryState = retryState;
+
+  // Next state
+  state = ER_DISPLAY;
+}
+
+/****************************************************************/
+/***        Finite State Machine (FSM) State Handlers         ***/
+/****************************************************************/
+
+// Each handler is called by the UI task while its state is current.
+// Handlers for states that take input are passed the latest button
+// event (BS_NONE if there isn't one).
+
+// BOOT_SD_INIT state handler
+void stateBootSdInit(enum BUTTON_STATE /* result */) {
+  // The card may have been swapped after an error
+  closeCardFiles();
+
+  // Initialize the SD. The LCD reset and wake up waits run meanwhile.
+  sdReady = hal->card->begin();
+  if (sdReady) {
+#if ENABLE_SD_TUNING
+    hal->system->printf("SD clock: %d MHz\n", hal->card->getMHz());
+#endif
+    openCardFiles();
+  }
+  hal->system->bootPhase("sd begin");
+
+  // Next state
+  state = BOOT_BT_INIT;
+}
+
+// BOOT_BT_INIT state handler
+void stateBootBtInit(enum BUTTON_STATE /* result */) {
+  // Start the Song Manager which does the Bluetooth connection so the
+  // speaker can pair while the welcome screen is up
+  if (sdReady) {
+    hal->player->begin();
+  }
+  hal->system->bootPhase("bt begin");
+
+  // Next state
+  state = BOOT_LCD_WAIT;
+}
+
+// BOOT_LCD_WAIT state handler
+void stateBootLcdWait(enum BUTTON_STATE /* result */) {
+  // Wait for the display to finish initializing
+  if (!hal->display->initStep()) {
+    return;
+  }
+
+  if (!lcdReady) {
+    lcdReady = true;
+    hal->display->setTextSize(2);
+    hal->display->clearScreen();
+    hal->display->setTextColor(SCREEN_TEXT_COLOR, SCREEN_COLOR);
+    hal->system->bootPhase("lcd ready");
+  }
+
+  if (!sdReady) {
+    showError("SD Card Failed", BOOT_SD_INIT);
+    return;
+  }
+
+  // Display welcome screen while artists are being loaded
+  displayWelcomeScreen();
+  hal->system->bootPhase("welcome");
+
+  // Next state
+  state = BOOT_SCAN;
+}
+
+// BOOT_SCAN state handler
+void stateBootScan(enum BUTTON_STATE /* result */) {
+  // Read in all available artists
+  if (!library->populateArtists()) {
+    showError("Artist Read Failed", BOOT_SCAN);
+    return;
+  }
+  hal->system->bootPhase("artist scan");
+
+  // Next state
+  state = BOOT_WELCOME_WAIT;
+}
+
+// BOOT_WELCOME_WAIT state handler
+void stateBootWelcomeWait(enum BUTTON_STATE result) {
+  // Show the welcome screen for its full time unless a button is pressed
+  if ((result == BS_NONE) && ((int32_t)(hal->time->millis() - welcomeEndMs) < 0)) {
+    return;
+  }
+  hal->system->bootPhase("welcome wait");
+
+  // Next state
+  state = INITIAL;
+}
+
+// INITIAL state handler
+void stateInitial(enum BUTTON_STATE /* result */) {
+#if !ENABLE_UDP_REMOTE
+  // Turn off the wifi to possibly save battery life
+  hal->system->radioOff();
+#endif
+
+  // Initialize the display timeout
+  displayTimeout = hal->time->millis() + DISPLAY_TIMEOUT_MS;
+
+  skipInput = false;
+
+  // Start over from the top level menu
+  listBox->clearStack();
+
+#if ENABLE_SD_TUNING
+  // Slow the card down after read errors during playback
+  if (hal->player->getReadErrors() != sdReadErrors) {
+    sdReadErrors = hal->player->getReadErrors();
+    closeCardFiles();
+    boolean lowered = hal->card->stepDown();
+    openCardFiles();
+    if (lowered) {
+      hal->system->printf("SD read errors, clock lowered to %d MHz\n", hal->card->getMHz());
+    }
+  }
+#endif
+
+#if ENABLE_SESSION_LOG
+  // Record from the first visit to the Operations menu on
+  if (!sessionStarted) {
+    startRecording();
+  }
+#endif
+
+#if ENABLE_FTP_REMOTE
+  // Pick up artists added or removed during remote access
+  if (libraryChanged) {
+    libraryChanged = false;
+    if (!library->populateArtists()) {
+      hal->system->print("Artist Read Failed\n");
+    }
+  }
+#endif
+
+  // Next state
+  state = OP_POPULATE_LB;
+}
+
+// OP_POPULATE_LB state handler
+void stateOpPopulateLB(enum BUTTON_STATE /* result */) {
+  // Display the on screen buttons
+  hal->input->drawButtons();
+
+  listBox->setDataSource(OPERATION_DS);
+
+  // Initialize list box
+  listBox->clear();
+  listBox->setCenterFlag(true);
+  listBox->setTitle("- Operations -");
+
+  // Paint list box
+  listBox->doRepaint();
+
+  // Report how long it took to get here after power on
+  if (!bootProfiled) {
+    bootProfiled = true;
+    hal->system->bootDone();
+  }
+
+  // Next state
+  state = OP_BUTTON_CHECK;
+}
+
+// OP_BUTTON_CHECK state handler
+void stateOpButtonCheck(enum BUTTON_STATE result) {
+  if (result != BS_NONE) {
+    updateTimeOut();
+  }
+
+  if (result == BS_MINUS) {
+    listBox->selectionUp(true);
+  }
+
+  else if (result == BS_SELECT) {
+    // An action has been selected
+    // Save current listbox state
+    listBox->push();
+
+    // Load artist data
+    listBox->setDataSource(ARTIST_DS);
+
+    // Next state
+    state = OP_DISPATCH;
+  }
+
+  else if (result == BS_PLUS) {
+    listBox->selectionDown(true);
+  }
+
+  else if (result == BS_BACK) {
+    // Nothing to do here
+  }
+}
+
+// OP_DISPATCH state handler
+void stateOpDispatch(enum BUTTON_STATE /* result */) {
+  // Get selection index
+  switch (listBox->getSelectionIndex()) {
+    case 0:
+      // Bluetooth selected
+      // Next state
+      state = BT_START;
+      break;
+    case 1:
+      // Sequential play selected
+      playMode = SEQUENTIAL;
+      // Next state
+      state = AR_POPULATE_LB;
+      break;
+    case 2:
+      // Random play selected
+      playMode = RANDOM;
+      // Next state
+      state = AR_POPULATE_LB;
+      break;
+    case 3:
+      // Shuffle play selected
+#if ENABLE_SHUFFLE_HISTORY
+      // Pick a new song unless back in the history
+      shuffleMove = SM_FORWARD;
+#endif
+      // Next state
+      state = SH_PICKANDPLAY;
+      break;
+#if ENABLE_FTP_REMOTE
+    case 4:
+      // Remote access selected
+      // Next state
+      state = RA_WIFI_CONNECT;
+      break;
+#endif
+#if ENABLE_SD_TUNING
+    case OP_SD_TEST:
+      // SD card test selected
+      // Next state
+      state = SD_TEST;
+      break;
+#endif
+#if ENABLE_BROWSE_INDEX
+    case OP_BROWSE:
+    case OP_BROWSE + 1:
+    case OP_BROWSE + 2:
+#if ENABLE_PLAYLISTS
+    case OP_BROWSE + BROWSE_PLAYLISTS:
+#endif
+      // A browse mode selected
+      browseMode = listBox->getSelectionIndex() - OP_BROWSE;
+      // Next state
+      state = BX_OPEN;
+      break;
+#endif
+#if ENABLE_ALBUM_SHUFFLE
+    case OP_ALBUM_SHUFFLE:
+      // Album shuffle selected
+      // Next state
+      state = AS_START;
+      break;
+#endif
+#if ENABLE_SMART_SHUFFLE
+    case OP_SMART_SHUFFLE:
+      // Smart shuffle selected
+      // Next state
+      state = SS_START;
+      break;
+#endif
+  }
+}
+
+// BT_START state handler
+void stateBtStart(enum BUTTON_STATE /* result */) {
+  // Display BT connection screen
+  displayBluetoothConnectionScreen();
+
+  // The Song Manager was started during boot. This only does
+  // something if that was skipped.
+  hal->player->begin();
+
+  // Next state
+  state = BT_CONNECT_WAIT;
+}
+
+// BT_CONNECT_WAIT state handler
+void stateBtConnectWait(enum BUTTON_STATE result) {
+  // Back gives up waiting. Bluetooth keeps trying in the background.
+  if (result == BS_BACK) {
+    updateTimeOut();
+    listBox->pop();
+    hal->input->drawButtons();
+    state = OP_BUTTON_CHECK;
+    return;
+  }
+
+  // Wait for BT connection
+  if (!hal->player->isConnected()) {
+    return;
+  }
+
+  // Pop previous menu
+  listBox->pop();
+
+  // Advance to next selection
+  listBox->selectionDown(true);
+
+  // Display the on screen buttons
+  hal->input->drawButtons();
+
+  // Next state
+  state = OP_BUTTON_CHECK;
+}
+
+// AR_POPULATE_LB state handler
+void stateArPopulateLB(enum BUTTON_STATE /* result */) {
+  // Root directory path
+  strcpy(songPath, "/");
+
+  listBox->clear();
+  listBox->setTitle("- Artists -");
+  listBox->setCenterFlag(true);
+  listBox->setDataSource(ARTIST_DS);
+
+  // Paint list box
+  listBox->doRepaint();
+
+  // Next state
+  state = AR_BUTTON_CHECK;
+}
+
+// AR_BUTTON_CHECK state handler
+void stateArButtonCheck(enum BUTTON_STATE result) {
+  // Determine how many artists there are
+  int count = listBox->getListBoxCount();
+  int quarterCount = count / 4;
+  int halfCount = count / 2;
+
+  if (result != BS_NONE) {
+    updateTimeOut();
+  }
+
+  if (result == BS_MINUS) {
+    listBox->selectionUp(true);
+  }
+
+  else if (result == BS_MINUSP) {
+    for (int i = 0; i < quarterCount; i++) {
+      listBox->selectionUp(false);
+    }
+    listBox->doRepaint();
+  }
+
+  else if (result == BS_MINUSPP) {
+    for (int i = 0; i < halfCount; i++) {
+      listBox->selectionUp(false);
+    }
+    listBox->doRepaint();
+  }
+
+  else if (result == BS_PLUS) {
+    listBox->selectionDown(true);
+  }
+
+  else if (result == BS_PLUSP) {
+    for (int i = 0; i < quarterCount; i++) {
+      listBox->selectionDown(false);
+    }
+    listBox->doRepaint();
+  }
+
+  else if (result == BS_PLUSPP) {
+    for (int i = 0; i < halfCount; i++) {
+      listBox->selectionDown(false);
+    }
+    listBox->doRepaint();
+  }
+
+  else if (result == BS_BACK) {
+    // Null out song path
+    *songPath = '\0';
+
+    // Back to operation selection
+    listBox->pop();
+
+    // Next state
+    state = OP_BUTTON_CHECK;
+  }
+
+  else if (result == BS_SELECT) {
+    // An artist has been selected so save list box state
+    listBox->push();
+
+    // Next state
+    state = AL_POPULATE_LB;
+  }
+}
+
+// AL_POPULATE_LB state handler
+void stateAlPopulateLB(enum BUTTON_STATE /* result */) {
+  // Add artist to song path
+  strcat(songPath, listBox->getSelection());
+  hal->system->printf("SP: %s\n", songPath);
+
+  if (!library->populateAlbums(songPath)) {
+    showError("Album Read Failed", INITIAL);
+    return;
+  }
+
+  listBox->setDataSource(ALBUM_DS);
+
+  listBox->clear();
+  listBox->setTitle("- Albums/CDs -");
+  listBox->setCenterFlag(true);
+
+  // Paint list box
+  listBox->doRepaint();
+
+  // Next state
+  state = AL_BUTTON_CHECK;
+}
+
+// AL_BUTTON_CHECK state handler
+void stateAlButtonCheck(enum BUTTON_STATE result) {
+  // Determine how many albums there are
+  int count = listBox->getListBoxCount();
+  int quarterCount = count / 4;
+  int halfCount = count / 2;
+
+  if (result != BS_NONE) {
+    updateTimeOut();
+  }
+
+  if (result == BS_MINUS) {
+    listBox->selectionUp(true);
+  }
+
+  else if (result == BS_MINUSP) {
+    for (int i = 0; i < quarterCount; i++) {
+      listBox->selectionUp(false);
+    }
+    listBox->doRepaint();
+  }
+
+  else if (result == BS_MINUSPP) {
+    for (int i = 0; i < halfCount; i++) {
+      listBox->selectionUp(false);
+    }
+    listBox->doRepaint();
+  }
+
+  else if (result == BS_PLUS) {
+    listBox->selectionDown(true);
+  }
+
+  else if (result == BS_PLUSP) {
+    for (int i = 0; i < quarterCount; i++) {
+      listBox->selectionDown(false);
+    }
+    listBox->doRepaint();
+  }
+
+  else if (result == BS_PLUSPP) {
+    for (int i = 0; i < halfCount; i++) {
+      listBox->selectionDown(false);
+    }
+    listBox->doRepaint();
+  }
+
+  else if (result == BS_BACK) {
+    // Root directory path
+    strcpy(songPath, "/");
+
+    // Back to artist selection
+    listBox->pop();
+
+    // Next state
+    state = AR_BUTTON_CHECK;
+  }
+
+  else if (result == BS_SELECT) {
+    // An album has been selected so save list box state
+    listBox->push();
+
+    // Next state
+    state = SG_POPULATE_LB;
+  }
+}
+
+// SG_POPULATE_LB state handler
+void stateSgPopulateLB(enum BUTTON_STATE /* result */) {
+  // Add album to song path
+  strcat(songPath, "/");
+  strcat(songPath, listBox->getSelection());
+
+  if (!library->populateSongs(songPath)) {
+    showError("Song Read Failed", INITIAL);
+    return;
+  }
+  listBox->setDataSource(SONG_DS);
+
+  listBox->clear();
+  listBox->setTitle("- Songs -");
+  listBox->setCenterFlag(true);
+
+  // Paint list box
+  listBox->doRepaint();
+
+  // Next state
+  state = SG_BUTTON_CHECK;
+}
+
+// SG_BUTTON_CHECK state handler
+void stateSgButtonCheck(enum BUTTON_STATE result) {
+  if (result != BS_NONE) {
+    updateTimeOut();
+  }
+
+  if (result == BS_MINUS) {
+    listBox->selectionUp(true);
+  }
+
+  else if (result == BS_PLUS) {
+    listBox->selectionDown(true);
+  }
+
+  else if (result == BS_BACK) {
+    // Find last forward slash in file path
+    char *lastSlash = strrchr(songPath, 0x2F);
+
+    // Terminate song path there
+    *lastSlash = '\0';
+
+    // Back to album selection
+    listBox->pop();
+
+    // Next state
+    state = AL_BUTTON_CHECK;
+  }
+
+  else if (result == BS_SELECT) {
+    // An song has been selected so save list box state
+    listBox->push();
+
+    // Next state
+    state = SG_PLAY;
+  }
+}
+
+// SG_PLAY state handler
+void stateSgPlay(enum BUTTON_STATE /* result */) {
+  // Stop any song playing
+  playing = false;
+  hal->player->stopSong();
+
+  // Add song filename to song path
+  strcat(songPath, "/");
+  strcat(songPath, listBox->getSelection());
+
+  hal->system->printf("File to play: %s\n", songPath);
+
+  // Play the song
+#if ENABLE_PLAY_STATS
+  countPlay();
+#endif
+  hal->player->playSong(songPath);
+#if ENABLE_LIBRARY_INDEX
+  findIndexedTrack(songPath);
+#endif
+
+  // Display the song playing
+  displaySongNowPlayingScreen(listBox->getSelection());
+
+  // Turn display back on if off for song change
+  updateTimeOut();
+
+  playing = true;
+
+  // Next state
+  state = SG_SONGSTATUS_CHECK;
+}
+
+// SG_SONGSTATUS_CHECK state handler
+void stateSgSongStatusCheck(enum BUTTON_STATE result) {
+  // Has the song ended ?
+  if (songEnded()) {
+    // Song has ended
+
+    // Stop any song playing
+    playing = false;
+    hal->player->stopSong();
+
+    // Are we looping on this song ?
+    if (looping) {
+      // Looping
+    } else {
+      // Not looping
+      if (playMode == SEQUENTIAL) {
+        listBox->selectionDown(false);
+      } else {
+        listBox->selectRandomEntry(false);
+      }
+      listBox->updatePush();
+    }
+
+    // Next state
+    state = SG_PATH_RESET;
+    return;
+  }
+
+  // If skipInput is true we are trying to consume
+  // the first button press because it should just
+  // turn the backlight back on. Remote presses act immediately.
+
+  if (skipInput && !inputQueued) {
+    if (result != 0) {
+      skipInput = false;
+      updateTimeOut();
+
+      // Stay in this state
+      return;
+    }
+  }
+  if (result != BS_NONE) {
+    updateTimeOut();
+  }
+
+  if (result == BS_MINUS) {
+    // Stop any song playing
+    playing = false;
+    hal->player->stopSong();
+
+    listBox->selectionUp(false);
+    listBox->updatePush();
+
+    // Next state
+    state = SG_PATH_RESET;
+  }
+
+  else if (result == BS_PLUS) {
+    // Stop any song playing
+    playing = false;
+    hal->player->stopSong();
+
+    listBox->selectionDown(false);
+    listBox->updatePush();
+
+    // Next state
+    state = SG_PATH_RESET;
+  }
+
+  else if (result == BS_MINUSP) {
+    // Skip back within the song
+    hal->player->skip(-SCRUB_PERCENT);
+  }
+
+  else if (result == BS_PLUSP) {
+    // Skip forward within the song
+    hal->player->skip(SCRUB_PERCENT);
+  }
+
+  else if (result == BS_BACK) {
+    hal->player->stopSong();
+    playing = false;
+
+    // Back to song selection
+    listBox->pop();
+
+    // Remove previous song from song path
+    char *lastSlash = strrchr(songPath, 0x2F);
+    *lastSlash = '\0';
+
+    // Next state
+    state = SG_BUTTON_CHECK;
+  }
+
+  else if ((result == BS_SELECT) || (result == BS_TOUCHED)) {
+    // Select button during song playback brings up actions screen
+    // Pause the music
+    hal->player->stopSong();
+    playing = false;
+
+    // Next state
+    state = AC_DISPLAY;
+  }
+
+  else if (displayTimedOut()) {
+    // If skipInput is true
+    // Ignore the button press that turns the display backlight on
+    skipInput = true;
+    hal->display->backlight(false);
+  }
+}
+
+// SG_PATH_RESET state handler
+void stateSgPathReset(enum BUTTON_STATE /* result */) {
+  // Remove previous song from song path
+  char *lastSlash = strrchr(songPath, 0x2F);
+  *lastSlash = '\0';
+
+  // Next state
+  state = SG_PLAY;
+}
+
+// AC_DISPLAY state handler
+void stateAcDisplay(enum BUTTON_STATE /* result */) {
+  // Display the action screen
+  displayActionScreen(looping);
+
+  // Next state
+  state = AC_BUTTON_CHECK;
+}
+
+// AC_BUTTON_CHECK state handler
+void stateAcButtonCheck(enum BUTTON_STATE result) {
+  if (result != BS_NONE) {
+    updateTimeOut();
+  }
+
+  if (result == BS_MINUS) {
+    hal->player->volumeDown();
+  }
+
+  else if (result == BS_PLUS) {
+    hal->player->volumeUp();
+  }
+
+  else if (result == BS_BACK) {
+    looping = !looping;
+
+    // Next state
+    state = AC_DISPLAY;
+  }
+
+  else if (result == BS_SELECT) {
+    // Turn music back on
+    hal->player->resume();
+    playing = true;
+
+    // Display song now playing
+    displaySongNowPlayingScreen(listBox->getSelection());
+
+    // Next state
+#if ENABLE_BROWSE_INDEX
+    if (listBox->getDataSource() == BROWSE_ENTRY_DS) {
+      state = BX_SONGSTATUS_CHECK;
+      return;
+    }
+#endif
+    state = SG_SONGSTATUS_CHECK;
+  }
+}
+
+// SH_PICKANDPLAY state handler
+void stateShPickAndPlay(enum BUTTON_STATE /* result */) {
+  // Stop any song playing
+  playing = false;
+  hal->player->stopSong();
+
+#if ENABLE_SHUFFLE_HISTORY
+  // Go back or forward through the songs played, else pick a new one
+  uint32_t track;
+  boolean stepped = libraryIndex.isOpen() &&
+                    ((shuffleMove == SM_BACK) ? shuffleHistory.back(&track) : shuffleHistory.forward(&track));
+  shuffleMove = SM_FORWARD;
+  boolean read = stepped ? libraryIndex.getTrack(track, songPath, &indexedTrack) :
+                           library->pickShuffledSong(songPath, sizeof(songPath));
+#else
+  // Pick a shuffled song
+  boolean read = library->pickShuffledSong(songPath, sizeof(songPath));
+#endif
+  if (!read) {
+    showError("Song Read Failed", INITIAL);
+    return;
+  }
+
+  // Play the song
+#if ENABLE_PLAY_STATS
+  countPlay();
+#endif
+  hal->player->playSong(songPath);
+#if ENABLE_SHUFFLE_HISTORY
+  if (stepped) {
+    useIndexedTrack(true, track);
+  } else {
+    // Remember the new song
+    uint32_t number = UINT32_MAX;
+    boolean found = libraryIndex.find(songPath, &indexedTrack, &number);
+    useIndexedTrack(found, number);
+    if (found) {
+      shuffleHistory.add(number);
+    }
+  }
+#elif ENABLE_LIBRARY_INDEX
+  findIndexedTrack(songPath);
+#endif
+
+  // Display song now playing
+  displaySongNowPlayingScreen(strrchr(songPath, '/') + 1);
+
+  playing = true;
+
+  // Next state
+  state = SH_BUTTONSTATUS_CHECK;
+}
+
+// SH_BUTTONSTATUS_CHECK state handler
+void stateShButtonStatusCheck(enum BUTTON_STATE result) {
+  // Has the song ended ?
+  if (songEnded()) {
+    // Song has ended
+    // Pick a new song to play
+    state = SH_PICKANDPLAY;
+    return;
+  }
+
+  // If skipInput is true we are trying to consume
+  // the first button press because it should just
+  // turn the backlight back on. Remote presses act immediately.
+
+  if (skipInput && !inputQueued) {
+    if (result != 0) {
+      skipInput = false;
+      updateTimeOut();
+      // Stay in this state
+      return;
+    }
+  }
+  if (result != BS_NONE) {
+    updateTimeOut();
+  }
+
+  if (result == BS_MINUS) {
+#if ENABLE_SHUFFLE_HISTORY
+    // Back to the song before, or a new one with no history
+    shuffleMove = SM_BACK;
+#endif
+    // Next state
+    state = SH_PICKANDPLAY;
+  }
+
+  else if (result == BS_PLUS) {
+    // Next state
+    state = SH_PICKANDPLAY;
+  }
+
+  else if (result == BS_MINUSP) {
+    // Skip back within the song
+    hal->player->skip(-SCRUB_PERCENT);
+  }
+
+  else if (result == BS_PLUSP) {
+    // Skip forward within the song
+    hal->player->skip(SCRUB_PERCENT);
+  }
+
+  else if (result == BS_BACK) {
+    hal->player->stopSong();
+    playing = false;
+
+    // Back to song selection
+    listBox->pop();
+
+    // Next state
+    state = OP_BUTTON_CHECK;
+  }
+
+  else if (result == BS_SELECT) {
+    // Select button doesn't do anything
+  }
+
+  else if (displayTimedOut()) {
+    // If skipInput is true
+    // Ignore the button press that turns the display backlight on
+    skipInput = true;
+    hal->display->backlight(false);
+  }
+}
+
+// ER_DISPLAY state handler
+void stateErDisplay(enum BUTTON_STATE /* result */) {
+  // Display the error and the on screen buttons
+  displayErrorScreen();
+  hal->input->drawButtons();
+  updateTimeOut();
+
+  // Next state
+  state = ER_BUTTON_CHECK;
+}
+
+// ER_BUTTON_CHECK state handler
+void stateErButtonCheck(enum BUTTON_STATE result) {
+  if (result != BS_NONE) {
+    updateTimeOut();
+
+    // Next state is a retry of whatever failed
+    state = errorRetryState;
+  }
+}
+
+#if ENABLE_SD_TUNING
+// SD_TEST state handler
+void stateSdTest(enum BUTTON_STATE /* result */) {
+  // Clear screen area, draw outline and title
+  clearListboxArea();
+  hal->display->drawCenteredText(calcLineOffset(0), "- SD Card Test -");
+  hal->display->drawCenteredText(calcLineOffset(2), "Testing...");
+
+  // Re-tune the clock then benchmark it. The card is restarted at
+  // each clock so nothing may stay open on it.
+  HAL_CARD_TEST test;
+  closeCardFiles();
+  boolean ok = hal->card->test(&test);
+  openCardFiles();
+
+  // Show the results in the small font
+  clearListboxArea();
+  hal->display->drawCenteredText(calcLineOffset(0), "- SD Card Test -");
+  hal->display->setTextSize(1);
+
+  char buffer[40];
+  int y = 50;
+  for (int i = 0; i < test.probeCount; i++) {
+    const HAL_CARD_PROBE *p = &test.probes[i];
+    if (p->ok) {
+      sprintf(buffer, "%2d MHz  ok  %4lu KB/s", p->mhz, (unsigned long) p->readKBps);
+    } else {
+      sprintf(buffer, "%2d MHz  failed", p->mhz);
+    }
+    hal->display->drawText(20, y, buffer);
+    y += 12;
+  }
+  y += 6;
+
+  if (ok) {
+    sprintf(buffer, "Using %d MHz", test.mhz);
+    hal->display->drawText(20, y, buffer);
+    y += 12;
+    sprintf(buffer, "%s, %lu KB clusters", test.format, (unsigned long) test.clusterKB);
+    hal->display->drawText(20, y, buffer);
+    y += 18;
+    sprintf(buffer, "Sequential  %4lu KB/s", (unsigned long) test.seqKBps);
+    hal->display->drawText(20, y, buffer);
+    y += 12;
+    sprintf(buffer, "Random avg  %4lu us", (unsigned long) test.randomAvgUs);
+    hal->display->drawText(20, y, buffer);
+    y += 12;
+    sprintf(buffer, "Random max  %4lu us", (unsigned long) test.randomMaxUs);
+    hal->display->drawText(20, y, buffer);
+    y += 12;
+    if (test.errors != 0) {
+      sprintf(buffer, "Read errors %4lu", (unsigned long) test.errors);
+      hal->display->drawText(20, y, buffer);
+    }
+    hal->system->printf("SD %d MHz: sequential %lu KB/s, random %lu us avg %lu us max, %lu errors\n",
+                        test.mhz, (unsigned long) test.seqKBps,
+                        (unsigned long) test.randomAvgUs, (unsigned long) test.randomMaxUs,
+                        (unsigned long) test.errors);
+  } else {
+    hal->display->setTextColor(COLOR_RED, SCREEN_COLOR);
+    hal->display->drawText(20, y, "SD card failed");
+    hal->display->setTextColor(SCREEN_TEXT_COLOR, SCREEN_COLOR);
+  }
+  hal->display->setTextSize(2);
+  hal->display->drawCenteredText(calcLineOffset(6), "Any button");
+
+  // Next state
+  state = SD_TEST_WAIT;
+}
+
+// SD_TEST_WAIT state handler
+void stateSdTestWait(enum BUTTON_STATE result) {
+  if (result == BS_NONE) {
+    return;
+  }
+  updateTimeOut();
+
+  // Back to operation selection
+  listBox->pop();
+  hal->input->drawButtons();
+
+  // Next state
+  state = OP_BUTTON_CHECK;
+}
+#endif
+
+#if ENABLE_FTP_REMOTE
+// RA_WIFI_CONNECT state handler
+void stateRaWiFiConnect(enum BUTTON_STATE /* result */) {
+  // Display the WiFi screen
+  displayWiFiScreen();
+
+  // Start the WiFi connection
+  hal->remote->startConnect();
+
+  // Next state
+  state = RA_WIFI_WAIT;
+}
+
+// RA_WIFI_WAIT state handler
+void stateRaWiFiWait(enum BUTTON_STATE /* result */) {
+  switch (hal->remote->pollConnect()) {
+    case WCS_CONNECTING:
+      break;
+
+    case WCS_CONNECTED:
+      // Next state
+      state = RA_DISPLAY;
+      break;
+
+    case WCS_FAILED:
+      blinkCount = 0;
+      blinkAtMs = hal->time->millis();
+
+      // Next state
+      state = RA_CONNECT_FAILED;
+      break;
+  }
+}
+
+// RA_CONNECT_FAILED state handler
+void stateRaConnectFailed(enum BUTTON_STATE /* result */) {
+  // Blink the failure message then reboot
+  if ((int32_t)(hal->time->millis() - blinkAtMs) < 0) {
+    return;
+  }
+  if (blinkCount >= CONNECT_FAIL_BLINKS) {
+    // Reboot the ESP32
+    hal->system->restart();
+    return;
+  }
+
+  if ((blinkCount & 1) == 0) {
+    hal->display->setTextColor(COLOR_RED, SCREEN_COLOR);
+    hal->display->drawCenteredText(calcLineOffset(2), "Connect Failed");
+  } else {
+    hal->display->clearScreen();
+  }
+  blinkCount++;
+  blinkAtMs += CONNECT_FAIL_BLINK_MS;
+}
+
+// RA_DISPLAY state handler
+void stateRaDisplay(enum BUTTON_STATE /* result */) {
+  displayUploadScreen();
+
+  // Indicating we are uploading
+  uploading = true;
+
+  // Next state
+  state = RA_BUTTON_CHECK;
+}
+
+// RA_BUTTON_CHECK state handler
+void stateRaButtonCheck(enum BUTTON_STATE result) {
+  if (result != BS_NONE) {
+
+    // Indicate not uploading
+    uploading = false;
+
+    // Next state is complete restart
+    state = INITIAL;
+  }
+}
+#endif
+
+#if ENABLE_BROWSE_INDEX
+// Library index track number of entry i of the group or playlist open
+uint32_t browseTrack(int i) {
+#if ENABLE_PLAYLISTS
+  if (browseMode == BROWSE_PLAYLISTS) {
+    return playlist.getTrack(i);
+  }
+#endif
+  return browseIndex.getTrack(i);
+}
+
+// BX_OPEN state handler
+void stateBxOpen(enum BUTTON_STATE /* result */) {
+#if ENABLE_PLAYLISTS
+  // The playlists on the card in place of a browse index's groups
+  if (browseMode == BROWSE_PLAYLISTS) {
+    if (!libraryIndex.isOpen()) {
+      showError("Run libprep First", INITIAL);
+      return;
+    }
+    if (!Playlist::list(hal->fs, PLAYLIST_DIR, browseGroups) || (browseGroups.size() == 0)) {
+      showError("No Playlists Found", INITIAL);
+      return;
+    }
+  } else
+#endif
+  // Read the groups of the selected browse index
+  if (!browseIndex.open(hal->fs, BROWSE_PATHS[browseMode], browseGroups) || !libraryIndex.isOpen()) {
+    showError("Run libprep First", INITIAL);
+    return;
+  }
+  listBox->setDataSource(BROWSE_GROUP_DS);
+
+  listBox->clear();
+#if ENABLE_PLAYLISTS
+  listBox->setTitle((browseMode == BROWSE_PLAYLISTS) ? "- Playlists -" : BROWSE_TITLES[browseMode]);
+#else
+  listBox->setTitle(BROWSE_TITLES[browseMode]);
+#endif
+  listBox->setCenterFlag(true);
+
+  // Paint list box
+  listBox->doRepaint();
+
+  // Next state
+  state = BX_GROUP_CHECK;
+}
+
+// BX_GROUP_CHECK state handler
+void stateBxGroupCheck(enum BUTTON_STATE result) {
+  if (result != BS_NONE) {
+    updateTimeOut();
+  }
+
+  if (result == BS_MINUS) {
+    listBox->selectionUp(true);
+  }
+
+  else if (result == BS_PLUS) {
+    listBox->selectionDown(true);
+  }
+
+  else if (result == BS_BACK) {
+    browseIndex.close();
+#if ENABLE_PLAYLISTS
+    playlist.close();
+#endif
+
+    // Back to operation selection
+    listBox->pop();
+
+    // Next state
+    state = OP_BUTTON_CHECK;
+  }
+
+  else if (result == BS_SELECT) {
+    // A group has been selected so save list box state
+    listBox->push();
+
+    // Next state
+    state = BX_ENTRIES_POPULATE_LB;
+  }
+}
+
+// BX_ENTRIES_POPULATE_LB state handler
+void stateBxEntriesPopulateLB(enum BUTTON_STATE /* result */) {
+  std::string group = listBox->getSelection();
+#if ENABLE_PLAYLISTS
+  if (browseMode == BROWSE_PLAYLISTS) {
+    // The playlist's cache, or every entry found in the library index
+    // the first time
+    std::string path = PLAYLIST_DIR + group;
+    uint32_t startMs = hal->time->millis();
+    if (!playlist.open(hal->fs, path.c_str(), &libraryIndex, browseEntries)) {
+      showError("Playlist Read Failed", INITIAL);
+      return;
+    }
+    hal->system->printf("Playlist %s: %d songs, %lu not found, %s in %lu ms\n", group.c_str(),
+                        playlist.getEntryCount(), (unsigned long) playlist.getMissing(),
+                        playlist.wasCached() ? "cached" : "resolved",
+                        (unsigned long)(hal->time->millis() - startMs));
+    if (playlist.getEntryCount() == 0) {
+      showError("No Songs Found", INITIAL);
+      return;
+    }
+    group = group.substr(0, group.rfind('.'));
+  } else
+#endif
+  // One seek to the group's block
+  if (!browseIndex.openGroup(listBox->getSelectionIndex(), browseEntries)) {
+    showError("Browse Read Failed", INITIAL);
+    return;
+  }
+  listBox->setDataSource(BROWSE_ENTRY_DS);
+
+  listBox->clear();
+  listBox->setTitle(group.c_str());
+  listBox->setCenterFlag(false);
+
+  // Paint list box
+  listBox->doRepaint();
+
+  // Next state
+  state = BX_ENTRY_CHECK;
+}
+
+// BX_ENTRY_CHECK state handler
+void stateBxEntryCheck(enum BUTTON_STATE result) {
+  if (result != BS_NONE) {
+    updateTimeOut();
+  }
+
+  if (result == BS_MINUS) {
+    listBox->selectionUp(true);
+  }
+
+  else if (result == BS_PLUS) {
+    listBox->selectionDown(true);
+  }
+
+  else if (result == BS_BACK) {
+    // Back to group selection
+    listBox->pop();
+
+    // Next state
+    state = BX_GROUP_CHECK;
+  }
+
+  else if (result == BS_SELECT) {
+    // A song has been selected so save list box state
+    listBox->push();
+
+    // Next state
+    state = BX_PLAY;
+  }
+}
+
+// BX_PLAY state handler
+void stateBxPlay(enum BUTTON_STATE /* result */) {
+  // Stop any song playing
+  playing = false;
+  hal->player->stopSong();
+
+  // The song's path from its place in the library index
+  char path[256];
+  if (!libraryIndex.getPath(browseTrack(listBox->getSelectionIndex()), path) ||
+      (strlen(path) >= sizeof(songPath))) {
+    showError("Browse Read Failed", INITIAL);
+    return;
+  }
+  strcpy(songPath, path);
+
+  hal->system->printf("File to play: %s\n", songPath);
+
+  // Play the song
+#if ENABLE_PLAY_STATS
+  countPlay();
+#endif
+  hal->player->playSong(songPath);
+  findIndexedTrack(songPath);
+
+  // Display the song playing
+  displaySongNowPlayingScreen(strrchr(songPath, '/') + 1);
+
+  // Turn display back on if off for song change
+  updateTimeOut();
+
+  playing = true;
+
+  // Next state
+  state = BX_SONGSTATUS_CHECK;
+}
+
+// BX_SONGSTATUS_CHECK state handler
+void stateBxSongStatusCheck(enum BUTTON_STATE result) {
+  // Has the song ended ?
+  if (songEnded()) {
+    // Song has ended so play the next in the group unless looping
+    if (!looping) {
+      listBox->selectionDown(false);
+      listBox->updatePush();
+    }
+
+    // Next state
+    state = BX_PLAY;
+    return;
+  }
+
+  // If skipInput is true we are trying to consume
+  // the first button press because it should just
+  // turn the backlight back on. Remote presses act immediately.
+
+  if (skipInput && !inputQueued) {
+    if (result != 0) {
+      skipInput = false;
+      updateTimeOut();
+
+      // Stay in this state
+      return;
+    }
+  }
+  if (result != BS_NONE) {
+    updateTimeOut();
+  }
+
+  if (result == BS_MINUS) {
+    listBox->selectionUp(false);
+    listBox->updatePush();
+
+    // Next state
+    state = BX_PLAY;
+  }
+
+  else if (result == BS_PLUS) {
+    listBox->selectionDown(false);
+    listBox->updatePush();
+
+    // Next state
+    state = BX_PLAY;
+  }
+
+  else if (result == BS_MINUSP) {
+    // Skip back within the song
+    hal->player->skip(-SCRUB_PERCENT);
+  }
+
+  else if (result == BS_PLUSP) {
+    // Skip forward within the song
+    hal->player->skip(SCRUB_PERCENT);
+  }
+
+  else if (result == BS_BACK) {
+    hal->player->stopSong();
+    playing = false;
+
+    // Back to song selection
+    listBox->pop();
+
+    // Next state
+    state = BX_ENTRY_CHECK;
+  }
+
+  else if ((result == BS_SELECT) || (result == BS_TOUCHED)) {
+    // Select button during song playback brings up actions screen
+    // Pause the music
+    hal->player->stopSong();
+    playing = false;
+
+    // Next state
+    state = AC_DISPLAY;
+  }
+
+  else if (displayTimedOut()) {
+    // If skipInput is true
+    // Ignore the button press that turns the display backlight on
+    skipInput = true;
+    hal->display->backlight(false);
+  }
+}
+#endif
+
+#if ENABLE_ALBUM_SHUFFLE
+// AS_START state handler
+void stateAsStart(enum BUTTON_STATE /* result */) {
+  // Shuffle the albums of the album index
+  if (!libraryIndex.isOpen() || !albumShuffle.open(hal->fs, &libraryIndex)) {
+    showError("Run libprep First", INITIAL);
+    return;
+  }
+  albumMove = AM_NEXT_SONG;
+
+  // Next state
+  state = AS_PLAY;
+}
+
+// AS_PLAY state handler
+void stateAsPlay(enum BUTTON_STATE /* result */) {
+  // Stop any song playing
+  playing = false;
+  hal->player->stopSong();
+
+  // Move on to the next song, reading its record into indexedTrack
+  boolean moved;
+  switch (albumMove) {
+    case AM_PREVIOUS_SONG:
+      moved = albumShuffle.previousSong(&indexedTrack);
+      break;
+    case AM_NEXT_ALBUM:
+      moved = albumShuffle.nextAlbum(&indexedTrack);
+      break;
+    default:
+      moved = albumShuffle.nextSong(&indexedTrack);
+      break;
+  }
+  if (!moved || (strlen(albumShuffle.getPath()) >= sizeof(songPath))) {
+    showError("Song Read Failed", INITIAL);
+    return;
+  }
+  strcpy(songPath, albumShuffle.getPath());
+
+  hal->system->printf("File to play: %s\n", songPath);
+
+  // Play the song
+#if ENABLE_PLAY_STATS
+  countPlay();
+#endif
+  hal->player->playSong(songPath);
+  useIndexedTrack(true, albumShuffle.getTrackNumber());
+
+  // Display the song playing
+  displaySongNowPlayingScreen(strrchr(songPath, '/') + 1);
+
+  // Turn display back on if off for song change
+  updateTimeOut();
+
+  playing = true;
+
+  // Next state
+  state = AS_SONGSTATUS_CHECK;
+}
+
+// AS_SONGSTATUS_CHECK state handler
+void stateAsSongStatusCheck(enum BUTTON_STATE result) {
+  // Has the song ended ?
+  if (songEnded()) {
+    // Song has ended so play the next
+    albumMove = AM_NEXT_SONG;
+
+    // Next state
+    state = AS_PLAY;
+    return;
+  }
+
+  // Read the next album ahead during the last song of this one
+  if (result == BS_NONE) {
+    albumShuffle.prefetch();
+  }
+
+  // If skipInput is true we are trying to consume
+  // the first button press because it should just
+  // turn the backlight back on. Remote presses act immediately.
+
+  if (skipInput && !inputQueued) {
+    if (result != 0) {
+      skipInput = false;
+      updateTimeOut();
+
+      // Stay in this state
+      return;
+    }
+  }
+  if (result != BS_NONE) {
+    updateTimeOut();
+  }
+
+  if (result == BS_MINUS) {
+    albumMove = AM_PREVIOUS_SONG;
+
+    // Next state
+    state = AS_PLAY;
+  }
+
+  else if (result == BS_PLUS) {
+    albumMove = AM_NEXT_SONG;
+
+    // Next state
+    state = AS_PLAY;
+  }
+
+  else if (result == BS_MINUSP) {
+    // Skip back within the song
+    hal->player->skip(-SCRUB_PERCENT);
+  }
+
+  else if (result == BS_PLUSP) {
+    // Skip forward within the song
+    hal->player->skip(SCRUB_PERCENT);
+  }
+
+  else if (result == BS_BACK) {
+    hal->player->stopSong();
+    playing = false;
+    albumShuffle.close();
+
+    // Back to operation selection
+    listBox->pop();
+
+    // Next state
+    state = OP_BUTTON_CHECK;
+  }
+
+  else if (result == BS_SELECT) {
+    // Select skips the rest of the album
+    albumMove = AM_NEXT_ALBUM;
+
+    // Next state
+    state = AS_PLAY;
+  }
+
+  else if (displayTimedOut()) {
+    // If skipInput is true
+    // Ignore the button press that turns the display backlight on
+    skipInput = true;
+    hal->display->backlight(false);
+  }
+}
+#endif
+
+#if ENABLE_SMART_SHUFFLE
+// SS_START state handler
+void stateSsStart(enum BUTTON_STATE /* result */) {
+  // Weigh the songs by their play statistics
+  if (!libraryIndex.isOpen() || !smartShuffle.open(&playStats)) {
+    showError("Run libprep First", INITIAL);
+    return;
+  }
+
+  // Next state
+  state = SS_PICKANDPLAY;
+}
+
+// SS_PICKANDPLAY state handler
+void stateSsPickAndPlay(enum BUTTON_STATE /* result */) {
+  // Stop any song playing
+  playing = false;
+  hal->player->stopSong();
+
+  // Pick a song by weight and read its record into indexedTrack
+  char path[256];
+  uint32_t track = smartShuffle.pick();
+  if (!libraryIndex.getTrack(track, path, &indexedTrack) || (strlen(path) >= sizeof(songPath))) {
+    showError("Song Read Failed", INITIAL);
+    return;
+  }
+  strcpy(songPath, path);
+
+  // Play the song, counting the last one
+  countPlay();
+  hal->player->playSong(songPath);
+  useIndexedTrack(true, track);
+
+  // Display song now playing
+  displaySongNowPlayingScreen(strrchr(songPath, '/') + 1);
+
+  playing = true;
+
+  // Next state
+  state = SS_SONGSTATUS_CHECK;
+}
+
+// SS_SONGSTATUS_CHECK state handler
+void stateSsSongStatusCheck(enum BUTTON_STATE result) {
+  // Has the song ended ?
+  if (songEnded()) {
+    // Song has ended so pick a new song
+    state = SS_PICKANDPLAY;
+    return;
+  }
+
+  // If skipInput is true we are trying to consume
+  // the first button press because it should just
+  // turn the backlight back on. Remote presses act immediately.
+
+  if (skipInput && !inputQueued) {
+    if (result != 0) {
+      skipInput = false;
+      updateTimeOut();
+      // Stay in this state
+      return;
+    }
+  }
+  if (result != BS_NONE) {
+    updateTimeOut();
+  }
+
+  if ((result == BS_MINUS) || (result == BS_PLUS)) {
+    // Next state
+    state = SS_PICKANDPLAY;
+  }
+
+  else if (result == BS_MINUSP) {
+    // Skip back within the song
+    hal->player->skip(-SCRUB_PERCENT);
+  }
+
+  else if (result == BS_PLUSP) {
+    // Skip forward within the song
+    hal->player->skip(SCRUB_PERCENT);
+  }
+
+  else if (result == BS_BACK) {
+    hal->player->stopSong();
+    playing = false;
+    smartShuffle.close();
+
+    // Back to operation selection
+    listBox->pop();
+
+    // Next state
+    state = OP_BUTTON_CHECK;
+  }
+
+  else if (displayTimedOut()) {
+    // If skipInput is true
+    // Ignore the button press that turns the display backlight on
+    skipInput = true;
+    hal->display->backlight(false);
+  }
+}
+#endif
+
+// FSM state table. One entry per STATES value, in the same order.
+typedef void (*stateHandler)(enum BUTTON_STATE result);
+
+typedef struct {
+  const char *name;
+  stateHandler handler;
+  boolean takesInput;
+} STATE_ENTRY;
+
+const STATE_ENTRY stateTable[] = {
+  { "BOOT_SD_INIT", stateBootSdInit, false },
+  { "BOOT_BT_INIT", stateBootBtInit, false },
+  { "BOOT_LCD_WAIT", stateBootLcdWait, false },
+  { "BOOT_SCAN", stateBootScan, false },
+  { "BOOT_WELCOME_WAIT", stateBootWelcomeWait, true },
+  { "INITIAL", stateInitial, false },
+  { "OP_POPULATE_LB", stateOpPopulateLB, false },
+  { "OP_BUTTON_CHECK", stateOpButtonCheck, true },
+  { "OP_DISPATCH", stateOpDispatch, false },
+  { "BT_START", stateBtStart, false },
+  { "BT_CONNECT_WAIT", stateBtConnectWait, true },
+  { "AR_POPULATE_LB", stateArPopulateLB, false },
+  { "AR_BUTTON_CHECK", stateArButtonCheck, true },
+  { "AL_POPULATE_LB", stateAlPopulateLB, false },
+  { "AL_BUTTON_CHECK", stateAlButtonCheck, true },
+  { "SG_POPULATE_LB", stateSgPopulateLB, false },
+  { "SG_BUTTON_CHECK", stateSgButtonCheck, true },
+  { "SG_PLAY", stateSgPlay, false },
+  { "SG_SONGSTATUS_CHECK", stateSgSongStatusCheck, true },
+  { "SG_PATH_RESET", stateSgPathReset, false },
+  { "AC_DISPLAY", stateAcDisplay, false },
+  { "AC_BUTTON_CHECK", stateAcButtonCheck, true },
+  { "SH_PICKANDPLAY", stateShPickAndPlay, false },
+  { "SH_BUTTONSTATUS_CHECK", stateShButtonStatusCheck, true },
+  { "ER_DISPLAY", stateErDisplay, false },
+  { "ER_BUTTON_CHECK", stateErButtonCheck, true },
+#if ENABLE_SD_TUNING
+  { "SD_TEST", stateSdTest, false },
+  { "SD_TEST_WAIT", stateSdTestWait, true },
+#else
+  { "SD_TEST", NULL, false },
+  { "SD_TEST_WAIT", NULL, false },
+#endif
+#if ENABLE_FTP_REMOTE
+  { "RA_WIFI_CONNECT", stateRaWiFiConnect, false },
+  { "RA_WIFI_WAIT", stateRaWiFiWait, false },
+  { "RA_CONNECT_FAILED", stateRaConnectFailed, false },
+  { "RA_DISPLAY", stateRaDisplay, false },
+  { "RA_BUTTON_CHECK", stateRaButtonCheck, true },
+#else
+  { "RA_WIFI_CONNECT", NULL, false },
+  { "RA_WIFI_WAIT", NULL, false },
+  { "RA_CONNECT_FAILED", NULL, false },
+  { "RA_DISPLAY", NULL, false },
+  { "RA_BUTTON_CHECK", NULL, false },
+#endif
+#if ENABLE_BROWSE_INDEX
+  { "BX_OPEN", stateBxOpen, false },
+  { "BX_GROUP_CHECK", stateBxGroupCheck, true },
+  { "BX_ENTRIES_POPULATE_LB", stateBxEntriesPopulateLB, false },
+  { "BX_ENTRY_CHECK", stateBxEntryCheck, true },
+  { "BX_PLAY", stateBxPlay, false },
+  { "BX_SONGSTATUS_CHECK", stateBxSongStatusCheck, true },
+#else
+  { "BX_OPEN", NULL, false },
+  { "BX_GROUP_CHECK", NULL, false },
+  { "BX_ENTRIES_POPULATE_LB", NULL, false },
+  { "BX_ENTRY_CHECK", NULL, false },
+  { "BX_PLAY", NULL, false },
+  { "BX_SONGSTATUS_CHECK", NULL, false },
+#endif
+#if ENABLE_ALBUM_SHUFFLE
+  { "AS_START", stateAsStart, false },
+  { "AS_PLAY", stateAsPlay, false },
+  { "AS_SONGSTATUS_CHECK", stateAsSongStatusCheck, true },
+#else
+  { "AS_START", NULL, false },
+  { "AS_PLAY", NULL, false },
+  { "AS_SONGSTATUS_CHECK", NULL, false },
+#endif
+#if ENABLE_SMART_SHUFFLE
+  { "SS_START", stateSsStart, false },
+  { "SS_PICKANDPLAY", stateSsPickAndPlay, false },
+  { "SS_SONGSTATUS_CHECK", stateSsSongStatusCheck, true },
+#else
+  { "SS_START", NULL, false },
+  { "SS_PICKANDPLAY", NULL, false },
+  { "SS_SONGSTATUS_CHECK", NULL, false },
+#endif
+};
+
+static_assert(sizeof(stateTable) / sizeof(stateTable[0]) == STATE_COUNT,
+              "stateTable must have an entry for every STATES value");
+
+// Get the name of a state
+const char *stateName(int s) {
+  return stateTable[s].name;
+}
+
+
+/****************************************************************/
+/***                    Starting and Running                  ***/
+/****************************************************************/
+
+// Start the FSM on _hal. idle is called while the library reads large
+// directories and hook, if not NULL, sees each button event first.
+void fsmBegin(HAL *_hal, libraryIdleCallback idle, fsmButtonHook hook) {
+
+  hal = _hal;
+  buttonHook = hook;
+
+  // Initialize control variables
+  playing = false;
+  looping = false;
+  skipInput = false;
+#if ENABLE_FTP_REMOTE
+  uploading = false;
+  libraryChanged = false;
+#endif
+  sdReady = false;
+  lcdReady = false;
+  bootProfiled = false;
+#if ENABLE_SESSION_LOG
+  sessionStarted = false;
+  replaying = false;
+#endif
+#if ENABLE_SD_TUNING
+  sdReadErrors = 0;
+#endif
+  state = BOOT_SD_INIT;
+
+  // Populate operation data source
+  operations.clear();
+  operations.push_back(std::string("Bluetooth"));
+  operations.push_back(std::string("Sequential Play"));
+  operations.push_back(std::string("Random Play"));
+  operations.push_back(std::string("Shuffle"));
+#if ENABLE_FTP_REMOTE
+  operations.push_back(std::string("Remote Access"));
+#endif
+#if ENABLE_SD_TUNING
+  operations.push_back(std::string("SD Card Test"));
+#endif
+#if ENABLE_BROWSE_INDEX
+  operations.push_back(std::string("Genres"));
+  operations.push_back(std::string("Decades"));
+  operations.push_back(std::string("Recently Added"));
+#endif
+#if ENABLE_PLAYLISTS
+  operations.push_back(std::string("Playlists"));
+#endif
+#if ENABLE_ALBUM_SHUFFLE
+  operations.push_back(std::string("Album Shuffle"));
+#endif
+#if ENABLE_SMART_SHUFFLE
+  operations.push_back(std::string("Smart Shuffle"));
+#endif
+
+  // Instantiate the list box and the music library
+  listBox = new ListBox(LISTBOX_LINES, LISTBOX_CHARS, paintListBox);
+  library = new MusicLibrary(hal->fs, idle);
+#if ENABLE_DIR_CACHE
+  library->setCache(&dirCache);
+#endif
+}
+
+// Run the handler of the current state once
+void fsmRun() {
+
+  const STATE_ENTRY *entry = &stateTable[state];
+  if (entry->handler != NULL) {
+    enum BUTTON_STATE result = entry->takesInput ? pollInput() : BS_NONE;
+    if ((result != BS_NONE) && (buttonHook != NULL) && buttonHook(result)) {
+      result = BS_NONE;
+    }
+    entry->handler(result);
+  }
+
+#if ENABLE_TRACE
+  // Mark state transitions on the timeline
+  static int tracedState = -1;
+  if (state != tracedState) {
+    tracedState = state;
+    TRACE_INSTANT(TE_FSM_STATE, state);
+  }
+#endif
+
+#if ENABLE_SESSION_LOG
+  // Log state changes and the songs started
+  if (state != sessionState) {
+    sessionState = state;
+    sessionOutput(SR_STATE, state, 0);
+  }
+  if (hal->player->getSongNumber() != sessionSong) {
+    if (sessionSong != sessionFirstSong) {
+      sessionOutput(SR_AUDIO, 0, hal->player->getLastSongBytes());
+    }
+    sessionSong = hal->player->getSongNumber();
+    sessionOutput(SR_PLAY, 0, halHash(HAL_HASH_SEED, songPath));
+  }
+#endif
+}
+
+#endif
@@ -0,0 +1,712 @@
+/*
+   Playlists
+
+   M3U, M3U8 and PLS playlists on the card, their songs found in the
+   library index (see LibraryIndex.h) and listed like a browse index
+   group (see BrowseIndex.h).
+
+   PlaylistParser reads a playlist a line at a time through a 512 byte
+   buffer, so a playlist of any length takes the same memory. It
+   handles a UTF-8 byte order mark, LF, CRLF and CR line ends, #EXTINF
+   titles, PLS FileN and TitleN keys in any case and Latin-1 .m3u and
+   .pls files. Lines longer than PLAYLIST_LINE_SIZE and stream URLs are
+   skipped. resolve() turns an entry into a card path: relative to the
+   playlist's folder, with \ for /, a drive letter or file:// URL
+   dropped and . and .. folded.
+
+   Looking a path up in the index is a binary search reading a path per
+   step, slow on the card for a long playlist. Playlist::open() does it
+   once with findNear(), since a playlist's songs often follow one
+   another in the index, and writes the track numbers and labels to a
+   cache file in PLAYLIST_CACHE_DIR. Opening it again reads just that
+   file while the playlist and index are unchanged. The cache is
+   stamped with the playlist's size, which a playlist edited in place
+   may keep, so whatever writes playlists to the card calls
+   removeCache() for them.
+
+   Cache file layout, little endian:
+
+     magic "CYDP", version, playlist size, index track count,
+     index size, entry count, songs not found       (uint32 each)
+     playlist path                                  string
+     entries: track number, label                   per entry
+
+   Strings are a uint8 length and that many UTF-8 bytes, as in the
+   library index. The version is written last, so a cache cut short is
+   made again. tools/hostplayer.cpp playlisttest checks the parser and
+   playlistbench times resolving against reading the cache.
+
+   Last Update: 10/18/2026
+*/
+
+#ifndef PLAYLIST_H
+#define PLAYLIST_H
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "FrontCodedList.h"
+#include "Hal.h"
+#include "LibraryIndex.h"
+
+#define PLAYLIST_CACHE_DIR "/.library/playlists"
+#define PLAYLIST_CACHE_MAGIC 0x50445943  // "CYDP"
+#define PLAYLIST_CACHE_VERSION 1
+#define PLAYLIST_CACHE_HEADER 28
+#define PLAYLIST_CACHE_PATH_SIZE (sizeof(PLAYLIST_CACHE_DIR) + 16)
+
+// Levels of the index's binary search kept while resolving, see
+// LibraryIndex::cacheTop()
+#ifndef PLAYLIST_TOP_LEVELS
+#define PLAYLIST_TOP_LEVELS 7
+#endif
+
+// Longest playlist line read, bytes
+#define PLAYLIST_LINE_SIZE 512
+
+// Playlist file extensions listed, see halHasExtension()
+static const char *const PLAYLIST_EXTENSIONS[] = { "m3u", "m3u8", "pls", NULL };
+
+enum PLAYLIST_FORMAT {PF_M3U, PF_M3U8, PF_PLS};
+
+// An entry as the playlist gives it. The title is empty if there's none.
+typedef struct {
+  char path[256];
+  char title[HAL_NAME_SIZE];
+} PLAYLIST_ENTRY;
+
+class PlaylistParser {
+
+public:
+
+  PlaylistParser() {
+    begin(NULL, PF_M3U);
+  }
+
+  void begin(HalFile *_file, enum PLAYLIST_FORMAT _format) {
+    file = _file;
+    format = _format;
+    have = 0;
+    used = 0;
+    skipLF = false;
+    firstLine = true;
+    skipped = 0;
+    pendingNumber = -1;
+    pendingPath[0] = '\0';
+    pendingTitle[0] = '\0';
+    title[0] = '\0';
+  }
+
+  // The format of a playlist by its extension
+  static enum PLAYLIST_FORMAT formatOf(const char *name) {
+    static const char *const m3u8[] = { "m3u8", NULL };
+    static const char *const pls[] = { "pls", NULL };
+    return halHasExtension(name, m3u8) ? PF_M3U8 : halHasExtension(name, pls) ? PF_PLS : PF_M3U;
+  }
+
+  // Read the next entry. Returns false at the end of the playlist.
+  boolean next(PLAYLIST_ENTRY *entry) {
+
+    while (readLine()) {
+      char *s = trim(line);
+      boolean latin1 = (format != PF_M3U8) && !isUtf8(s);
+      if (format == PF_PLS) {
+        if (plsLine(s, latin1, entry)) {
+          return true;
+        }
+      } else if (startsWith(s, "#extinf:")) {
+        // Duration and attributes, then the title after the first
+        // comma outside quotes
+        boolean quoted = false;
+        for (s += 8; (*s != '\0') && (quoted || (*s != ',')); s++) {
+          quoted ^= (*s == '"');
+        }
+        copyText(title, sizeof(title), (*s == ',') ? trim(s + 1) : s, latin1, true);
+      } else if ((*s != '\0') && (*s != '#')) {
+        boolean copied = copyText(entry->path, sizeof(entry->path), s, latin1, false);
+        strcpy(entry->title, title);
+        title[0] = '\0';
+        if (copied) {
+          return true;
+        }
+        skipped++;
+      }
+    }
+
+    // A PLS entry is only known complete when another starts
+    if ((format == PF_PLS) && (pendingPath[0] != '\0')) {
+      strcpy(entry->path, pendingPath);
+      strcpy(entry->title, pendingTitle);
+      pendingPath[0] = '\0';
+      return true;
+    }
+    return false;
+  }
+
+  // Entries skipped as their line or path was too long
+  uint32_t getSkipped() {
+    return skipped;
+  }
+
+  // The card path of entry path of a playlist in folder dir, into out
+  // of size bytes. Returns false for a stream URL, a path above the
+  // root or one too long.
+  static boolean resolve(const char *dir, const char *path, char *out, size_t size) {
+
+    char s[256];
+    size_t n = 0;
+    if (startsWith(path, "file://")) {
+      path += 7;
+      if (startsWith(path, "localhost/")) {
+        path += 9;
+      }
+      // Undo %XX escapes
+      for (; (*path != '\0') && (n < sizeof(s) - 1); path++) {
+        int hi, lo;
+        if ((*path == '%') && ((hi = hexDigit(path[1])) >= 0) && ((lo = hexDigit(path[2])) >= 0)) {
+          s[n++] = (hi << 4) | lo;
+          path += 2;
+        } else {
+          s[n++] = *path;
+        }
+      }
+    } else if (strstr(path, "://") != NULL) {
+      return false;
+    } else {
+      for (; (*path != '\0') && (n < sizeof(s) - 1); path++) {
+        s[n++] = *path;
+      }
+    }
+    if (*path != '\0') {
+      return false;
+    }
+    s[n] = '\0';
+
+    // Windows paths, and a drive letter taken as the card's root
+    for (char *p = s; *p != '\0'; p++) {
+      if (*p == '\\') {
+        *p = '/';
+      }
+    }
+    char *p = s;
+    if ((p[0] == '/') && isalpha((uint8_t) p[1]) && (p[2] == ':')) {
+      p++;
+    }
+    boolean absolute = (p[0] == '/');
+    if (isalpha((uint8_t) p[0]) && (p[1] == ':')) {
+      p += 2;
+      absolute = true;
+    }
+
+    // Fold the segments onto the playlist's folder
+    n = 0;
+    if (!absolute) {
+      n = strlen(dir);
+      if (n >= size) {
+        return false;
+      }
+      memcpy(out, dir, n);
+      while ((n > 0) && (out[n - 1] == '/')) {
+        n--;
+      }
+    }
+    while (*p != '\0') {
+      char *end = strchr(p, '/');
+      size_t length = (end != NULL) ? end - p : strlen(p);
+      if ((length == 2) && (p[0] == '.') && (p[1] == '.')) {
+        if (n == 0) {
+          return false;
+        }
+        while (out[--n] != '/') {
+        }
+      } else if ((length > 0) && !((length == 1) && (p[0] == '.'))) {
+        if (n + 1 + length >= size) {
+          return false;
+        }
+        out[n++] = '/';
+        memcpy(out + n, p, length);
+        n += length;
+      }
+      p += length + (end != NULL);
+    }
+    out[n] = '\0';
+    return n > 0;
+  }
+
+protected:
+  HalFile *file;
+  enum PLAYLIST_FORMAT format;
+  uint32_t skipped;
+
+  uint8_t buffer[512];
+  size_t have;
+  size_t used;
+  boolean skipLF;
+  boolean firstLine;
+
+  char line[PLAYLIST_LINE_SIZE];
+  boolean tooLong;
+
+  // #EXTINF title for the next path
+  char title[HAL_NAME_SIZE];
+
+  // The PLS entry read so far
+  long pendingNumber;
+  char pendingPath[256];
+  char pendingTitle[HAL_NAME_SIZE];
+
+  // Next byte of the file or -1 at its end
+  int readByte() {
+    if (used == have) {
+      int n = (file != NULL) ? file->read(buffer, sizeof(buffer)) : 0;
+      if (n <= 0) {
+        return -1;
+      }
+      have = n;
+      used = 0;
+    }
+    return buffer[used++];
+  }
+
+  // Read a line without its end into line. Lines too long are read to
+  // their end and skipped. Returns false at the end of the file.
+  boolean readLine() {
+
+    while (true) {
+      size_t length = 0;
+      tooLong = false;
+      int c = readByte();
+      if (skipLF && (c == '\n')) {
+        c = readByte();
+      }
+      skipLF = false;
+      if (c < 0) {
+        return false;
+      }
+      while ((c >= 0) && (c != '\n') && (c != '\r')) {
+        if (length < sizeof(line) - 1) {
+          line[length++] = c;
+        } else {
+          tooLong = true;
+        }
+        c = readByte();
+      }
+      skipLF = (c == '\r');
+      line[length] = '\0';
+
+      if (firstLine && ((uint8_t) line[0] == 0xEF) && ((uint8_t) line[1] == 0xBB) &&
+          ((uint8_t) line[2] == 0xBF)) {
+        memmove(line, line + 3, length - 2);
+      }
+      firstLine = false;
+      if (!tooLong) {
+        return true;
+      }
+      skipped++;
+    }
+  }
+
+  // A PLS line, returning true with entry set when it ends an entry
+  boolean plsLine(char *s, boolean latin1, PLAYLIST_ENTRY *entry) {
+
+    char *equals = strchr(s, '=');
+    if ((s[0] == '[') || (equals == NULL)) {
+      return false;
+    }
+    *equals = '\0';
+    char *key = trim(s);
+    char *value = trim(equals + 1);
+    boolean isFile = startsWith(key, "file");
+    if (!isFile && !startsWith(key, "title")) {
+      return false;
+    }
+    char *digits = key + (isFile ? 4 : 5);
+    char *end;
+    long number = strtol(digits, &end, 10);
+    if ((end == digits) || (*end != '\0')) {
+      return false;
+    }
+
+    // Keys of another entry end the one read so far
+    boolean ended = false;
+    if (number != pendingNumber) {
+      if (pendingPath[0] != '\0') {
+        strcpy(entry->path, pendingPath);
+        strcpy(entry->title, pendingTitle);
+        ended = true;
+      }
+      pendingNumber = number;
+      pendingPath[0] = '\0';
+      pendingTitle[0] = '\0';
+    }
+    if (isFile) {
+      if (!copyText(pendingPath, sizeof(pendingPath), value, latin1, false)) {
+        skipped++;
+      }
+    } else {
+      copyText(pendingTitle, sizeof(pendingTitle), value, latin1, true);
+    }
+    return ended;
+  }
+
+  // Copy text to out of size bytes, from Latin-1 to UTF-8 if latin1.
+  // Returns false if it doesn't fit, leaving it empty or cut at a
+  // character if cut.
+  static boolean copyText(char *out, size_t size, const char *text, boolean latin1, boolean cut) {
+
+    size_t n = 0;
+    for (; *text != '\0'; text++) {
+      uint8_t c = *text;
+      size_t length = (latin1 && (c >= 0x80)) ? 2 : 1;
+      if (!latin1 && (c >= 0xC0)) {
+        length = (c >= 0xF0) ? 4 : (c >= 0xE0) ? 3 : 2;
+        length = min(length, strlen(text));
+      }
+      if (n + length >= size) {
+        out[cut ? n : 0] = '\0';
+        return false;
+      }
+      if (length == 2 && latin1) {
+        out[n++] = 0xC0 | (c >> 6);
+        out[n++] = 0x80 | (c & 0x3F);
+      } else {
+        memcpy(out + n, text, length);
+        n += length;
+        text += length - 1;
+      }
+    }
+    out[n] = '\0';
+    return true;
+  }
+
+  static boolean isUtf8(const char *s) {
+    for (const uint8_t *p = (const uint8_t *) s; *p != '\0'; p++) {
+      int more = (*p < 0x80) ? 0 : ((*p & 0xE0) == 0xC0) ? 1 : ((*p & 0xF0) == 0xE0) ? 2 :
+                 ((*p & 0xF8) == 0xF0) ? 3 : -1;
+      for (; more != 0; more--) {
+        if ((more < 0) || ((*++p & 0xC0) != 0x80)) {
+          return false;
+        }
+      }
+    }
+    return true;
+  }
+
+  // Case blind, prefix in lower case
+  static boolean startsWith(const char *s, const char *prefix) {
+    for (; *prefix != '\0'; s++, prefix++) {
+      if (tolower((uint8_t) *s) != *prefix) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  static char *trim(char *s) {
+    while ((*s == ' ') || (*s == '\t')) {
+      s++;
+    }
+    size_t n = strlen(s);
+    while ((n > 0) && ((s[n - 1] == ' ') || (s[n - 1] == '\t'))) {
+      s[--n] = '\0';
+    }
+    return s;
+  }
+
+  static int hexDigit(char c) {
+    return isdigit((uint8_t) c) ? c - '0' : isxdigit((uint8_t) c) ? tolower((uint8_t) c) - 'a' + 10 : -1;
+  }
+};
+
+class Playlist {
+
+public:
+
+  Playlist() {
+    close();
+  }
+
+  // The sorted names of the playlists in folder dir
+  static boolean list(HalFileSystem *fs, const char *dir, FrontCodedList &names) {
+
+    names.clear();
+    HalDir *d = fs->openDir(dir);
+    if (d == NULL) {
+      return false;
+    }
+    d->setExtensions(PLAYLIST_EXTENSIONS);
+    std::vector<std::string> found;
+    HAL_DIR_ENTRY entry;
+    while (d->next(&entry)) {
+      if (!entry.isDirectory && (entry.name[0] != '.')) {
+        found.push_back(entry.name);
+      }
+    }
+    delete d;
+    std::sort(found.begin(), found.end());
+    names.assign(found);
+    return true;
+  }
+
+  // Read the songs of the playlist at path and their labels, from its
+  // cache if that's current and else by resolving every entry in index
+  boolean open(HalFileSystem *fs, const char *path, LibraryIndex *index, FrontCodedList &labels) {
+
+    close();
+    labels.clear();
+    HalFile *file = fs->open(path, HOM_READ);
+    if ((file == NULL) || !index->isOpen()) {
+      delete file;
+      return false;
+    }
+    stamp[0] = file->size();
+    stamp[1] = index->getCount();
+    stamp[2] = index->getSize();
+
+    char cache[PLAYLIST_CACHE_PATH_SIZE];
+    cachePath(path, cache);
+    std::vector<std::string> entryLabels;
+    cached = readCache(fs, cache, path, entryLabels);
+    if (!cached) {
+      close();
+      entryLabels.clear();
+      resolveAll(file, path, index, entryLabels);
+      writeCache(fs, cache, path, entryLabels);
+    }
+    delete file;
+    labels.assign(entryLabels);
+    return true;
+  }
+
+  // The cache file of the playlist at path, PLAYLIST_CACHE_PATH_SIZE
+  // bytes
+  static void cachePath(const char *path, char *cache) {
+    snprintf(cache, PLAYLIST_CACHE_PATH_SIZE, "%s/%08lx.bin", PLAYLIST_CACHE_DIR,
+             (unsigned long) halHash(HAL_HASH_SEED, path));
+  }
+
+  // Drop the cache of the playlist at path, as it's been written or
+  // removed. Returns false if path isn't a playlist.
+  static boolean removeCache(HalFileSystem *fs, const char *path) {
+    if (!halHasExtension(path, PLAYLIST_EXTENSIONS)) {
+      return false;
+    }
+    char cache[PLAYLIST_CACHE_PATH_SIZE];
+    cachePath(path, cache);
+    if (fs->exists(cache)) {
+      fs->remove(cache);
+    }
+    return true;
+  }
+
+  void close() {
+    tracks.clear();
+    missing = 0;
+    cached = false;
+  }
+
+  int getEntryCount() {
+    return tracks.size();
+  }
+
+  // Library index track number of entry i
+  uint32_t getTrack(int i) {
+    return ((i >= 0) && (i < (int) tracks.size())) ? tracks[i] : UINT32_MAX;
+  }
+
+  // Entries not found in the library index, or skipped
+  uint32_t getMissing() {
+    return missing;
+  }
+
+  // Whether the last open() read the cache
+  boolean wasCached() {
+    return cached;
+  }
+
+protected:
+  std::vector<uint32_t> tracks;
+  uint32_t missing;
+  boolean cached;
+
+  // Playlist size, index track count and index size the cache is for
+  uint32_t stamp[3];
+
+  // Cache reads and writes go through a buffer
+  HalFile *cacheFile;
+  uint8_t buffer[512];
+  size_t have;
+  size_t used;
+
+  void resolveAll(HalFile *file, const char *path, LibraryIndex *index,
+                  std::vector<std::string> &entryLabels) {
+
+    std::string dir(path, strrchr(path, '/') - path);
+    PlaylistParser *parser = new PlaylistParser();
+    parser->begin(file, PlaylistParser::formatOf(path));
+    PLAYLIST_ENTRY *entry = new PLAYLIST_ENTRY;
+    LIBRARY_TRACK *track = new LIBRARY_TRACK;
+    char songPath[256];
+    uint32_t hint = 0;
+    index->cacheTop(PLAYLIST_TOP_LEVELS);
+    while (parser->next(entry)) {
+      uint32_t number;
+      if (!PlaylistParser::resolve(dir.c_str(), entry->path, songPath, sizeof(songPath)) ||
+          !index->findNear(songPath, hint, &number)) {
+        missing++;
+        continue;
+      }
+      tracks.push_back(number);
+      hint = number + 1;
+
+      // The playlist's title, else the song's as the browse indexes
+      // label them
+      std::string label = entry->title;
+      if (label.empty() && index->getTrack(number, songPath, track)) {
+        label = track->title;
+        if (label.empty()) {
+          const char *name = strrchr(songPath, '/') + 1;
+          const char *dot = strrchr(name, '.');
+          label.assign(name, (dot != NULL) ? dot - name : strlen(name));
+        }
+        if (track->artist[0] != '\0') {
+          label = std::string(track->artist) + " - " + label;
+        }
+      }
+      entryLabels.push_back(label);
+    }
+    missing += parser->getSkipped();
+    index->cacheTop(0);
+    delete track;
+    delete entry;
+    delete parser;
+  }
+
+  boolean readCache(HalFileSystem *fs, const char *cache, const char *path,
+                    std::vector<std::string> &entryLabels) {
+
+    cacheFile = fs->open(cache, HOM_READ);
+    if (cacheFile == NULL) {
+      return false;
+    }
+    have = 0;
+    used = 0;
+    uint8_t header[PLAYLIST_CACHE_HEADER];
+    char name[256];
+    boolean ok = readBytes(header, sizeof(header)) && readString(name, sizeof(name)) &&
+                 (get32(header) == PLAYLIST_CACHE_MAGIC) && (get32(header + 4) == PLAYLIST_CACHE_VERSION) &&
+                 (get32(header + 8) == stamp[0]) && (get32(header + 12) == stamp[1]) &&
+                 (get32(header + 16) == stamp[2]) && !strcmp(name, path);
+    uint32_t count = ok ? get32(header + 20) : 0;
+    for (uint32_t i = 0; ok && (i < count); i++) {
+      uint8_t b[4];
+      char label[HAL_NAME_SIZE];
+      ok = readBytes(b, 4) && readString(label, sizeof(label)) && (get32(b) < stamp[1]);
+      tracks.push_back(get32(b));
+      entryLabels.push_back(label);
+    }
+    missing = get32(header + 24);
+    delete cacheFile;
+    return ok;
+  }
+
+  void writeCache(HalFileSystem *fs, const char *cache, const char *path,
+                  const std::vector<std::string> &entryLabels) {
+
+    if (!fs->exists(PLAYLIST_CACHE_DIR)) {
+      fs->mkdir(PLAYLIST_CACHE_DIR);
+    }
+    cacheFile = fs->open(cache, HOM_WRITE);
+    if (cacheFile == NULL) {
+      return;
+    }
+    uint8_t header[PLAYLIST_CACHE_HEADER];
+    put32(header, PLAYLIST_CACHE_MAGIC);
+    put32(header + 4, 0);
+    put32(header + 8, stamp[0]);
+    put32(header + 12, stamp[1]);
+    put32(header + 16, stamp[2]);
+    put32(header + 20, tracks.size());
+    put32(header + 24, missing);
+    have = 0;
+    writeBytes(header, sizeof(header));
+    writeString(path, 255);
+    for (size_t i = 0; i < tracks.size(); i++) {
+      uint8_t b[4];
+      put32(b, tracks[i]);
+      writeBytes(b, 4);
+      writeString(entryLabels[i].c_str(), HAL_NAME_SIZE - 1);
+    }
+    cacheFile->write(buffer, have);
+    cacheFile->flush();
+
+    // Valid only once everything else is on the card
+    put32(header + 4, PLAYLIST_CACHE_VERSION);
+    cacheFile->seek(4);
+    cacheFile->write(header + 4, 4);
+    delete cacheFile;
+  }
+
+  boolean readBytes(void *data, size_t length) {
+    uint8_t *p = (uint8_t *) data;
+    while (length > 0) {
+      if (used == have) {
+        int n = cacheFile->read(buffer, sizeof(buffer));
+        if (n <= 0) {
+          return false;
+        }
+        have = n;
+        used = 0;
+      }
+      size_t n = min(length, have - used);
+      memcpy(p, buffer + used, n);
+      used += n;
+      p += n;
+      length -= n;
+    }
+    return true;
+  }
+
+  boolean readString(char *s, size_t size) {
+    uint8_t length;
+    if (!readBytes(&length, 1) || (length >= size) || !readBytes(s, length)) {
+      return false;
+    }
+    s[length] = '\0';
+    return true;
+  }
+
+  void writeBytes(const void *data, size_t length) {
+    const uint8_t *p = (const uint8_t *) data;
+    while (length > 0) {
+      if (have == sizeof(buffer)) {
+        cacheFile->write(buffer, have);
+        have = 0;
+      }
+      size_t n = min(length, sizeof(buffer) - have);
+      memcpy(buffer + have, p, n);
+      have += n;
+      p += n;
+      length -= n;
+    }
+  }
+
+  void writeString(const char *s, size_t most) {
+    uint8_t length = min(strlen(s), most);
+    writeBytes(&length, 1);
+    writeBytes(s, length);
+  }
+
+  static uint32_t get32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+  }
+
+  static void put32(uint8_t *p, uint32_t v) {
+    for (int i = 0; i < 4; i++) {
+      p[i] = v >> (8 * i);
+    }
+  }
+};
+
+#endif
@@ -0,0 +1,205 @@
+/*
+   UDP Remote Control Protocol for the CYD Music Player
+
+   Shared by the player (UDPRemote.h) and the Linux reference client
+   (tools/cyd_remote.cpp) so it must only depend on standard headers.
+
+   Every datagram starts with a REMOTE_HEADER. All multi-byte fields
+   are little endian (native on both the ESP32 and x86/ARM hosts).
+
+   Both sides share a secret (REMOTE_SECRET in Secrets.h, --secret or
+   CYD_REMOTE_SECRET for the client). The header's tag is a SipHash-2-4
+   of the whole datagram, with the tag zeroed, keyed from the secret.
+   Datagrams with a wrong tag are dropped without a reply, so a device
+   on the network that doesn't know the secret can't press buttons or
+   read what is playing. Datagrams aren't encrypted, and a captured
+   command can be sent again.
+
+   Client -> player
+     RT_BUTTON       uint8_t key (REMOTE_KEY). Queued exactly like a
+                     touch on the corresponding on screen button.
+     RT_VOLUME_SET   uint8_t volume 0..100
+     RT_VOLUME_STEP  int8_t steps (+/-), 10% per step
+     RT_SUBSCRIBE    uint16_t status interval in ms (0 unsubscribes).
+                     The subscription lapses after REMOTE_LEASE_MS
+                     unless renewed.
+     RT_PING         no payload. Answered immediately, for latency checks.
+
+   Player -> client
+     RT_ACK          uint8_t result (REMOTE_RESULT). Echoes the seq of the
+                     command being acknowledged.
+     RT_STATUS       REMOTE_STATUS followed by nameLength bytes of the
+                     current track name (not NUL terminated)
+
+   Last Update: 10/18/2026
+*/
+
+#ifndef REMOTEPROTOCOL_H
+#define REMOTEPROTOCOL_H
+
+#include <stdint.h>
+
+#define REMOTE_UDP_PORT 4210
+#define REMOTE_MAGIC0 'C'
+#define REMOTE_MAGIC1 'Y'
+#define REMOTE_VERSION 2
+#define REMOTE_MAX_PACKET 160
+#define REMOTE_NAME_SIZE 96
+#define REMOTE_LEASE_MS 30000
+#define REMOTE_MIN_INTERVAL_MS 100
+
+// Datagram types
+enum REMOTE_TYPE {
+  RT_BUTTON = 0x01,
+  RT_VOLUME_SET = 0x02,
+  RT_VOLUME_STEP = 0x03,
+  RT_SUBSCRIBE = 0x04,
+  RT_PING = 0x05,
+
+  RT_ACK = 0x80,
+  RT_STATUS = 0x81
+};
+
+// Keys that can be pressed remotely
+enum REMOTE_KEY {
+  RK_MINUS = 1,
+  RK_PLUS,
+  RK_SELECT,
+  RK_BACK,
+  RK_TOUCHED
+};
+
+// Command results carried by RT_ACK
+enum REMOTE_RESULT {
+  RR_OK = 0,
+  RR_BAD_PACKET,
+  RR_QUEUE_FULL,
+  RR_UNKNOWN_COMMAND
+};
+
+// Status flags
+#define RS_PLAYING      0x01
+#define RS_BT_CONNECTED 0x02
+
+typedef struct __attribute__((packed)) {
+  uint8_t magic[2];
+  uint8_t version;
+  uint8_t type;
+  uint16_t seq;
+  uint8_t tag[8];  // see remoteSign()
+} REMOTE_HEADER;
+
+typedef struct __attribute__((packed)) {
+  REMOTE_HEADER header;
+  uint8_t result;
+} REMOTE_ACK;
+
+typedef struct __attribute__((packed)) {
+  REMOTE_HEADER header;
+  uint8_t flags;        // RS_* flags
+  uint8_t volume;       // 0..100
+  uint8_t state;        // player FSM state
+  uint8_t nameLength;   // bytes of track name following this struct
+  uint32_t position;    // byte position within the current track
+  uint32_t size;        // size of the current track in bytes
+  uint32_t bufferFree;  // free space in the Bluetooth output buffer
+  uint32_t uptimeMs;    // player millis() when the status was sent
+} REMOTE_STATUS;
+
+// Key for remoteSign(), derived from the shared secret
+typedef struct {
+  uint64_t k0;
+  uint64_t k1;
+} REMOTE_KEY_PAIR;
+
+#define REMOTE_ROTL(x, b) (uint64_t)(((x) << (b)) | ((x) >> (64 - (b))))
+
+inline void remoteSipRound(uint64_t *v) {
+  v[0] += v[1]; v[1] = REMOTE_ROTL(v[1], 13); v[1] ^= v[0]; v[0] = REMOTE_ROTL(v[0], 32);
+  v[2] += v[3]; v[3] = REMOTE_ROTL(v[3], 16); v[3] ^= v[2];
+  v[0] += v[3]; v[3] = REMOTE_ROTL(v[3], 21); v[3] ^= v[0];
+  v[2] += v[1]; v[1] = REMOTE_ROTL(v[1], 17); v[1] ^= v[2]; v[2] = REMOTE_ROTL(v[2], 32);
+}
+
+// SipHash-2-4 of data. skip bytes from offset skipAt are hashed as zeros.
+inline uint64_t remoteSipHash(const REMOTE_KEY_PAIR *key, const uint8_t *data, int length,
+                              int skipAt = 0, int skip = 0) {
+  uint64_t v[4] = { key->k0 ^ 0x736f6d6570736575ULL, key->k1 ^ 0x646f72616e646f6dULL,
+                    key->k0 ^ 0x6c7967656e657261ULL, key->k1 ^ 0x7465646279746573ULL };
+  uint64_t m = 0;
+  int i;
+  for (i = 0; i < length; i++) {
+    uint8_t b = ((i >= skipAt) && (i < skipAt + skip)) ? 0 : data[i];
+    m |= (uint64_t) b << (8 * (i & 7));
+    if ((i & 7) == 7) {
+      v[3] ^= m;
+      remoteSipRound(v);
+      remoteSipRound(v);
+      v[0] ^= m;
+      m = 0;
+    }
+  }
+  m |= (uint64_t)(length & 0xFF) << 56;
+  v[3] ^= m;
+  remoteSipRound(v);
+  remoteSipRound(v);
+  v[0] ^= m;
+  v[2] ^= 0xFF;
+  for (i = 0; i < 4; i++) {
+    remoteSipRound(v);
+  }
+  return v[0] ^ v[1] ^ v[2] ^ v[3];
+}
+
+// Derive the key from a text secret
+inline void remoteKey(REMOTE_KEY_PAIR *key, const char *secret) {
+  const REMOTE_KEY_PAIR k0 = { 0, 0 };
+  const REMOTE_KEY_PAIR k1 = { 1, 0 };
+  int length = 0;
+  while (secret[length] != '\0') {
+    length++;
+  }
+  key->k0 = remoteSipHash(&k0, (const uint8_t *) secret, length);
+  key->k1 = remoteSipHash(&k1, (const uint8_t *) secret, length);
+}
+
+#define REMOTE_TAG_OFFSET ((int) sizeof(REMOTE_HEADER) - 8)
+
+// Set the tag of a complete datagram. Call after the payload is filled in.
+inline void remoteSign(const REMOTE_KEY_PAIR *key, uint8_t *data, int length) {
+  uint64_t tag = remoteSipHash(key, data, length, REMOTE_TAG_OFFSET, 8);
+  for (int i = 0; i < 8; i++) {
+    data[REMOTE_TAG_OFFSET + i] = (uint8_t)(tag >> (8 * i));
+  }
+}
+
+// Check the tag of a datagram that has a valid header
+inline bool remoteVerify(const REMOTE_KEY_PAIR *key, const uint8_t *data, int length) {
+  uint64_t tag = remoteSipHash(key, data, length, REMOTE_TAG_OFFSET, 8);
+  uint8_t diff = 0;
+  for (int i = 0; i < 8; i++) {
+    diff |= data[REMOTE_TAG_OFFSET + i] ^ (uint8_t)(tag >> (8 * i));
+  }
+  return diff == 0;
+}
+
+// Fill in a header. The tag is set by remoteSign().
+inline void remoteHeader(REMOTE_HEADER *header, uint8_t type, uint16_t seq) {
+  header->magic[0] = REMOTE_MAGIC0;
+  header->magic[1] = REMOTE_MAGIC1;
+  header->version = REMOTE_VERSION;
+  header->type = type;
+  header->seq = seq;
+  for (int i = 0; i < 8; i++) {
+    header->tag[i] = 0;
+  }
+}
+
+// Check that a datagram starts with a valid header and is signed with key
+inline bool remoteHeaderValid(const REMOTE_KEY_PAIR *key, const uint8_t *data, int length) {
+  return (length >= (int) sizeof(REMOTE_HEADER)) &&
+         (data[0] == REMOTE_MAGIC0) && (data[1] == REMOTE_MAGIC1) &&
+         (data[2] == REMOTE_VERSION) && remoteVerify(key, data, length);
+}
+
+#endif
@@ -0,0 +1,283 @@
+/*
+   Cooperative Task Scheduler
+
+   Replaces a monolithic loop() with a small set of prioritized tasks.
+   Each task has:
+     period   - minimum time between runs (0 = run on every pass)
+     deadline - how late a run may start before it counts as a miss.
+                For period 0 tasks it is the max gap between runs.
+     budget   - how long one run is expected to take. Longer runs are
+                counted as overruns. Long running work can call
+                shouldYield() to split itself across passes. Audio tasks
+                run from runCritical() don't count against the budget.
+
+   Tasks run in priority order, at most once per pass, except that tasks
+   of priority TP_AUDIO also run before every other task that runs and
+   from runCritical(), which lengthy code can call as a preemption point.
+
+   The clock is a function pointer returning microseconds so the
+   scheduler can be driven by a virtual clock on a host.
+
+   Last Update: 10/18/2026
+*/
+
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define MAX_TASKS 8
+
+// Task priorities. Lower values run first.
+enum TASK_PRIORITY {
+  TP_AUDIO,
+  TP_INPUT,
+  TP_UI,
+  TP_NETWORK,
+  TP_BACKGROUND
+};
+
+typedef void (*taskFunction)(void);
+typedef uint32_t (*clockFunction)(void);
+
+typedef struct {
+  const char *name;
+  taskFunction function;
+  uint8_t priority;
+  bool enabled;
+  uint32_t periodUs;
+  uint32_t deadlineUs;
+  uint32_t budgetUs;
+
+  // Scheduling state
+  uint32_t nextRunUs;
+  uint32_t lastRunUs;
+  bool hasRun;
+
+  // Statistics
+  uint32_t runs;
+  uint32_t overruns;
+  uint32_t misses;
+  uint32_t maxRunUs;
+  uint32_t maxLateUs;
+  uint64_t totalRunUs;
+} TASK;
+
+class Scheduler {
+
+public:
+
+  // Class Constructor
+  // _clock returns the current time in microseconds
+  Scheduler(clockFunction _clock) {
+
+    clock = _clock;
+    taskCount = 0;
+    currentTask = -1;
+    criticalUs = 0;
+    passes = 0;
+  }
+
+  // Add a task, keeping the task list sorted by priority.
+  // Returns the task's id or -1 if the table is full.
+  int addTask(const char *name, taskFunction function, enum TASK_PRIORITY priority,
+              uint32_t periodUs, uint32_t deadlineUs, uint32_t budgetUs) {
+
+    if (taskCount >= MAX_TASKS) {
+      return -1;
+    }
+
+    // Find insertion point after tasks of equal or higher priority
+    int pos = taskCount;
+    while (pos > 0 && tasks[pos - 1].priority > priority) {
+      tasks[pos] = tasks[pos - 1];
+      pos--;
+    }
+
+    TASK *t = &tasks[pos];
+    memset(t, 0, sizeof(TASK));
+    t->name = name;
+    t->function = function;
+    t->priority = priority;
+    t->enabled = true;
+    t->periodUs = periodUs;
+    t->deadlineUs = deadlineUs;
+    t->budgetUs = budgetUs;
+    t->nextRunUs = clock();
+    taskCount++;
+
+    return pos;
+  }
+
+  // Enable or disable a task by name
+  void setEnabled(const char *name, bool enabled) {
+
+    TASK *t = findTask(name);
+    if (t != NULL) {
+      if (enabled && !t->enabled) {
+        // Don't count the time spent disabled as lateness
+        t->nextRunUs = clock();
+        t->hasRun = false;
+      }
+      t->enabled = enabled;
+    }
+  }
+
+  // Run each due task once, highest priority first
+  void runPass() {
+
+    passes++;
+
+    for (int i = 0; i < taskCount; i++) {
+      TASK *t = &tasks[i];
+      if (!isDue(t, clock())) {
+        continue;
+      }
+      if (t->priority != TP_AUDIO) {
+        runCritical();
+      }
+      runTask(i);
+    }
+  }
+
+  // Run any due audio priority tasks. Safe to call from inside a
+  // task as a preemption point during lengthy work.
+  void runCritical() {
+
+    for (int i = 0; i < taskCount && tasks[i].priority == TP_AUDIO; i++) {
+      if (i != currentTask && isDue(&tasks[i], clock())) {
+        int saved = currentTask;
+        uint32_t savedStart = taskStartUs;
+        uint32_t savedCritical = criticalUs;
+        uint32_t start = clock();
+        runTask(i);
+        currentTask = saved;
+        taskStartUs = savedStart;
+        criticalUs = savedCritical + (clock() - start);
+      }
+    }
+  }
+
+  // Determine if the running task has used up its budget. Time spent
+  // running audio tasks from runCritical() isn't counted against it.
+  bool shouldYield() {
+
+    if (currentTask < 0) {
+      return false;
+    }
+    return (clock() - taskStartUs - criticalUs) >= tasks[currentTask].budgetUs;
+  }
+
+  // Reset all statistics
+  void resetStats() {
+
+    for (int i = 0; i < taskCount; i++) {
+      TASK *t = &tasks[i];
+      t->runs = t->overruns = t->misses = 0;
+      t->maxRunUs = t->maxLateUs = 0;
+      t->totalRunUs = 0;
+    }
+    passes = 0;
+  }
+
+  int getTaskCount() {
+    return taskCount;
+  }
+
+  const TASK *getTask(int index) {
+    return &tasks[index];
+  }
+
+  uint32_t getPasses() {
+    return passes;
+  }
+
+#ifdef ARDUINO
+  // Print a table of task statistics
+  void printStats(Print *out) {
+
+    out->printf("Scheduler: %lu passes\n", (unsigned long) passes);
+    out->printf("%-10s %3s %9s %7s %7s %8s %8s %8s\n",
+                "task", "pri", "runs", "overrun", "missed", "avg us", "max us", "late us");
+    for (int i = 0; i < taskCount; i++) {
+      const TASK *t = &tasks[i];
+      out->printf("%-10s %3d %9lu %7lu %7lu %8lu %8lu %8lu\n",
+                  t->name, t->priority, (unsigned long) t->runs,
+                  (unsigned long) t->overruns, (unsigned long) t->misses,
+                  (unsigned long) (t->runs ? t->totalRunUs / t->runs : 0),
+                  (unsigned long) t->maxRunUs, (unsigned long) t->maxLateUs);
+    }
+  }
+#endif
+
+protected:
+
+  bool isDue(TASK *t, uint32_t now) {
+    return t->enabled && (int32_t)(now - t->nextRunUs) >= 0;
+  }
+
+  void runTask(int index) {
+
+    TASK *t = &tasks[index];
+    uint32_t start = clock();
+
+    // Deadline tracking. Periodic tasks are late relative to when they
+    // became due, every pass tasks relative to their previous run.
+    uint32_t late = (t->periodUs == 0) ?
+                      (t->hasRun ? start - t->lastRunUs : 0) :
+                      start - t->nextRunUs;
+    if (late > t->maxLateUs) {
+      t->maxLateUs = late;
+    }
+    if (t->deadlineUs != 0 && late > t->deadlineUs) {
+      t->misses++;
+    }
+
+    currentTask = index;
+    taskStartUs = start;
+    criticalUs = 0;
+    t->function();
+    currentTask = -1;
+
+    uint32_t end = clock();
+    uint32_t runUs = end - start - criticalUs;
+    t->runs++;
+    t->totalRunUs += runUs;
+    if (runUs > t->maxRunUs) {
+      t->maxRunUs = runUs;
+    }
+    if (t->budgetUs != 0 && runUs > t->budgetUs) {
+      t->overruns++;
+    }
+    t->lastRunUs = start;
+    t->hasRun = true;
+
+    // Schedule the next run. If we fell more than a period behind,
+    // don't try to catch up with a burst of runs.
+    t->nextRunUs += t->periodUs;
+    if ((int32_t)(end - t->nextRunUs) > (int32_t) t->periodUs) {
+      t->nextRunUs = end + t->periodUs;
+    }
+  }
+
+  TASK *findTask(const char *name) {
+
+    for (int i = 0; i < taskCount; i++) {
+      if (!strcmp(tasks[i].name, name)) {
+        return &tasks[i];
+      }
+    }
+    return NULL;
+  }
+
+  clockFunction clock;
+  TASK tasks[MAX_TASKS];
+  int taskCount;
+  int currentTask;
+  uint32_t taskStartUs;
+  uint32_t criticalUs;  // in runCritical() during the current task
+  uint32_t passes;
+};
+
+#endif
@@ -0,0 +1,293 @@
+/*
+   SD Card SPI Clock Tuner
+
+   Finds the fastest SPI clock the card reads reliably at. The card is
+   started at the slowest step and reference sectors spread over the
+   data area are read and CRC32'd. The clock is then stepped up,
+   restarting the card at each step, and the same sectors are read with
+   multi-sector reads SD_TUNE_PASSES times and compared with the
+   reference CRCs. The first step that fails to start or mismatches ends
+   the probe and the card is restarted at the last good step.
+
+   The chosen speed is saved on the card so later boots only verify it.
+   stepDown() drops one step, e.g. after read errors during playback.
+   begin(), probe() and stepDown() restart the card, which leaves any
+   file open on it invalid, so the caller closes its files first and
+   opens them again after.
+
+   bench() measures sequential and random sector reads at the current
+   clock.
+
+   Last Update: 10/18/2026
+*/
+
+#ifndef SDCLOCKTUNER_H
+#define SDCLOCKTUNER_H
+
+#include "SdFsConfig.h"
+#include "esp_rom_crc.h"
+
+// Clock steps in MHz. The ESP32 divides 80 MHz so the actual clock is
+// at or below each step.
+static const uint8_t SD_CLOCK_STEPS[] = { 12, 16, 20, 25, 32, 40 };
+#define SD_CLOCK_STEP_COUNT (sizeof(SD_CLOCK_STEPS) / sizeof(SD_CLOCK_STEPS[0]))
+
+// Reference reads: SD_TUNE_READS reads of SD_TUNE_SECTORS sectors each
+#define SD_TUNE_READS 8
+#define SD_TUNE_SECTORS 16
+#define SD_TUNE_PASSES 2
+
+// Benchmark sizes
+#define SD_BENCH_SEQ_KB 1024
+#define SD_BENCH_RANDOM_READS 200
+
+typedef struct {
+  uint8_t mhz;
+  boolean ok;
+  uint32_t readKBps;  // during the check
+} SD_CLOCK_PROBE;
+
+typedef struct {
+  uint32_t seqKBps;
+  uint32_t randomAvgUs;
+  uint32_t randomMaxUs;
+  uint32_t errors;
+} SD_BENCH_RESULT;
+
+class SdClockTuner {
+
+public:
+
+  // Class Constructor
+  SdClockTuner(uint8_t csPin) {
+    _csPin = csPin;
+    _sd = NULL;
+    step = 0;
+    probeCount = 0;
+  }
+
+  // Start the card at the saved clock if it still verifies, otherwise
+  // probe for the fastest. Returns false if the card won't start at all.
+  boolean begin(CardFs *sd, const char *savePath) {
+
+    _sd = sd;
+    _savePath = savePath;
+    probeCount = 0;
+
+    if (!startAt(0) || !readReference()) {
+      return false;
+    }
+
+    int saved = loadSaved();
+    if (saved > 0) {
+      if (startAt(saved) && check(NULL)) {
+        return true;
+      }
+      Serial.printf("SD clock %d MHz failed, probing\n", SD_CLOCK_STEPS[saved]);
+    } else if (saved == 0) {
+      // Saved at the slowest step
+      return true;
+    }
+    return probe();
+  }
+
+  // Step up from the slowest clock until a check fails. Leaves the card
+  // running at the fastest good step and saves it.
+  boolean probe() {
+
+    probeCount = 0;
+    int best = 0;
+
+    for (int i = 0; i < (int) SD_CLOCK_STEP_COUNT; i++) {
+      SD_CLOCK_PROBE *p = &probes[probeCount++];
+      p->mhz = SD_CLOCK_STEPS[i];
+      p->readKBps = 0;
+      p->ok = startAt(i) && ((i > 0) || readReference()) && check(&p->readKBps);
+      Serial.printf("SD clock %d MHz %s\n", p->mhz, p->ok ? "ok" : "failed");
+      if (!p->ok) {
+        break;
+      }
+      best = i;
+    }
+
+    // Fall back to the last good step
+    if ((step != best) && !startAt(best)) {
+      return false;
+    }
+    save();
+    return true;
+  }
+
+  // Drop to the next slower clock. Returns false if already slowest.
+  boolean stepDown() {
+
+    if ((_sd == NULL) || (step == 0)) {
+      return false;
+    }
+    if (!startAt(step - 1)) {
+      startAt(0);
+    }
+    save();
+    return true;
+  }
+
+  uint8_t getMHz() {
+    return SD_CLOCK_STEPS[step];
+  }
+
+  // Results of the last probe()
+  int getProbeCount() {
+    return probeCount;
+  }
+
+  const SD_CLOCK_PROBE *getProbe(int i) {
+    return &probes[i];
+  }
+
+  // Measure sequential and random sector reads at the current clock
+  boolean bench(SD_BENCH_RESULT *result) {
+
+    memset(result, 0, sizeof(SD_BENCH_RESULT));
+    uint8_t *buffer = (uint8_t *) malloc(SD_TUNE_SECTORS * 512);
+    if (buffer == NULL) {
+      return false;
+    }
+
+    SdCard *card = _sd->card();
+    uint32_t first = _sd->dataStartSector();
+    uint32_t span = dataSectors();
+
+    // Sequential multi-sector reads
+    uint32_t sectors = SD_BENCH_SEQ_KB * 2;
+    uint32_t start = micros();
+    for (uint32_t s = 0; s < sectors; s += SD_TUNE_SECTORS) {
+      if (!card->readSectors(first + s, buffer, SD_TUNE_SECTORS)) {
+        result->errors++;
+      }
+    }
+    uint32_t us = micros() - start;
+    result->seqKBps = (uint64_t) SD_BENCH_SEQ_KB * 1000000 / max(us, (uint32_t) 1);
+
+    // Random single sector reads
+    uint64_t totalUs = 0;
+    for (int i = 0; i < SD_BENCH_RANDOM_READS; i++) {
+      uint32_t sector = first + (esp_random() % span);
+      start = micros();
+      if (!card->readSectors(sector, buffer, 1)) {
+        result->errors++;
+      }
+      us = micros() - start;
+      totalUs += us;
+      result->randomMaxUs = max(result->randomMaxUs, us);
+    }
+    result->randomAvgUs = totalUs / SD_BENCH_RANDOM_READS;
+
+    free(buffer);
+    return true;
+  }
+
+protected:
+  uint8_t _csPin;
+  CardFs *_sd;
+  const char *_savePath;
+  int step;
+  uint32_t referenceCrc[SD_TUNE_READS];
+  SD_CLOCK_PROBE probes[SD_CLOCK_STEP_COUNT];
+  int probeCount;
+
+  // Restart the card at a clock step
+  boolean startAt(int i) {
+    _sd->end();
+    step = i;
+    return _sd->begin(SdSpiConfig(_csPin, DEDICATED_SPI, SD_SCK_MHZ(SD_CLOCK_STEPS[i])));
+  }
+
+  uint32_t dataSectors() {
+    return max((uint32_t)(_sd->clusterCount() * _sd->sectorsPerCluster()),
+               (uint32_t) SD_TUNE_SECTORS);
+  }
+
+  // First sector of reference read i
+  uint32_t referenceSector(int i) {
+    uint32_t spacing = (dataSectors() - SD_TUNE_SECTORS) / SD_TUNE_READS;
+    return _sd->dataStartSector() + i * spacing;
+  }
+
+  // Read the reference sectors and return their CRCs in crcs.
+  // Returns the time taken or 0 on a read error.
+  uint32_t readAll(uint32_t *crcs) {
+
+    uint8_t *buffer = (uint8_t *) malloc(SD_TUNE_SECTORS * 512);
+    if (buffer == NULL) {
+      return 0;
+    }
+    uint32_t start = micros();
+    boolean ok = true;
+    for (int i = 0; ok && i < SD_TUNE_READS; i++) {
+      ok = _sd->card()->readSectors(referenceSector(i), buffer, SD_TUNE_SECTORS);
+      crcs[i] = esp_rom_crc32_le(0, buffer, SD_TUNE_SECTORS * 512);
+    }
+    uint32_t us = micros() - start;
+    free(buffer);
+    return ok ? max(us, (uint32_t) 1) : 0;
+  }
+
+  // Read the reference CRCs at the current (slowest) clock
+  boolean readReference() {
+    return readAll(referenceCrc) != 0;
+  }
+
+  // Read the reference sectors SD_TUNE_PASSES times and compare.
+  // kbps gets the read rate if not NULL.
+  boolean check(uint32_t *kbps) {
+
+    uint32_t crcs[SD_TUNE_READS];
+    uint32_t totalUs = 0;
+    for (int pass = 0; pass < SD_TUNE_PASSES; pass++) {
+      uint32_t us = readAll(crcs);
+      if ((us == 0) || memcmp(crcs, referenceCrc, sizeof(crcs))) {
+        return false;
+      }
+      totalUs += us;
+    }
+    if (kbps != NULL) {
+      *kbps = (uint64_t) SD_TUNE_PASSES * SD_TUNE_READS * SD_TUNE_SECTORS / 2 * 1000000 / totalUs;
+    }
+    return true;
+  }
+
+  // Saved clock step or -1 if none
+  int loadSaved() {
+
+    CardFile f = _sd->open(_savePath, O_RDONLY);
+    if (!f) {
+      return -1;
+    }
+    char text[8];
+    int n = f.read(text, sizeof(text) - 1);
+    f.close();
+    if (n <= 0) {
+      return -1;
+    }
+    text[n] = '\0';
+
+    int mhz = atoi(text);
+    for (int i = 0; i < (int) SD_CLOCK_STEP_COUNT; i++) {
+      if (SD_CLOCK_STEPS[i] == mhz) {
+        return i;
+      }
+    }
+    return -1;
+  }
+
+  void save() {
+
+    CardFile f = _sd->open(_savePath, O_WRONLY | O_CREAT | O_TRUNC);
+    if (f) {
+      f.printf("%d\n", getMHz());
+      f.close();
+    }
+  }
+};
+
+#endif
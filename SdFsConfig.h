@@ -0,0 +1,33 @@
+/*
+   SD Card File System Types
+
+   The SdFat volume and file classes used by the player, the music
+   library, the FTP and WebDAV servers and the SD helpers, picked by
+   ENABLE_EXFAT:
+
+     1  CardFs = SdFs, CardFile = FsFile. Reads FAT16, FAT32 and exFAT
+        cards. Cards of 64 GB and up come formatted as exFAT.
+     0  CardFs = SdFat32, CardFile = File32. FAT16 and FAT32 only, with
+        less code.
+
+   Last Update: 10/18/2026
+*/
+
+#ifndef SDFSCONFIG_H
+#define SDFSCONFIG_H
+
+#include <SdFat.h>
+
+#ifndef ENABLE_EXFAT
+#define ENABLE_EXFAT 1
+#endif
+
+#if ENABLE_EXFAT
+typedef SdFs CardFs;
+typedef FsFile CardFile;
+#else
+typedef SdFat32 CardFs;
+typedef File32 CardFile;
+#endif
+
+#endif
@@ -13,3 +13,6 @@
 // Credentials for FTP connection
 #define FTP_USER "craig"
 #define FTP_PSWD "music"
+
+// Shared secret for the UDP remote. Use the same one with tools/cyd_remote.
+#define REMOTE_SECRET "change-this-remote-secret"
@@ -0,0 +1,525 @@
+/*
+   Session Log
+
+   Records a session of the FSM so it can be replayed. Each record has
+   a millisecond timestamp relative to the start of the session.
+
+   Inputs are what drives the FSM:
+     SR_SEED      the halRandom() seed used for shuffle and random play
+     SR_BUTTON    a button event handed to a state handler
+     SR_TIMEOUT   the display timeout firing
+     SR_SONG_END  a playing song ending
+
+   Outputs are what the FSM did with them:
+     SR_STATE     a state transition
+     SR_SCREEN    a listbox repaint (ListBox::getScreenHash())
+     SR_PLAY      a song starting (hash of its path)
+     SR_AUDIO     the PCM bytes decoded for a song when the next starts
+
+   SR_LOST ends a log that was cut short. Records come faster than
+   they are flushed when the buffer fills, so the recorder ends the
+   log there rather than leave a gap a replay would trip over.
+
+   A log file is a SESSION_LOG_HEADER, the NUL terminated state and
+   operation names, then SESSION_RECORDs up to the end of the file.
+
+   SessionRecorder buffers records in RAM and appends them to the log
+   when flush() is called. SessionReplay hands the recorded inputs back
+   to the FSM in the state they were recorded in, keeping the recorded
+   time between them, and checks the outputs against the recording. A
+   state handler that moves to a different state than recorded is
+   reported as a mismatch naming both states. tools/hostplayer.cpp
+   replays a log on a host through the same FSM (PlayerFsm.h) against
+   a virtual clock.
+
+   Last Update: 10/18/2026
+*/
+
+#ifndef SESSIONLOG_H
+#define SESSIONLOG_H
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include "Hal.h"
+
+#define SESSION_MAGIC "CYSL"
+#define SESSION_VERSION 1
+
+// Records buffered between flushes. Records added while the buffer is
+// full are counted as lost.
+#define SESSION_BUFFER_RECORDS 64
+
+// How much longer than recorded the next record may take to happen
+// during a replay before the replay is abandoned
+#define SESSION_REPLAY_SLACK_MS 10000
+
+// Decoded audio depends on timing so it only has to be this close
+#define SESSION_AUDIO_TOLERANCE_PCT 5
+
+enum SESSION_RECORD_TYPE {
+  // Inputs
+  SR_SEED,      // value = seed
+  SR_BUTTON,    // a = BUTTON_STATE, b = state, value = SR_FLAG_*
+  SR_TIMEOUT,   // b = state
+  SR_SONG_END,  // b = state
+
+  // Outputs
+  SR_STATE,     // a = new state
+  SR_SCREEN,    // value = screen hash
+  SR_PLAY,      // value = song path hash
+  SR_AUDIO,     // value = PCM bytes
+
+  // The records after this one were lost
+  SR_LOST
+};
+
+// The button came from the queue (e.g. the UDP remote)
+#define SR_FLAG_QUEUED 1
+
+static const char *const SESSION_RECORD_NAMES[] = {
+  "seed", "button", "timeout", "song end", "state", "screen", "play", "audio", "lost"
+};
+
+typedef struct __attribute__((packed)) {
+  uint32_t ms;
+  uint8_t type;
+  uint8_t a;
+  uint16_t b;
+  uint32_t value;
+} SESSION_RECORD;
+
+typedef struct __attribute__((packed)) {
+  char magic[4];
+  uint8_t version;
+  uint8_t reserved;
+  uint16_t stateCount;      // state names following the header
+  uint16_t operationCount;  // then the operation names
+  uint16_t reserved2;
+} SESSION_LOG_HEADER;
+
+inline boolean sessionIsInput(uint8_t type) {
+  return type <= SR_SONG_END;
+}
+
+class SessionRecorder {
+
+public:
+
+  SessionRecorder() {
+    _fs = NULL;
+    count = 0;
+    lost = 0;
+  }
+
+  // Start a new log at path. The state names are stored so tools can
+  // label the log. operations is the Operations menu.
+  boolean begin(HalFileSystem *fs, const char *path, uint32_t nowMs,
+                const char *(*stateName)(int state), int stateCount,
+                const std::vector<std::string> &operations) {
+
+    end();
+
+    HalFile *file = fs->open(path, HOM_WRITE);
+    if (file == NULL) {
+      return false;
+    }
+
+    SESSION_LOG_HEADER header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SESSION_MAGIC, 4);
+    header.version = SESSION_VERSION;
+    header.stateCount = stateCount;
+    header.operationCount = operations.size();
+    boolean ok = file->write(&header, sizeof(header)) == sizeof(header);
+
+    for (int i = 0; i < stateCount; i++) {
+      const char *name = stateName(i);
+      ok &= file->write(name, strlen(name) + 1) == strlen(name) + 1;
+    }
+    for (const std::string &op : operations) {
+      ok &= file->write(op.c_str(), op.size() + 1) == op.size() + 1;
+    }
+    delete file;
+
+    if (!ok) {
+      return false;
+    }
+
+    _fs = fs;
+    _path = path;
+    startMs = nowMs;
+    count = 0;
+    lost = 0;
+    return true;
+  }
+
+  // Write what is buffered and stop recording
+  void end() {
+    flush();
+    _fs = NULL;
+  }
+
+  boolean isRecording() {
+    return _fs != NULL;
+  }
+
+  void add(uint32_t nowMs, enum SESSION_RECORD_TYPE type,
+           uint8_t a = 0, uint16_t b = 0, uint32_t value = 0) {
+
+    if (_fs == NULL) {
+      return;
+    }
+    if (lost != 0) {
+      lost++;
+      return;
+    }
+    if (count == SESSION_BUFFER_RECORDS - 1) {
+      // The last slot ends the log
+      type = SR_LOST;
+      lost = 1;
+    }
+    SESSION_RECORD *r = &buffer[count++];
+    r->ms = nowMs - startMs;
+    r->type = type;
+    r->a = a;
+    r->b = b;
+    r->value = value;
+  }
+
+  // Append the buffered records to the log
+  boolean flush() {
+
+    if ((_fs == NULL) || (count == 0)) {
+      return true;
+    }
+    HalFile *file = _fs->open(_path.c_str(), HOM_APPEND);
+    if (file == NULL) {
+      return false;
+    }
+    size_t length = count * sizeof(SESSION_RECORD);
+    boolean ok = file->write(buffer, length) == length;
+    delete file;
+
+    count = 0;
+    return ok;
+  }
+
+  // Records dropped because the buffer was full. The log ends at the
+  // first.
+  uint32_t getLost() {
+    return lost;
+  }
+
+protected:
+  HalFileSystem *_fs;
+  std::string _path;
+  uint32_t startMs;
+  SESSION_RECORD buffer[SESSION_BUFFER_RECORDS];
+  int count;
+  uint32_t lost;
+};
+
+class SessionReader {
+
+public:
+
+  SessionReader() {
+    _file = NULL;
+  }
+
+  ~SessionReader() {
+    close();
+  }
+
+  // Read the header and names. The reader deletes file when closed.
+  boolean open(HalFile *file) {
+
+    close();
+    if (file == NULL) {
+      return false;
+    }
+    _file = file;
+
+    SESSION_LOG_HEADER header;
+    if ((_file->read(&header, sizeof(header)) != sizeof(header)) ||
+        memcmp(header.magic, SESSION_MAGIC, 4) || (header.version != SESSION_VERSION)) {
+      close();
+      return false;
+    }
+
+    stateNames.clear();
+    operationNames.clear();
+    for (int i = 0; i < header.stateCount + header.operationCount; i++) {
+      std::string name;
+      char c;
+      while ((_file->read(&c, 1) == 1) && (c != '\0')) {
+        name += c;
+      }
+      if (i < header.stateCount) {
+        stateNames.push_back(name);
+      } else {
+        operationNames.push_back(name);
+      }
+    }
+    return true;
+  }
+
+  void close() {
+    if (_file != NULL) {
+      delete _file;
+      _file = NULL;
+    }
+  }
+
+  // Fetch the next record. Returns false at the end of the log.
+  boolean next(SESSION_RECORD *r) {
+    return (_file != NULL) && (_file->read(r, sizeof(*r)) == sizeof(*r));
+  }
+
+  const char *stateName(int state) {
+    return (state < (int) stateNames.size()) ? stateNames[state].c_str() : "?";
+  }
+
+  std::vector<std::string> stateNames;
+  std::vector<std::string> operationNames;
+
+protected:
+  HalFile *_file;
+};
+
+// Called with the description of each mismatch
+typedef void (*sessionMismatchCallback)(const char *description);
+
+class SessionReplay {
+
+public:
+
+  SessionReplay() {
+    active = false;
+    callback = NULL;
+  }
+
+  // Report every mismatch to _callback, not just the first
+  void setMismatchCallback(sessionMismatchCallback _callback) {
+    callback = _callback;
+  }
+
+  // Load a log. Call getSeed() and restart the FSM at the state the
+  // recording started in after this succeeds.
+  boolean begin(HalFileSystem *fs, const char *path, uint32_t nowMs) {
+
+    active = false;
+    if (!reader.open(fs->open(path, HOM_READ))) {
+      return false;
+    }
+
+    seed = 1;
+    matched = 0;
+    mismatched = 0;
+    firstMismatch[0] = '\0';
+    recordIndex = 0;
+    lastRecordMs = 0;
+    lastProgressMs = nowMs;
+    stalled = false;
+    truncated = false;
+
+    haveHead = readHead();
+    if (haveHead && head.type == SR_SEED) {
+      seed = head.value;
+      advance(nowMs);
+    }
+    active = haveHead;
+    return true;
+  }
+
+  uint32_t getSeed() {
+    return seed;
+  }
+
+  boolean isActive() {
+    return active;
+  }
+
+  // Return the recorded button for state once it is due, otherwise 0
+  // (BS_NONE). queued is set to whether it came from the queue.
+  uint8_t pollButton(int state, uint32_t nowMs, boolean *queued) {
+
+    *queued = false;
+    if (!inputDue(SR_BUTTON, state, nowMs)) {
+      return 0;
+    }
+    uint8_t button = head.a;
+    *queued = (head.value & SR_FLAG_QUEUED) != 0;
+    advance(nowMs);
+    return button;
+  }
+
+  // Return true once a recorded display timeout or song end is due
+  boolean pollTimeout(int state, uint32_t nowMs) {
+    if (!inputDue(SR_TIMEOUT, state, nowMs)) {
+      return false;
+    }
+    advance(nowMs);
+    return true;
+  }
+
+  boolean pollSongEnd(int state, uint32_t nowMs) {
+    if (!inputDue(SR_SONG_END, state, nowMs)) {
+      return false;
+    }
+    advance(nowMs);
+    return true;
+  }
+
+  // Check an output of the FSM against the recording
+  void observe(uint32_t nowMs, enum SESSION_RECORD_TYPE type,
+               uint8_t a = 0, uint16_t b = 0, uint32_t value = 0) {
+
+    if (!active) {
+      return;
+    }
+
+    // An output that wasn't recorded before the next input
+    if (sessionIsInput(head.type) || (head.type != type)) {
+      mismatch(type, a, b, value);
+      return;
+    }
+
+    boolean same = (head.a == a) && (head.b == b);
+    if (type == SR_AUDIO) {
+      uint32_t diff = (value > head.value) ? value - head.value : head.value - value;
+      same &= (uint64_t) diff * 100 <= (uint64_t) head.value * SESSION_AUDIO_TOLERANCE_PCT;
+    } else {
+      same &= head.value == value;
+    }
+
+    if (same) {
+      matched++;
+    } else {
+      mismatch(type, a, b, value);
+    }
+    advance(nowMs);
+  }
+
+  // Give up if the next record is overdue (the FSM went somewhere
+  // else). Call regularly.
+  void checkStall(uint32_t nowMs) {
+
+    if (active && (nowMs - lastProgressMs) > (head.ms - lastRecordMs) + SESSION_REPLAY_SLACK_MS) {
+      stalled = true;
+      char text[sizeof(firstMismatch)];
+      snprintf(text, sizeof(text), "record %lu at %lu ms: stuck waiting for ",
+               (unsigned long) recordIndex, (unsigned long) head.ms);
+      describe(text, sizeof(text), head.type, head.a, head.b, head.value);
+      report(text);
+      active = false;
+      reader.close();
+    }
+  }
+
+  uint32_t getMatched() {
+    return matched;
+  }
+
+  uint32_t getMismatched() {
+    return mismatched;
+  }
+
+  boolean isStalled() {
+    return stalled;
+  }
+
+  // The replay reached the end of a log that was cut short
+  boolean isTruncated() {
+    return truncated;
+  }
+
+  // Description of the first mismatch
+  const char *getFirstMismatch() {
+    return firstMismatch;
+  }
+
+protected:
+  SessionReader reader;
+  SESSION_RECORD head;
+  boolean haveHead;
+  boolean active;
+  boolean stalled;
+  boolean truncated;
+  uint32_t seed;
+  uint32_t recordIndex;
+  uint32_t lastRecordMs;    // recorded time of the last record used
+  uint32_t lastProgressMs;  // replay time it was used
+  uint32_t matched;
+  uint32_t mismatched;
+  char firstMismatch[128];
+  sessionMismatchCallback callback;
+
+  // The head is an input for state and as much time has passed since
+  // the last record as was recorded
+  boolean inputDue(enum SESSION_RECORD_TYPE type, int state, uint32_t nowMs) {
+    return active && (head.type == type) && (head.b == state) &&
+           ((nowMs - lastProgressMs) >= (head.ms - lastRecordMs));
+  }
+
+  // Read the next record. The end of a cut short log is the end.
+  boolean readHead() {
+    if (!reader.next(&head)) {
+      return false;
+    }
+    truncated = head.type == SR_LOST;
+    return !truncated;
+  }
+
+  void advance(uint32_t nowMs) {
+
+    lastRecordMs = head.ms;
+    lastProgressMs = nowMs;
+    recordIndex++;
+
+    haveHead = readHead();
+    if (!haveHead) {
+      active = false;
+      reader.close();
+    }
+  }
+
+  // Append a record to text, naming states
+  void describe(char *text, size_t size, uint8_t type, uint8_t a, uint16_t b, uint32_t value) {
+    size_t used = strlen(text);
+    if (type == SR_STATE) {
+      snprintf(text + used, size - used, "state %s", reader.stateName(a));
+    } else if (type == SR_BUTTON) {
+      snprintf(text + used, size - used, "button %u in state %s", a, reader.stateName(b));
+    } else if (sessionIsInput(type) && (type != SR_SEED)) {
+      snprintf(text + used, size - used, "%s in state %s", SESSION_RECORD_NAMES[type], reader.stateName(b));
+    } else {
+      snprintf(text + used, size - used, "%s %lu", SESSION_RECORD_NAMES[type], (unsigned long) value);
+    }
+  }
+
+  void mismatch(uint8_t type, uint8_t a, uint16_t b, uint32_t value) {
+
+    char text[sizeof(firstMismatch)];
+    snprintf(text, sizeof(text), "record %lu at %lu ms: expected ",
+             (unsigned long) recordIndex, (unsigned long) head.ms);
+    describe(text, sizeof(text), head.type, head.a, head.b, head.value);
+    strncat(text, ", got ", sizeof(text) - strlen(text) - 1);
+    describe(text, sizeof(text), type, a, b, value);
+    report(text);
+  }
+
+  void report(const char *text) {
+
+    if (mismatched++ == 0) {
+      snprintf(firstMismatch, sizeof(firstMismatch), "%s", text);
+    }
+    if (callback != NULL) {
+      callback(text);
+    }
+  }
+};
+
+#endif
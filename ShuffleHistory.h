@@ -0,0 +1,178 @@
+/*
+   Shuffle History
+
+   The last SHUFFLE_HISTORY_SIZE songs shuffle play played, as library
+   index track numbers (see LibraryIndex.h) in a ring, and a cursor on
+   the one playing. back() steps to older songs and forward() to newer
+   ones until the cursor is on the newest, when shuffle picks a new song
+   and add()s it.
+
+   Every change is written to SHUFFLE_HISTORY_PATH so the history
+   survives a reboot. The file is small and written whole:
+
+     magic "CYDH", version, track count of the index   (uint32 each)
+     songs, cursor                                      (uint8 each)
+     track numbers, oldest first                        (uint32 each)
+
+   A history for a different track count is dropped. tools/libprep.cpp
+   moves the track numbers of songs still on the card to their new ones
+   when it rebuilds the index. tools/hostplayer.cpp historytest checks
+   it against a simple model.
+
+   Last Update: 10/18/2026
+*/
+
+#ifndef SHUFFLEHISTORY_H
+#define SHUFFLEHISTORY_H
+
+#include "Hal.h"
+
+#define SHUFFLE_HISTORY_PATH "/.library/history.bin"
+#define SHUFFLE_HISTORY_MAGIC 0x48445943  // "CYDH"
+#define SHUFFLE_HISTORY_VERSION 1
+#define SHUFFLE_HISTORY_HEADER 14
+
+// Songs remembered, at most 255
+#define SHUFFLE_HISTORY_SIZE 64
+
+class ShuffleHistory {
+
+public:
+
+  ShuffleHistory() {
+    fs = NULL;
+    clear();
+  }
+
+  // Read the history kept for an index of trackCount songs
+  void begin(HalFileSystem *_fs, uint32_t _trackCount, const char *_path = SHUFFLE_HISTORY_PATH) {
+
+    fs = _fs;
+    trackCount = _trackCount;
+    path = _path;
+    clear();
+
+    HalFile *file = fs->open(path, HOM_READ);
+    if (file == NULL) {
+      return;
+    }
+    uint8_t b[SHUFFLE_HISTORY_HEADER + 4 * SHUFFLE_HISTORY_SIZE];
+    int n = file->read(b, sizeof(b));
+    delete file;
+    if ((n < SHUFFLE_HISTORY_HEADER) || (get32(b) != SHUFFLE_HISTORY_MAGIC) ||
+        (get32(b + 4) != SHUFFLE_HISTORY_VERSION) || (get32(b + 8) != trackCount) ||
+        (b[12] > SHUFFLE_HISTORY_SIZE) || (b[13] >= max((int) b[12], 1)) ||
+        (n < SHUFFLE_HISTORY_HEADER + 4 * b[12])) {
+      return;
+    }
+    for (int i = 0; i < b[12]; i++) {
+      uint32_t track = get32(b + SHUFFLE_HISTORY_HEADER + 4 * i);
+      if (track >= trackCount) {
+        clear();
+        return;
+      }
+      tracks[i] = track;
+    }
+    count = b[12];
+    cursor = b[13];
+    newest = (count > 0) ? count - 1 : newest;
+  }
+
+  void clear() {
+    newest = SHUFFLE_HISTORY_SIZE - 1;
+    count = 0;
+    cursor = 0;
+  }
+
+  int getCount() {
+    return count;
+  }
+
+  // Songs back from the newest to the one playing
+  int getCursor() {
+    return cursor;
+  }
+
+  // The song i back from the newest
+  uint32_t get(int i) {
+    return tracks[(newest + SHUFFLE_HISTORY_SIZE - i) % SHUFFLE_HISTORY_SIZE];
+  }
+
+  // A new song picked, which becomes the newest and the one playing
+  void add(uint32_t track) {
+    newest = (newest + 1) % SHUFFLE_HISTORY_SIZE;
+    tracks[newest] = track;
+    count = min(count + 1, SHUFFLE_HISTORY_SIZE);
+    cursor = 0;
+    save();
+  }
+
+  boolean canGoBack() {
+    return cursor + 1 < count;
+  }
+
+  // Step to the song before the one playing
+  boolean back(uint32_t *track) {
+    if (!canGoBack()) {
+      return false;
+    }
+    *track = get(++cursor);
+    save();
+    return true;
+  }
+
+  // Step to the song after the one playing. Returns false if it's the
+  // newest so a new song should be picked.
+  boolean forward(uint32_t *track) {
+    if (cursor == 0) {
+      return false;
+    }
+    *track = get(--cursor);
+    save();
+    return true;
+  }
+
+protected:
+  HalFileSystem *fs;
+  const char *path;
+  uint32_t trackCount;
+
+  uint32_t tracks[SHUFFLE_HISTORY_SIZE];
+  int newest;
+  int count;
+  int cursor;
+
+  // Write the history oldest first
+  void save() {
+
+    if (fs == NULL) {
+      return;
+    }
+    uint8_t b[SHUFFLE_HISTORY_HEADER + 4 * SHUFFLE_HISTORY_SIZE];
+    put32(b, SHUFFLE_HISTORY_MAGIC);
+    put32(b + 4, SHUFFLE_HISTORY_VERSION);
+    put32(b + 8, trackCount);
+    b[12] = count;
+    b[13] = cursor;
+    for (int i = 0; i < count; i++) {
+      put32(b + SHUFFLE_HISTORY_HEADER + 4 * i, get(count - 1 - i));
+    }
+    HalFile *file = fs->open(path, HOM_WRITE);
+    if (file != NULL) {
+      file->write(b, SHUFFLE_HISTORY_HEADER + 4 * count);
+      delete file;
+    }
+  }
+
+  static uint32_t get32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+  }
+
+  static void put32(uint8_t *p, uint32_t v) {
+    for (int i = 0; i < 4; i++) {
+      p[i] = v >> (8 * i);
+    }
+  }
+};
+
+#endif
@@ -25,11 +25,13 @@
 #include "MP3AudioPlayer.h"
 
 #include "AudioSourceSDFAT.h"
+#include "LibraryIndex.h"
+#include "SdFsConfig.h"
 #include "AudioTools/AudioLibs/A2DPStream.h"
 #include "AudioTools/AudioCodecs/CodecMP3Helix.h"
 
-// FIX: Explicitly define template types <SdFat32, File32> to match your SD configuration
-AudioSourceSDFAT<SdFat32, File32> source("", "");
+// The card's file system types are set in SdFsConfig.h
+AudioSourceSDFAT<CardFs, CardFile> source("", "");
 A2DPStream out;
 MP3DecoderHelix decoder;
 MP3AudioPlayer player(source, out, decoder);
@@ -37,10 +39,17 @@ MP3AudioPlayer player(source, out, decoder);
 class SongManager {
 public:
 
-  void begin(SdFat32 *ptrSd) {
+  // Safe to call more than once. Only the first call starts Bluetooth.
+  void begin(CardFs *ptrSd) {
+
+    if (begun) {
+      return;
+    }
 
     source.setSd(ptrSd);
 
+    begun = true;
+
     AudioToolsLogger.begin(Serial, AudioToolsLogLevel::Error);
 
     // Setup output to connect to a Bluetooth Speaker
@@ -57,7 +66,7 @@ public:
 
   // Determine if BT device has connected or not
   bool btConnected() {
-    return out.isConnected();
+    return begun && out.isConnected();
   }
 
   // Volume 0.0 to 1.0
@@ -73,6 +82,10 @@ public:
     }
   }
 
+  float getVolume() {
+    return currentVolume;
+  }
+
   void volumeDown() {
     if (currentVolume >= 0.1) {
       currentVolume -= 0.1;
@@ -82,13 +95,30 @@ public:
 
   // Plays the song specified with the full path on the SD card
   bool playSong(const char *path) {
+    lastSongBytes = player.getBytesDecoded();
+    songNumber++;
+    track = NULL;
     return player.playMP3(path);
   }
 
+  // The playing song's library index entry, so skip() moves by time.
+  // Ignored unless its size matches the song's.
+  void setTrack(const LIBRARY_TRACK *_track) {
+    track = ((_track != NULL) && (_track->size == source.fileSize())) ? _track : NULL;
+  }
+
   void stopSong() {
     player.setActive(false);
   }
 
+  // Stop and close the song's file, which stopSong() leaves open until
+  // the next song, before the card is restarted
+  void closeSong() {
+    player.setActive(false);
+    source.closeFile();
+    track = NULL;
+  }
+
   void resume() {
     player.setActive(true);
   }
@@ -97,6 +127,60 @@ public:
     return player.isActive();
   }
 
+  // Byte position within the current song
+  uint32_t getPosition() {
+    return source.position();
+  }
+
+  // Size in bytes of the current song
+  uint32_t getSize() {
+    return source.fileSize();
+  }
+
+  // Move the play position by percent of the song, stopping at its
+  // ends. With a track set the move is by percent of its duration
+  // through its seek table, so VBR songs skip evenly. The decoder finds
+  // the next frame so the position is rounded to a sector boundary to
+  // keep reads whole.
+  bool skip(int percent) {
+    int64_t size = source.fileSize();
+    int64_t pos;
+    if (track != NULL) {
+      int64_t ms = LibraryIndex::timeAt(track, source.position()) +
+                   (int64_t) track->durationMs * percent / 100;
+      pos = LibraryIndex::positionAt(track, constrain(ms, (int64_t) 0, (int64_t) track->durationMs));
+    } else {
+      pos = source.position() + size * percent / 100;
+    }
+    pos = constrain(pos, (int64_t) 0, size) & ~(int64_t) 511;
+    return source.seek(pos);
+  }
+
+  // Free space in the Bluetooth output buffer
+  uint32_t getBufferFree() {
+    return begun ? out.availableForWrite() : 0;
+  }
+
+  // Failed SD reads while playing since startup
+  uint32_t getReadErrors() {
+    return source.getReadErrors();
+  }
+
+  // Incremented each time a song is started
+  uint32_t getSongNumber() {
+    return songNumber;
+  }
+
+  // PCM bytes decoded for the current song
+  uint32_t getSongBytes() {
+    return player.getBytesDecoded();
+  }
+
+  // PCM bytes decoded for the song before the current one
+  uint32_t getLastSongBytes() {
+    return lastSongBytes;
+  }
+
   // This needs to be called in the Arduino loop() function
   // as fast as possible
   void loop() {
@@ -105,5 +189,9 @@ public:
 
 protected:
 
-  float currentVolume;
+  bool begun = false;
+  float currentVolume = DEFAULT_VOLUME;
+  uint32_t songNumber = 0;
+  uint32_t lastSongBytes = 0;
+  const LIBRARY_TRACK *track = NULL;
 };
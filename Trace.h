@@ -0,0 +1,231 @@
+/*
+   Lock-Free Event Trace Ring
+
+   A fixed size ring of compact trace records used to find the cause of
+   rare audio glitches. Any task can add a record. Claiming a slot is a
+   single atomic increment so writers never block or take a lock. When
+   the ring is full the oldest records are overwritten.
+
+   Records are stamped with the CPU cycle counter, which is much cheaper
+   to read than micros(). The dump header carries the ticks per
+   microsecond, and the converter unwraps the 32 bit counter, which wraps
+   every 17.9 s at 240 MHz.
+
+   dump() writes the ring to the SD card, oldest record first, followed
+   by a table of FSM state names. tools/trace2json.cpp turns the dump
+   into Chrome trace_event JSON for chrome://tracing or ui.perfetto.dev.
+
+   Use the TRACE_BEGIN/TRACE_END/TRACE_INSTANT macros for instrumentation.
+   They compile to nothing unless ENABLE_TRACE is 1.
+
+   Only standard headers are used outside of ARDUINO so the host tool
+   can share the record format.
+
+   Last Update: 10/18/2026
+*/
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <atomic>
+#include <stdint.h>
+#include <string.h>
+
+#ifndef ENABLE_TRACE
+#define ENABLE_TRACE 0
+#endif
+
+// Number of records in the ring. Must be a power of two.
+#define TRACE_RING_SIZE 1024
+
+#define TRACE_MAGIC "CYTR"
+#define TRACE_VERSION 1
+
+// Traced events. Names for the host tool are in TRACE_EVENT_NAMES.
+enum TRACE_EVENT {
+  TE_SD_READ,       // arg = bytes requested
+  TE_DECODE,        // one player copy() pass: read + decode + output
+  TE_A2DP_WRITE,    // decoded frame written toward A2DP, arg = bytes
+  TE_LCD_FILL,      // large rectangle fill, arg = pixels / 256
+  TE_LCD_TEXT,      // text draw, arg = chars
+  TE_LCD_PAINT,     // listbox repaint
+  TE_FSM_STATE,     // FSM entered a state, arg = state
+  TE_SELF_TEST,     // trace cost measurement
+  TE_COUNT
+};
+
+static const char *const TRACE_EVENT_NAMES[TE_COUNT] = {
+  "sd_read", "decode", "a2dp_write", "lcd_fill", "lcd_text", "lcd_paint",
+  "state", "self_test"
+};
+
+// Record phases. Same letters as Chrome trace events.
+#define TRACE_PHASE_BEGIN   'B'
+#define TRACE_PHASE_END     'E'
+#define TRACE_PHASE_INSTANT 'i'
+
+typedef struct __attribute__((packed)) {
+  uint32_t ticks;   // CPU cycle counter
+  uint8_t event;    // TRACE_EVENT
+  uint8_t phase;    // TRACE_PHASE_*
+  uint16_t arg;
+} TRACE_RECORD;
+
+// Start of a trace dump file
+typedef struct __attribute__((packed)) {
+  char magic[4];
+  uint8_t version;
+  uint8_t reserved;
+  uint16_t ticksPerUs;
+  uint32_t recordCount;   // records following the header
+  uint32_t lost;          // records overwritten before the dump
+  uint16_t nameCount;     // state names following the records
+  uint16_t reserved2;
+} TRACE_FILE_HEADER;
+
+#ifdef ARDUINO
+#include "SdFsConfig.h"
+#define TRACE_TICKS() ESP.getCycleCount()
+#define TRACE_TICKS_PER_US() getCpuFrequencyMhz()
+#else
+#include <time.h>
+inline uint32_t traceHostTicks() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint32_t)(ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+}
+#define TRACE_TICKS() traceHostTicks()
+#define TRACE_TICKS_PER_US() 1000
+#endif
+
+class TraceRing {
+
+public:
+
+  TraceRing() {
+    head.store(0, std::memory_order_relaxed);
+    enabled.store(false, std::memory_order_relaxed);
+  }
+
+  void setEnabled(bool on) {
+    enabled.store(on, std::memory_order_relaxed);
+  }
+
+  bool isEnabled() {
+    return enabled.load(std::memory_order_relaxed);
+  }
+
+  // Forget all records
+  void clear() {
+    head.store(0, std::memory_order_relaxed);
+  }
+
+  // Add a record. Safe from any task.
+  inline void record(uint8_t event, uint8_t phase, uint16_t arg) {
+
+    if (!enabled.load(std::memory_order_relaxed)) {
+      return;
+    }
+    uint32_t slot = head.fetch_add(1, std::memory_order_relaxed) & (TRACE_RING_SIZE - 1);
+    TRACE_RECORD *r = &ring[slot];
+    r->ticks = TRACE_TICKS();
+    r->event = event;
+    r->phase = phase;
+    r->arg = arg;
+  }
+
+  // Number of records written since the last clear()
+  uint32_t getHead() {
+    return head.load(std::memory_order_relaxed);
+  }
+
+  // Average cost of one record in nanoseconds, measured over count
+  // records. Clears the ring and leaves tracing as it was.
+  uint32_t measureCostNs(uint32_t count) {
+
+    bool wasEnabled = isEnabled();
+    setEnabled(true);
+
+    uint32_t start = TRACE_TICKS();
+    for (uint32_t i = 0; i < count; i++) {
+      record(TE_SELF_TEST, TRACE_PHASE_INSTANT, (uint16_t) i);
+    }
+    uint32_t ticks = TRACE_TICKS() - start;
+
+    setEnabled(wasEnabled);
+    clear();
+
+    return (uint32_t)((uint64_t) ticks * 1000 / TRACE_TICKS_PER_US() / count);
+  }
+
+#ifdef ARDUINO
+  // Write the ring, oldest record first, and the state names to path.
+  // Tracing is paused while dumping. Returns false on a write error.
+  boolean dump(CardFs *ptrSd, const char *path,
+               const char *(*stateName)(int state), int stateCount) {
+
+    bool wasEnabled = isEnabled();
+    setEnabled(false);
+
+    CardFile out = ptrSd->open(path, O_WRONLY | O_CREAT | O_TRUNC);
+    if (!out) {
+      setEnabled(wasEnabled);
+      return false;
+    }
+
+    uint32_t written = getHead();
+    uint32_t count = (written < TRACE_RING_SIZE) ? written : TRACE_RING_SIZE;
+    uint32_t first = written - count;
+
+    TRACE_FILE_HEADER header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TRACE_MAGIC, 4);
+    header.version = TRACE_VERSION;
+    header.ticksPerUs = TRACE_TICKS_PER_US();
+    header.recordCount = count;
+    header.lost = first;
+    header.nameCount = stateCount;
+    out.write((const uint8_t *) &header, sizeof(header));
+
+    // Oldest part of the ring first
+    uint32_t start = first & (TRACE_RING_SIZE - 1);
+    uint32_t firstPart = (count < TRACE_RING_SIZE - start) ? count : TRACE_RING_SIZE - start;
+    out.write((const uint8_t *) &ring[start], firstPart * sizeof(TRACE_RECORD));
+    out.write((const uint8_t *) &ring[0], (count - firstPart) * sizeof(TRACE_RECORD));
+
+    // NUL terminated state names so the tool can label transitions
+    for (int i = 0; i < stateCount; i++) {
+      const char *name = stateName(i);
+      out.write((const uint8_t *) name, strlen(name) + 1);
+    }
+
+    boolean ok = !out.getWriteError();
+    out.close();
+
+    clear();
+    setEnabled(wasEnabled);
+    return ok;
+  }
+#endif
+
+protected:
+
+  std::atomic<uint32_t> head;
+  std::atomic<bool> enabled;
+  TRACE_RECORD ring[TRACE_RING_SIZE];
+};
+
+#if ENABLE_TRACE
+// The one trace ring
+TraceRing traceRing;
+
+#define TRACE_BEGIN(event, arg) traceRing.record(event, TRACE_PHASE_BEGIN, arg)
+#define TRACE_END(event, arg) traceRing.record(event, TRACE_PHASE_END, arg)
+#define TRACE_INSTANT(event, arg) traceRing.record(event, TRACE_PHASE_INSTANT, arg)
+#else
+#define TRACE_BEGIN(event, arg)
+#define TRACE_END(event, arg)
+#define TRACE_INSTANT(event, arg)
+#endif
+
+#endif
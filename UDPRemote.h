@@ -0,0 +1,284 @@
+/*
+   UDP Remote Control and Now Playing Server
+
+   Lets a phone or PC press the player's buttons, change the volume and
+   receive periodic now playing status datagrams over WiFi.
+   See RemoteProtocol.h for the datagram formats.
+
+   Datagrams must be signed with REMOTE_SECRET from Secrets.h. Anything
+   else is dropped without a reply.
+
+   Remote button presses go into the ButtonManager's queue so the FSM
+   handles them exactly like touches. Each call to loop() handles at most
+   REMOTE_MAX_PACKETS datagrams and never waits on the network so it can't
+   starve the audio feed.
+
+   Last Update: 10/18/2026
+*/
+
+#ifndef UDPREMOTE_H
+#define UDPREMOTE_H
+
+#include <WiFi.h>
+#include <WiFiUdp.h>
+
+#include "RemoteProtocol.h"
+
+// Max datagrams handled per loop() call
+#define REMOTE_MAX_PACKETS 4
+
+// Now playing information supplied by the application
+typedef struct {
+  boolean playing;
+  uint8_t state;
+  const char *name;
+} REMOTE_NOW_PLAYING;
+
+// Callback the application uses to describe what is playing
+typedef void (*nowPlayingCallback)(REMOTE_NOW_PLAYING *info);
+
+class UDPRemote {
+
+public:
+
+  // Class Constructor
+  UDPRemote(ButtonManager *pBm, SongManager *pSm) {
+
+    // Save incoming
+    _pBm = pBm;
+    _pSm = pSm;
+
+    listening = false;
+    subscribed = false;
+    statusSeq = 0;
+    nowPlaying = NULL;
+    remoteKey(&key, REMOTE_SECRET);
+  }
+
+  // Start connecting to WiFi. loop() starts listening once connected.
+  void begin(nowPlayingCallback callback) {
+
+    nowPlaying = callback;
+
+    if (WiFi.status() != WL_CONNECTED) {
+      WiFi.mode(WIFI_STA);
+      WiFi.begin(WIFI_NAME, WIFI_PSWD);
+    }
+  }
+
+  // Stop listening and forget any subscriber
+  void end() {
+
+    if (listening) {
+      udp.stop();
+    }
+    listening = false;
+    subscribed = false;
+  }
+
+  // This needs to be called in the Arduino loop() function
+  void loop() {
+
+    if (WiFi.status() != WL_CONNECTED) {
+      if (listening) {
+        end();
+      }
+      return;
+    }
+    if (!listening) {
+      listening = udp.begin(REMOTE_UDP_PORT);
+      if (!listening) {
+        return;
+      }
+      Serial.printf("UDP remote listening on %s:%d\n",
+                    WiFi.localIP().toString().c_str(), REMOTE_UDP_PORT);
+    }
+
+    for (int i = 0; i < REMOTE_MAX_PACKETS; i++) {
+      int length = udp.parsePacket();
+      if (length <= 0) {
+        break;
+      }
+      handlePacket(length);
+    }
+
+    if (subscribed) {
+      uint32_t now = millis();
+      if ((int32_t)(now - leaseEndMs) > 0) {
+        subscribed = false;
+      } else if ((now - lastStatusMs) >= statusIntervalMs) {
+        lastStatusMs = now;
+        sendStatus(subscriberIp, subscriberPort, statusSeq++);
+      }
+    }
+  }
+
+protected:
+
+  void handlePacket(int length) {
+
+    uint8_t packet[REMOTE_MAX_PACKET];
+    int n = udp.read(packet, sizeof(packet));
+
+    // Oversized, malformed or unsigned datagrams are dropped without a reply
+    if (n != length || !remoteHeaderValid(&key, packet, n)) {
+      return;
+    }
+
+    REMOTE_HEADER *header = (REMOTE_HEADER *) packet;
+    uint8_t *payload = packet + sizeof(REMOTE_HEADER);
+    int payloadLength = n - sizeof(REMOTE_HEADER);
+    uint8_t result = RR_OK;
+
+    switch (header->type) {
+      case RT_BUTTON:
+        if (payloadLength < 1) {
+          result = RR_BAD_PACKET;
+        } else {
+          result = queueKey(payload[0]);
+        }
+        break;
+
+      case RT_VOLUME_SET:
+        if (payloadLength < 1 || payload[0] > 100) {
+          result = RR_BAD_PACKET;
+        } else {
+          _pSm->setVolume(payload[0] / 100.0);
+        }
+        break;
+
+      case RT_VOLUME_STEP:
+        if (payloadLength < 1) {
+          result = RR_BAD_PACKET;
+        } else {
+          int8_t steps = (int8_t) payload[0];
+          for (; steps > 0; steps--) {
+            _pSm->volumeUp();
+          }
+          for (; steps < 0; steps++) {
+            _pSm->volumeDown();
+          }
+        }
+        break;
+
+      case RT_SUBSCRIBE:
+        if (payloadLength < 2) {
+          result = RR_BAD_PACKET;
+        } else {
+          uint16_t interval = payload[0] | (payload[1] << 8);
+          subscribe(interval);
+        }
+        break;
+
+      case RT_PING:
+        break;
+
+      default:
+        result = RR_UNKNOWN_COMMAND;
+        break;
+    }
+
+    sendAck(header->seq, result);
+
+    // New subscribers get a status right away
+    if (header->type == RT_SUBSCRIBE && subscribed) {
+      lastStatusMs = millis();
+      sendStatus(subscriberIp, subscriberPort, statusSeq++);
+    }
+  }
+
+  // Translate a remote key into a button event for the FSM
+  uint8_t queueKey(uint8_t key) {
+
+    enum BUTTON_STATE bs;
+
+    switch (key) {
+      case RK_MINUS: bs = BS_MINUS; break;
+      case RK_PLUS: bs = BS_PLUS; break;
+      case RK_SELECT: bs = BS_SELECT; break;
+      case RK_BACK: bs = BS_BACK; break;
+      case RK_TOUCHED: bs = BS_TOUCHED; break;
+      default:
+        return RR_BAD_PACKET;
+    }
+    return _pBm->queueButton(bs) ? RR_OK : RR_QUEUE_FULL;
+  }
+
+  // Only one subscriber at a time. The latest one wins.
+  void subscribe(uint16_t interval) {
+
+    if (interval == 0) {
+      subscribed = false;
+      return;
+    }
+    subscriberIp = udp.remoteIP();
+    subscriberPort = udp.remotePort();
+    statusIntervalMs = max((uint16_t) REMOTE_MIN_INTERVAL_MS, interval);
+    leaseEndMs = millis() + REMOTE_LEASE_MS;
+    subscribed = true;
+  }
+
+  void sendAck(uint16_t seq, uint8_t result) {
+
+    REMOTE_ACK ack;
+    remoteHeader(&ack.header, RT_ACK, seq);
+    ack.result = result;
+    remoteSign(&key, (uint8_t *) &ack, sizeof(ack));
+
+    udp.beginPacket(udp.remoteIP(), udp.remotePort());
+    udp.write((uint8_t *) &ack, sizeof(ack));
+    udp.endPacket();
+  }
+
+  void sendStatus(IPAddress ip, uint16_t port, uint16_t seq) {
+
+    uint8_t packet[sizeof(REMOTE_STATUS) + REMOTE_NAME_SIZE];
+    REMOTE_STATUS *status = (REMOTE_STATUS *) packet;
+
+    REMOTE_NOW_PLAYING info = { false, 0, "" };
+    if (nowPlaying != NULL) {
+      nowPlaying(&info);
+    }
+
+    remoteHeader(&status->header, RT_STATUS, seq);
+    status->flags = (info.playing ? RS_PLAYING : 0) |
+                    (_pSm->btConnected() ? RS_BT_CONNECTED : 0);
+    status->volume = (uint8_t)(_pSm->getVolume() * 100.0 + 0.5);
+    status->state = info.state;
+    status->position = _pSm->getPosition();
+    status->size = _pSm->getSize();
+    status->bufferFree = _pSm->getBufferFree();
+    status->uptimeMs = millis();
+
+    size_t nameLength = (info.name != NULL) ? strlen(info.name) : 0;
+    if (nameLength > REMOTE_NAME_SIZE) {
+      nameLength = REMOTE_NAME_SIZE;
+    }
+    status->nameLength = nameLength;
+    memcpy(packet + sizeof(REMOTE_STATUS), info.name, nameLength);
+    remoteSign(&key, packet, sizeof(REMOTE_STATUS) + nameLength);
+
+    udp.beginPacket(ip, port);
+    udp.write(packet, sizeof(REMOTE_STATUS) + nameLength);
+    udp.endPacket();
+  }
+
+  ButtonManager *_pBm;
+  SongManager *_pSm;
+  nowPlayingCallback nowPlaying;
+  REMOTE_KEY_PAIR key;
+
+  WiFiUDP udp;
+  boolean listening;
+
+  // Status subscriber
+  boolean subscribed;
+  IPAddress subscriberIp;
+  uint16_t subscriberPort;
+  uint16_t statusIntervalMs;
+  uint16_t statusSeq;
+  uint32_t lastStatusMs;
+  uint32_t leaseEndMs;
+};
+
+#endif
@@ -0,0 +1,1359 @@
+/*
+   HTTP/WebDAV Server for ESP32 with attached SD Card
+
+   Serves the SD card over plain HTTP on port 80 so files can be
+   managed from a browser, curl or any WebDAV client (Windows Explorer,
+   macOS Finder, Android/iOS file managers) without FTP's separate
+   passive data port.
+
+   Supported methods:
+     OPTIONS
+     GET/HEAD   - files with single "Range: bytes=" requests, directories
+                  as a simple HTML listing
+     PUT        - Content-Length or chunked transfer encoded uploads
+     DELETE     - files and (recursively) directories
+     MKCOL      - create a directory
+     MOVE       - rename or move a file or directory
+     PROPFIND   - Depth 0 and 1
+
+   Every call to handleHTTP() does a bounded amount of work and never
+   waits on the network, so it can run from the main loop alongside
+   the FTP server and the audio feed. Responses are queued in the
+   transfer buffer and sent with non-blocking socket writes. Whatever
+   the socket doesn't take waits there for the next call. Removing a
+   directory tree is also spread over calls.
+
+   MOVE never replaces the root, the source itself or a directory
+   holding the source. An existing destination is renamed out of the
+   way first and only removed once the source is in its place.
+
+   PUT writes the body to a file next to the target and only puts it
+   in the target's place once all of it is on the card. An upload that
+   fails or is cut off is removed and leaves the old file as it was.
+
+   tools/webdavtest.cpp runs this server on Linux against a directory
+   and checks it with curl.
+
+   Requests are authenticated with HTTP Basic auth using the FTP
+   credentials.
+
+   Last Update: 10/18/2026
+*/
+
+// Uncomment to print debugging info to console attached to ESP32
+// #define HTTP_DEBUG
+
+#ifndef WEBDAVSERVER_H
+#define WEBDAVSERVER_H
+
+#include <WiFi.h>
+#include <WiFiClient.h>
+#include <base64.h>
+#include <errno.h>
+#include <lwip/sockets.h>
+
+#include "FileTransferHelpers.h"
+
+#ifndef HTTP_PORT
+#define HTTP_PORT 80                // Port the server is listening on
+#endif
+#define HTTP_LINE_SIZE 512          // max size of a request or header line
+#define HTTP_PATH_SIZE 255 + 8      // max size of a decoded path
+#define HTTP_BUF_SIZE 4096          // size of file buffer for read/write (multiple of 512 byte sectors)
+#define HTTP_SEND_BUDGET_MS 20      // max time spent sending/receiving body data per call
+#define HTTP_LIST_ENTRIES 4         // directory entries emitted per call
+#define HTTP_IDLE_TIME_OUT 30000    // close idle keep-alive connections after 30 seconds
+#define HTTP_CHUNKED 0xFFFFFFFF     // content length value selecting chunked encoding
+#define HTTP_CHUNK_HEAD 10          // "%08X\r\n" chunk size line
+
+// Instantiate the HTTP server
+WiFiServer httpServer(HTTP_PORT);
+
+enum HTTP_METHOD {
+  HM_UNKNOWN,
+  HM_OPTIONS,
+  HM_GET,
+  HM_HEAD,
+  HM_PUT,
+  HM_DELETE,
+  HM_MKCOL,
+  HM_MOVE,
+  HM_PROPFIND
+};
+
+// Connection states
+enum HTTP_STATE {
+  HS_IDLE,          // No client
+  HS_REQUEST_LINE,  // Waiting for a request line
+  HS_HEADERS,       // Reading request headers
+  HS_SEND_FILE,     // Streaming a file (or part of one) to the client
+  HS_SEND_LIST,     // Streaming a directory listing to the client
+  HS_RECV_BODY,     // Receiving a PUT body into a file
+  HS_REMOVE,        // Removing a directory tree for DELETE or MOVE
+  HS_FLUSH          // Sending the rest of a response
+};
+
+// Chunked transfer decoding states
+enum CHUNK_STATE {
+  CS_SIZE,          // Reading a chunk size line
+  CS_DATA,          // Reading chunk data
+  CS_DATA_END,      // Reading the CRLF which follows chunk data
+  CS_TRAILER        // Reading trailer lines after the last chunk
+};
+
+class WebDAVServer {
+
+public:
+
+  void begin(String uname, String pword, CardFs *ptrSd) {
+
+    _ptrSd = ptrSd;
+
+    // Precompute the expected Authorization header
+    _auth = "Basic " + base64::encode(uname + ":" + pword);
+
+    httpServer.begin();
+    state = HS_IDLE;
+    bufPos = 0;
+    bufLen = 0;
+  }
+
+  void handleHTTP() {
+
+    // Only pick up a new connection when the current one is idle.
+    // Pending connections wait in the listen backlog.
+    if (httpServer.hasClient() &&
+        (state == HS_IDLE || (state == HS_REQUEST_LINE && iLine == 0 && !client.available()))) {
+      client.stop();
+      client = httpServer.available();
+      discardRemaining = 0;
+      startRequest();
+#ifdef HTTP_DEBUG
+      Serial.println("HTTP client connected");
+#endif
+    }
+
+    if (state == HS_IDLE) {
+      return;
+    }
+
+    // A removal is finished even if the client went away, so MOVE
+    // doesn't leave the old destination behind
+    if (state != HS_REMOVE && !client.connected() && !client.available()) {
+      // Client went away
+      abortRequest();
+      return;
+    }
+
+    switch (state) {
+      case HS_REQUEST_LINE:
+      case HS_HEADERS:
+        readRequest();
+        break;
+
+      case HS_SEND_FILE:
+        sendFile();
+        break;
+
+      case HS_SEND_LIST:
+        sendListing();
+        break;
+
+      case HS_RECV_BODY:
+        receiveBody();
+        break;
+
+      case HS_REMOVE:
+        removeSome();
+        break;
+
+      case HS_FLUSH:
+        finishResponse();
+        break;
+
+      default:
+        break;
+    }
+
+    // Drop connections that stopped sending or reading
+    if (state != HS_IDLE && state != HS_REMOVE &&
+        (millis() - millisLastActivity) > HTTP_IDLE_TIME_OUT) {
+      abortRequest();
+    }
+  }
+
+private:
+
+  /****************************************************************/
+  /***                     Request parsing                      ***/
+  /****************************************************************/
+
+  // Prepare for the next request on the current connection
+  void startRequest() {
+
+    state = HS_REQUEST_LINE;
+    iLine = 0;
+    lineOverflow = false;
+    millisLastActivity = millis();
+  }
+
+  // Reset the per request header values
+  void resetHeaders() {
+
+    contentLength = -1;
+    chunked = false;
+    expectContinue = false;
+    overwrite = true;
+    depth = 1;
+    rangeHeader[0] = 0;
+    authHeader[0] = 0;
+    destination[0] = 0;
+  }
+
+  // Read request and header lines as they arrive
+  void readRequest() {
+
+    // Throw away the body of a previous request we did not use
+    while (discardRemaining > 0) {
+      size_t toRead = min((uint32_t) HTTP_BUF_SIZE, discardRemaining);
+      int nb = client.read((uint8_t *) buf, toRead);
+      if (nb <= 0) {
+        return;
+      }
+      discardRemaining -= nb;
+      millisLastActivity = millis();
+    }
+
+    // Bound the work done in one call
+    int count = HTTP_LINE_SIZE;
+
+    while (client.available() && count--) {
+      char c = client.read();
+      millisLastActivity = millis();
+      if (c == '\r') {
+        continue;
+      }
+      if (c != '\n') {
+        if (iLine < HTTP_LINE_SIZE - 1) {
+          line[iLine++] = c;
+        } else {
+          lineOverflow = true;
+        }
+        continue;
+      }
+      line[iLine] = 0;
+
+      if (state == HS_REQUEST_LINE) {
+        // Tolerate blank lines between requests
+        if (iLine > 0) {
+          if (lineOverflow) {
+            resetHeaders();
+            keepAlive = false;
+            sendError(414, "URI Too Long");
+            return;
+          }
+          parseRequestLine();
+          resetHeaders();
+          state = HS_HEADERS;
+        }
+      } else if (iLine == 0) {
+        // Blank line ends the headers
+        iLine = 0;
+        dispatchRequest();
+        return;
+      } else {
+        parseHeader();
+      }
+      iLine = 0;
+      lineOverflow = false;
+    }
+  }
+
+  // Parse "METHOD target HTTP/1.x"
+  void parseRequestLine() {
+
+#ifdef HTTP_DEBUG
+    Serial.println(line);
+#endif
+    char *target = strchr(line, ' ');
+    char *version = NULL;
+    if (target != NULL) {
+      *target++ = 0;
+      version = strchr(target, ' ');
+      if (version != NULL) {
+        *version++ = 0;
+      }
+    }
+
+    if (!strcmp(line, "OPTIONS")) method = HM_OPTIONS;
+    else if (!strcmp(line, "GET")) method = HM_GET;
+    else if (!strcmp(line, "HEAD")) method = HM_HEAD;
+    else if (!strcmp(line, "PUT")) method = HM_PUT;
+    else if (!strcmp(line, "DELETE")) method = HM_DELETE;
+    else if (!strcmp(line, "MKCOL")) method = HM_MKCOL;
+    else if (!strcmp(line, "MOVE")) method = HM_MOVE;
+    else if (!strcmp(line, "PROPFIND")) method = HM_PROPFIND;
+    else method = HM_UNKNOWN;
+
+    // HTTP/1.1 defaults to persistent connections
+    keepAlive = (version != NULL) && !strcmp(version, "HTTP/1.1");
+
+    pathValid = (target != NULL) && decodePath(target, path);
+  }
+
+  // Parse a "Name: value" header line, keeping only the ones we use
+  void parseHeader() {
+
+    char *value = strchr(line, ':');
+    if (value == NULL) {
+      return;
+    }
+    *value++ = 0;
+    while (*value == ' ' || *value == '\t') {
+      value++;
+    }
+
+    if (!strcasecmp(line, "Content-Length")) {
+      contentLength = strtoul(value, NULL, 10);
+    } else if (!strcasecmp(line, "Transfer-Encoding")) {
+      chunked = (containsIgnoreCase(value, "chunked"));
+    } else if (!strcasecmp(line, "Connection")) {
+      if (containsIgnoreCase(value, "close")) {
+        keepAlive = false;
+      } else if (containsIgnoreCase(value, "keep-alive")) {
+        keepAlive = true;
+      }
+    } else if (!strcasecmp(line, "Expect")) {
+      expectContinue = (containsIgnoreCase(value, "100-continue"));
+    } else if (!strcasecmp(line, "Range")) {
+      strncpy(rangeHeader, value, sizeof(rangeHeader) - 1);
+      rangeHeader[sizeof(rangeHeader) - 1] = 0;
+    } else if (!strcasecmp(line, "Authorization")) {
+      strncpy(authHeader, value, sizeof(authHeader) - 1);
+      authHeader[sizeof(authHeader) - 1] = 0;
+    } else if (!strcasecmp(line, "Destination")) {
+      strncpy(destination, value, sizeof(destination) - 1);
+      destination[sizeof(destination) - 1] = 0;
+    } else if (!strcasecmp(line, "Depth")) {
+      depth = (value[0] == '0') ? 0 : 1;
+    } else if (!strcasecmp(line, "Overwrite")) {
+      overwrite = (toupper(value[0]) != 'F');
+    }
+  }
+
+  // Case insensitive substring test for header values
+  boolean containsIgnoreCase(const char *str, const char *word) {
+
+    size_t len = strlen(word);
+    for (; *str; str++) {
+      if (!strncasecmp(str, word, len)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Convert a request target (absolute path or absolute URL) into a
+  // decoded SD card path. Returns false for malformed or unsafe paths.
+  boolean decodePath(char *target, char *outPath) {
+
+    // Skip scheme and authority of an absolute URL
+    char *p = strstr(target, "://");
+    if (p != NULL) {
+      p = strchr(p + 3, '/');
+      if (p == NULL) {
+        p = (char *) "/";
+      }
+    } else {
+      p = target;
+    }
+    if (*p != '/') {
+      return false;
+    }
+
+    uint16_t n = 0;
+    while (*p && *p != '?' && *p != '#') {
+      char c = *p++;
+      if (c == '%' && isxdigit(p[0]) && isxdigit(p[1])) {
+        char hex[3] = { p[0], p[1], 0 };
+        c = (char) strtol(hex, NULL, 16);
+        p += 2;
+      }
+      if (n >= HTTP_PATH_SIZE - 1) {
+        return false;
+      }
+      outPath[n++] = c;
+    }
+    outPath[n] = 0;
+
+    // Never allow escaping the root directory
+    if (strstr(outPath, "/../") != NULL || !strcmp(outPath + max((int)n - 3, 0), "/..")) {
+      return false;
+    }
+
+    // Remove a trailing slash except for the root
+    if (n > 1 && outPath[n - 1] == '/') {
+      outPath[n - 1] = 0;
+    }
+    return true;
+  }
+
+  /****************************************************************/
+  /***                    Request dispatching                   ***/
+  /****************************************************************/
+
+  void dispatchRequest() {
+
+    // A body we do not consume is thrown away before the next request.
+    // Chunked bodies can't be skipped that way so the connection closes.
+    discardRemaining = (contentLength > 0) ? contentLength : 0;
+    if (chunked && method != HM_PUT) {
+      keepAlive = false;
+    }
+
+    if (strcmp(authHeader, _auth.c_str())) {
+      sendError(401, "Unauthorized", "WWW-Authenticate: Basic realm=\"CYD Music Player\"\r\n");
+      return;
+    }
+    if (!pathValid) {
+      sendError(400, "Bad Request");
+      return;
+    }
+
+    switch (method) {
+      case HM_OPTIONS:
+        sendHeaders(200, "OK", NULL, 0,
+                    "DAV: 1\r\n"
+                    "MS-Author-Via: DAV\r\n"
+                    "Allow: OPTIONS, GET, HEAD, PUT, DELETE, MKCOL, MOVE, PROPFIND\r\n");
+        finishResponse();
+        break;
+
+      case HM_GET:
+      case HM_HEAD:
+        doGet();
+        break;
+
+      case HM_PUT:
+        doPut();
+        break;
+
+      case HM_DELETE:
+        doDelete();
+        break;
+
+      case HM_MKCOL:
+        doMkcol();
+        break;
+
+      case HM_MOVE:
+        doMove();
+        break;
+
+      case HM_PROPFIND:
+        doPropfind();
+        break;
+
+      default:
+        sendError(405, "Method Not Allowed");
+        break;
+    }
+  }
+
+  // GET/HEAD - Retrieve a file, part of a file or a directory listing
+  void doGet() {
+
+    file = _ptrSd->open(path, O_RDONLY);
+    if (!file) {
+      sendError(404, "Not Found");
+      return;
+    }
+
+    if (file.isDirectory()) {
+      if (method == HM_HEAD) {
+        file.close();
+        sendHeaders(200, "OK", "text/html", 0);
+        finishResponse();
+        return;
+      }
+      sendHeaders(200, "OK", "text/html; charset=utf-8", HTTP_CHUNKED);
+      char *out = chunkData();
+      int size = chunkSpace();
+      int n = snprintf(out, size,
+                       "<html><head><meta charset=\"utf-8\"></head><body><h3>Index of ");
+      n += xmlEscape(out + n, size - n, path);
+      n += snprintf(out + n, size - n, "</h3><ul>\n");
+      commitChunk(n);
+      listXml = false;
+      state = HS_SEND_LIST;
+      return;
+    }
+
+    uint32_t size = file.fileSize();
+    uint32_t first = 0;
+    uint32_t last = size - 1;
+    boolean partial = false;
+
+    if (rangeHeader[0] != 0) {
+      if (!parseRange(size, &first, &last)) {
+        file.close();
+        sendError(416, "Range Not Satisfiable",
+                  ("Content-Range: bytes */" + String(size) + "\r\n").c_str());
+        return;
+      }
+      partial = true;
+    }
+
+    sendRemaining = (size == 0) ? 0 : last - first + 1;
+    String extra = "Accept-Ranges: bytes\r\n";
+    if (partial) {
+      extra += "Content-Range: bytes " + String(first) + "-" + String(last) + "/" + String(size) + "\r\n";
+    }
+    sendHeaders(partial ? 206 : 200, partial ? "Partial Content" : "OK",
+                contentType(path), sendRemaining, extra.c_str());
+
+    if (method == HM_HEAD || sendRemaining == 0) {
+      file.close();
+      finishResponse();
+      return;
+    }
+
+    file.seekSet(first);
+    bytesPerCluster = _ptrSd->bytesPerCluster();
+    state = HS_SEND_FILE;
+  }
+
+  // Parse a single "bytes=first-last", "bytes=first-" or "bytes=-suffix"
+  // range. Only the first range of a multi range request is honored.
+  boolean parseRange(uint32_t size, uint32_t *pFirst, uint32_t *pLast) {
+
+    if (strncasecmp(rangeHeader, "bytes=", 6) || size == 0) {
+      return false;
+    }
+    char *p = rangeHeader + 6;
+    char *end;
+
+    if (*p == '-') {
+      uint32_t suffix = strtoul(p + 1, &end, 10);
+      if (end == p + 1 || suffix == 0) {
+        return false;
+      }
+      *pFirst = (suffix >= size) ? 0 : size - suffix;
+      *pLast = size - 1;
+      return true;
+    }
+
+    *pFirst = strtoul(p, &end, 10);
+    if (end == p || *end != '-' || *pFirst >= size) {
+      return false;
+    }
+    p = end + 1;
+    if (isdigit(*p)) {
+      *pLast = strtoul(p, &end, 10);
+      if (*pLast < *pFirst) {
+        return false;
+      }
+      if (*pLast >= size) {
+        *pLast = size - 1;
+      }
+    } else {
+      *pLast = size - 1;
+    }
+    return true;
+  }
+
+  // PUT - Create or replace a file
+  void doPut() {
+
+    if (contentLength < 0 && !chunked) {
+      keepAlive = false;
+      sendError(411, "Length Required");
+      return;
+    }
+    if (!parentExists(path)) {
+      sendError(409, "Conflict");
+      return;
+    }
+
+    CardFile existing = _ptrSd->open(path, O_RDONLY);
+    putExisted = existing;
+    boolean isDir = existing && existing.isDirectory();
+    existing.close();
+    if (isDir) {
+      sendError(405, "Method Not Allowed");
+      return;
+    }
+
+    // The target is replaced once the whole body is written
+    if (!tempName(path, putTemp)) {
+      sendError(500, "Can't Create File");
+      return;
+    }
+    file = _ptrSd->open(putTemp, O_WRONLY | O_CREAT | O_TRUNC);
+    if (!file) {
+      sendError(500, "Can't Create File");
+      return;
+    }
+
+#ifdef HTTP_DEBUG
+    Serial.println("Receiving " + String(path));
+#endif
+    if (expectContinue) {
+      queue("HTTP/1.1 100 Continue\r\n\r\n");
+    }
+
+    // The body is consumed here rather than discarded
+    discardRemaining = 0;
+    bodyRemaining = chunked ? 0 : contentLength;
+    chunkState = CS_SIZE;
+    chunkedBodyDone = false;
+    iLine = 0;
+    writeBehind.begin(&file, (uint8_t *) buf, HTTP_BUF_SIZE);
+    state = HS_RECV_BODY;
+  }
+
+  // DELETE - Remove a file or a directory tree
+  void doDelete() {
+
+    if (!strcmp(path, "/")) {
+      sendError(403, "Forbidden");
+      return;
+    }
+    CardFile f = _ptrSd->open(path, O_RDONLY);
+    if (!f) {
+      sendError(404, "Not Found");
+      return;
+    }
+
+    f.close();
+
+    // Answered by removeFinished()
+    strcpy(removing, path);
+    startRemove();
+  }
+
+  // MKCOL - Create a directory
+  void doMkcol() {
+
+    if (contentLength > 0 || chunked) {
+      sendError(415, "Unsupported Media Type");
+    } else if (_ptrSd->exists(path)) {
+      sendError(405, "Method Not Allowed");
+    } else if (!parentExists(path)) {
+      sendError(409, "Conflict");
+    } else if (!_ptrSd->mkdir(path, false)) {
+      sendError(500, "Can't Create Directory");
+    } else {
+      notifyPathChanged(path);
+      sendHeaders(201, "Created", NULL, 0);
+      finishResponse();
+    }
+  }
+
+  // MOVE - Rename or move a file or directory
+  void doMove() {
+
+    // Decode the destination into the line buffer which is free now
+    if (destination[0] == 0 || !decodePath(destination, line)) {
+      sendError(400, "Bad Destination");
+      return;
+    }
+
+    // Replacing the destination would remove the source or the card
+    if (!strcmp(path, "/") || !strcmp(line, "/") ||
+        isWithin(line, path) || isWithin(path, line)) {
+      sendError(403, "Forbidden");
+      return;
+    }
+    if (!_ptrSd->exists(path)) {
+      sendError(404, "Not Found");
+      return;
+    }
+    if (!parentExists(line)) {
+      sendError(409, "Conflict");
+      return;
+    }
+
+    boolean replaced = _ptrSd->exists(line);
+    if (replaced) {
+      if (!overwrite) {
+        sendError(412, "Precondition Failed");
+        return;
+      }
+      // Keep the old destination until the source is in its place
+      if (!tempName(line, removing) || !_ptrSd->rename(line, removing)) {
+        sendError(500, "Can't Replace Destination");
+        return;
+      }
+    }
+
+    if (!_ptrSd->rename(path, line)) {
+      if (replaced) {
+        _ptrSd->rename(removing, line);
+      }
+      sendError(500, "Move Failed");
+      return;
+    }
+    notifyPathChanged(path);
+    notifyPathChanged(line);
+    if (replaced) {
+      // Answered by removeFinished()
+      startRemove();
+      return;
+    }
+    sendHeaders(201, "Created", NULL, 0);
+    finishResponse();
+  }
+
+  // Determine if p is dir or somewhere below it. FAT names ignore case.
+  boolean isWithin(const char *p, const char *dir) {
+
+    size_t len = strlen(dir);
+    return !strncasecmp(p, dir, len) && (p[len] == 0 || p[len] == '/');
+  }
+
+  // Pick an unused name next to p to move it out of the way
+  boolean tempName(const char *p, char *temp) {
+
+    for (int i = 0; i < 10; i++) {
+      if (snprintf(temp, HTTP_PATH_SIZE, "%s.~%d", p, i) >= HTTP_PATH_SIZE) {
+        return false;
+      }
+      if (!_ptrSd->exists(temp)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // PROPFIND - Report properties of a resource and, for Depth 1,
+  // of the members of a collection
+  void doPropfind() {
+
+    file = _ptrSd->open(path, O_RDONLY);
+    if (!file) {
+      sendError(404, "Not Found");
+      return;
+    }
+
+    sendHeaders(207, "Multi-Status", "application/xml; charset=\"utf-8\"", HTTP_CHUNKED);
+    char *out = chunkData();
+    int size = chunkSpace();
+    int n = snprintf(out, size,
+                     "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n"
+                     "<D:multistatus xmlns:D=\"DAV:\">\n");
+    n += propEntry(out + n, size - n, file, NULL);
+    commitChunk(n);
+
+    if (file.isDirectory() && depth > 0) {
+      listXml = true;
+      state = HS_SEND_LIST;
+    } else {
+      file.close();
+      endListing();
+    }
+  }
+
+  /****************************************************************/
+  /***                       Body transfer                      ***/
+  /****************************************************************/
+
+  // Send file data until the socket's send buffer is full or the time
+  // budget for this call is used up. Reads never cross a cluster
+  // boundary so the SD card sees whole sector transfers.
+  void sendFile() {
+
+    uint32_t startMs = millis();
+
+    while (drain()) {
+      if (sendRemaining == 0) {
+        file.close();
+        finishResponse();
+        return;
+      }
+      if ((millis() - startMs) >= HTTP_SEND_BUDGET_MS) {
+        return;
+      }
+
+      uint32_t toRead = min((uint32_t) HTTP_BUF_SIZE, sendRemaining);
+      if (bytesPerCluster >= HTTP_BUF_SIZE) {
+        uint32_t toBoundary = bytesPerCluster - (file.curPosition() % bytesPerCluster);
+        if (toBoundary < toRead) {
+          toRead = toBoundary;
+        }
+      }
+      int nb = file.read(buf, toRead);
+      if (nb <= 0) {
+        // File shrank or read error. The response length can't be honored.
+        keepAlive = false;
+        file.close();
+        finishResponse();
+        return;
+      }
+      bufPos = 0;
+      bufLen = nb;
+      sendRemaining -= nb;
+    }
+  }
+
+  // Send a few directory entries per call, each once the previous one
+  // has been sent
+  void sendListing() {
+
+    for (int i = 0; i < HTTP_LIST_ENTRIES; i++) {
+      if (!drain()) {
+        return;
+      }
+      CardFile entry = file.openNextFile();
+      if (!entry) {
+        file.close();
+        endListing();
+        return;
+      }
+
+      entry.getName(name, sizeof(name));
+      if (name[0] != '.') {
+        char *out = chunkData();
+        int size = chunkSpace();
+        int n;
+        if (listXml) {
+          n = propEntry(out, size, entry, name);
+        } else {
+          n = snprintf(out, size, "<li><a href=\"");
+          n += urlEncode(out + n, size - n, path, name, entry.isDirectory());
+          n += snprintf(out + n, size - n, "\">");
+          n += xmlEscape(out + n, size - n, name);
+          n += snprintf(out + n, size - n, "%s</a></li>\n", entry.isDirectory() ? "/" : "");
+        }
+        commitChunk(n);
+      }
+      entry.close();
+    }
+  }
+
+  // Close the HTML or PROPFIND listing and end the response
+  void endListing() {
+
+    int n = snprintf(chunkData(), chunkSpace(), listXml ? "</D:multistatus>\n" : "</ul></body></html>\n");
+    commitChunk(n);
+    queue("0\r\n\r\n");
+    finishResponse();
+  }
+
+  // Receive a PUT body, decoding chunked transfer encoding if used
+  void receiveBody() {
+
+    // The 100 Continue response goes out before the buffer takes the body
+    if (!drain()) {
+      return;
+    }
+
+    uint32_t startMs = millis();
+
+    while (client.available()) {
+      if (!chunked || chunkState == CS_DATA) {
+        // Read body data straight into the write-behind buffer
+        size_t toRead = min((size_t) client.available(), writeBehind.space());
+        uint32_t remaining = chunked ? chunkRemaining : bodyRemaining;
+        if (toRead > remaining) {
+          toRead = remaining;
+        }
+        int nb = client.read(writeBehind.writePtr(), toRead);
+        if (nb <= 0) {
+          break;
+        }
+        millisLastActivity = millis();
+        writeBehind.commit(nb);
+        if (chunked) {
+          chunkRemaining -= nb;
+          if (chunkRemaining == 0) {
+            chunkState = CS_DATA_END;
+          }
+        } else {
+          bodyRemaining -= nb;
+        }
+      } else {
+        // Chunk framing is line oriented
+        char c = client.read();
+        if (c == '\r') {
+          continue;
+        }
+        if (c != '\n') {
+          if (iLine < HTTP_LINE_SIZE - 1) {
+            line[iLine++] = c;
+          }
+          continue;
+        }
+        line[iLine] = 0;
+
+        if (chunkState == CS_SIZE) {
+          chunkRemaining = strtoul(line, NULL, 16);
+          chunkState = (chunkRemaining == 0) ? CS_TRAILER : CS_DATA;
+        } else if (chunkState == CS_DATA_END) {
+          chunkState = CS_SIZE;
+        } else if (iLine == 0) {
+          // Blank line after the trailers ends the body
+          chunkedBodyDone = true;
+        }
+        iLine = 0;
+      }
+
+      if (writeBehind.hasError() || bodyDone()) {
+        break;
+      }
+      if ((millis() - startMs) >= HTTP_SEND_BUDGET_MS) {
+        return;
+      }
+    }
+
+    if (!bodyDone() && !writeBehind.hasError()) {
+      return;
+    }
+
+    writeBehind.flush();
+    file.close();
+
+    if (writeBehind.hasError()) {
+      _ptrSd->remove(putTemp);
+      keepAlive = false;
+      sendError(507, "Insufficient Storage");
+      return;
+    }
+    if (!replaceWithUpload()) {
+      _ptrSd->remove(putTemp);
+      sendError(500, "Can't Replace File");
+      return;
+    }
+    notifyPathChanged(path);
+    if (putExisted) {
+      sendHeaders(204, "No Content", NULL, 0);
+    } else {
+      sendHeaders(201, "Created", NULL, 0);
+    }
+    finishResponse();
+  }
+
+  // Put the uploaded file in the target's place. An existing target is
+  // renamed out of the way and only removed once the upload is there.
+  boolean replaceWithUpload() {
+
+    if (putExisted) {
+      if (!tempName(path, removing) || !_ptrSd->rename(path, removing)) {
+        return false;
+      }
+    }
+    if (!_ptrSd->rename(putTemp, path)) {
+      if (putExisted) {
+        _ptrSd->rename(removing, path);
+      }
+      return false;
+    }
+    if (putExisted) {
+      _ptrSd->remove(removing);
+    }
+    return true;
+  }
+
+  boolean bodyDone() {
+    return chunked ? chunkedBodyDone : (bodyRemaining == 0);
+  }
+
+  /****************************************************************/
+  /***                      Response helpers                    ***/
+  /****************************************************************/
+
+  // Send the status line and headers. A length of HTTP_CHUNKED selects
+  // chunked transfer encoding.
+  void sendHeaders(int code, const char *reason, const char *type,
+                   uint32_t length, const char *extra = NULL) {
+
+    String hdr = "HTTP/1.1 " + String(code) + " " + String(reason) + "\r\n";
+    hdr += "Server: CYD-MusicPlayer\r\n";
+    if (type != NULL) {
+      hdr += "Content-Type: " + String(type) + "\r\n";
+    }
+    if (length == HTTP_CHUNKED) {
+      hdr += "Transfer-Encoding: chunked\r\n";
+    } else {
+      hdr += "Content-Length: " + String(length) + "\r\n";
+    }
+    if (extra != NULL) {
+      hdr += extra;
+    }
+    hdr += keepAlive ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n";
+    queue(hdr.c_str());
+  }
+
+  // Send a short plain text error response
+  void sendError(int code, const char *reason, const char *extra = NULL) {
+
+#ifdef HTTP_DEBUG
+    Serial.println("HTTP " + String(code) + " " + String(reason));
+#endif
+    if (method == HM_PUT && chunked) {
+      keepAlive = false;
+    }
+    sendHeaders(code, reason, "text/plain", strlen(reason) + 2, extra);
+    if (method != HM_HEAD) {
+      queue(reason);
+      queue("\r\n");
+    }
+    finishResponse();
+  }
+
+  // Add text to the response waiting in buf
+  void queue(const char *text) {
+
+    size_t len = min(strlen(text), (size_t)(HTTP_BUF_SIZE - bufLen));
+    memcpy(buf + bufLen, text, len);
+    bufLen += len;
+  }
+
+  // Send what is waiting in buf without blocking. Returns true once all
+  // of it is sent, false while the socket's send buffer is full.
+  boolean drain() {
+
+    while (bufPos < bufLen) {
+      int n = ::send(client.fd(), buf + bufPos, bufLen - bufPos, MSG_DONTWAIT);
+      if (n <= 0) {
+        if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+          // Connection lost. handleHTTP() drops the client next call.
+          client.stop();
+        }
+        return false;
+      }
+      bufPos += n;
+      millisLastActivity = millis();
+    }
+    bufPos = 0;
+    bufLen = 0;
+    return true;
+  }
+
+  // The next chunk's data goes at chunkData(), up to chunkSpace() bytes,
+  // leaving room for its size line and trailing CRLF
+  char *chunkData() {
+    return buf + bufLen + HTTP_CHUNK_HEAD;
+  }
+
+  int chunkSpace() {
+    return HTTP_BUF_SIZE - bufLen - HTTP_CHUNK_HEAD - 2;
+  }
+
+  // Frame the len bytes placed at chunkData() as a chunk. The size is
+  // zero padded so the line can be written after the data.
+  void commitChunk(int len) {
+
+    if (len <= 0) {
+      return;
+    }
+    char size[HTTP_CHUNK_HEAD + 1];
+    snprintf(size, sizeof(size), "%08X\r\n", len);
+    memcpy(buf + bufLen, size, HTTP_CHUNK_HEAD);
+    bufLen += HTTP_CHUNK_HEAD + len;
+    queue("\r\n");
+  }
+
+  // Response queued. Send it, then wait for the next request or close
+  // the connection.
+  void finishResponse() {
+
+    state = HS_FLUSH;
+    if (!drain()) {
+      return;
+    }
+    if (keepAlive) {
+      startRequest();
+    } else {
+      client.stop();
+      state = HS_IDLE;
+    }
+  }
+
+  // Drop the current client, closing any open file
+  void abortRequest() {
+
+    if (state == HS_RECV_BODY) {
+      // A partial upload never replaces the target
+      file.close();
+      _ptrSd->remove(putTemp);
+    } else if (state == HS_SEND_FILE || state == HS_SEND_LIST || state == HS_REMOVE) {
+      file.close();
+    }
+    client.stop();
+    bufPos = 0;
+    bufLen = 0;
+    state = HS_IDLE;
+  }
+
+  // Format one PROPFIND <D:response> element. name is NULL for the
+  // requested resource itself.
+  int propEntry(char *out, int size, CardFile &f, const char *entryName) {
+
+    boolean isDir = f.isDirectory();
+    int n = snprintf(out, size, "<D:response><D:href>");
+    n += urlEncode(out + n, size - n, path, entryName, isDir);
+    n += snprintf(out + n, size - n, "</D:href><D:propstat><D:prop><D:displayname>");
+    if (entryName != NULL) {
+      n += xmlEscape(out + n, size - n, entryName);
+    } else {
+      const char *lastSlash = strrchr(path, '/');
+      n += xmlEscape(out + n, size - n, lastSlash + 1);
+    }
+    n += snprintf(out + n, size - n, "</D:displayname>");
+
+    if (isDir) {
+      n += snprintf(out + n, size - n, "<D:resourcetype><D:collection/></D:resourcetype>");
+    } else {
+      n += snprintf(out + n, size - n,
+                    "<D:resourcetype/><D:getcontentlength>%lu</D:getcontentlength>"
+                    "<D:getcontenttype>%s</D:getcontenttype>",
+                    (unsigned long) f.fileSize(), contentType(entryName != NULL ? entryName : path));
+    }
+
+    uint16_t date, time;
+    if (f.getModifyDateTime(&date, &time)) {
+      n += snprintf(out + n, size - n, "<D:getlastmodified>");
+      n += httpDate(out + n, size - n, date, time);
+      n += snprintf(out + n, size - n, "</D:getlastmodified>");
+    }
+    n += snprintf(out + n, size - n,
+                  "</D:prop><D:status>HTTP/1.1 200 OK</D:status></D:propstat></D:response>\n");
+    return min(n, size - 1);
+  }
+
+  // Format a FAT date and time as an RFC 1123 date
+  int httpDate(char *out, int size, uint16_t date, uint16_t time) {
+
+    static const char *DAYS[] = { "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat" };
+    static const char *MONTHS[] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun",
+                                    "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
+    static const int OFFSETS[] = { 0, 3, 2, 5, 0, 3, 5, 1, 4, 6, 2, 4 };
+
+    int year = ((date >> 9) & 0x7F) + 1980;
+    int month = constrain((date >> 5) & 0x0F, 1, 12);
+    int day = date & 0x1F;
+
+    // Sakamoto's day of week
+    int y = (month < 3) ? year - 1 : year;
+    int dow = (y + y / 4 - y / 100 + y / 400 + OFFSETS[month - 1] + day) % 7;
+
+    return snprintf(out, size, "%s, %02d %s %04d %02d:%02d:%02d GMT",
+                    DAYS[dow], day, MONTHS[month - 1], year,
+                    (time >> 11) & 0x1F, (time >> 5) & 0x3F, (time & 0x1F) << 1);
+  }
+
+  // Percent encode dir (plus "/" and name when name isn't NULL)
+  int urlEncode(char *out, int size, const char *dir, const char *entryName, boolean isDir) {
+
+    int n = 0;
+    for (int part = 0; part < 2; part++) {
+      const char *s = (part == 0) ? dir : entryName;
+      if (s == NULL) {
+        break;
+      }
+      if (part == 1 && n > 0 && out[n - 1] != '/' && n < size - 1) {
+        out[n++] = '/';
+      }
+      for (; *s && n < size - 4; s++) {
+        uint8_t c = *s;
+        if (isalnum(c) || strchr("/-_.~", c) != NULL) {
+          out[n++] = c;
+        } else {
+          n += sprintf(out + n, "%%%02X", c);
+        }
+      }
+    }
+    if (isDir && n > 0 && out[n - 1] != '/' && n < size - 1) {
+      out[n++] = '/';
+    }
+    out[n] = 0;
+    return n;
+  }
+
+  // Copy text escaping the XML/HTML special characters
+  int xmlEscape(char *out, int size, const char *s) {
+
+    int n = 0;
+    for (; *s && n < size - 7; s++) {
+      switch (*s) {
+        case '&': n += sprintf(out + n, "&amp;"); break;
+        case '<': n += sprintf(out + n, "&lt;"); break;
+        case '>': n += sprintf(out + n, "&gt;"); break;
+        case '"': n += sprintf(out + n, "&quot;"); break;
+        default: out[n++] = *s; break;
+      }
+    }
+    out[n] = 0;
+    return n;
+  }
+
+  // Guess a MIME type from the file extension
+  const char *contentType(const char *fileName) {
+
+    const char *ext = strrchr(fileName, '.');
+    if (ext == NULL) return "application/octet-stream";
+    if (!strcasecmp(ext, ".mp3")) return "audio/mpeg";
+    if (!strcasecmp(ext, ".m3u") || !strcasecmp(ext, ".m3u8")) return "audio/x-mpegurl";
+    if (!strcasecmp(ext, ".pls")) return "audio/x-scpls";
+    if (!strcasecmp(ext, ".txt")) return "text/plain";
+    if (!strcasecmp(ext, ".htm") || !strcasecmp(ext, ".html")) return "text/html";
+    if (!strcasecmp(ext, ".jpg") || !strcasecmp(ext, ".jpeg")) return "image/jpeg";
+    if (!strcasecmp(ext, ".png")) return "image/png";
+    return "application/octet-stream";
+  }
+
+  // Start removing the file or directory tree at removing. handleHTTP()
+  // carries on in HS_REMOVE until removeFinished() answers the request.
+  void startRemove() {
+
+    removeRootLen = strlen(removing);
+    removeOk = true;
+    state = HS_REMOVE;
+    removeSome();
+  }
+
+  // Remove entries until the tree is gone or the time budget for this
+  // call is used up
+  void removeSome() {
+
+    uint32_t startMs = millis();
+
+    while (!removeStep()) {
+      if ((millis() - startMs) >= HTTP_SEND_BUDGET_MS) {
+        return;
+      }
+    }
+    removeFinished();
+  }
+
+  // Remove one entry. Returns true once the tree is gone or on an error.
+  // Only one directory is open, in file, at a time: going into a
+  // subdirectory closes its parent, which is opened again from its first
+  // entry once the subdirectory is removed. rmRfStar() is FAT only.
+  boolean removeStep() {
+
+    if (!file) {
+      file = _ptrSd->open(removing, O_RDONLY);
+      if (!file) {
+        removeOk = false;
+        return true;
+      }
+      if (!file.isDirectory()) {
+        // Only the top of the tree is opened as a file
+        file.close();
+        removeOk = _ptrSd->remove(removing);
+        return true;
+      }
+    }
+
+    size_t len = strlen(removing);
+    CardFile entry = file.openNextFile();
+    if (!entry) {
+      file.close();
+      if (!_ptrSd->rmdir(removing)) {
+        removeOk = false;
+        return true;
+      }
+      if (len == removeRootLen) {
+        return true;
+      }
+      *strrchr(removing, '/') = 0;
+      return false;
+    }
+
+    boolean isDir = entry.isDirectory();
+    removing[len] = '/';
+    entry.getName(removing + len + 1, sizeof(removing) - len - 1);
+    entry.close();
+    if (isDir) {
+      file.close();
+      return false;
+    }
+    boolean ok = _ptrSd->remove(removing);
+    removing[len] = 0;
+    if (!ok) {
+      file.close();
+      removeOk = false;
+      return true;
+    }
+    return false;
+  }
+
+  // Answer the DELETE or MOVE that started the removal
+  void removeFinished() {
+
+    removing[removeRootLen] = 0;
+    if (method == HM_DELETE) {
+      notifyPathChanged(path);
+      if (!removeOk) {
+        sendError(500, "Delete Failed");
+        return;
+      }
+    } else if (!removeOk) {
+      // The move itself succeeded
+      Serial.printf("HTTP MOVE couldn't remove %s\n", removing);
+    }
+    sendHeaders(204, "No Content", NULL, 0);
+    finishResponse();
+  }
+
+  // Determine if the directory holding p exists
+  boolean parentExists(const char *p) {
+
+    const char *lastSlash = strrchr(p, '/');
+    if (lastSlash == NULL || lastSlash == p) {
+      return true;
+    }
+    char parent[HTTP_PATH_SIZE];
+    size_t len = lastSlash - p;
+    memcpy(parent, p, len);
+    parent[len] = 0;
+    return _ptrSd->exists(parent);
+  }
+
+  WiFiClient client;
+  CardFile file;
+  FileWriteBehind writeBehind;  // sector aligned buffering for PUT
+
+  enum HTTP_STATE state;
+  enum HTTP_METHOD method;
+  enum CHUNK_STATE chunkState;
+
+  char buf[HTTP_BUF_SIZE];      // data buffer for transfers
+  char line[HTTP_LINE_SIZE];    // request/header line being assembled
+  char path[HTTP_PATH_SIZE];    // decoded path of the request target
+  char name[128];               // directory entry name
+  char rangeHeader[48];         // value of the Range header
+  char authHeader[96];          // value of the Authorization header
+  char destination[HTTP_LINE_SIZE];  // value of the Destination header
+  char removing[HTTP_PATH_SIZE];  // directory or file being removed
+  char putTemp[HTTP_PATH_SIZE];   // file the PUT body is written to
+  size_t removeRootLen;         // length of the path at the top of the removal
+  boolean removeOk;             // nothing failed to remove so far
+  uint16_t iLine;               // next free position in line
+  boolean lineOverflow;         // current line was too long
+  uint16_t bufPos,              // next byte of buf to send
+    bufLen;                     // number of bytes in buf waiting to be sent
+  boolean pathValid;            // path decoded without error
+  boolean keepAlive;            // keep the connection open after the response
+  boolean chunked;              // request body uses chunked encoding
+  boolean expectContinue;       // client sent "Expect: 100-continue"
+  boolean overwrite;            // MOVE may replace an existing destination
+  boolean listXml;              // listing is PROPFIND XML rather than HTML
+  boolean putExisted;           // PUT target existed before the upload
+  boolean chunkedBodyDone;      // last chunk and trailers received
+  uint8_t depth;                // PROPFIND depth (0 or 1)
+  int32_t contentLength;        // request body length or -1 if not given
+  uint32_t discardRemaining,    // unused request body bytes to skip
+    bodyRemaining,              // PUT body bytes still expected
+    chunkRemaining,             // bytes left in the current chunk
+    sendRemaining,              // response body bytes left to send
+    bytesPerCluster,            // cluster size of the SD volume
+    millisLastActivity;         // time the client last sent anything
+  String _auth;
+
+  CardFs *_ptrSd;
+};
+
+#endif
@@ -0,0 +1,494 @@
+/*
+   Host stand-ins for the Arduino, WiFi and SdFat classes used by the
+   remote file access servers (FTPServer.h and WebDAVServer.h)
+
+   Lets the servers run unchanged on Linux for tests and measurements.
+   Put this directory on the include path so <WiFi.h>, <WiFiClient.h>,
+   <base64.h>, <SdFat.h> and <lwip/sockets.h> come from here:
+
+     g++ -I tools/arduino ...
+
+   Only what the servers call is provided:
+
+     String      the handful of Arduino String members they use
+     Serial      printf/print/println to stdout
+     IPAddress   four bytes
+     WiFiClient  a TCP socket. Reads never block, write() and print()
+                 block like the ESP32's.
+     WiFiServer  a listening socket on 127.0.0.1. Port 0 picks a free
+                 port, see port(). hostSendBuffer shrinks the send
+                 buffer of accepted sockets so a slow reader fills it.
+     SdFs/FsFile a directory on the host as the card. hostCardDelayUs
+                 is added to each remove, rmdir, rename and mkdir to
+                 model the card's write time. Like SdFat, rename()
+                 won't replace an existing destination.
+
+   Last Update: 10/18/2026
+*/
+
+#ifndef ARDUINOHOST_H
+#define ARDUINOHOST_H
+
+#ifdef ARDUINO
+#error "ArduinoHost.h is for host builds"
+#endif
+
+#include <arpa/inet.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <memory>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string>
+#include <strings.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../../Hal.h"
+
+#define constrain(x, low, high) ((x) < (low) ? (low) : ((x) > (high) ? (high) : (x)))
+
+inline uint64_t hostNowUs() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+inline uint32_t millis() {
+  static uint64_t start = hostNowUs();
+  return (uint32_t)((hostNowUs() - start) / 1000);
+}
+
+inline void delay(uint32_t ms) {
+  usleep(ms * 1000);
+}
+
+class String {
+public:
+  String() {}
+  String(const char *str) : s(str) {}
+  String(const std::string &str) : s(str) {}
+  String(int n) : s(std::to_string(n)) {}
+  String(unsigned n) : s(std::to_string(n)) {}
+  String(long n) : s(std::to_string(n)) {}
+  String(unsigned long n) : s(std::to_string(n)) {}
+
+  const char *c_str() const {
+    return s.c_str();
+  }
+
+  unsigned length() const {
+    return s.length();
+  }
+
+  int lastIndexOf(char c) const {
+    size_t at = s.rfind(c);
+    return (at == std::string::npos) ? -1 : (int) at;
+  }
+
+  String substring(unsigned from) const {
+    return String(from < s.size() ? s.substr(from) : std::string());
+  }
+
+  String &operator+=(const String &other) {
+    s += other.s;
+    return *this;
+  }
+
+  bool operator==(const String &other) const {
+    return s == other.s;
+  }
+
+  friend String operator+(const String &a, const String &b) {
+    return String(a.s + b.s);
+  }
+
+  std::string s;
+};
+
+class HostSerial {
+public:
+  void printf(const char *format, ...) __attribute__((format(printf, 2, 3))) {
+    va_list args;
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
+  }
+
+  void print(const String &text) {
+    fputs(text.c_str(), stdout);
+  }
+
+  void println(const String &text = "") {
+    puts(text.c_str());
+  }
+};
+
+static HostSerial Serial __attribute__((unused));
+
+namespace base64 {
+inline String encode(const String &text) {
+  static const char *DIGITS = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  const std::string &in = text.s;
+  std::string out;
+  for (size_t i = 0; i < in.size(); i += 3) {
+    uint32_t v = (uint8_t) in[i] << 16;
+    if (i + 1 < in.size()) v |= (uint8_t) in[i + 1] << 8;
+    if (i + 2 < in.size()) v |= (uint8_t) in[i + 2];
+    out += DIGITS[(v >> 18) & 63];
+    out += DIGITS[(v >> 12) & 63];
+    out += (i + 1 < in.size()) ? DIGITS[(v >> 6) & 63] : '=';
+    out += (i + 2 < in.size()) ? DIGITS[v & 63] : '=';
+  }
+  return String(out);
+}
+}
+
+/****************************************************************/
+/***                         Networking                       ***/
+/****************************************************************/
+
+class IPAddress {
+public:
+  IPAddress() {
+    memset(bytes, 0, sizeof(bytes));
+  }
+
+  uint8_t &operator[](int i) {
+    return bytes[i];
+  }
+
+  uint8_t bytes[4];
+};
+
+// Send buffer size of accepted sockets, 0 for the system default
+static int hostSendBuffer = 0;
+
+class WiFiClient {
+public:
+  WiFiClient() {}
+  explicit WiFiClient(int fd) : _fd(fd) {}
+
+  int fd() const {
+    return _fd;
+  }
+
+  IPAddress localIP() {
+    IPAddress ip;
+    sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    if (_fd >= 0 && getsockname(_fd, (sockaddr *) &addr, &len) == 0) {
+      memcpy(ip.bytes, &addr.sin_addr.s_addr, 4);
+    }
+    return ip;
+  }
+
+  uint8_t connected() {
+    if (_fd < 0) {
+      return false;
+    }
+    char c;
+    int n = recv(_fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+    return (n > 0) || ((n < 0) && (errno == EAGAIN || errno == EWOULDBLOCK));
+  }
+
+  operator bool() {
+    return connected();
+  }
+
+  int available() {
+    int n = 0;
+    if (_fd < 0 || ioctl(_fd, FIONREAD, &n) < 0) {
+      return 0;
+    }
+    return n;
+  }
+
+  int read() {
+    uint8_t c;
+    return (read(&c, 1) == 1) ? c : -1;
+  }
+
+  int read(uint8_t *buf, size_t size) {
+    if (_fd < 0) {
+      return -1;
+    }
+    return recv(_fd, buf, size, MSG_DONTWAIT);
+  }
+
+  size_t write(const uint8_t *data, size_t size) {
+    size_t done = 0;
+    while (_fd >= 0 && done < size) {
+      int n = ::send(_fd, data + done, size - done, MSG_NOSIGNAL);
+      if (n <= 0) {
+        break;
+      }
+      done += n;
+    }
+    return done;
+  }
+
+  size_t print(const String &text) {
+    return write((const uint8_t *) text.c_str(), text.length());
+  }
+
+  size_t println(const String &text = "") {
+    return print(text) + print("\r\n");
+  }
+
+  void stop() {
+    if (_fd >= 0) {
+      close(_fd);
+    }
+    _fd = -1;
+  }
+
+protected:
+  int _fd = -1;
+};
+
+class WiFiServer {
+public:
+  WiFiServer(uint16_t port) : _port(port) {}
+
+  void begin() {
+    _fd = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(_port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(_fd, (sockaddr *) &addr, sizeof(addr)) < 0 || listen(_fd, 8) < 0) {
+      perror("WiFiServer");
+      exit(1);
+    }
+  }
+
+  bool hasClient() {
+    pollfd pfd = { _fd, POLLIN, 0 };
+    return poll(&pfd, 1, 0) > 0;
+  }
+
+  WiFiClient available() {
+    int fd = accept(_fd, NULL, NULL);
+    if (fd >= 0 && hostSendBuffer > 0) {
+      setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &hostSendBuffer, sizeof(hostSendBuffer));
+    }
+    return WiFiClient(fd);
+  }
+
+  // The port listened on, for servers started on port 0
+  uint16_t port() {
+    sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    getsockname(_fd, (sockaddr *) &addr, &len);
+    return ntohs(addr.sin_port);
+  }
+
+protected:
+  uint16_t _port;
+  int _fd = -1;
+};
+
+/****************************************************************/
+/***                          SD card                         ***/
+/****************************************************************/
+
+// Added to every directory change to model the card's write time
+static uint32_t hostCardDelayUs = 0;
+
+// Host directory standing in for the card
+static std::string hostCardRoot = ".";
+
+#define FILE_READ O_RDONLY
+#define FILE_WRITE (O_RDWR | O_CREAT | O_APPEND)
+
+inline std::string hostCardPath(const char *path) {
+  return hostCardRoot + ((path[0] == '/') ? "" : "/") + path;
+}
+
+inline void hostCardWait() {
+  if (hostCardDelayUs > 0) {
+    usleep(hostCardDelayUs);
+  }
+}
+
+class FsFile {
+public:
+  operator bool() const {
+    return isOpen();
+  }
+
+  bool isOpen() const {
+    return _open && (_open->fd >= 0 || _open->dir != NULL);
+  }
+
+  bool isDirectory() const {
+    return isOpen() && _open->dir != NULL;
+  }
+
+  uint32_t fileSize() const {
+    struct stat st;
+    return (isOpen() && _open->fd >= 0 && fstat(_open->fd, &st) == 0) ? st.st_size : 0;
+  }
+
+  uint32_t size() const {
+    return fileSize();
+  }
+
+  bool seekSet(uint32_t pos) {
+    return isOpen() && _open->fd >= 0 && lseek(_open->fd, pos, SEEK_SET) == (off_t) pos;
+  }
+
+  uint32_t curPosition() const {
+    return (isOpen() && _open->fd >= 0) ? lseek(_open->fd, 0, SEEK_CUR) : 0;
+  }
+
+  int read(void *buf, size_t size) {
+    return (isOpen() && _open->fd >= 0) ? ::read(_open->fd, buf, size) : -1;
+  }
+
+  size_t write(const void *buf, size_t size) {
+    if (!isOpen() || _open->fd < 0) {
+      return 0;
+    }
+    ssize_t n = ::write(_open->fd, buf, size);
+    return (n < 0) ? 0 : n;
+  }
+
+  FsFile openNextFile() {
+    FsFile next;
+    if (!isDirectory()) {
+      return next;
+    }
+    dirent *entry;
+    while ((entry = readdir(_open->dir)) != NULL) {
+      if (strcmp(entry->d_name, ".") && strcmp(entry->d_name, "..")) {
+        next.openPath(_open->path + "/" + entry->d_name, entry->d_name, O_RDONLY);
+        break;
+      }
+    }
+    return next;
+  }
+
+  size_t getName(char *name, size_t size) {
+    if (!isOpen() || size == 0) {
+      return 0;
+    }
+    snprintf(name, size, "%s", _open->name.c_str());
+    return strlen(name);
+  }
+
+  bool getModifyDateTime(uint16_t *date, uint16_t *time) {
+    struct stat st;
+    if (!isOpen() || stat(_open->path.c_str(), &st) != 0) {
+      return false;
+    }
+    struct tm t;
+    gmtime_r(&st.st_mtime, &t);
+    *date = ((t.tm_year - 80) << 9) | ((t.tm_mon + 1) << 5) | t.tm_mday;
+    *time = (t.tm_hour << 11) | (t.tm_min << 5) | (t.tm_sec / 2);
+    return true;
+  }
+
+  void close() {
+    _open.reset();
+  }
+
+  // Host path and name as SdFs opens them
+  bool openPath(const std::string &path, const std::string &name, int oflag) {
+    close();
+    std::shared_ptr<Open> open(new Open());
+    open->path = path;
+    open->name = name;
+    struct stat st;
+    if (stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode)) {
+      if (oflag != O_RDONLY) {
+        return false;
+      }
+      open->dir = opendir(path.c_str());
+    } else {
+      open->fd = ::open(path.c_str(), oflag, 0644);
+    }
+    if (open->fd < 0 && open->dir == NULL) {
+      return false;
+    }
+    _open = open;
+    return true;
+  }
+
+protected:
+  struct Open {
+    int fd = -1;
+    DIR *dir = NULL;
+    std::string path;
+    std::string name;
+
+    ~Open() {
+      if (fd >= 0) {
+        ::close(fd);
+      }
+      if (dir != NULL) {
+        closedir(dir);
+      }
+    }
+  };
+
+  // Copies share the open file, like copies of an SdFat file object
+  std::shared_ptr<Open> _open;
+};
+
+class SdFs {
+public:
+  FsFile open(const char *path, int oflag = O_RDONLY) {
+    FsFile f;
+    const char *slash = strrchr(path, '/');
+    f.openPath(hostCardPath(path), (slash != NULL) ? slash + 1 : path, oflag);
+    return f;
+  }
+
+  bool exists(const char *path) {
+    struct stat st;
+    return stat(hostCardPath(path).c_str(), &st) == 0;
+  }
+
+  bool mkdir(const char *path, bool /* pFlag */ = true) {
+    hostCardWait();
+    return ::mkdir(hostCardPath(path).c_str(), 0755) == 0;
+  }
+
+  bool rmdir(const char *path) {
+    hostCardWait();
+    return ::rmdir(hostCardPath(path).c_str()) == 0;
+  }
+
+  bool remove(const char *path) {
+    hostCardWait();
+    return ::unlink(hostCardPath(path).c_str()) == 0;
+  }
+
+  bool rename(const char *oldPath, const char *newPath) {
+    hostCardWait();
+    if (exists(newPath)) {
+      return false;
+    }
+    return ::rename(hostCardPath(oldPath).c_str(), hostCardPath(newPath).c_str()) == 0;
+  }
+
+  uint32_t bytesPerCluster() {
+    return 32768;
+  }
+};
+
+typedef SdFs SdFat32;
+typedef FsFile File32;
+
+#endif
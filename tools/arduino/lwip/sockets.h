@@ -0,0 +1,2 @@
+// Host stand-in, see ArduinoHost.h
+#include "../ArduinoHost.h"
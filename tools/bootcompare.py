@@ -0,0 +1,112 @@
+#!/usr/bin/env python3
+"""
+Compare CYD Music Player boot logs and flag startup regressions
+
+The player appends each boot's phase timings to /bootlog.csv on the SD
+card (see BootProfiler.h). Copy the logs off the card and run:
+
+  bootcompare.py base.csv new.csv
+  bootcompare.py bootlog.csv bootlog.csv --base-version 2.1 --new-version 2.2
+
+Each log is reduced to the median duration of every phase over all boots
+of one firmware version (by default the latest version in that log).
+A phase is flagged when it is slower by more than --threshold percent and
+by more than --min-ms milliseconds. Exits with status 1 if anything was
+flagged so it can gate a release script.
+
+Last Update: 10/18/2026
+"""
+
+import argparse
+import statistics
+import sys
+
+
+def read_log(path):
+    """Return a list of (version, total_us, {phase: duration_us}) boots"""
+    boots = []
+    with open(path) as log:
+        for line in log:
+            fields = line.strip().split(",")
+            if fields[0] == "B" and len(fields) == 3:
+                boots.append((fields[1], int(fields[2]), {}))
+            elif fields[0] == "P" and len(fields) == 4 and boots:
+                phases = boots[-1][2]
+                # Retried phases (error screen) add up
+                phases[fields[1]] = phases.get(fields[1], 0) + int(fields[3])
+    return boots
+
+
+def summarize(path, version):
+    """Median phase durations in ms for one version. Keeps phase order."""
+    boots = read_log(path)
+    if not boots:
+        sys.exit("%s: no boots logged" % path)
+    if version is None:
+        version = boots[-1][0]
+    boots = [b for b in boots if b[0] == version]
+    if not boots:
+        sys.exit("%s: no boots of version %s" % (path, version))
+
+    order = []
+    samples = {}
+    for _, total, phases in boots:
+        for phase, us in phases.items():
+            if phase not in samples:
+                order.append(phase)
+                samples[phase] = []
+            samples[phase].append(us / 1000.0)
+        samples.setdefault("total", []).append(total / 1000.0)
+    order.append("total")
+
+    medians = [(phase, statistics.median(samples[phase])) for phase in order]
+    return version, len(boots), medians
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Flag boot time regressions")
+    parser.add_argument("base", help="boot log of the reference firmware")
+    parser.add_argument("new", help="boot log of the firmware under test")
+    parser.add_argument("--base-version", help="version to use from the base log")
+    parser.add_argument("--new-version", help="version to use from the new log")
+    parser.add_argument("--threshold", type=float, default=10.0,
+                        help="percent slowdown that counts as a regression (default 10)")
+    parser.add_argument("--min-ms", type=float, default=5.0,
+                        help="ignore slowdowns smaller than this (default 5 ms)")
+    args = parser.parse_args()
+
+    base_version, base_boots, base = summarize(args.base, args.base_version)
+    new_version, new_boots, new = summarize(args.new, args.new_version)
+    base_ms = dict(base)
+
+    print("base %s (%d boots)  new %s (%d boots)" %
+          (base_version, base_boots, new_version, new_boots))
+    print("%-14s %9s %9s %9s %7s" % ("phase", "base ms", "new ms", "delta", "%"))
+
+    regressions = 0
+    for phase, ms in new:
+        if phase not in base_ms:
+            print("%-14s %9s %9.1f %9s %7s  new phase" % (phase, "-", ms, "-", "-"))
+            continue
+        before = base_ms[phase]
+        delta = ms - before
+        percent = (100.0 * delta / before) if before > 0 else 0.0
+        flag = ""
+        if delta > args.min_ms and (before <= 0 or percent > args.threshold):
+            flag = "  REGRESSION"
+            regressions += 1
+        print("%-14s %9.1f %9.1f %+9.1f %+6.1f%%%s" %
+              (phase, before, ms, delta, percent, flag))
+
+    for phase, ms in base:
+        if phase not in dict(new):
+            print("%-14s %9.1f %9s %9s %7s  phase gone" % (phase, ms, "-", "-", "-"))
+
+    if regressions:
+        print("%d phase(s) regressed" % regressions)
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
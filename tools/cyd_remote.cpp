@@ -0,0 +1,249 @@
+/*
+   Linux reference client for the CYD Music Player UDP remote
+
+   Build:
+     g++ -O2 -std=c++11 -o cyd_remote cyd_remote.cpp
+
+   Usage:
+     cyd_remote [--secret <secret>] <player-ip> next | prev | select | back
+     cyd_remote <player-ip> vol <0-100> | vol+ | vol-
+     cyd_remote <player-ip> status [seconds] [interval-ms]
+     cyd_remote <player-ip> bench [count]
+
+   "bench" sends count pings (default 1000) one at a time and reports the
+   round trip latency distribution and packet loss.
+
+   The secret must match REMOTE_SECRET in Secrets.h. It can also be
+   given in the CYD_REMOTE_SECRET environment variable. Commands are retried
+   up to three times when no acknowledgement arrives.
+
+   Last Update: 10/18/2026
+*/
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+#include "../RemoteProtocol.h"
+
+#define ACK_TIMEOUT_MS 500
+#define RETRIES 3
+
+static int sock;
+static sockaddr_in player;
+static uint16_t nextSeq = 1;
+static REMOTE_KEY_PAIR key;
+
+static double nowMs() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+// Wait for a datagram of the given type and seq. Returns its length,
+// 0 on timeout.
+static int receive(uint8_t *buf, int size, uint8_t type, int seq, int timeoutMs) {
+  double end = nowMs() + timeoutMs;
+  for (;;) {
+    int left = (int)(end - nowMs());
+    if (left <= 0) {
+      return 0;
+    }
+    pollfd pfd = { sock, POLLIN, 0 };
+    if (poll(&pfd, 1, left) <= 0) {
+      return 0;
+    }
+    int n = recv(sock, buf, size, 0);
+    if (!remoteHeaderValid(&key, buf, n)) {
+      continue;
+    }
+    REMOTE_HEADER *header = (REMOTE_HEADER *) buf;
+    if (header->type == type && (seq < 0 || header->seq == seq)) {
+      return n;
+    }
+  }
+}
+
+// Send a command and wait for its acknowledgement.
+// Returns the result code or -1 if the player never answered.
+static int command(uint8_t type, const uint8_t *payload, int length) {
+  uint8_t packet[REMOTE_MAX_PACKET];
+  uint16_t seq = nextSeq++;
+  remoteHeader((REMOTE_HEADER *) packet, type, seq);
+  memcpy(packet + sizeof(REMOTE_HEADER), payload, length);
+  remoteSign(&key, packet, sizeof(REMOTE_HEADER) + length);
+
+  for (int attempt = 0; attempt < RETRIES; attempt++) {
+    sendto(sock, packet, sizeof(REMOTE_HEADER) + length, 0, (sockaddr *) &player, sizeof(player));
+    uint8_t reply[REMOTE_MAX_PACKET];
+    if (receive(reply, sizeof(reply), RT_ACK, seq, ACK_TIMEOUT_MS) > 0) {
+      return ((REMOTE_ACK *) reply)->result;
+    }
+  }
+  return -1;
+}
+
+static int report(int result) {
+  static const char *NAMES[] = { "ok", "bad packet", "queue full", "unknown command" };
+  if (result < 0) {
+    fprintf(stderr, "no answer from player\n");
+    return 1;
+  }
+  printf("%s\n", result < 4 ? NAMES[result] : "error");
+  return result == RR_OK ? 0 : 1;
+}
+
+static void printStatus(const uint8_t *buf, int n) {
+  const REMOTE_STATUS *status = (const REMOTE_STATUS *) buf;
+  if (n < (int) sizeof(REMOTE_STATUS)) {
+    return;
+  }
+  int nameLength = std::min((int) status->nameLength, n - (int) sizeof(REMOTE_STATUS));
+  printf("%s%s vol %3u%% pos %8u/%-8u (%3u%%) bt buffer free %6u state %2u  %.*s\n",
+         (status->flags & RS_PLAYING) ? "playing" : "stopped",
+         (status->flags & RS_BT_CONNECTED) ? "" : " (no BT)",
+         status->volume, status->position, status->size,
+         status->size ? (unsigned)(100.0 * status->position / status->size) : 0,
+         status->bufferFree, status->state,
+         nameLength, (const char *) (buf + sizeof(REMOTE_STATUS)));
+  fflush(stdout);
+}
+
+static int status(int seconds, int intervalMs) {
+  uint8_t payload[2] = { (uint8_t)(intervalMs & 0xFF), (uint8_t)(intervalMs >> 8) };
+  if (command(RT_SUBSCRIBE, payload, 2) != RR_OK) {
+    fprintf(stderr, "subscribe failed\n");
+    return 1;
+  }
+  double end = nowMs() + seconds * 1000.0;
+  double renew = nowMs() + REMOTE_LEASE_MS / 2;
+  while (nowMs() < end) {
+    uint8_t buf[REMOTE_MAX_PACKET];
+    int n = receive(buf, sizeof(buf), RT_STATUS, -1, 1000);
+    if (n > 0) {
+      printStatus(buf, n);
+    }
+    if (nowMs() > renew) {
+      command(RT_SUBSCRIBE, payload, 2);
+      renew = nowMs() + REMOTE_LEASE_MS / 2;
+    }
+  }
+  uint8_t stop[2] = { 0, 0 };
+  command(RT_SUBSCRIBE, stop, 2);
+  return 0;
+}
+
+// Round trip latency benchmark
+static int bench(int count) {
+  std::vector<double> rtt;
+  int lost = 0;
+
+  for (int i = 0; i < count; i++) {
+    uint8_t packet[sizeof(REMOTE_HEADER)];
+    uint16_t seq = nextSeq++;
+    remoteHeader((REMOTE_HEADER *) packet, RT_PING, seq);
+    remoteSign(&key, packet, sizeof(packet));
+
+    double start = nowMs();
+    sendto(sock, packet, sizeof(packet), 0, (sockaddr *) &player, sizeof(player));
+    uint8_t reply[REMOTE_MAX_PACKET];
+    if (receive(reply, sizeof(reply), RT_ACK, seq, ACK_TIMEOUT_MS) > 0) {
+      rtt.push_back(nowMs() - start);
+    } else {
+      lost++;
+    }
+  }
+
+  if (rtt.empty()) {
+    fprintf(stderr, "no answers from player\n");
+    return 1;
+  }
+  std::sort(rtt.begin(), rtt.end());
+  double sum = 0;
+  for (double r : rtt) {
+    sum += r;
+  }
+  printf("pings %d  lost %d (%.1f%%)\n", count, lost, 100.0 * lost / count);
+  printf("rtt ms  min %.2f  avg %.2f  p50 %.2f  p90 %.2f  p99 %.2f  max %.2f\n",
+         rtt.front(), sum / rtt.size(),
+         rtt[rtt.size() / 2], rtt[rtt.size() * 90 / 100], rtt[rtt.size() * 99 / 100], rtt.back());
+  return 0;
+}
+
+static int usage() {
+  fprintf(stderr,
+          "usage: cyd_remote [--secret <secret>] <player-ip> next|prev|select|back\n"
+          "       cyd_remote [--secret <secret>] <player-ip> vol <0-100> | vol+ | vol-\n"
+          "       cyd_remote [--secret <secret>] <player-ip> status [seconds] [interval-ms]\n"
+          "       cyd_remote [--secret <secret>] <player-ip> bench [count]\n"
+          "The secret defaults to $CYD_REMOTE_SECRET.\n");
+  return 2;
+}
+
+int main(int argc, char **argv) {
+  const char *secret = getenv("CYD_REMOTE_SECRET");
+  if (argc > 2 && !strcmp(argv[1], "--secret")) {
+    secret = argv[2];
+    argc -= 2;
+    argv += 2;
+  }
+  if (argc < 3) {
+    return usage();
+  }
+  if (secret == NULL) {
+    fprintf(stderr, "no secret, use --secret or set CYD_REMOTE_SECRET\n");
+    return 2;
+  }
+  remoteKey(&key, secret);
+
+  memset(&player, 0, sizeof(player));
+  player.sin_family = AF_INET;
+  player.sin_port = htons(REMOTE_UDP_PORT);
+  if (inet_pton(AF_INET, argv[1], &player.sin_addr) != 1) {
+    fprintf(stderr, "bad address %s\n", argv[1]);
+    return 2;
+  }
+
+  sock = socket(AF_INET, SOCK_DGRAM, 0);
+  if (sock < 0) {
+    perror("socket");
+    return 1;
+  }
+  nextSeq = (uint16_t) getpid();
+
+  const char *cmd = argv[2];
+  uint8_t key = 0;
+  if (!strcmp(cmd, "next")) key = RK_PLUS;
+  else if (!strcmp(cmd, "prev")) key = RK_MINUS;
+  else if (!strcmp(cmd, "select")) key = RK_SELECT;
+  else if (!strcmp(cmd, "back")) key = RK_BACK;
+
+  if (key != 0) {
+    return report(command(RT_BUTTON, &key, 1));
+  }
+  if (!strcmp(cmd, "vol") && argc > 3) {
+    uint8_t volume = (uint8_t) std::min(100, std::max(0, atoi(argv[3])));
+    return report(command(RT_VOLUME_SET, &volume, 1));
+  }
+  if (!strcmp(cmd, "vol+") || !strcmp(cmd, "vol-")) {
+    uint8_t step = (uint8_t)(cmd[3] == '+' ? 1 : -1);
+    return report(command(RT_VOLUME_STEP, &step, 1));
+  }
+  if (!strcmp(cmd, "status")) {
+    int seconds = (argc > 3) ? atoi(argv[3]) : 10;
+    int interval = (argc > 4) ? atoi(argv[4]) : 1000;
+    return status(seconds, interval);
+  }
+  if (!strcmp(cmd, "bench")) {
+    return bench((argc > 3) ? std::max(1, atoi(argv[3])) : 1000);
+  }
+  return usage();
+}
@@ -0,0 +1,864 @@
+/*
+   Lays a music folder out as a FAT32 volume with every file in one run
+   of clusters, or reports how fragmented a card is
+
+   Cards filled by dragging folders across end up with songs, and the
+   folders listing them, scattered in runs of clusters all over the
+   card, and every jump between runs stalls SDFileStream's multi block
+   reads (see AudioSourceSDFAT.h). Built volumes are laid out, in
+   cluster order, as:
+
+     directories     the root, then each artist followed by its albums,
+                     in the order the player lists them
+     /.library       the library index (see tools/libprep.cpp)
+     songs           album by album in playback order, so one song
+                     ends where the next one starts
+     everything else
+
+   Names are sorted by byte, as MusicLibrary sorts them, and stored as
+   long names with generated 8.3 short names. Files and folders get
+   their host modification times. The volume has no partition table,
+   which SdFat mounts like any other, and its data area starts on a
+   1 MB boundary.
+
+   With -r an existing FAT32 or exFAT volume (an image, a dd of a card
+   or the card's device, with or without a partition table) is walked
+   with FatDirScanner and every file mapped with FatExtents, and the
+   fragmentation of songs, other files and directories is reported
+   along with how many songs start right where the song before them in
+   playback order ended.
+
+   Build:
+     g++ -O2 -std=c++11 -o fatpack fatpack.cpp
+
+   Usage:
+     fatpack [options] <music-dir> <image>
+       Builds the volume into <image>, a file (made sparse) or a card's
+       block device. The volume is then reported as with -r.
+
+     fatpack -r <image>
+       Reports the fragmentation of a volume.
+
+   Options:
+     -c kb     cluster size (default 32)
+     -s mb     volume size (default a block device's size, otherwise
+               the files plus -g but at least the FAT32 minimum)
+     -g mb     free space left when sizing the volume (default 256)
+     -l label  volume label (default CYDMUSIC)
+     -n n      most fragmented files listed by the report (default 5)
+
+   Last Update: 10/18/2026
+*/
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "../FatDirScanner.h"
+#include "../FatExtents.h"
+
+#define SECTOR_SIZE 512
+#define FAT32_MIN_CLUSTERS 65525
+#define RESERVED_SECTORS 32
+#define ALIGN_SECTORS 2048  // 1 MB
+
+static const char *const SONG_EXTENSIONS[] = { "mp3", NULL };
+
+static int clusterKB = 32;
+static uint64_t volumeMB = 0;
+static uint64_t gapMB = 256;
+static const char *label = "CYDMUSIC";
+static int worstListed = 5;
+
+static inline uint32_t get16(const uint8_t *p) {
+  return p[0] | (p[1] << 8);
+}
+
+static inline uint32_t get32(const uint8_t *p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static inline void put16(uint8_t *p, uint16_t v) {
+  p[0] = v;
+  p[1] = v >> 8;
+}
+
+static inline void put32(uint8_t *p, uint32_t v) {
+  put16(p, v);
+  put16(p + 2, v >> 16);
+}
+
+// A file or folder of the music folder
+struct Node {
+  std::string name;
+  std::string hostPath;
+  bool isDirectory;
+  uint64_t size;
+  time_t mtime;
+  std::vector<Node> children;
+  std::vector<uint16_t> name16;  // UTF-16 long name
+  uint8_t shortName[11];
+  uint32_t firstCluster;
+  uint32_t clusters;
+};
+
+// UTF-8 to UTF-16. Returns false for names FAT can't hold.
+static bool longName(const std::string &name, std::vector<uint16_t> &out) {
+
+  out.clear();
+  for (size_t i = 0; i < name.size();) {
+    uint8_t c = name[i];
+    uint32_t u;
+    int extra;
+    if (c < 0x80) {
+      u = c;
+      extra = 0;
+    } else if ((c & 0xE0) == 0xC0) {
+      u = c & 0x1F;
+      extra = 1;
+    } else if ((c & 0xF0) == 0xE0) {
+      u = c & 0x0F;
+      extra = 2;
+    } else if ((c & 0xF8) == 0xF0) {
+      u = c & 0x07;
+      extra = 3;
+    } else {
+      return false;
+    }
+    if (i + extra >= name.size()) {
+      return false;
+    }
+    for (int k = 1; k <= extra; k++) {
+      u = (u << 6) | (name[i + k] & 0x3F);
+    }
+    i += 1 + extra;
+    if ((u < 0x20) || ((u < 0x80) && strchr("\"*/:<>?\\|", u))) {
+      return false;
+    }
+    if (u >= 0x10000) {
+      u -= 0x10000;
+      out.push_back(0xD800 + (u >> 10));
+      out.push_back(0xDC00 + (u & 0x3FF));
+    } else {
+      out.push_back(u);
+    }
+  }
+  return !out.empty() && (out.size() <= 255);
+}
+
+// Read the music folder. Names are sorted by byte.
+static void readFolder(Node &dir) {
+
+  DIR *d = opendir(dir.hostPath.c_str());
+  if (d == NULL) {
+    fprintf(stderr, "can't read %s\n", dir.hostPath.c_str());
+    return;
+  }
+  struct dirent *e;
+  while ((e = readdir(d)) != NULL) {
+    if (!strcmp(e->d_name, ".") || !strcmp(e->d_name, "..")) {
+      continue;
+    }
+    Node node;
+    node.name = e->d_name;
+    node.hostPath = dir.hostPath + "/" + e->d_name;
+    struct stat st;
+    if ((stat(node.hostPath.c_str(), &st) != 0) || !(S_ISDIR(st.st_mode) || S_ISREG(st.st_mode))) {
+      continue;
+    }
+    if (!longName(node.name, node.name16)) {
+      fprintf(stderr, "skipping %s: not a FAT name\n", node.hostPath.c_str());
+      continue;
+    }
+    if (S_ISREG(st.st_mode) && ((uint64_t) st.st_size > 0xFFFFFFFFULL)) {
+      fprintf(stderr, "skipping %s: over 4 GB\n", node.hostPath.c_str());
+      continue;
+    }
+    node.isDirectory = S_ISDIR(st.st_mode);
+    node.size = node.isDirectory ? 0 : st.st_size;
+    node.mtime = st.st_mtime;
+    node.firstCluster = 0;
+    node.clusters = 0;
+    if (node.isDirectory) {
+      readFolder(node);
+    }
+    dir.children.push_back(node);
+  }
+  closedir(d);
+  std::sort(dir.children.begin(), dir.children.end(),
+            [](const Node &a, const Node &b) { return a.name < b.name; });
+}
+
+// Generated 8.3 names, NAME~N.EXT, unique within each folder
+static void shortNames(Node &dir) {
+
+  std::set<std::string> used;
+  for (Node &node : dir.children) {
+    std::string base, ext;
+    size_t dot = node.name.find_last_of('.');
+    for (size_t i = 0; i < node.name.size(); i++) {
+      char c = node.name[i];
+      if ((c == ' ') || (c == '.')) {
+        continue;
+      }
+      char u = isalnum((uint8_t) c) ? toupper(c) : '_';
+      if ((dot != std::string::npos) && (i > dot)) {
+        if (ext.size() < 3) {
+          ext += u;
+        }
+      } else if (base.size() < 8) {
+        base += u;
+      }
+    }
+    if (base.empty()) {
+      base = "_";
+    }
+    for (int n = 1;; n++) {
+      std::string tail = "~" + std::to_string(n);
+      std::string name = base.substr(0, 8 - tail.size()) + tail;
+      name.resize(8, ' ');
+      std::string e = ext;
+      e.resize(3, ' ');
+      if (used.insert(name + e).second) {
+        memcpy(node.shortName, (name + e).data(), 11);
+        break;
+      }
+    }
+    if (node.isDirectory) {
+      shortNames(node);
+    }
+  }
+}
+
+// Directory entries a folder takes
+static uint32_t entryCount(const Node &dir, bool root) {
+  uint32_t n = root ? 1 : 2;  // volume label, or . and ..
+  for (const Node &node : dir.children) {
+    n += 1 + (node.name16.size() + 12) / 13;
+  }
+  return n + 1;  // an end marker
+}
+
+class Packer {
+public:
+  uint32_t sectorsPerCluster;
+  uint32_t totalSectors;
+  uint32_t reserved;
+  uint32_t fatLength;
+  uint32_t dataStart;
+  uint32_t clusterCount;
+  std::vector<uint32_t> fat;
+  uint32_t nextCluster = 2;
+  int fd = -1;
+
+  uint32_t clusterBytes() {
+    return sectorsPerCluster * SECTOR_SIZE;
+  }
+
+  // Fit the FATs and align the data area. Returns false if the volume
+  // is too small or large for FAT32.
+  bool layout(uint64_t sectors) {
+    totalSectors = std::min(sectors, (uint64_t) 0xFFFFFFFF);
+    uint32_t clusters = (totalSectors - RESERVED_SECTORS) / sectorsPerCluster;
+    fatLength = ((uint64_t)(clusters + 2) * 4 + SECTOR_SIZE - 1) / SECTOR_SIZE;
+    reserved = RESERVED_SECTORS;
+    dataStart = reserved + 2 * fatLength;
+    reserved += (ALIGN_SECTORS - dataStart % ALIGN_SECTORS) % ALIGN_SECTORS;
+    dataStart = reserved + 2 * fatLength;
+    if (dataStart >= totalSectors) {
+      return false;
+    }
+    clusterCount = (totalSectors - dataStart) / sectorsPerCluster;
+    fat.assign(clusterCount + 2, 0);
+    fat[0] = 0x0FFFFFF8;
+    fat[1] = 0x0FFFFFFF;
+    return (clusterCount >= FAT32_MIN_CLUSTERS) && (clusterCount < 0x0FFFFFF5);
+  }
+
+  // A chain of clusters after the last one handed out
+  uint32_t allocate(uint32_t clusters) {
+    if ((clusters == 0) || (nextCluster + clusters > clusterCount + 2)) {
+      return 0;
+    }
+    uint32_t first = nextCluster;
+    for (uint32_t c = first; c < first + clusters - 1; c++) {
+      fat[c] = c + 1;
+    }
+    fat[first + clusters - 1] = 0x0FFFFFFF;
+    nextCluster += clusters;
+    return first;
+  }
+
+  uint64_t clusterOffset(uint32_t cluster) {
+    return ((uint64_t) dataStart + (uint64_t)(cluster - 2) * sectorsPerCluster) * SECTOR_SIZE;
+  }
+
+  bool write(uint64_t offset, const void *data, size_t length) {
+    return pwrite(fd, data, length, offset) == (ssize_t) length;
+  }
+};
+
+// Clusters for directories, depth first in listing order
+static bool placeDirectories(Packer &p, Node &dir, bool root) {
+  uint64_t bytes = (uint64_t) entryCount(dir, root) * 32;
+  dir.clusters = (bytes + p.clusterBytes() - 1) / p.clusterBytes();
+  dir.firstCluster = p.allocate(dir.clusters);
+  if (dir.firstCluster == 0) {
+    return false;
+  }
+  for (Node &node : dir.children) {
+    if (node.isDirectory && !placeDirectories(p, node, false)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Clusters for files of one kind, depth first in listing order
+enum FILE_KIND { FK_LIBRARY, FK_SONG, FK_OTHER };
+
+static bool placeFiles(Packer &p, Node &dir, enum FILE_KIND kind, bool inLibrary) {
+  for (Node &node : dir.children) {
+    if (node.isDirectory) {
+      if (!placeFiles(p, node, kind, inLibrary || (node.name == ".library"))) {
+        return false;
+      }
+      continue;
+    }
+    enum FILE_KIND k = inLibrary ? FK_LIBRARY :
+                       halHasExtension(node.name.c_str(), SONG_EXTENSIONS) ? FK_SONG : FK_OTHER;
+    if ((k != kind) || (node.size == 0)) {
+      continue;
+    }
+    node.clusters = (node.size + p.clusterBytes() - 1) / p.clusterBytes();
+    node.firstCluster = p.allocate(node.clusters);
+    if (node.firstCluster == 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Clusters the folder needs, directories included
+static uint64_t clustersNeeded(const Node &dir, bool root, uint32_t clusterBytes) {
+  uint64_t n = ((uint64_t) entryCount(dir, root) * 32 + clusterBytes - 1) / clusterBytes;
+  for (const Node &node : dir.children) {
+    n += node.isDirectory ? clustersNeeded(node, false, clusterBytes) :
+                            (node.size + clusterBytes - 1) / clusterBytes;
+  }
+  return n;
+}
+
+static void fatTime(time_t t, uint8_t *p) {
+  struct tm tm;
+  localtime_r(&t, &tm);
+  if (tm.tm_year < 80) {
+    memset(&tm, 0, sizeof(tm));
+    tm.tm_year = 80;
+    tm.tm_mday = 1;
+  }
+  put16(p, (tm.tm_hour << 11) | (tm.tm_min << 5) | (tm.tm_sec / 2));
+  put16(p + 2, ((tm.tm_year - 80) << 9) | ((tm.tm_mon + 1) << 5) | tm.tm_mday);
+}
+
+static uint8_t shortChecksum(const uint8_t *name) {
+  uint8_t sum = 0;
+  for (int i = 0; i < 11; i++) {
+    sum = ((sum & 1) << 7) + (sum >> 1) + name[i];
+  }
+  return sum;
+}
+
+static void shortEntry(uint8_t *d, const uint8_t *name, uint8_t attr, uint32_t cluster,
+                       uint32_t size, time_t mtime) {
+  memcpy(d, name, 11);
+  d[11] = attr;
+  fatTime(mtime, d + 14);   // created
+  put16(d + 18, get16(d + 16));  // accessed
+  put16(d + 20, cluster >> 16);
+  fatTime(mtime, d + 22);   // written
+  put16(d + 26, cluster);
+  put32(d + 28, size);
+}
+
+// Write a folder's entries and those of the folders in it
+static bool writeDirectory(Packer &p, const Node &dir, uint32_t parentCluster, bool root) {
+
+  std::vector<uint8_t> data((size_t) dir.clusters * p.clusterBytes(), 0);
+  uint8_t *d = data.data();
+  if (root) {
+    uint8_t name[11];
+    memset(name, ' ', 11);
+    memcpy(name, label, std::min(strlen(label), (size_t) 11));
+    shortEntry(d, name, 0x08, 0, 0, time(NULL));
+    d += 32;
+  } else {
+    uint8_t dot[11], dotdot[11];
+    memset(dot, ' ', 11);
+    memset(dotdot, ' ', 11);
+    dot[0] = dotdot[0] = dotdot[1] = '.';
+    shortEntry(d, dot, 0x10, dir.firstCluster, 0, dir.mtime);
+    shortEntry(d + 32, dotdot, 0x10, parentCluster, 0, dir.mtime);
+    d += 64;
+  }
+
+  for (const Node &node : dir.children) {
+    int parts = (node.name16.size() + 12) / 13;
+    uint8_t sum = shortChecksum(node.shortName);
+    static const uint8_t offsets[13] = { 1, 3, 5, 7, 9, 14, 16, 18, 20, 22, 24, 28, 30 };
+    for (int part = parts; part >= 1; part--) {
+      d[0] = part | ((part == parts) ? 0x40 : 0);
+      d[11] = 0x0F;
+      d[13] = sum;
+      for (int i = 0; i < 13; i++) {
+        size_t c = (part - 1) * 13 + i;
+        uint16_t u = (c < node.name16.size()) ? node.name16[c] : (c == node.name16.size()) ? 0x0000 : 0xFFFF;
+        put16(d + offsets[i], u);
+      }
+      d += 32;
+    }
+    shortEntry(d, node.shortName, node.isDirectory ? 0x10 : 0x20, node.firstCluster,
+               node.size, node.mtime);
+    d += 32;
+  }
+
+  if (!p.write(p.clusterOffset(dir.firstCluster), data.data(), data.size())) {
+    return false;
+  }
+  for (const Node &node : dir.children) {
+    if (node.isDirectory && !writeDirectory(p, node, root ? 0 : dir.firstCluster, false)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Copy the files' data to their clusters
+static bool writeFiles(Packer &p, const Node &dir, uint64_t *copied) {
+
+  std::vector<uint8_t> buffer(1 << 20);
+  for (const Node &node : dir.children) {
+    if (node.isDirectory) {
+      if (!writeFiles(p, node, copied)) {
+        return false;
+      }
+      continue;
+    }
+    if (node.size == 0) {
+      continue;
+    }
+    FILE *f = fopen(node.hostPath.c_str(), "rb");
+    if (f == NULL) {
+      fprintf(stderr, "can't read %s\n", node.hostPath.c_str());
+      return false;
+    }
+    uint64_t offset = p.clusterOffset(node.firstCluster);
+    size_t n;
+    uint64_t left = node.size;
+    while ((left > 0) && ((n = fread(buffer.data(), 1, std::min((uint64_t) buffer.size(), left), f)) > 0)) {
+      if (!p.write(offset, buffer.data(), n)) {
+        fclose(f);
+        return false;
+      }
+      offset += n;
+      left -= n;
+      *copied += n;
+    }
+    fclose(f);
+    if (left > 0) {
+      fprintf(stderr, "%s changed while copying\n", node.hostPath.c_str());
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool writeVolume(Packer &p) {
+
+  uint8_t boot[SECTOR_SIZE] = { 0 };
+  boot[0] = 0xEB;
+  boot[1] = 0x58;
+  boot[2] = 0x90;
+  memcpy(boot + 3, "CYDPACK ", 8);
+  put16(boot + 11, SECTOR_SIZE);
+  boot[13] = p.sectorsPerCluster;
+  put16(boot + 14, p.reserved);
+  boot[16] = 2;
+  boot[21] = 0xF8;
+  put16(boot + 24, 63);
+  put16(boot + 26, 255);
+  put32(boot + 32, p.totalSectors);
+  put32(boot + 36, p.fatLength);
+  put32(boot + 44, 2);  // root cluster
+  put16(boot + 48, 1);  // FSInfo
+  put16(boot + 50, 6);  // backup boot sector
+  boot[64] = 0x80;
+  boot[66] = 0x29;
+  put32(boot + 67, (uint32_t) time(NULL));
+  memset(boot + 71, ' ', 11);
+  memcpy(boot + 71, label, std::min(strlen(label), (size_t) 11));
+  memcpy(boot + 82, "FAT32   ", 8);
+  boot[510] = 0x55;
+  boot[511] = 0xAA;
+
+  uint8_t info[SECTOR_SIZE] = { 0 };
+  put32(info, 0x41615252);
+  put32(info + 484, 0x61417272);
+  put32(info + 488, p.clusterCount + 2 - p.nextCluster);
+  put32(info + 492, p.nextCluster);
+  put32(info + 508, 0xAA550000);
+
+  // Blank the reserved sectors of a reused card, then both copies of
+  // the boot sectors
+  std::vector<uint8_t> zero((size_t) p.reserved * SECTOR_SIZE, 0);
+  if (!p.write(0, zero.data(), zero.size()) || !p.write(0, boot, SECTOR_SIZE) ||
+      !p.write(SECTOR_SIZE, info, SECTOR_SIZE) || !p.write(6 * SECTOR_SIZE, boot, SECTOR_SIZE) ||
+      !p.write(7 * SECTOR_SIZE, info, SECTOR_SIZE)) {
+    return false;
+  }
+
+  std::vector<uint8_t> fat((size_t) p.fatLength * SECTOR_SIZE, 0);
+  for (size_t c = 0; c < p.fat.size(); c++) {
+    put32(&fat[c * 4], p.fat[c]);
+  }
+  for (int copy = 0; copy < 2; copy++) {
+    if (!p.write(((uint64_t) p.reserved + copy * p.fatLength) * SECTOR_SIZE, fat.data(), fat.size())) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/****************************************************************/
+/***                 Fragmentation report                     ***/
+/****************************************************************/
+
+struct Card {
+  int fd;
+  uint64_t base;  // the volume's first byte
+  uint8_t fatType;
+  uint32_t sectorsPerCluster;
+  uint32_t fatStart;
+  uint32_t dataStart;
+  uint32_t clusterCount;
+  uint32_t rootCluster;
+};
+
+static boolean cardReadSector(void *context, uint32_t sector, uint8_t *buffer) {
+  Card *card = (Card *) context;
+  return pread(card->fd, buffer, SECTOR_SIZE, card->base + (uint64_t) sector * SECTOR_SIZE) == SECTOR_SIZE;
+}
+
+// The FAT32 or exFAT volume at the start of the image or in its first
+// partition
+static bool openCard(Card &card, const char *path) {
+
+  card.fd = open(path, O_RDONLY);
+  if (card.fd < 0) {
+    return false;
+  }
+  uint8_t b[SECTOR_SIZE];
+  card.base = 0;
+  for (int attempt = 0; attempt < 2; attempt++) {
+    if (!cardReadSector(&card, 0, b) || (b[510] != 0x55) || (b[511] != 0xAA)) {
+      return false;
+    }
+    if (!memcmp(b + 3, "EXFAT   ", 8) && (b[108] == 9)) {
+      card.fatType = FAT_EXTENTS_EXFAT;
+      card.sectorsPerCluster = 1 << b[109];
+      card.fatStart = get32(b + 80);
+      card.dataStart = get32(b + 88);
+      card.clusterCount = get32(b + 92);
+      card.rootCluster = get32(b + 96);
+      return true;
+    }
+    if (!memcmp(b + 82, "FAT32   ", 8) && (get16(b + 11) == SECTOR_SIZE) && b[13]) {
+      card.fatType = 32;
+      card.sectorsPerCluster = b[13];
+      card.fatStart = get16(b + 14);
+      card.dataStart = card.fatStart + b[16] * get32(b + 36);
+      card.clusterCount = (get32(b + 32) - card.dataStart) / card.sectorsPerCluster;
+      card.rootCluster = get32(b + 44);
+      return true;
+    }
+    // A partition table, try the first partition
+    card.base = (uint64_t) get32(b + 446 + 8) * SECTOR_SIZE;
+    if ((b[446 + 4] == 0) || (card.base == 0)) {
+      return false;
+    }
+  }
+  return false;
+}
+
+struct FileStats {
+  uint32_t files = 0;
+  uint32_t fragmented = 0;
+  uint64_t extents = 0;
+  uint32_t most = 0;
+  uint32_t overMax = 0;  // in more than FAT_EXTENTS_MAX extents
+};
+
+struct Report {
+  FileStats songs, others, directories;
+  std::vector<std::pair<uint32_t, std::string> > worst;
+  uint32_t followOn = 0;    // songs starting where the one before ended
+  uint32_t lastCluster = 0; // of the song before
+  bool readError = false;
+};
+
+// Extents of a file or directory, 0 if over FAT_EXTENTS_MAX
+static int countExtents(Card &card, uint32_t cluster, uint32_t size, bool contiguous,
+                        FatExtents &extents) {
+  boolean ok = contiguous ? extents.setContiguous(cluster, size) :
+                            extents.build(cluster, size, cardReadSector, &card);
+  return ok ? extents.getCount() : 0;
+}
+
+static void addFile(Report &report, FileStats &stats, const std::string &path, int count) {
+  stats.files++;
+  if (count == 0) {
+    stats.overMax++;
+    stats.fragmented++;
+    report.worst.push_back(std::make_pair((uint32_t) FAT_EXTENTS_MAX + 1, path));
+    return;
+  }
+  stats.extents += count;
+  stats.most = std::max(stats.most, (uint32_t) count);
+  if (count > 1) {
+    stats.fragmented++;
+    report.worst.push_back(std::make_pair((uint32_t) count, path));
+  }
+}
+
+// Clusters of a FAT directory, walking its chain
+static uint32_t chainLength(Card &card, uint32_t cluster) {
+  uint8_t b[SECTOR_SIZE];
+  uint32_t n = 0;
+  uint32_t sector = UINT32_MAX;
+  while ((cluster >= 2) && (cluster < card.clusterCount + 2) && (n <= card.clusterCount)) {
+    n++;
+    uint32_t s = card.fatStart + cluster / 128;
+    if ((s != sector) && !cardReadSector(&card, s, b)) {
+      break;
+    }
+    sector = s;
+    cluster = get32(b + (cluster % 128) * 4) & 0x0FFFFFFF;
+  }
+  return n;
+}
+
+// Walk a directory in the order the player lists it
+static void walk(Card &card, Report &report, const std::string &path, uint32_t cluster,
+                 bool contiguous, uint32_t length) {
+
+  FatExtents extents;
+  extents.setVolume(card.fatType, card.fatStart, card.dataStart, card.sectorsPerCluster,
+                    card.clusterCount);
+  uint32_t clusterBytes = card.sectorsPerCluster * SECTOR_SIZE;
+  if (!contiguous) {
+    length = chainLength(card, cluster) * clusterBytes;
+  }
+  addFile(report, report.directories, path.empty() ? "/" : path,
+          countExtents(card, cluster, std::max(length, clusterBytes), contiguous, extents));
+
+  FatDirScanner scanner;
+  scanner.setVolume(card.fatType, card.fatStart, card.dataStart, card.sectorsPerCluster,
+                    card.clusterCount);
+  scanner.setReader(cardReadSector, &card);
+  if (!scanner.begin(cluster, contiguous, length)) {
+    return;
+  }
+  struct Entry {
+    std::string name;
+    bool isDirectory;
+    uint32_t size;
+    uint32_t cluster;
+    bool contiguous;
+  };
+  std::vector<Entry> entries;
+  HAL_DIR_ENTRY entry;
+  while (scanner.next(&entry)) {
+    entries.push_back({ entry.name, entry.isDirectory, entry.size, scanner.getCluster(),
+                        scanner.isContiguous() });
+  }
+  if (scanner.isError()) {
+    report.readError = true;
+  }
+  std::sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b) { return a.name < b.name; });
+
+  // Songs, then the folders below
+  for (const Entry &e : entries) {
+    if (e.isDirectory || (e.size == 0)) {
+      continue;
+    }
+    std::string p = path + "/" + e.name;
+    bool song = halHasExtension(e.name.c_str(), SONG_EXTENSIONS);
+    int count = countExtents(card, e.cluster, e.size, e.contiguous, extents);
+    addFile(report, song ? report.songs : report.others, p, count);
+    if (song && (count > 0)) {
+      if (report.lastCluster + 1 == e.cluster) {
+        report.followOn++;
+      }
+      int last = count - 1;
+      report.lastCluster = extents.getExtent(last)->cluster + extents.getLength(last) - 1;
+    }
+  }
+  for (const Entry &e : entries) {
+    if (e.isDirectory) {
+      walk(card, report, path + "/" + e.name, e.cluster, e.contiguous, e.size);
+    }
+  }
+}
+
+static void printStats(const char *label, const FileStats &s) {
+  printf("  %-12s %8u  %10u  %8llu  %5u  %8.2f\n", label, s.files, s.fragmented,
+         (unsigned long long) s.extents, s.most,
+         (s.files > s.overMax) ? (double) s.extents / (s.files - s.overMax) : 0.0);
+}
+
+static int report(const char *path) {
+
+  Card card;
+  if (!openCard(card, path)) {
+    fprintf(stderr, "%s: no FAT32 or exFAT volume\n", path);
+    return 1;
+  }
+  Report r;
+  walk(card, r, "", card.rootCluster, false, 0);
+  close(card.fd);
+
+  printf("%s: %s, %u KB clusters, %u clusters\n", path,
+         (card.fatType == 32) ? "FAT32" : "exFAT", card.sectorsPerCluster / 2, card.clusterCount);
+  printf("                  count  fragmented   extents   most  per file\n");
+  printStats("songs", r.songs);
+  printStats("other files", r.others);
+  printStats("directories", r.directories);
+  uint32_t over = r.songs.overMax + r.others.overMax + r.directories.overMax;
+  if (over > 0) {
+    printf("  %u in more than %d extents, not counted in extents\n", over, FAT_EXTENTS_MAX);
+  }
+  if (r.songs.files > 1) {
+    printf("songs starting where the one before in playback order ended: %u of %u (%.1f%%)\n",
+           r.followOn, r.songs.files - 1, 100.0 * r.followOn / (r.songs.files - 1));
+  }
+  std::sort(r.worst.begin(), r.worst.end(),
+            [](const std::pair<uint32_t, std::string> &a, const std::pair<uint32_t, std::string> &b) {
+              return a.first > b.first;
+            });
+  for (int i = 0; (i < worstListed) && (i < (int) r.worst.size()); i++) {
+    if (r.worst[i].first > FAT_EXTENTS_MAX) {
+      printf("  over %d extents  %s\n", FAT_EXTENTS_MAX, r.worst[i].second.c_str());
+    } else {
+      printf("  %4u extents  %s\n", r.worst[i].first, r.worst[i].second.c_str());
+    }
+  }
+  if (r.readError) {
+    printf("read errors, some directories weren't listed\n");
+    return 1;
+  }
+  return 0;
+}
+
+static int usage() {
+  fprintf(stderr, "usage: fatpack [-c kb] [-s mb] [-g mb] [-l label] [-n n] <music-dir> <image>\n"
+                  "       fatpack [-n n] -r <image>\n");
+  return 2;
+}
+
+int main(int argc, char **argv) {
+
+  bool reportOnly = false;
+  int opt;
+  while ((opt = getopt(argc, argv, "c:s:g:l:n:r")) != -1) {
+    switch (opt) {
+      case 'c': clusterKB = atoi(optarg); break;
+      case 's': volumeMB = atoll(optarg); break;
+      case 'g': gapMB = atoll(optarg); break;
+      case 'l': label = optarg; break;
+      case 'n': worstListed = atoi(optarg); break;
+      case 'r': reportOnly = true; break;
+      default: return usage();
+    }
+  }
+  if (reportOnly) {
+    return (optind == argc - 1) ? report(argv[optind]) : usage();
+  }
+  if (optind != argc - 2) {
+    return usage();
+  }
+  if ((clusterKB < 1) || (clusterKB > 64) || (clusterKB & (clusterKB - 1))) {
+    fprintf(stderr, "cluster size must be 1 to 64 KB, a power of two\n");
+    return 2;
+  }
+  const char *imagePath = argv[optind + 1];
+
+  Node root;
+  root.hostPath = argv[optind];
+  root.isDirectory = true;
+  root.mtime = time(NULL);
+  readFolder(root);
+  shortNames(root);
+
+  Packer p;
+  p.sectorsPerCluster = clusterKB * 2;
+
+  // A card's block device is used whole
+  struct stat st;
+  bool device = (stat(imagePath, &st) == 0) && S_ISBLK(st.st_mode);
+  p.fd = open(imagePath, device ? O_WRONLY : (O_WRONLY | O_CREAT | O_TRUNC), 0666);
+  if (p.fd < 0) {
+    fprintf(stderr, "can't open %s\n", imagePath);
+    return 1;
+  }
+  uint64_t sectors;
+  if (volumeMB > 0) {
+    sectors = volumeMB * 2048;
+  } else if (device) {
+    sectors = lseek(p.fd, 0, SEEK_END) / SECTOR_SIZE;
+  } else {
+    uint64_t clusters = clustersNeeded(root, true, p.clusterBytes()) + gapMB * 2048 / p.sectorsPerCluster;
+    clusters = std::max(clusters, (uint64_t) FAT32_MIN_CLUSTERS + 16);
+    sectors = clusters * p.sectorsPerCluster + (clusters + 2) * 8 / SECTOR_SIZE + 2 +
+              RESERVED_SECTORS + ALIGN_SECTORS;
+  }
+  if (!p.layout(sectors)) {
+    fprintf(stderr, "%llu MB with %d KB clusters isn't a FAT32 volume\n",
+            (unsigned long long)(sectors / 2048), clusterKB);
+    return 1;
+  }
+
+  // Directories, the library index, songs in playback order, the rest
+  bool placed = placeDirectories(p, root, true);
+  placed = placed && placeFiles(p, root, FK_LIBRARY, false);
+  placed = placed && placeFiles(p, root, FK_SONG, false);
+  placed = placed && placeFiles(p, root, FK_OTHER, false);
+  if (!placed) {
+    fprintf(stderr, "the files don't fit in %llu MB\n", (unsigned long long)(sectors / 2048));
+    return 1;
+  }
+
+  if (!device && (ftruncate(p.fd, (off_t) p.totalSectors * SECTOR_SIZE) != 0)) {
+    fprintf(stderr, "can't size %s\n", imagePath);
+    return 1;
+  }
+  uint64_t copied = 0;
+  if (!writeVolume(p) || !writeDirectory(p, root, 0, true) || !writeFiles(p, root, &copied)) {
+    fprintf(stderr, "can't write %s\n", imagePath);
+    return 1;
+  }
+  fsync(p.fd);
+  close(p.fd);
+  printf("%s: %llu MB FAT32, %d KB clusters, %u of %u used, %llu MB of files\n", imagePath,
+         (unsigned long long)(p.totalSectors / 2048), clusterKB, p.nextCluster - 2, p.clusterCount,
+         (unsigned long long)(copied >> 20));
+  return report(imagePath);
+}
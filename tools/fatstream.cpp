@@ -0,0 +1,1592 @@
+/*
+   SD read time of audio files in a FAT32 or exFAT image, through
+   SdFat's file reads and through the player's raw contiguous reads
+
+   Replays the reads the player makes while streaming a song against a
+   model of the SD card's SPI bus and reports how long the bus is busy
+   per second of audio. Two readers are modeled:
+
+     SdFat  File32::read() as the player used it before raw reads: the
+            cluster chain is followed through a one sector FAT cache,
+            partial sectors go through a one sector data cache and
+            multi-sector reads stop at cluster ends.
+     raw    SDFileStream in AudioSourceSDFAT.h: FatExtents maps the
+            chain once at open, then up to SD_PREFETCH_SECTORS are read
+            at a time with one readSectors() call, stopping at extent
+            ends. Files in more than FAT_EXTENTS_MAX extents fall back
+            to SdFat reads.
+
+   exFAT files flagged NoFatChain are read by both without the FAT, as
+   ExFatFile does, and FatExtents maps them with setContiguous().
+
+   Each file is also read for SEEK_READ_BYTES after random seeks to
+   sector boundaries, as SongManager::skip() seeks. SdFat walks the chain
+   from the current cluster, or from the start when seeking backwards.
+   The raw reader looks the position up in the extents.
+
+   The card model follows SdSpiCard: with a dedicated SPI bus a multi
+   block read stays open while reads continue at the next sector, any
+   other sector stops it (CMD12) and starts a new one (CMD18) which
+   waits the card's access time. With a shared bus every call is its own
+   command. Bus time is command bytes, access waits, block gaps and
+   data at the SPI clock. CPU time is not modeled.
+
+   Both readers' data is checked against each other. Exits with 1 if
+   it differs.
+
+   With -d the built image also holds /MUSIC, a folder of long named
+   entries (songs, every 10th a .jpg and every 50th a hidden ._ file),
+   and listing it is measured instead of the songs:
+
+     openNextFile  SdFatHalDir's loop before raw scans: each entry is
+                   opened through SdFat's one sector cache and getName()
+                   of a FAT long name reopens the folder and seeks back
+                   to each LFN entry, walking the cluster chain from the
+                   folder's start. exFAT remembers the name's cluster.
+     raw scan      FatDirScanner reading the folder's sectors.
+
+   Both list the visible .mp3 files and their names are checked against
+   each other. Host entries/s is the CPU time of the scanner and of the
+   model of the loop on this machine, not of SdFat itself.
+
+   Build:
+     g++ -O2 -std=c++11 -o fatstream fatstream.cpp
+
+   Usage:
+     fatstream [options]
+       Builds a FAT32 image holding CONTIG.MP3, stored in one run of
+       clusters, and FRAG.MP3, stored in runs of -f clusters between
+       the clusters of FILLER.BIN, and measures both songs. With -e
+       the image is exFAT and CONTIG.MP3 is flagged NoFatChain.
+
+     fatstream [options] <image>
+       Measures every file of at least 64 KB in a FAT32 or exFAT image,
+       e.g. a dd of a card. FAT32 files are listed by their 8.3 names.
+
+   Options:
+     -c kb    cluster size of the built image (default 32, 128 for exFAT)
+     -s kb    song size of the built image (default 5120)
+     -f n     cluster runs of FRAG.MP3 in the built image (default 8)
+     -w path  also write the built image to path (sparse)
+     -k kbps  audio bit rate (default 128)
+     -m mhz   SPI clock (default 20)
+     -a us    card access time starting a read (default 300). The
+              random read average of the SD Card Test is a good value.
+     -g us    wait between blocks of a multi block read (default 10)
+     -r n     bytes the player reads at a time (default 1024)
+     -p n     SD_PREFETCH_SECTORS (default 8)
+     -n n     random seeks per file (default 200)
+     -x       model a shared SPI bus
+     -e       build an exFAT image
+     -d n     add a folder of n entries and measure listing it
+
+   Last Update: 10/18/2026
+*/
+
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "../FatDirScanner.h"
+#include "../FatExtents.h"
+
+#define SECTOR_SIZE 512
+
+// Bytes on the bus around each command
+#define CMD_BYTES 8    // command and R1
+#define STOP_BYTES 10  // CMD12, stuff byte, R1 and busy
+#define BLOCK_BYTES (1 + SECTOR_SIZE + 2)  // token, data, CRC
+
+// Read after each seek, about a second of 128 kbps audio
+#define SEEK_READ_BYTES 16384
+
+// Built image
+#define BUILD_CLUSTERS 66000  // over the FAT32 minimum of 65525
+#define BUILD_RESERVED 32
+#define EXFAT_FAT_OFFSET 128
+
+static int clusterKB = 0;  // 32 for FAT32 or 128 for exFAT
+static bool exfat = false;
+static uint32_t songKB = 5120;
+static const char *writePath = NULL;
+static int kbps = 128;
+static double mhz = 20;
+static double accessUs = 300;
+static double gapUs = 10;
+static uint32_t readSize = 1024;
+static uint32_t prefetchSectors = 8;
+static bool sharedBus = false;
+static int fragRun = 8;
+static int seeks = 200;
+static int dirEntries = 0;
+
+static inline uint16_t get16(const uint8_t *p) {
+  return p[0] | (p[1] << 8);
+}
+
+static inline uint32_t get32(const uint8_t *p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static inline void put16(uint8_t *p, uint16_t v) {
+  p[0] = v;
+  p[1] = v >> 8;
+}
+
+static inline void put32(uint8_t *p, uint32_t v) {
+  put16(p, v);
+  put16(p + 2, v >> 16);
+}
+
+// Sectors of an image, built in memory or read from a file. Sectors
+// past the end read as zeros so a large volume only takes the memory of
+// what was written.
+class Image {
+public:
+  std::vector<uint8_t> data;
+  FILE *file = NULL;
+
+  ~Image() {
+    if (file != NULL) {
+      fclose(file);
+    }
+  }
+
+  uint8_t *sector(uint32_t s) {
+    size_t end = (size_t)(s + 1) * SECTOR_SIZE;
+    if (data.size() < end) {
+      data.resize(end, 0);
+    }
+    return &data[(size_t) s * SECTOR_SIZE];
+  }
+
+  void read(uint32_t s, uint8_t *dst) {
+    size_t offset = (size_t) s * SECTOR_SIZE;
+    if (file != NULL) {
+      if ((fseeko(file, offset, SEEK_SET) != 0) || (fread(dst, 1, SECTOR_SIZE, file) != SECTOR_SIZE)) {
+        memset(dst, 0, SECTOR_SIZE);
+      }
+    } else if (offset + SECTOR_SIZE <= data.size()) {
+      memcpy(dst, &data[offset], SECTOR_SIZE);
+    } else {
+      memset(dst, 0, SECTOR_SIZE);
+    }
+  }
+
+  bool open(const char *path) {
+    file = fopen(path, "rb");
+    return file != NULL;
+  }
+
+  bool save(const char *path, uint64_t size) {
+    FILE *f = fopen(path, "wb");
+    if (f == NULL) {
+      return false;
+    }
+    bool ok = fwrite(data.data(), 1, data.size(), f) == data.size();
+    ok &= ftruncate(fileno(f), size) == 0;
+    fclose(f);
+    return ok;
+  }
+};
+
+// SPI bus time and commands of the card
+class CardModel {
+public:
+  Image *image;
+  bool streaming = false;
+  uint32_t nextSector = 0;
+  uint32_t commands = 0;
+  uint32_t sectors = 0;
+  double busUs = 0;
+
+  explicit CardModel(Image *img) {
+    image = img;
+  }
+
+  void reset() {
+    streaming = false;
+    commands = 0;
+    sectors = 0;
+    busUs = 0;
+  }
+
+  // SdCard::readSectors()
+  void readSectors(uint32_t s, uint8_t *dst, uint32_t n) {
+    if (sharedBus) {
+      // CMD17 for one sector, CMD18 and CMD12 for more
+      startRead();
+      if (n > 1) {
+        busUs += bytesUs(STOP_BYTES);
+      }
+      streaming = false;
+    } else if (!streaming || (s != nextSector)) {
+      if (streaming) {
+        busUs += bytesUs(STOP_BYTES);
+      }
+      startRead();
+      streaming = true;
+    } else {
+      busUs += gapUs;
+    }
+    for (uint32_t i = 0; i < n; i++) {
+      if (i > 0) {
+        busUs += gapUs;
+      }
+      busUs += bytesUs(BLOCK_BYTES);
+      image->read(s + i, dst + i * SECTOR_SIZE);
+    }
+    sectors += n;
+    nextSector = s + n;
+  }
+
+  void readSector(uint32_t s, uint8_t *dst) {
+    readSectors(s, dst, 1);
+  }
+
+protected:
+  double bytesUs(uint32_t bytes) {
+    return bytes * 8 / mhz;
+  }
+
+  void startRead() {
+    commands++;
+    busUs += bytesUs(CMD_BYTES) + accessUs;
+  }
+};
+
+// FAT32 or exFAT volume geometry
+struct Volume {
+  uint8_t fatType;  // 32 or FAT_EXTENTS_EXFAT
+  uint32_t sectorsPerCluster;
+  uint32_t fatStart;
+  uint32_t fatLength;  // sectors per FAT
+  uint8_t fatCount;
+  uint32_t dataStart;
+  uint32_t rootCluster;
+  uint32_t clusterCount;
+
+  bool parse(Image &image) {
+    uint8_t b[SECTOR_SIZE];
+    image.read(0, b);
+    if ((b[510] != 0x55) || (b[511] != 0xAA)) {
+      return false;
+    }
+    if (memcmp(b + 3, "EXFAT   ", 8) == 0) {
+      if ((b[108] != 9) || (b[109] > 16)) {
+        return false;  // only 512 byte sectors
+      }
+      fatType = FAT_EXTENTS_EXFAT;
+      sectorsPerCluster = 1 << b[109];
+      fatStart = get32(b + 80);
+      fatLength = get32(b + 84);
+      fatCount = b[110];
+      dataStart = get32(b + 88);
+      clusterCount = get32(b + 92);
+      rootCluster = get32(b + 96);
+      return true;
+    }
+    if ((get16(b + 11) != SECTOR_SIZE) || (get16(b + 22) != 0) || (b[13] == 0)) {
+      return false;  // not FAT32 with 512 byte sectors
+    }
+    fatType = 32;
+    sectorsPerCluster = b[13];
+    fatStart = get16(b + 14);
+    fatLength = get32(b + 36);
+    fatCount = b[16];
+    dataStart = fatStart + fatCount * fatLength;
+    rootCluster = get32(b + 44);
+    uint32_t total = get16(b + 19) ? get16(b + 19) : get32(b + 32);
+    clusterCount = (total - dataStart) / sectorsPerCluster;
+    return true;
+  }
+
+  const char *name() {
+    return (fatType == 32) ? "FAT32" : "exFAT";
+  }
+
+  uint32_t clusterSector(uint32_t cluster) {
+    return dataStart + (cluster - 2) * sectorsPerCluster;
+  }
+
+  // The FAT entry of a cluster from a FAT sector
+  uint32_t entry(const uint8_t *fatSector, uint32_t cluster) {
+    uint32_t value = get32(fatSector + (cluster % (SECTOR_SIZE / 4)) * 4);
+    return (fatType == 32) ? (value & 0x0FFFFFFF) : value;
+  }
+
+  // Next cluster of a chain read from the image, 0 at its end
+  uint32_t next(Image &image, uint32_t cluster) {
+    uint8_t b[SECTOR_SIZE];
+    image.read(fatStart + cluster / (SECTOR_SIZE / 4), b);
+    uint32_t value = entry(b, cluster);
+    return ((value < 2) || (value >= clusterCount + 2)) ? 0 : value;
+  }
+};
+
+// A file found in the image
+struct FileInfo {
+  std::string path;
+  uint32_t firstCluster;
+  uint32_t size;
+  bool contiguous;  // exFAT NoFatChain, the FAT isn't used
+};
+
+// Reads a file the way SdFat's FatFile::read() and ExFatFile::read() do
+class SdFatReader {
+public:
+  SdFatReader(CardModel *card, Volume *vol) {
+    _card = card;
+    _vol = vol;
+  }
+
+  uint32_t fatReads = 0;
+
+  void open(const FileInfo &file, bool contiguous) {
+    _file = file;
+    _contiguous = contiguous;
+    position = 0;
+    fatCacheSector = UINT32_MAX;
+    dataCacheSector = UINT32_MAX;
+  }
+
+  // fatGet() through the FAT cache
+  uint32_t fatGet(uint32_t cluster) {
+    uint32_t s = _vol->fatStart + cluster / (SECTOR_SIZE / 4);
+    if (s != fatCacheSector) {
+      _card->readSector(s, fatCache);
+      fatCacheSector = s;
+      fatReads++;
+    }
+    return _vol->entry(fatCache, cluster);
+  }
+
+  // FatFile::seekSet(): walks the chain on from the current cluster, or
+  // from the first cluster when seeking backwards
+  void seek(uint32_t pos) {
+    uint32_t clusterBytes = _vol->sectorsPerCluster * SECTOR_SIZE;
+    if (pos > 0) {
+      uint32_t nCur = (position - 1) / clusterBytes;
+      uint32_t nNew = (pos - 1) / clusterBytes;
+      if (_contiguous) {
+        cluster = _file.firstCluster + nNew;
+        nNew = 0;
+      } else if ((nNew < nCur) || (position == 0)) {
+        cluster = _file.firstCluster;
+      } else {
+        nNew -= nCur;
+      }
+      while (nNew--) {
+        cluster = fatGet(cluster);
+      }
+    }
+    position = pos;
+  }
+
+  uint32_t read(uint8_t *dst, uint32_t length) {
+    uint32_t toRead = std::min(length, _file.size - position);
+    uint32_t done = 0;
+    uint32_t clusterBytes = _vol->sectorsPerCluster * SECTOR_SIZE;
+
+    while (done < toRead) {
+      uint32_t left = toRead - done;
+      uint32_t offset = position % SECTOR_SIZE;
+      uint32_t sectorOfCluster = (position % clusterBytes) / SECTOR_SIZE;
+      if ((position % clusterBytes) == 0) {
+        if (position == 0) {
+          cluster = _file.firstCluster;
+        } else if (_contiguous) {
+          cluster++;
+        } else {
+          cluster = fatGet(cluster);
+        }
+      }
+      uint32_t s = _vol->clusterSector(cluster) + sectorOfCluster;
+      uint32_t n;
+
+      if ((offset != 0) || (left < SECTOR_SIZE) || (s == dataCacheSector)) {
+        // Partial sector or already cached
+        n = std::min((uint32_t) SECTOR_SIZE - offset, left);
+        if (s != dataCacheSector) {
+          _card->readSector(s, dataCache);
+          dataCacheSector = s;
+        }
+        memcpy(dst + done, dataCache + offset, n);
+      } else if (left >= 2 * SECTOR_SIZE) {
+        // Whole sectors up to the end of the cluster
+        uint32_t ns = std::min(left / SECTOR_SIZE, _vol->sectorsPerCluster - sectorOfCluster);
+        n = ns * SECTOR_SIZE;
+        _card->readSectors(s, dst + done, ns);
+      } else {
+        n = SECTOR_SIZE;
+        _card->readSector(s, dst + done);
+      }
+      done += n;
+      position += n;
+    }
+    return done;
+  }
+
+protected:
+  CardModel *_card;
+  Volume *_vol;
+  FileInfo _file;
+  bool _contiguous;
+  uint32_t position;
+  uint32_t cluster;
+  uint32_t fatCacheSector;
+  uint32_t dataCacheSector;
+  uint8_t fatCache[SECTOR_SIZE];
+  uint8_t dataCache[SECTOR_SIZE];
+};
+
+// CardModel reads for FatExtents::build()
+static boolean modelReadSector(void *context, uint32_t sector, uint8_t *buffer) {
+  ((CardModel *) context)->readSector(sector, buffer);
+  return true;
+}
+
+// Reads a file the way SDFileStream does
+class RawReader {
+public:
+  RawReader(CardModel *card, Volume *vol) : fallback(card, vol) {
+    _card = card;
+    _vol = vol;
+    buffer.resize(prefetchSectors * SECTOR_SIZE);
+  }
+
+  SdFatReader fallback;
+  FatExtents extents;
+
+  // Returns whether the file is read raw
+  bool open(const FileInfo &file) {
+    _file = file;
+    position = 0;
+    count = 0;
+    used = 0;
+
+    extents.setVolume(_vol->fatType, _vol->fatStart, _vol->dataStart, _vol->sectorsPerCluster,
+                      _vol->clusterCount);
+    if (file.contiguous) {
+      raw = extents.setContiguous(file.firstCluster, file.size);
+    } else {
+      raw = extents.build(file.firstCluster, file.size, modelReadSector, _card);
+    }
+    fallback.open(file, file.contiguous);
+    return raw;
+  }
+
+  uint32_t fatReadCount() {
+    return extents.getFatReads() + fallback.fatReads;
+  }
+
+  void seek(uint32_t pos) {
+    if (!raw) {
+      fallback.seek(pos);
+      return;
+    }
+    uint32_t start = position - used;
+    if ((pos >= start) && (pos < start + count)) {
+      used = pos - start;
+    } else {
+      used = 0;
+      count = 0;
+    }
+    position = pos;
+  }
+
+  uint32_t read(uint8_t *dst, uint32_t length) {
+    if (!raw) {
+      return fallback.read(dst, length);
+    }
+    uint32_t done = 0;
+    while (done < length) {
+      if (used >= count) {
+        if (position >= _file.size) {
+          break;
+        }
+        uint32_t offset = position % SECTOR_SIZE;
+        uint32_t left = _file.size - position + offset;
+        uint32_t run;
+        uint32_t s = extents.sector(position, &run);
+        uint32_t n = std::min(std::min(prefetchSectors, run), (left + SECTOR_SIZE - 1) / SECTOR_SIZE);
+        _card->readSectors(s, buffer.data(), n);
+        count = std::min(left, n * SECTOR_SIZE);
+        used = offset;
+      }
+      uint32_t n = std::min(length - done, count - used);
+      memcpy(dst + done, &buffer[used], n);
+      used += n;
+      position += n;
+      done += n;
+    }
+    return done;
+  }
+
+protected:
+  CardModel *_card;
+  Volume *_vol;
+  FileInfo _file;
+  bool raw;
+  uint32_t position;
+  std::vector<uint8_t> buffer;
+  uint32_t count;  // bytes in the buffer
+  uint32_t used;   // of position in the buffer
+};
+
+// Number of runs of consecutive clusters in a file
+static uint32_t countExtents(Image &image, Volume &vol, const FileInfo &file) {
+  if (file.contiguous) {
+    return 1;
+  }
+  uint32_t extents = 1;
+  for (uint32_t c = file.firstCluster, i = 0; i <= vol.clusterCount; i++) {
+    uint32_t next = vol.next(image, c);
+    if (next == 0) {
+      return extents;
+    }
+    if (next != c + 1) {
+      extents++;
+    }
+    c = next;
+  }
+  return extents;  // the chain loops
+}
+
+// Read a directory's clusters. An exFAT directory flagged contiguous
+// has length bytes with no FAT chain.
+static std::vector<uint8_t> readDirectory(Image &image, Volume &vol, uint32_t firstCluster,
+                                          bool contiguous, uint32_t length) {
+  std::vector<uint8_t> dir;
+  uint32_t clusterBytes = vol.sectorsPerCluster * SECTOR_SIZE;
+  uint32_t cluster = firstCluster;
+  for (uint32_t i = 0; (cluster >= 2) && (i < vol.clusterCount); i++) {
+    if (contiguous && (i * clusterBytes >= length)) {
+      break;
+    }
+    size_t at = dir.size();
+    dir.resize(at + clusterBytes);
+    for (uint32_t s = 0; s < vol.sectorsPerCluster; s++) {
+      image.read(vol.clusterSector(cluster) + s, &dir[at + s * SECTOR_SIZE]);
+    }
+    cluster = contiguous ? cluster + 1 : vol.next(image, cluster);
+  }
+  return dir;
+}
+
+// Collect the files of a FAT32 directory and its subdirectories
+static void listFat32(Image &image, Volume &vol, uint32_t dirCluster,
+                      const std::string &dirPath, std::vector<FileInfo> &files, int depth) {
+  std::vector<uint8_t> dir = readDirectory(image, vol, dirCluster, false, 0);
+  for (size_t e = 0; e < dir.size(); e += 32) {
+    const uint8_t *d = &dir[e];
+    if (d[0] == 0) {
+      return;  // end of directory
+    }
+    uint8_t attr = d[11];
+    if ((d[0] == 0xE5) || (d[0] == '.') || ((attr & 0x0F) == 0x0F) || (attr & 0x08)) {
+      continue;  // deleted, dot, long name or volume label
+    }
+    std::string name(reinterpret_cast<const char *>(d), 8);
+    name.erase(name.find_last_not_of(' ') + 1);
+    std::string ext(reinterpret_cast<const char *>(d + 8), 3);
+    ext.erase(ext.find_last_not_of(' ') + 1);
+    if (!ext.empty()) {
+      name += "." + ext;
+    }
+    uint32_t first = ((uint32_t) get16(d + 20) << 16) | get16(d + 26);
+    if (attr & 0x10) {
+      if (depth < 8) {
+        listFat32(image, vol, first, dirPath + name + "/", files, depth + 1);
+      }
+    } else if (first >= 2) {
+      files.push_back({ dirPath + name, first, get32(d + 28), false });
+    }
+  }
+}
+
+// Collect the files of an exFAT directory and its subdirectories. Each
+// file is an entry set: a file entry (0x85), a stream extension (0xC0)
+// with the first cluster, size and NoFatChain flag, then name entries
+// (0xC1) of 15 UTF-16 characters. Names are shown as ASCII.
+static void listExfat(Image &image, Volume &vol, uint32_t dirCluster, bool contiguous,
+                      uint32_t length, const std::string &dirPath, std::vector<FileInfo> &files,
+                      int depth) {
+  std::vector<uint8_t> dir = readDirectory(image, vol, dirCluster, contiguous, length);
+  for (size_t e = 0; e < dir.size(); e += 32) {
+    const uint8_t *d = &dir[e];
+    if (d[0] == 0) {
+      return;  // end of directory
+    }
+    uint8_t secondary = d[1];
+    if ((d[0] != 0x85) || (secondary < 2) || (e + (secondary + 1) * 32 > dir.size())) {
+      continue;  // not an in-use file entry set
+    }
+    const uint8_t *stream = d + 32;
+    if (stream[0] != 0xC0) {
+      continue;
+    }
+    std::string name;
+    for (int i = 2; (i <= secondary) && (name.size() < stream[3]); i++) {
+      const uint8_t *n = d + i * 32;
+      for (int c = 0; (c < 15) && (name.size() < stream[3]); c++) {
+        uint16_t u = get16(n + 2 + c * 2);
+        name += (u < 0x80) ? (char) u : '?';
+      }
+    }
+    uint32_t first = get32(stream + 20);
+    uint32_t size = get32(stream + 24);  // files over 4 GB aren't songs
+    bool noFatChain = (stream[1] & 0x02) != 0;
+    if (get16(d + 4) & 0x10) {
+      if (depth < 8) {
+        listExfat(image, vol, first, noFatChain, size, dirPath + name + "/", files, depth + 1);
+      }
+    } else if (first >= 2) {
+      files.push_back({ dirPath + name, first, size, noFatChain });
+    }
+    e += secondary * 32;
+  }
+}
+
+static void listFiles(Image &image, Volume &vol, std::vector<FileInfo> &files) {
+  if (vol.fatType == 32) {
+    listFat32(image, vol, vol.rootCluster, "/", files, 0);
+  } else {
+    listExfat(image, vol, vol.rootCluster, false, 0, "/", files, 0);
+  }
+}
+
+static void setFat(Image &image, Volume &vol, uint32_t cluster, uint32_t value) {
+  for (int copy = 0; copy < vol.fatCount; copy++) {
+    uint8_t *s = image.sector(vol.fatStart + copy * vol.fatLength + cluster / (SECTOR_SIZE / 4));
+    put32(s + (cluster % (SECTOR_SIZE / 4)) * 4, value);
+  }
+}
+
+// Write the clusters of a file with pseudo random bytes. chain writes
+// its FAT chain, left out for exFAT NoFatChain files.
+static void fillClusters(Image &image, Volume &vol, const std::vector<uint32_t> &clusters,
+                         uint32_t size, uint32_t seed, bool chain) {
+  uint32_t x = seed;
+  uint32_t left = size;
+  uint32_t end = (vol.fatType == 32) ? 0x0FFFFFFF : 0xFFFFFFFF;
+  for (size_t i = 0; i < clusters.size(); i++) {
+    if (chain) {
+      setFat(image, vol, clusters[i], (i + 1 < clusters.size()) ? clusters[i + 1] : end);
+    }
+    for (uint32_t s = 0; (s < vol.sectorsPerCluster) && left; s++) {
+      uint8_t *p = image.sector(vol.clusterSector(clusters[i]) + s);
+      uint32_t n = std::min(left, (uint32_t) SECTOR_SIZE);
+      for (uint32_t j = 0; j < n; j++) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        p[j] = x;
+      }
+      left -= n;
+    }
+  }
+}
+
+// Where the builders left off, for addFolder()
+static uint32_t buildNextCluster;
+static int buildRootIndex;
+
+// Clusters of the test songs: CONTIG.MP3 in one run from next, then
+// FRAG.MP3 in runs of fragRun with a cluster of FILLER.BIN between
+static void layoutSongs(uint32_t next, uint32_t n, std::vector<uint32_t> &contig,
+                        std::vector<uint32_t> &frag, std::vector<uint32_t> &filler) {
+  for (uint32_t i = 0; i < n; i++) {
+    contig.push_back(next++);
+  }
+  while (frag.size() < n) {
+    for (int i = 0; (i < fragRun) && (frag.size() < n); i++) {
+      frag.push_back(next++);
+    }
+    filler.push_back(next++);
+  }
+}
+
+// Add a FAT32 root directory entry
+static void addEntry(Image &image, Volume &vol, int index, const char *name83,
+                     uint32_t firstCluster, uint32_t size) {
+  uint8_t *d = image.sector(vol.clusterSector(vol.rootCluster) + index / 16) + (index % 16) * 32;
+  memcpy(d, name83, 11);
+  d[11] = 0x20;  // archive
+  put16(d + 20, firstCluster >> 16);
+  put16(d + 26, firstCluster);
+  put32(d + 28, size);
+}
+
+// Build a FAT32 test image. Returns its size in bytes.
+static uint64_t buildFat32(Image &image, Volume &vol) {
+  vol.fatType = 32;
+  vol.sectorsPerCluster = clusterKB * 2;
+  vol.clusterCount = BUILD_CLUSTERS;
+  vol.rootCluster = 2;
+  vol.fatLength = ((BUILD_CLUSTERS + 2) * 4 + SECTOR_SIZE - 1) / SECTOR_SIZE;
+  vol.fatCount = 2;
+  vol.fatStart = BUILD_RESERVED;
+  vol.dataStart = BUILD_RESERVED + 2 * vol.fatLength;
+  uint32_t total = vol.dataStart + BUILD_CLUSTERS * vol.sectorsPerCluster;
+
+  // Boot sector, FSInfo and the backup boot sector
+  uint8_t b[SECTOR_SIZE] = { 0 };
+  memcpy(b, "\xEB\x58\x90" "MSWIN4.1", 11);
+  put16(b + 11, SECTOR_SIZE);
+  b[13] = vol.sectorsPerCluster;
+  put16(b + 14, BUILD_RESERVED);
+  b[16] = 2;
+  b[21] = 0xF8;
+  put16(b + 24, 63);
+  put16(b + 26, 255);
+  put32(b + 32, total);
+  put32(b + 36, vol.fatLength);
+  put32(b + 44, vol.rootCluster);
+  put16(b + 48, 1);
+  put16(b + 50, 6);
+  b[64] = 0x80;
+  b[66] = 0x29;
+  put32(b + 67, 0x20261018);
+  memcpy(b + 71, "CYD MUSIC  FAT32   ", 19);
+  b[510] = 0x55;
+  b[511] = 0xAA;
+  memcpy(image.sector(0), b, SECTOR_SIZE);
+  memcpy(image.sector(6), b, SECTOR_SIZE);
+
+  uint8_t *fsInfo = image.sector(1);
+  put32(fsInfo, 0x41615252);
+  put32(fsInfo + 484, 0x61417272);
+  put32(fsInfo + 488, 0xFFFFFFFF);
+  put32(fsInfo + 492, 0xFFFFFFFF);
+  fsInfo[510] = 0x55;
+  fsInfo[511] = 0xAA;
+
+  setFat(image, vol, 0, 0x0FFFFFF8);
+  setFat(image, vol, 1, 0x0FFFFFFF);
+  setFat(image, vol, vol.rootCluster, 0x0FFFFFFF);
+
+  uint32_t size = songKB * 1024;
+  uint32_t clusterBytes = vol.sectorsPerCluster * SECTOR_SIZE;
+  uint32_t n = (size + clusterBytes - 1) / clusterBytes;
+  std::vector<uint32_t> contig, frag, filler;
+  layoutSongs(vol.rootCluster + 1, n, contig, frag, filler);
+
+  fillClusters(image, vol, contig, size, 1, true);
+  fillClusters(image, vol, frag, size, 1, true);
+  fillClusters(image, vol, filler, filler.size() * clusterBytes, 2, true);
+  addEntry(image, vol, 0, "CONTIG  MP3", contig[0], size);
+  addEntry(image, vol, 1, "FRAG    MP3", frag[0], size);
+  addEntry(image, vol, 2, "FILLER  BIN", filler[0], filler.size() * clusterBytes);
+  buildRootIndex = 3;
+  buildNextCluster = filler.back() + 1;
+  return (uint64_t) total * SECTOR_SIZE;
+}
+
+// exFAT checksums. The boot region's skips VolumeFlags and
+// PercentInUse, an entry set's skips its own SetChecksum field.
+static uint32_t exfatSum32(uint32_t sum, const uint8_t *p, size_t n, bool bootSector) {
+  for (size_t i = 0; i < n; i++) {
+    if (bootSector && ((i == 106) || (i == 107) || (i == 112))) {
+      continue;
+    }
+    sum = ((sum & 1) ? 0x80000000 : 0) + (sum >> 1) + p[i];
+  }
+  return sum;
+}
+
+static uint16_t exfatSum16(uint16_t sum, const uint8_t *p, size_t n, bool fileEntry) {
+  for (size_t i = 0; i < n; i++) {
+    if (fileEntry && ((i == 2) || (i == 3))) {
+      continue;
+    }
+    sum = ((sum & 1) ? 0x8000 : 0) + (sum >> 1) + p[i];
+  }
+  return sum;
+}
+
+// Entry index of a directory stored in clusters
+static uint8_t *dirEntry(Image &image, Volume &vol, const std::vector<uint32_t> &clusters,
+                         uint32_t index) {
+  uint32_t perCluster = vol.sectorsPerCluster * (SECTOR_SIZE / 32);
+  uint32_t i = index % perCluster;
+  return image.sector(vol.clusterSector(clusters[index / perCluster]) + i / 16) + (i % 16) * 32;
+}
+
+// Add an exFAT file entry set at entry index of a directory. Returns
+// the index after it.
+static int addExfatEntry(Image &image, Volume &vol, const std::vector<uint32_t> &dir, int index,
+                         const char *name, uint32_t firstCluster, uint32_t size, bool noFatChain,
+                         uint16_t attributes = 0x20) {
+  int length = strlen(name);
+  int secondary = 1 + (length + 14) / 15;
+  std::vector<uint8_t> set((secondary + 1) * 32, 0);
+
+  uint8_t *file = &set[0];
+  file[0] = 0x85;
+  file[1] = secondary;
+  put16(file + 4, attributes);
+
+  uint8_t *stream = &set[32];
+  uint16_t hash = 0;
+  stream[0] = 0xC0;
+  stream[1] = (firstCluster == 0) ? 0 : noFatChain ? 0x03 : 0x01;  // AllocationPossible, NoFatChain
+  stream[3] = length;
+  put32(stream + 8, size);  // ValidDataLength
+  put32(stream + 20, firstCluster);
+  put32(stream + 24, size);  // DataLength
+
+  for (int i = 0; i < length; i++) {
+    uint8_t *n = &set[(2 + i / 15) * 32];
+    n[0] = 0xC1;
+    put16(n + 2 + (i % 15) * 2, name[i]);
+    uint8_t up[2] = { (uint8_t) toupper(name[i]), 0 };
+    hash = exfatSum16(hash, up, 2, false);
+  }
+  put16(stream + 4, hash);
+  put16(file + 2, exfatSum16(0, set.data(), set.size(), true));
+
+  for (size_t i = 0; i < set.size(); i += 32, index++) {
+    memcpy(dirEntry(image, vol, dir, index), &set[i], 32);
+  }
+  return index;
+}
+
+// Mark clusters first to last in use in the exFAT allocation bitmap
+static void markUsed(Image &image, Volume &vol, uint32_t first, uint32_t last) {
+  for (uint32_t c = first; c <= last; c++) {
+    uint32_t bit = c - 2;
+    image.sector(vol.clusterSector(2) + bit / (SECTOR_SIZE * 8))[(bit / 8) % SECTOR_SIZE] |=
+        1 << (bit % 8);
+  }
+}
+
+// Build an exFAT test image: the allocation bitmap, up-case table and
+// root directory take the first clusters, then the songs as in FAT32.
+// Returns its size in bytes.
+static uint64_t buildExfat(Image &image, Volume &vol) {
+  int shift = 0;
+  while ((1 << shift) < clusterKB * 2) {
+    shift++;
+  }
+  vol.fatType = FAT_EXTENTS_EXFAT;
+  vol.sectorsPerCluster = clusterKB * 2;
+  vol.clusterCount = BUILD_CLUSTERS;
+  vol.fatStart = EXFAT_FAT_OFFSET;
+  vol.fatLength = ((BUILD_CLUSTERS + 2) * 4 + SECTOR_SIZE - 1) / SECTOR_SIZE;
+  vol.fatCount = 1;
+  vol.dataStart = (vol.fatStart + vol.fatLength + vol.sectorsPerCluster - 1) /
+                  vol.sectorsPerCluster * vol.sectorsPerCluster;
+  uint32_t total = vol.dataStart + BUILD_CLUSTERS * vol.sectorsPerCluster;
+  uint32_t clusterBytes = vol.sectorsPerCluster * SECTOR_SIZE;
+
+  uint32_t bitmapBytes = (BUILD_CLUSTERS + 7) / 8;
+  uint32_t bitmapClusters = (bitmapBytes + clusterBytes - 1) / clusterBytes;
+  uint32_t upcase = 2 + bitmapClusters;
+  vol.rootCluster = upcase + 1;
+
+  // Main and backup boot regions: boot sector, 8 extended boot sectors,
+  // OEM parameters, a reserved sector and the checksum sector
+  std::vector<uint8_t> region(12 * SECTOR_SIZE, 0);
+  uint8_t *b = &region[0];
+  memcpy(b, "\xEB\x76\x90" "EXFAT   ", 11);
+  put32(b + 72, total);  // VolumeLength, 64 bit
+  put32(b + 80, vol.fatStart);
+  put32(b + 84, vol.fatLength);
+  put32(b + 88, vol.dataStart);
+  put32(b + 92, vol.clusterCount);
+  put32(b + 96, vol.rootCluster);
+  put32(b + 100, 0x20261018);
+  put16(b + 104, 0x0100);
+  b[108] = 9;
+  b[109] = shift;
+  b[110] = 1;
+  b[111] = 0x80;
+  b[112] = 0xFF;
+  b[510] = 0x55;
+  b[511] = 0xAA;
+  for (int s = 1; s <= 8; s++) {
+    put32(&region[s * SECTOR_SIZE + 508], 0xAA550000);
+  }
+  uint32_t sum = 0;
+  for (int s = 0; s < 11; s++) {
+    sum = exfatSum32(sum, &region[s * SECTOR_SIZE], SECTOR_SIZE, s == 0);
+  }
+  for (int i = 0; i < SECTOR_SIZE / 4; i++) {
+    put32(&region[11 * SECTOR_SIZE + i * 4], sum);
+  }
+  for (int s = 0; s < 24; s++) {
+    memcpy(image.sector(s), &region[(s % 12) * SECTOR_SIZE], SECTOR_SIZE);
+  }
+
+  setFat(image, vol, 0, 0xFFFFFFF8);
+  setFat(image, vol, 1, 0xFFFFFFFF);
+
+  uint32_t size = songKB * 1024;
+  uint32_t n = (size + clusterBytes - 1) / clusterBytes;
+  std::vector<uint32_t> bitmap, contig, frag, filler;
+  for (uint32_t i = 0; i < bitmapClusters; i++) {
+    bitmap.push_back(2 + i);
+  }
+  layoutSongs(vol.rootCluster + 1, n, contig, frag, filler);
+
+  // The system clusters are chained like any other
+  fillClusters(image, vol, bitmap, 0, 0, true);
+  fillClusters(image, vol, std::vector<uint32_t>(1, upcase), 0, 0, true);
+  fillClusters(image, vol, std::vector<uint32_t>(1, vol.rootCluster), 0, 0, true);
+  fillClusters(image, vol, contig, size, 1, false);
+  fillClusters(image, vol, frag, size, 1, true);
+  fillClusters(image, vol, filler, filler.size() * clusterBytes, 2, true);
+
+  // Everything up to the last filler cluster is in use
+  markUsed(image, vol, 2, filler.back());
+
+  // Up-case table of the ASCII range
+  uint8_t table[256];
+  for (int i = 0; i < 128; i++) {
+    put16(table + i * 2, toupper(i));
+  }
+  memcpy(image.sector(vol.clusterSector(upcase)), table, sizeof(table));
+
+  uint8_t *root = image.sector(vol.clusterSector(vol.rootCluster));
+  root[0] = 0x83;  // empty volume label
+  root[32] = 0x81;
+  put32(root + 32 + 20, 2);
+  put32(root + 32 + 24, bitmapBytes);
+  root[64] = 0x82;
+  put32(root + 64 + 4, exfatSum32(0, table, sizeof(table), false));
+  put32(root + 64 + 20, upcase);
+  put32(root + 64 + 24, sizeof(table));
+
+  std::vector<uint32_t> rootDir(1, vol.rootCluster);
+  int index = addExfatEntry(image, vol, rootDir, 3, "CONTIG.MP3", contig[0], size, true);
+  index = addExfatEntry(image, vol, rootDir, index, "FRAG.MP3", frag[0], size, false);
+  buildRootIndex = addExfatEntry(image, vol, rootDir, index, "FILLER.BIN", filler[0],
+                                 filler.size() * clusterBytes, false);
+  buildNextCluster = filler.back() + 1;
+  return (uint64_t) total * SECTOR_SIZE;
+}
+
+struct Result {
+  uint32_t commands;
+  uint32_t sectors;
+  uint32_t fatReads;
+  double busUs;
+  uint64_t hash;
+};
+
+template<typename Reader>
+static Result measure(CardModel &card, Reader &reader, const FileInfo &file) {
+  card.reset();
+  reader.open(file);
+  Result r;
+  r.hash = 1469598103934665603ULL;
+  std::vector<uint8_t> buffer(readSize);
+  uint32_t n;
+  while ((n = reader.read(buffer.data(), readSize)) > 0) {
+    for (uint32_t i = 0; i < n; i++) {
+      r.hash = (r.hash ^ buffer[i]) * 1099511628211ULL;
+    }
+  }
+  r.commands = card.commands;
+  r.sectors = card.sectors;
+  r.fatReads = reader.fatReadCount();
+  r.busUs = card.busUs;
+  return r;
+}
+
+// Seek to random positions, reading after each. The same positions are
+// used for every reader.
+template<typename Reader>
+static Result measureSeeks(CardModel &card, Reader &reader, const FileInfo &file) {
+  card.reset();
+  reader.open(file);
+  Result r;
+  r.hash = 1469598103934665603ULL;
+  std::vector<uint8_t> buffer(readSize);
+  uint32_t x = 12345;
+  for (int i = 0; i < seeks; i++) {
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    reader.seek((x % file.size) & ~(SECTOR_SIZE - 1));
+    for (uint32_t done = 0; done < SEEK_READ_BYTES;) {
+      uint32_t n = reader.read(buffer.data(), readSize);
+      if (n == 0) {
+        break;
+      }
+      for (uint32_t j = 0; j < n; j++) {
+        r.hash = (r.hash ^ buffer[j]) * 1099511628211ULL;
+      }
+      done += n;
+    }
+  }
+  r.commands = card.commands;
+  r.sectors = card.sectors;
+  r.fatReads = reader.fatReadCount();
+  r.busUs = card.busUs;
+  return r;
+}
+
+// Adapts SdFatReader to measure()
+class PlainReader : public SdFatReader {
+public:
+  using SdFatReader::SdFatReader;
+
+  void open(const FileInfo &file) {
+    fatReads = 0;
+    SdFatReader::open(file, file.contiguous);
+  }
+
+  uint32_t fatReadCount() {
+    return fatReads;
+  }
+};
+
+static void printResult(const char *label, const Result &r, double audioSeconds) {
+  printf("  %-6s %9u %9u %9u %10.1f %12.2f\n", label, r.commands, r.sectors, r.fatReads,
+         r.busUs / 1000, r.busUs / 1000 / audioSeconds);
+}
+
+static void printSeeks(const char *label, const Result &r) {
+  printf("  %-6s %9u %9u %9u %10.1f %12.2f\n", label, r.commands, r.sectors, r.fatReads,
+         r.busUs / 1000, r.busUs / 1000 / seeks);
+}
+
+// Name of entry i of the built folder: mostly songs, every 10th a
+// picture and every 50th a hidden macOS resource file
+static std::string folderName(int i, bool *hidden) {
+  char name[80];
+  *hidden = (i % 50) == 49;
+  if (*hidden) {
+    snprintf(name, sizeof(name), "._Track %05d - A Long Song Title From The Album.mp3", i);
+  } else if ((i % 10) == 9) {
+    snprintf(name, sizeof(name), "Cover %05d.jpg", i);
+  } else {
+    snprintf(name, sizeof(name), "Track %05d - A Long Song Title From The Album.mp3", i);
+  }
+  return name;
+}
+
+// Add /MUSIC holding dirEntries empty files with long names. Its
+// clusters follow the songs. Returns its clusters.
+static std::vector<uint32_t> addFolder(Image &image, Volume &vol) {
+
+  bool isExfat = vol.fatType == FAT_EXTENTS_EXFAT;
+  uint32_t perCluster = vol.sectorsPerCluster * (SECTOR_SIZE / 32);
+  uint32_t entries = 3;  // dots and the end
+  for (int i = 0; i < dirEntries; i++) {
+    bool hidden;
+    size_t length = folderName(i, &hidden).size();
+    entries += isExfat ? 2 + (length + 14) / 15 : 1 + (length + 12) / 13;
+  }
+  std::vector<uint32_t> dir;
+  for (uint32_t i = 0; i < (entries + perCluster - 1) / perCluster; i++) {
+    dir.push_back(buildNextCluster + i);
+  }
+  fillClusters(image, vol, dir, 0, 0, true);
+  std::vector<uint32_t> rootDir(1, vol.rootCluster);
+  uint32_t index = 0;
+
+  if (isExfat) {
+    markUsed(image, vol, dir.front(), dir.back());
+    for (int i = 0; i < dirEntries; i++) {
+      bool hidden;
+      std::string name = folderName(i, &hidden);
+      index = addExfatEntry(image, vol, dir, index, name.c_str(), 0, 0, false,
+                            hidden ? 0x22 : 0x20);
+    }
+    addExfatEntry(image, vol, rootDir, buildRootIndex, "MUSIC", dir[0],
+                  dir.size() * vol.sectorsPerCluster * SECTOR_SIZE, false, 0x10);
+    return dir;
+  }
+
+  // FAT32 dot entries, then each name as LFN entries and a short entry
+  uint8_t *d = dirEntry(image, vol, dir, index++);
+  memcpy(d, ".          ", 11);
+  d[11] = 0x10;
+  put16(d + 20, dir[0] >> 16);
+  put16(d + 26, dir[0]);
+  d = dirEntry(image, vol, dir, index++);
+  memcpy(d, "..         ", 11);
+  d[11] = 0x10;
+
+  for (int i = 0; i < dirEntries; i++) {
+    bool hidden;
+    std::string name = folderName(i, &hidden);
+    char shortName[12];
+    snprintf(shortName, sizeof(shortName), "T%07d%s", i % 10000000, (name.back() == 'g') ? "JPG" : "MP3");
+    uint8_t sum = 0;
+    for (int c = 0; c < 11; c++) {
+      sum = ((sum & 1) << 7) + (sum >> 1) + (uint8_t) shortName[c];
+    }
+
+    static const uint8_t offsets[13] = { 1, 3, 5, 7, 9, 14, 16, 18, 20, 22, 24, 28, 30 };
+    int lfnCount = (name.size() + 12) / 13;
+    for (int order = lfnCount; order >= 1; order--) {
+      d = dirEntry(image, vol, dir, index++);
+      d[0] = order | ((order == lfnCount) ? 0x40 : 0);
+      d[11] = 0x0F;
+      d[13] = sum;
+      for (int c = 0; c < 13; c++) {
+        size_t at = (order - 1) * 13 + c;
+        put16(d + offsets[c], (at < name.size()) ? name[at] : (at == name.size()) ? 0x0000 : 0xFFFF);
+      }
+    }
+    d = dirEntry(image, vol, dir, index++);
+    memcpy(d, shortName, 11);
+    d[11] = hidden ? 0x22 : 0x20;
+  }
+
+  d = image.sector(vol.clusterSector(vol.rootCluster) + buildRootIndex / 16) + (buildRootIndex % 16) * 32;
+  memcpy(d, "MUSIC      ", 11);
+  d[11] = 0x10;
+  put16(d + 20, dir[0] >> 16);
+  put16(d + 26, dir[0]);
+  return dir;
+}
+
+// Lists a directory the way SdFatHalDir's openNextFile() loop does.
+// Entries are read through SdFat's one sector cache. For a FAT long
+// name getName() reopens the directory and seeks back to each LFN
+// entry, and each seek walks the cluster chain from the directory's
+// first cluster. exFAT keeps the cluster of the name entries so its
+// getName() doesn't walk. Hidden files and names starting with a
+// period are skipped and files need an .mp3 extension.
+class DirLoopModel {
+public:
+  DirLoopModel(CardModel *card, Volume *vol) {
+    _card = card;
+    _vol = vol;
+  }
+
+  uint32_t fatReads;
+  uint64_t fatWalks;  // clusters walked by seeks
+
+  void open(uint32_t firstCluster) {
+    first = firstCluster;
+    cluster = firstCluster;
+    clusterIndex = 0;
+    index = 0;
+    done = false;
+    fatReads = 0;
+    fatWalks = 0;
+    fatCacheSector = UINT32_MAX;
+    dirCacheSector = UINT32_MAX;
+  }
+
+  bool next(HAL_DIR_ENTRY *entry) {
+    static const char *const extensions[] = { "mp3", NULL };
+    while (!done) {
+      if (!openNext(entry)) {
+        done = true;
+        break;
+      }
+      if (!hidden && (entry->name[0] != '.') && (entry->isDirectory || halHasExtension(entry->name, extensions))) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+protected:
+  CardModel *_card;
+  Volume *_vol;
+  uint32_t first;
+  uint32_t cluster;       // of the next entry
+  uint32_t clusterIndex;  // within the directory
+  uint32_t index;         // of the next entry
+  bool done;
+  bool hidden;
+  uint32_t fatCacheSector;
+  uint32_t dirCacheSector;
+  uint8_t fatCache[SECTOR_SIZE];
+  uint8_t dirCache[SECTOR_SIZE];
+
+  uint32_t fatGet(uint32_t c) {
+    uint32_t s = _vol->fatStart + c / (SECTOR_SIZE / 4);
+    if (s != fatCacheSector) {
+      _card->readSector(s, fatCache);
+      fatCacheSector = s;
+      fatReads++;
+    }
+    return _vol->entry(fatCache, c);
+  }
+
+  const uint8_t *cacheDir(uint32_t c, uint32_t i) {
+    uint32_t perCluster = _vol->sectorsPerCluster * (SECTOR_SIZE / 32);
+    uint32_t s = _vol->clusterSector(c) + (i % perCluster) / 16;
+    if (s != dirCacheSector) {
+      _card->readSector(s, dirCache);
+      dirCacheSector = s;
+    }
+    return dirCache + (i % 16) * 32;
+  }
+
+  // The next entry in order
+  const uint8_t *readNext(uint32_t *entryCluster) {
+    uint32_t perCluster = _vol->sectorsPerCluster * (SECTOR_SIZE / 32);
+    if (index / perCluster != clusterIndex) {
+      cluster = fatGet(cluster);
+      clusterIndex++;
+      if ((cluster < 2) || (cluster >= _vol->clusterCount + 2)) {
+        return NULL;
+      }
+    }
+    *entryCluster = cluster;
+    return cacheDir(cluster, index++);
+  }
+
+  // FatFile::cacheDir() after reopening: seekSet() from the start
+  const uint8_t *seekDir(uint32_t i) {
+    uint32_t perCluster = _vol->sectorsPerCluster * (SECTOR_SIZE / 32);
+    uint32_t c = first;
+    for (uint32_t k = 0; k < i / perCluster; k++) {
+      c = fatGet(c);
+      fatWalks++;
+    }
+    return cacheDir(c, i);
+  }
+
+  static void putUtf8(std::string &out, uint16_t c) {
+    if (c < 0x80) {
+      out += (char) c;
+    } else if (c < 0x800) {
+      out += (char) (0xC0 | (c >> 6));
+      out += (char) (0x80 | (c & 0x3F));
+    } else {
+      out += (char) (0xE0 | (c >> 12));
+      out += (char) (0x80 | ((c >> 6) & 0x3F));
+      out += (char) (0x80 | (c & 0x3F));
+    }
+  }
+
+  bool openNext(HAL_DIR_ENTRY *entry) {
+    return (_vol->fatType == FAT_EXTENTS_EXFAT) ? openNextExfat(entry) : openNextFat(entry);
+  }
+
+  bool openNextFat(HAL_DIR_ENTRY *entry) {
+    static const uint8_t offsets[13] = { 1, 3, 5, 7, 9, 14, 16, 18, 20, 22, 24, 28, 30 };
+    int lfnOrd = 0;
+    uint8_t checksum = 0;
+    const uint8_t *d;
+    uint32_t c;
+    while ((d = readNext(&c)) != NULL) {
+      if (d[0] == 0) {
+        return false;
+      }
+      if ((d[0] == 0xE5) || (d[0] == '.')) {
+        lfnOrd = 0;
+        continue;
+      }
+      if ((d[11] & 0x3F) == 0x0F) {
+        if (d[0] & 0x40) {
+          lfnOrd = d[0] & 0x1F;
+          checksum = d[13];
+        }
+        continue;
+      }
+      if (d[11] & 0x08) {
+        lfnOrd = 0;
+        continue;
+      }
+
+      entry->isDirectory = (d[11] & 0x10) != 0;
+      entry->size = get32(d + 28);
+      hidden = (d[11] & 0x02) != 0;
+      uint8_t sum = 0;
+      for (int i = 0; i < 11; i++) {
+        sum = ((sum & 1) << 7) + (sum >> 1) + d[i];
+      }
+      std::string name;
+      if (lfnOrd && (sum == checksum)) {
+        // getName(): reopen and seek back to each LFN entry
+        uint32_t sfn = index - 1;
+        for (int order = 1; order <= lfnOrd; order++) {
+          const uint8_t *l = seekDir(sfn - order);
+          for (int i = 0; i < 13; i++) {
+            uint16_t u = get16(l + offsets[i]);
+            if (u == 0) {
+              break;
+            }
+            putUtf8(name, u);
+          }
+        }
+        // The current position is read again for the next entry
+        cacheDir(c, sfn);
+      } else {
+        for (int i = 0; (i < 8) && (d[i] != ' '); i++) {
+          name += d[i];
+        }
+        if (d[8] != ' ') {
+          name += '.';
+          for (int i = 8; (i < 11) && (d[i] != ' '); i++) {
+            name += d[i];
+          }
+        }
+      }
+      snprintf(entry->name, sizeof(entry->name), "%s", name.c_str());
+      return true;
+    }
+    return false;
+  }
+
+  bool openNextExfat(HAL_DIR_ENTRY *entry) {
+    const uint8_t *d;
+    uint32_t c;
+    while ((d = readNext(&c)) != NULL) {
+      if (d[0] == 0) {
+        return false;
+      }
+      if (d[0] != 0x85) {
+        continue;
+      }
+      int secondary = d[1];
+      uint16_t attributes = get16(d + 4);
+      uint32_t setIndex = index;
+      uint32_t setCluster = c;
+      uint8_t nameLength = 0;
+      for (int i = 0; i < secondary; i++) {
+        d = readNext(&c);
+        if (d == NULL) {
+          return false;
+        }
+        if (d[0] == 0xC0) {
+          nameLength = d[3];
+          entry->size = get32(d + 24);
+        }
+      }
+      entry->isDirectory = (attributes & 0x10) != 0;
+      hidden = (attributes & 0x02) != 0;
+
+      // getName() reads the name entries again from the set's position
+      std::string name;
+      for (int i = 1; (i < secondary) && (name.size() < nameLength); i++) {
+        uint32_t at = setIndex + i;
+        const uint8_t *n = cacheDir((at / (_vol->sectorsPerCluster * 16) == (setIndex - 1) / (_vol->sectorsPerCluster * 16)) ? setCluster : c, at);
+        for (int k = 0; (k < 15) && (name.size() < nameLength); k++) {
+          putUtf8(name, get16(n + 2 + k * 2));
+        }
+      }
+      snprintf(entry->name, sizeof(entry->name), "%s", name.c_str());
+      return true;
+    }
+    return false;
+  }
+};
+
+// Counts FatDirScanner's reads of the FAT
+struct FatReadCounter {
+  CardModel *card;
+  Volume *vol;
+  uint32_t fatReads;
+};
+
+static boolean countedReadSector(void *context, uint32_t sector, uint8_t *buffer) {
+  FatReadCounter *counter = (FatReadCounter *) context;
+  if (sector < counter->vol->dataStart) {
+    counter->fatReads++;
+  }
+  counter->card->readSector(sector, buffer);
+  return true;
+}
+
+struct DirResult {
+  uint32_t entries;
+  uint32_t sectors;
+  uint32_t fatReads;
+  uint64_t fatWalks;
+  double busUs;
+  double hostUs;
+  uint64_t hash;
+};
+
+template<typename Lister>
+static DirResult measureDir(CardModel &card, Lister &lister) {
+  DirResult r;
+  r.entries = 0;
+  r.hash = 1469598103934665603ULL;
+  card.reset();
+  timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  HAL_DIR_ENTRY entry;
+  while (lister.next(&entry)) {
+    r.entries++;
+    for (const char *p = entry.name; *p; p++) {
+      r.hash = (r.hash ^ (uint8_t) *p) * 1099511628211ULL;
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  r.hostUs = (end.tv_sec - start.tv_sec) * 1e6 + (end.tv_nsec - start.tv_nsec) / 1e3;
+  r.sectors = card.sectors;
+  r.busUs = card.busUs;
+  return r;
+}
+
+static void printDir(const char *label, const DirResult &r) {
+  printf("  %-12s %7u %8u %9u %10llu %9.1f %12.0f\n", label, r.entries, r.sectors, r.fatReads,
+         (unsigned long long) r.fatWalks, r.busUs / 1000, r.entries / (r.hostUs / 1e6));
+}
+
+// Compare listing the built folder with the openNextFile() loop and with
+// FatDirScanner. Returns whether they found the same names.
+static bool measureFolder(Image &image, Volume &vol, const std::vector<uint32_t> &dir) {
+
+  CardModel card(&image);
+  static const char *const extensions[] = { "mp3", NULL };
+
+  // Best of a few runs for the host times
+  DirResult loop, raw;
+  for (int run = 0; run < 3; run++) {
+    DirLoopModel model(&card, &vol);
+    model.open(dir[0]);
+    DirResult a = measureDir(card, model);
+    a.fatReads = model.fatReads;
+    a.fatWalks = model.fatWalks;
+
+    FatDirScanner scanner;
+    scanner.setVolume(vol.fatType, vol.fatStart, vol.dataStart, vol.sectorsPerCluster,
+                      vol.clusterCount);
+    FatReadCounter counter = { &card, &vol, 0 };
+    scanner.setReader(countedReadSector, &counter);
+    scanner.setExtensions(extensions);
+    scanner.begin(dir[0]);
+    DirResult b = measureDir(card, scanner);
+    b.fatReads = counter.fatReads;
+    b.fatWalks = 0;
+
+    if ((run == 0) || (a.hostUs < loop.hostUs)) {
+      loop = a;
+    }
+    if ((run == 0) || (b.hostUs < raw.hostUs)) {
+      raw = b;
+    }
+  }
+
+  printf("\n/MUSIC  %d entries in %zu clusters\n", dirEntries, dir.size());
+  printf("  lister         songs  sectors FAT reads  FAT walks    bus ms  host entries/s\n");
+  printDir("openNextFile", loop);
+  printDir("raw scan", raw);
+  if (loop.hash != raw.hash) {
+    printf("  NAMES DIFFER\n");
+    return false;
+  }
+  return true;
+}
+
+int main(int argc, char **argv) {
+  int opt;
+  while ((opt = getopt(argc, argv, "c:s:f:w:k:m:a:g:r:p:n:xed:")) != -1) {
+    switch (opt) {
+      case 'c': clusterKB = atoi(optarg); break;
+      case 's': songKB = atoi(optarg); break;
+      case 'f': fragRun = atoi(optarg); break;
+      case 'w': writePath = optarg; break;
+      case 'k': kbps = atoi(optarg); break;
+      case 'm': mhz = atof(optarg); break;
+      case 'a': accessUs = atof(optarg); break;
+      case 'g': gapUs = atof(optarg); break;
+      case 'r': readSize = atoi(optarg); break;
+      case 'p': prefetchSectors = atoi(optarg); break;
+      case 'n': seeks = atoi(optarg); break;
+      case 'x': sharedBus = true; break;
+      case 'e': exfat = true; break;
+      case 'd': dirEntries = atoi(optarg); break;
+      default:
+        fprintf(stderr, "usage: fatstream [-c kb] [-s kb] [-f n] [-w path] [-k kbps] [-m mhz] "
+                        "[-a us] [-g us] [-r n] [-p n] [-n seeks] [-x] [-e] [-d entries] [image]\n");
+        return 2;
+    }
+  }
+  if (clusterKB == 0) {
+    clusterKB = exfat ? 128 : 32;
+  }
+  if ((clusterKB < 1) || (clusterKB > (exfat ? 1024 : 64)) || (clusterKB & (clusterKB - 1)) || (songKB == 0) ||
+      (kbps <= 0) || (mhz <= 0) || (readSize == 0) || (prefetchSectors == 0) || (fragRun < 1) || (seeks < 0) ||
+      (dirEntries < 0) || (dirEntries > 100000)) {
+    fprintf(stderr, "fatstream: bad option value\n");
+    return 2;
+  }
+
+  Image image;
+  Volume vol;
+  std::vector<uint32_t> folder;
+  if ((optind < argc) && (dirEntries > 0)) {
+    fprintf(stderr, "fatstream: -d builds its own image\n");
+    return 2;
+  }
+  if (optind < argc) {
+    if (!image.open(argv[optind]) || !vol.parse(image)) {
+      fprintf(stderr, "fatstream: %s is not a FAT32 or exFAT image\n", argv[optind]);
+      return 1;
+    }
+  } else {
+    uint64_t size = exfat ? buildExfat(image, vol) : buildFat32(image, vol);
+    if (dirEntries > 0) {
+      folder = addFolder(image, vol);
+    }
+    if ((writePath != NULL) && !image.save(writePath, size)) {
+      fprintf(stderr, "fatstream: can't write %s\n", writePath);
+      return 1;
+    }
+  }
+
+  std::vector<FileInfo> files;
+  listFiles(image, vol, files);
+
+  printf("%s, %u KB clusters, %d kbps, %.0f MHz SPI, %s bus, %.0f us access, %u byte reads, "
+         "%u sector prefetch\n",
+         vol.name(), vol.sectorsPerCluster / 2, kbps, mhz, sharedBus ? "shared" : "dedicated", accessUs,
+         readSize, prefetchSectors);
+
+  if (dirEntries > 0) {
+    return measureFolder(image, vol, folder) ? 0 : 1;
+  }
+
+  CardModel card(&image);
+  int measured = 0;
+  bool same = true;
+  for (const FileInfo &file : files) {
+    if ((file.size < 64 * 1024) || (optind >= argc && file.path == "/FILLER.BIN")) {
+      continue;
+    }
+    PlainReader before(&card, &vol);
+    RawReader after(&card, &vol);
+    Result a = measure(card, before, file);
+    Result b = measure(card, after, file);
+    double audioSeconds = (double) file.size / (kbps * 1000 / 8);
+
+    uint32_t extents = countExtents(image, vol, file);
+    printf("\n%s  %u KB  %u extent%s, %s\n", file.path.c_str(), file.size / 1024, extents,
+           (extents == 1) ? "" : "s", after.open(file) ? "read raw" : "too many for raw reads");
+    printf("  reader  commands   sectors FAT reads    bus ms  ms/s audio\n");
+    printResult("SdFat", a, audioSeconds);
+    printResult("raw", b, audioSeconds);
+    same &= (a.hash == b.hash);
+
+    if (seeks > 0) {
+      Result c = measureSeeks(card, before, file);
+      Result d = measureSeeks(card, after, file);
+      printf("  %d seeks commands   sectors FAT reads    bus ms     ms/seek\n", seeks);
+      printSeeks("SdFat", c);
+      printSeeks("raw", d);
+      same &= (c.hash == d.hash);
+    }
+    if (!same) {
+      printf("  DATA DIFFERS\n");
+    }
+    measured++;
+  }
+
+  if (measured == 0) {
+    printf("no files of 64 KB or more\n");
+  }
+  return same ? 0 : 1;
+}
@@ -0,0 +1,231 @@
+/*
+   RETR throughput of the FTP server on a host
+
+   Runs FTPServer.h on Linux, with the Arduino, WiFi and SdFat stand-ins
+   in tools/arduino, against <scratch-dir>/card and downloads a file of
+   megabytes MB (default 16) over loopback with a minimal passive mode
+   client reading as fast as it can. Then the first 2 MB are read at 4,
+   1 and 0.25 MB/s.
+
+   The server runs in its own thread and every handleFTP() call is
+   timed. Accepted sockets get the ESP32's default lwIP send buffer
+   (5744 bytes) so the server's sends find it full as they do on the
+   player. For each download it reports the rate, the handleFTP() calls
+   made and their average and longest time. A call that waits for the
+   reader instead of returning when the send buffer is full shows up as
+   a long longest call at the slow rates.
+
+   The host is much faster than the ESP32 and its SD card, so the rates
+   show the server's overhead, not what the player reaches over WiFi.
+
+   Build:
+     g++ -O2 -std=c++11 -Wall -Wextra -pthread -I arduino -o ftpbench ftpbench.cpp
+
+   Usage:
+     ftpbench <scratch-dir> [megabytes]
+
+   <scratch-dir>/card is deleted and made again. Exits with 1 if a
+   download differs from the file or a call takes over MAX_CALL_MS.
+
+   Last Update: 10/18/2026
+*/
+
+#include <atomic>
+#include <signal.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define FTP_CTRL_PORT 0
+#include "../FTPServer.h"
+
+#define USER "craig"
+#define PASSWORD "music"
+#define MAX_CALL_MS 60
+#define SEND_BUFFER 5744
+#define READ_SIZE 16384
+
+static FTPServer ftp;
+static SdFs card;
+static std::atomic<bool> running(true);
+static std::atomic<uint32_t> calls(0);
+static std::atomic<uint64_t> totalCallUs(0);
+static std::atomic<uint32_t> maxCallUs(0);
+
+static void serve() {
+  while (running) {
+    uint64_t start = hostNowUs();
+    ftp.handleFTP();
+    uint32_t us = hostNowUs() - start;
+    calls++;
+    totalCallUs += us;
+    if (us > maxCallUs) {
+      maxCallUs = us;
+    }
+    usleep(50);
+  }
+}
+
+static int connectTo(uint16_t port) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (connect(fd, (sockaddr *) &addr, sizeof(addr)) < 0) {
+    perror("connect");
+    exit(2);
+  }
+  return fd;
+}
+
+// Read a reply, skipping "nnn-" continuation lines. Returns the code.
+static int reply(int fd, std::string *text = NULL) {
+  std::string line;
+  for (;;) {
+    char c;
+    if (recv(fd, &c, 1, 0) != 1) {
+      return -1;
+    }
+    if (c == '\r') {
+      continue;
+    }
+    if (c != '\n') {
+      line += c;
+      continue;
+    }
+    if (line.size() >= 4 && line[3] == ' ') {
+      if (text != NULL) {
+        *text = line;
+      }
+      return atoi(line.c_str());
+    }
+    line.clear();
+  }
+}
+
+static int command(int fd, const std::string &cmd, std::string *text = NULL) {
+  std::string line = cmd + "\r\n";
+  send(fd, line.data(), line.size(), 0);
+  return reply(fd, text);
+}
+
+// Download name at rate bytes/s (0 for as fast as possible) and check
+// it against data
+static bool retrieve(int ctrl, const char *name, const std::string &data, double rate) {
+  std::string text;
+  if (command(ctrl, "PASV", &text) != 227) {
+    fprintf(stderr, "PASV failed: %s\n", text.c_str());
+    return false;
+  }
+  int h[6];
+  sscanf(text.c_str() + text.find('(') + 1, "%d,%d,%d,%d,%d,%d", &h[0], &h[1], &h[2], &h[3], &h[4], &h[5]);
+  int fd = connectTo(h[4] * 256 + h[5]);
+
+  calls = 0;
+  totalCallUs = 0;
+  maxCallUs = 0;
+  if (command(ctrl, std::string("RETR ") + name) != 150) {
+    fprintf(stderr, "RETR failed\n");
+    close(fd);
+    return false;
+  }
+
+  std::string got;
+  std::vector<char> buf(READ_SIZE);
+  uint64_t start = hostNowUs();
+  int n;
+  while ((n = recv(fd, buf.data(), buf.size(), 0)) > 0) {
+    got.append(buf.data(), n);
+    if (rate > 0) {
+      double due = start + got.size() * 1e6 / rate;
+      double now = hostNowUs();
+      if (due > now) {
+        usleep((useconds_t)(due - now));
+      }
+    }
+  }
+  double seconds = (hostNowUs() - start) / 1e6;
+  close(fd);
+  int code = reply(ctrl);
+
+  bool ok = (code == 226) && (got == data);
+  bool blocked = maxCallUs > MAX_CALL_MS * 1000;
+  char label[32];
+  if (rate > 0) {
+    snprintf(label, sizeof(label), "at %.2f MB/s", rate / 1e6);
+  } else {
+    snprintf(label, sizeof(label), "as fast as read");
+  }
+  printf("%-16s %7.1f MB/s  %7u calls  avg %6.3f ms  max %7.3f ms%s%s\n",
+         label, got.size() / seconds / 1e6, (unsigned) calls,
+         calls ? totalCallUs / 1000.0 / calls : 0, maxCallUs / 1000.0,
+         ok ? "" : "  DATA DIFFERS", blocked ? "  BLOCKED" : "");
+  return ok && !blocked;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: ftpbench <scratch-dir> [megabytes]\n");
+    return 2;
+  }
+  int megabytes = (argc > 2) ? std::max(1, atoi(argv[2])) : 16;
+  signal(SIGPIPE, SIG_IGN);
+  setvbuf(stdout, NULL, _IOLBF, 0);
+
+  std::string scratch = argv[1];
+  hostCardRoot = scratch + "/card";
+  if (system(("rm -rf '" + hostCardRoot + "'").c_str()) != 0) {
+    return 2;
+  }
+  ::mkdir(scratch.c_str(), 0755);
+  if (::mkdir(hostCardRoot.c_str(), 0755) != 0) {
+    perror(hostCardRoot.c_str());
+    return 2;
+  }
+
+  std::string data((size_t) megabytes << 20, 0);
+  halRandomSeed(1);
+  for (size_t i = 0; i < data.size(); i++) {
+    data[i] = (char) halRandom(256);
+  }
+  FILE *f = fopen((hostCardRoot + "/bench.bin").c_str(), "wb");
+  fwrite(data.data(), 1, data.size(), f);
+  fclose(f);
+
+  hostSendBuffer = SEND_BUFFER;
+  ftp.begin(USER, PASSWORD, &card);
+  std::thread server(serve);
+
+  // Let the server reach its idle state, which is when it greets clients
+  usleep(100000);
+  int ctrl = connectTo(controlServer.port());
+  bool ok = (reply(ctrl) == 220) &&
+            (command(ctrl, "USER " USER) == 331) &&
+            (command(ctrl, "PASS " PASSWORD) == 230) &&
+            (command(ctrl, "TYPE I") == 200);
+  if (!ok) {
+    fprintf(stderr, "login failed\n");
+    exit(2);
+  }
+
+  printf("RETR of %d MB, FTP_RETR_BUDGET_MS %d, send buffer %d bytes\n",
+         megabytes, FTP_RETR_BUDGET_MS, SEND_BUFFER);
+  ok = retrieve(ctrl, "bench.bin", data, 0) && ok;
+
+  // The slow readers only read the first 2 MB
+  std::string part = data.substr(0, 2 << 20);
+  f = fopen((hostCardRoot + "/part.bin").c_str(), "wb");
+  fwrite(part.data(), 1, part.size(), f);
+  fclose(f);
+  ok = retrieve(ctrl, "part.bin", part, 4e6) && ok;
+  ok = retrieve(ctrl, "part.bin", part, 1e6) && ok;
+  ok = retrieve(ctrl, "part.bin", part, 0.25e6) && ok;
+
+  command(ctrl, "QUIT");
+  close(ctrl);
+  running = false;
+  server.join();
+  return ok ? 0 : 1;
+}
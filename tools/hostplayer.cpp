@@ -0,0 +1,2082 @@
+/*
+   Host build of the CYD Music Player
+
+   Runs the player's FSM (PlayerFsm.h), ListBox and MusicLibrary on
+   Linux against a directory laid out like the SD card
+   (/artist/album/song.mp3) using HalLinux.h. The FSM is built with the
+   sketch's default ENABLE_* settings.
+
+   Build:
+     g++ -O2 -std=c++11 -o hostplayer hostplayer.cpp
+
+   Usage:
+     hostplayer <music-dir> bench [picks]
+       Times the artist scan, a walk of every album and song directory,
+       shuffle picks (default 1000) and listbox scrolling with repaints
+       into the framebuffer.
+
+     hostplayer <music-dir> cachebench [steps]
+       Replays a synthetic browsing trace of steps listings (default
+       10000) with no directory cache and with DirCache budgets of 4, 16
+       and 64 KB, and reports the hit rate, listing times and directory
+       entries read. Most artists browsed are from a few favorites,
+       albums are often reselected after Back, shuffle play lists random
+       directories and every 200 steps a remote upload invalidates an
+       album.
+
+     hostplayer <music-dir> namebench [names]
+       Builds a sorted list of names (default 50000) shaped like a large
+       library's artists and albums, stores it front coded and in a
+       vector of strings, checks every name reads back the same and
+       reports the bytes each takes and the time to read random names
+       and windows of LISTBOX_LINES consecutive names. Exits with 1 if
+       a name differs. <music-dir> isn't read.
+
+     hostplayer <music-dir> browsebench
+       Needs a card prepared by libprep. Times opening the genre, decade
+       and recently added indexes (see BrowseIndex.h) and every group in
+       them, checks each entry's song is in the library index under the
+       group it's listed in, and times finding the songs of the largest
+       genre by walking the folders and looking every song up in the
+       library index as the player would without them. Exits with 1 if
+       an entry is wrong.
+
+     hostplayer <music-dir> albumbench [rounds]
+       Needs a card prepared by libprep. Plays every song of the album
+       index (see AlbumShuffle.h) rounds times over (default 3) with
+       album shuffle, prefetching during each album's last song, and
+       checks every album and song plays once a round, albums play in
+       track order and no album plays twice in a row. Times shuffling,
+       moving between songs with and without the prefetch, and as many
+       shuffle picks as there are songs for the songs they cover. Exits
+       with 1 if the coverage is wrong.
+
+     hostplayer <music-dir> smartbench [tracks]
+       Checks the weight tree of smart shuffle (see SmartShuffle.h)
+       against a plain array of weights through random picks and
+       changes, checks a million picks land in proportion to the
+       weights, and times building it, picking and counting plays and
+       skips over tracks songs (default 100000). Then plays 1000 songs
+       of which a tenth are always skipped, and reports how often those
+       are picked and how often a song comes back within
+       SMART_RECENT_PLAYS plays, against picking uniformly. The play
+       statistics go in <music-dir>/smartbench.bin and .log, which are
+       removed after. Exits with 1 if a check fails.
+
+     hostplayer <music-dir> statsbench [tracks]
+       Counts random plays and skips of tracks songs (default 20000)
+       into play statistics (see PlayStats.h) and checks every record
+       against a plain array, with compactions cut short, reopens
+       without compacting and logs ending in half an event along the
+       way. Then counts 4096 events on a model of the card's FAT file
+       system and reports the sectors written per event, for data,
+       directory entries and FAT, and the write amplification: the
+       bytes written to the card for the 10 bytes of record an event
+       changes. It compares writing each event into its record with
+       logging them and compacting every 16, PLAY_LOG_COMPACT and
+       PLAY_LOG_MAX events, and times the compactions. The files go in
+       <music-dir>/statsbench.bin and .log, which are removed after.
+       Exits with 1 if a record differs.
+
+     hostplayer <music-dir> historytest [steps]
+       Moves back and forward through the shuffle history (see
+       ShuffleHistory.h) and adds songs at random for steps moves
+       (default 100000), checking it against a plain list of the songs
+       played and that it reads back the same from the file after each
+       of the first thousand. Checks histories that are cut short, for
+       another index or with a bad cursor or track number are dropped,
+       and times a move with its write. The history goes in
+       <music-dir>/historytest.bin, which is removed after. Exits with 1
+       if a check fails.
+
+     hostplayer <music-dir> playlisttest
+       Reads M3U, M3U8 and PLS playlists with byte order marks, CRLF and
+       CR line ends, quoted #EXTINF attributes, Latin-1 text, PLS keys
+       out of order and lines too long (see Playlist.h), and resolves
+       relative, Windows, file:// and stream entries, checking each
+       against what it should give. The playlist goes in
+       <music-dir>/playlisttest.tmp, which is removed after. Exits with
+       1 if a check fails.
+
+     hostplayer <music-dir> playlistbench [entries]
+       Needs a card prepared by libprep. Writes playlists of entries
+       songs (default 2000) to the card's root: runs of songs in index
+       order as an .m3u, random songs as an .m3u8 and as a .pls with
+       Windows paths. Opens each with no cache, from its cache, after
+       adding an entry, with its cache cut short and after swapping two
+       songs and removing its cache as an upload does, and reports the
+       time, reads and sectors read on a model of the card against
+       looking every entry up with LibraryIndex::find(). Checks every
+       open gives the songs written. Exits with 1 if one doesn't.
+
+     hostplayer <music-dir> schedtest
+       Runs tasks that log their order and advance a virtual clock
+       through the scheduler (see Scheduler.h) and checks tasks run by
+       priority with the audio task before every other, periodic tasks
+       run once a period without catch up bursts, a task yields when its
+       budget is used up while audio runs from its preemption points
+       without counting against the budget, and overruns and deadline
+       misses are counted, but not while a task is disabled. <music-dir>
+       isn't read. Exits with 1 if a check fails.
+
+     hostplayer <music-dir> loopstatstest
+       Checks the loop latency histogram's bucket edges (see LoopStats.h)
+       and that its p50/p99/max are in the same bucket as, and no less
+       than, the exact percentiles of random samples, that passes are
+       kept per state with the worst one tracked, and that reset clears
+       them. <music-dir> isn't read. Exits with 1 if a check fails.
+
+     hostplayer <music-dir> browse
+       Runs the player from boot on a virtual clock. Reads one command
+       per line from stdin, runs the player for a second after it and
+       prints the text it drew and the state it is in:
+         -  +   the - and + buttons
+         <  >   the - and + buttons double clicked
+         s      the Select button
+         b  B   the Back button, clicked and double clicked
+         w      wait a minute
+         p      save the screen to screen.ppm
+         q      quit
+       Songs "play" for as long as they last, as silence written to
+       hostplayer.wav through the WAV audio sink. There is no MP3
+       decoder in the host build. As on the player, the session is
+       recorded to <music-dir>/session.log, written out every second
+       of virtual time, and the play statistics, shuffle history and
+       playlist caches are written to <music-dir>.
+
+     hostplayer <music-dir> replay <session.log> [-v]
+       Replays a session recorded by the player (see SessionLog.h)
+       through the player's own state handlers on a virtual clock, as
+       the player's 'y' debug command does. <music-dir> must hold a copy
+       of the card as it was when the session was recorded, and the log
+       must have the states and Operations menu of this build. The player
+       boots to the welcome screen and the recorded button events,
+       display timeouts and song ends are handed to the FSM from
+       INITIAL on. Its state changes, listbox screens, songs played and
+       PCM bytes are checked against the recording. A handler that moves
+       to another state than recorded is reported with both states'
+       names. The replay stops at the end of the log or when a recorded
+       output is 10 s overdue. Songs play as silence into hostplayer.wav.
+       -v prints the player's log output, each state and each song.
+       Exits with 1 if anything differs or the log was cut short.
+
+   Last Update: 10/18/2026
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <deque>
+#include <set>
+#include <limits.h>
+
+// The player's settings, as CYD_MusicPlayer2.ino has them by default
+#define ENABLE_FTP_REMOTE 1
+#define ENABLE_WEBDAV_REMOTE 1
+#define ENABLE_UDP_REMOTE 0
+#define ENABLE_TRACE 0
+#define ENABLE_SESSION_LOG 1
+#define ENABLE_SD_TUNING 1
+#define ENABLE_DIR_CACHE 1
+#define ENABLE_LIBRARY_INDEX 1
+#define ENABLE_BROWSE_INDEX 1
+#define ENABLE_PLAYLISTS 1
+#define ENABLE_ALBUM_SHUFFLE 1
+#define ENABLE_PLAY_STATS 1
+#define ENABLE_SMART_SHUFFLE 1
+#define ENABLE_SHUFFLE_HISTORY 1
+
+#include "../HalLinux.h"
+#include "../LoopStats.h"
+#include "../PlayerFsm.h"
+#include "../Scheduler.h"
+
+#define SCREEN_WIDTH 240
+#define SCREEN_HEIGHT 320
+
+static LinuxTime halTime;
+static PosixFileSystem *halFs;
+static FramebufferDisplay halDisplay(SCREEN_WIDTH, SCREEN_HEIGHT);
+static WavAudioOut halAudio("hostplayer.wav");
+
+// The HAL the FSM runs on, with its own virtual clock
+static VirtualTime fsmClock;
+static QueueInput hostInput;
+static SilentSongPlayer *hostPlayer;
+static LinuxCard hostCard;
+static LinuxRemote hostRemote;
+static LinuxSystem hostSystem;
+static HAL hostHal;
+
+static double elapsedMs(uint32_t startUs) {
+  return (halTime.micros() - startUs) / 1000.0;
+}
+
+static int bench(MusicLibrary &library, int picks) {
+
+  uint32_t start = halTime.micros();
+  if (!library.populateArtists()) {
+    fprintf(stderr, "can't read the music directory\n");
+    return 1;
+  }
+  printf("artist scan:   %8.2f ms  %zu artists\n", elapsedMs(start), artists.size());
+
+  // Walk every album and song directory
+  start = halTime.micros();
+  size_t albumCount = 0, songCount = 0;
+  std::vector<std::string> allArtists = artists.names();
+  for (const std::string &artist : allArtists) {
+    std::string artistPath = "/" + artist;
+    library.populateAlbums(artistPath.c_str());
+    std::vector<std::string> artistAlbums = albums.names();
+    albumCount += artistAlbums.size();
+    for (const std::string &album : artistAlbums) {
+      std::string albumPath = artistPath + "/" + album;
+      library.populateSongs(albumPath.c_str());
+      songCount += songs.size();
+    }
+  }
+  printf("full walk:     %8.2f ms  %zu albums %zu songs\n", elapsedMs(start), albumCount, songCount);
+
+  // Shuffle picks
+  char songPath[120];
+  int failures = 0;
+  start = halTime.micros();
+  for (int i = 0; i < picks; i++) {
+    if (!library.pickShuffledSong(songPath, sizeof(songPath))) {
+      failures++;
+    }
+  }
+  double ms = elapsedMs(start);
+  printf("shuffle picks: %8.2f ms  %d picks, %.3f ms each, %d failed\n",
+         ms, picks, picks ? ms / picks : 0.0, failures);
+
+  // Scroll the artist list with repaints
+  listBox->clear();
+  listBox->setTitle("- Artists -");
+  listBox->setDataSource(ARTIST_DS);
+  int scrolls = 10000;
+  start = halTime.micros();
+  for (int i = 0; i < scrolls; i++) {
+    listBox->selectionDown(true);
+  }
+  ms = elapsedMs(start);
+  printf("scroll+paint:  %8.2f ms  %d repaints, %.1f us each\n", ms, scrolls, 1000.0 * ms / scrolls);
+  return 0;
+}
+
+// How often the session recorded is written out, as on the device
+#define SESSION_FLUSH_MS 1000
+
+// Run the player's loop for ms of virtual time, 1 ms a pass, and write
+// the session recorded out as the player's session task does
+static void runFsm(uint32_t ms) {
+  for (uint32_t i = 0; i < ms; i++) {
+    fsmClock.advanceMicros(1000);
+    hostPlayer->loop();
+    fsmRun();
+    if ((fsmClock.millis() % SESSION_FLUSH_MS) == 0) {
+      sessionRecorder.flush();
+    }
+  }
+}
+
+// Run the FSM for a second after each command on stdin and print the
+// text it drew
+static int browse() {
+
+  static const struct {
+    char key;
+    enum BUTTON_STATE button;
+  } keys[] = {
+    { '-', BS_MINUS }, { '<', BS_MINUSP }, { '+', BS_PLUS }, { '>', BS_PLUSP },
+    { 's', BS_SELECT }, { 'b', BS_BACK }, { 'B', BS_BACKP }
+  };
+
+  // Boot to the welcome screen
+  runFsm(1000);
+
+  char line[32];
+  for (;;) {
+    for (const std::string &text : halDisplay.text) {
+      printf("%s\n", text.c_str());
+    }
+    printf("[%s]\n", stateName(state));
+    halDisplay.clearText();
+
+    if (fgets(line, sizeof(line), stdin) == NULL) {
+      break;
+    }
+    switch (line[0]) {
+      case 'w':
+        runFsm(60000);
+        break;
+
+      case 'p':
+        printf("%s\n", halDisplay.savePPM("screen.ppm") ? "saved screen.ppm" : "save failed");
+        break;
+
+      case 'q':
+        endRecording();
+        halAudio.end();
+        return 0;
+
+      default:
+        for (const auto &k : keys) {
+          if (k.key == line[0]) {
+            hostInput.push(k.button);
+          }
+        }
+        runFsm(1000);
+        break;
+    }
+  }
+  endRecording();
+  halAudio.end();
+  return 0;
+}
+
+// Mismatches printed by a replay, after which they are only counted
+#define REPLAY_PRINT_MISMATCHES 20
+
+static int replayMismatches;
+
+static void replayMismatch(const char *description) {
+  if (replayMismatches++ < REPLAY_PRINT_MISMATCHES) {
+    printf("%9.3f s  %s\n", fsmClock.millis() / 1000.0, description);
+  }
+}
+
+// Replay a session log through the FSM from the Operations menu, as
+// the player's 'y' debug command does, until it ends or stalls
+static int replay(const char *logPath, boolean verbose) {
+
+  // The log is outside of the music directory
+  char fullPath[PATH_MAX];
+  if (realpath(logPath, fullPath) == NULL) {
+    fprintf(stderr, "can't find %s\n", logPath);
+    return 2;
+  }
+  PosixFileSystem hostFs("");
+  SessionReader reader;
+  if (!reader.open(hostFs.open(fullPath, HOM_READ))) {
+    fprintf(stderr, "%s is not a session log\n", logPath);
+    return 2;
+  }
+
+  // States and menu entries are logged by number, so the player that
+  // recorded the log must have had the same ones
+  boolean same = (reader.stateNames.size() == STATE_COUNT) && (reader.operationNames == operations);
+  for (int i = 0; same && i < STATE_COUNT; i++) {
+    same = reader.stateNames[i] == stateName(i);
+  }
+  if (!same) {
+    fprintf(stderr, "%s was recorded with other states or operations than this build\n", logPath);
+    return 2;
+  }
+  reader.close();
+
+  // Boot to the welcome screen, then replay from INITIAL
+  hostSystem.log = verbose ? stdout : NULL;
+  for (int ms = 0; (state != BOOT_WELCOME_WAIT) && (ms < 60000); ms++) {
+    runFsm(1);
+  }
+  if (state != BOOT_WELCOME_WAIT) {
+    fprintf(stderr, "the player didn't boot, stuck in %s\n", stateName(state));
+    return 2;
+  }
+  sessionReplay.setMismatchCallback(replayMismatch);
+  replayMismatches = 0;
+  if (!startReplay(&hostFs, fullPath)) {
+    return 2;
+  }
+  uint32_t startMs = fsmClock.millis();
+
+  // The player's loop with its session and statistics tasks, which run
+  // once a second
+  int shownState = -1;
+  uint32_t shownSong = hostPlayer->getSongNumber();
+  uint32_t songs = 0;
+  for (uint32_t ms = 1; sessionReplay.isActive(); ms++) {
+    fsmClock.advanceMicros(1000);
+    hostPlayer->loop();
+    fsmRun();
+
+    if (hostPlayer->getSongNumber() != shownSong) {
+      shownSong = hostPlayer->getSongNumber();
+      songs++;
+      if (verbose) {
+        printf("%9.3f s  playing %s\n", fsmClock.millis() / 1000.0, songPath);
+      }
+    }
+    if (verbose && (state != shownState)) {
+      shownState = state;
+      printf("%9.3f s  %s\n", fsmClock.millis() / 1000.0, stateName(state));
+    }
+
+    if ((ms % 1000) == 0) {
+      sessionReplay.checkStall(fsmClock.millis());
+      while (playStats.isCompactDue()) {
+        if (!playStats.compact(1)) {
+          playStats.close();
+          break;
+        }
+      }
+    }
+  }
+  halAudio.end();
+
+  if (replayMismatches > REPLAY_PRINT_MISMATCHES) {
+    printf("%d more mismatches\n", replayMismatches - REPLAY_PRINT_MISMATCHES);
+  }
+  if (sessionReplay.isTruncated()) {
+    printf("the log was cut short, the rest wasn't checked\n");
+  }
+  printf("replay %s after %.3f s in %s: %u songs, %lu outputs matched, %lu mismatched\n",
+         sessionReplay.isStalled() ? "stalled" : "done",
+         (fsmClock.millis() - startMs) / 1000.0, stateName(state), songs,
+         (unsigned long) sessionReplay.getMatched(), (unsigned long) sessionReplay.getMismatched());
+  return ((sessionReplay.getMismatched() == 0) && !sessionReplay.isTruncated()) ? 0 : 1;
+}
+
+// Directory entries read by the library, counted through its idle
+// callback
+static uint32_t entriesRead;
+
+static void countEntry(void) {
+  entriesRead++;
+}
+
+// A listing the player makes while browsing, or a remote change
+enum TRACE_KIND { TK_ARTISTS, TK_ALBUMS, TK_SONGS, TK_CHANGE };
+
+typedef struct {
+  enum TRACE_KIND kind;
+  std::string path;
+} TRACE_STEP;
+
+// Synthetic browsing: most artists picked are from a few favorites.
+// From an album's songs the user goes Back and reselects the same
+// album, picks another album of the artist, goes back to the artists
+// or plays a shuffled song. Every changeEvery steps a remote client
+// adds a song to an album and the artists are read again.
+static std::vector<TRACE_STEP> makeTrace(MusicLibrary &library, int steps, int changeEvery) {
+
+  std::vector<TRACE_STEP> trace;
+  std::vector<std::string> allArtists = artists.names();
+  int favorites = max((int) allArtists.size() / 10, 1);
+  std::string artistPath, albumPath;
+  std::vector<std::string> artistAlbums;
+  int level = 0;
+
+  while ((int) trace.size() < steps) {
+    if ((changeEvery > 0) && (trace.size() % changeEvery == (size_t)(changeEvery - 1)) &&
+        !albumPath.empty()) {
+      trace.push_back({ TK_CHANGE, albumPath + "/upload.mp3" });
+      trace.push_back({ TK_ARTISTS, "/" });
+      continue;
+    }
+
+    if (level == 0) {
+      int i = (halRandom(10) < 7) ? halRandom(favorites) : halRandom(allArtists.size());
+      artistPath = "/" + allArtists[i];
+      trace.push_back({ TK_ALBUMS, artistPath });
+      library.populateAlbums(artistPath.c_str());
+      artistAlbums = albums.names();
+      level = 1;
+    } else if (level == 1) {
+      if (artistAlbums.empty()) {
+        level = 0;
+        continue;
+      }
+      albumPath = artistPath + "/" + artistAlbums[halRandom(artistAlbums.size())];
+      trace.push_back({ TK_SONGS, albumPath });
+      level = 2;
+    } else {
+      int r = halRandom(100);
+      if (r < 40) {
+        trace.push_back({ TK_SONGS, albumPath });  // Back, Select
+      } else if (r < 65) {
+        level = 1;
+      } else if (r < 85) {
+        level = 0;
+      } else {
+        // Shuffle play lists a random artist's albums and songs
+        std::string path = "/" + allArtists[halRandom(allArtists.size())];
+        trace.push_back({ TK_ALBUMS, path });
+        library.populateAlbums(path.c_str());
+        if (!albums.empty()) {
+          trace.push_back({ TK_SONGS, path + "/" + albums.at(halRandom(albums.size())) });
+        }
+      }
+    }
+  }
+  return trace;
+}
+
+// Hit rate, listing latency and directory entries read while replaying
+// synthetic browsing traces with no cache and caches of a few sizes
+static int cacheBench(int steps) {
+
+  MusicLibrary library(halFs, countEntry);
+  if (!library.populateArtists()) {
+    fprintf(stderr, "can't read the music directory\n");
+    return 1;
+  }
+  std::vector<std::string> allArtists = artists.names();
+  halRandomSeed(1);  // the same trace every run
+  std::vector<TRACE_STEP> trace = makeTrace(library, steps, 200);
+
+  printf("%d listings over %zu artists\n", steps, allArtists.size());
+  printf("  cache KB  hit rate  avg us  p99 us  max us  entries read  evictions\n");
+
+  static const int budgetsKB[] = { 0, 4, 16, 64 };
+  for (int budgetKB : budgetsKB) {
+    DirCache cache(budgetKB * 1024);
+    library.setCache((budgetKB > 0) ? &cache : NULL);
+    library.populateArtists();
+    cache.resetStats();
+    entriesRead = 0;
+
+    std::vector<uint32_t> times;
+    for (const TRACE_STEP &step : trace) {
+      uint32_t start = halTime.micros();
+      switch (step.kind) {
+        case TK_ARTISTS: library.populateArtists(); break;
+        case TK_ALBUMS: library.populateAlbums(step.path.c_str()); break;
+        case TK_SONGS: library.populateSongs(step.path.c_str()); break;
+        case TK_CHANGE: cache.invalidate(step.path.c_str()); continue;
+      }
+      times.push_back(halTime.micros() - start);
+    }
+
+    uint64_t total = 0;
+    for (uint32_t t : times) {
+      total += t;
+    }
+    std::sort(times.begin(), times.end());
+    uint32_t lookups = cache.getHits() + cache.getMisses();
+    printf("  %8d  %7.1f%%  %6.1f  %6u  %6u  %12u  %9u\n", budgetKB,
+           lookups ? 100.0 * cache.getHits() / lookups : 0.0,
+           times.empty() ? 0.0 : (double) total / times.size(),
+           times.empty() ? 0 : times[times.size() * 99 / 100],
+           times.empty() ? 0 : times.back(), entriesRead, cache.getEvictions());
+  }
+  library.setCache(NULL);
+  return 0;
+}
+
+// Synthetic names sharing the prefixes sorted library names do
+static std::vector<std::string> makeNames(int count) {
+
+  static const char *const prefixes[] = { "", "", "The ", "Various Artists - ", "DJ ", "Best of " };
+  static const char *const words[] = { "Blue", "Midnight", "River", "Electric", "Golden", "Silver",
+                                       "Orchestra", "Quartet", "Sessions", "Live", "Anthology",
+                                       "Collection", "Nights", "Summer", "Winter", "Echoes" };
+  const int nWords = sizeof(words) / sizeof(words[0]);
+
+  std::vector<std::string> names;
+  for (int i = 0; i < count; i++) {
+    char name[HAL_NAME_SIZE];
+    int n = snprintf(name, sizeof(name), "%s%s %s %d", prefixes[halRandom(6)],
+                     words[halRandom(nWords)], words[halRandom(nWords)], (int) halRandom(1000));
+    if (halRandom(4) == 0) {
+      snprintf(name + n, sizeof(name) - n, " (Disc %d)", (int) halRandom(3) + 1);
+    }
+    names.push_back(name);
+  }
+  std::sort(names.begin(), names.end());
+  return names;
+}
+
+// Memory and read time of a front coded list against a vector of
+// strings
+static int nameBench(int count) {
+
+  halRandomSeed(1);
+  std::vector<std::string> names = makeNames(count);
+  FrontCodedList list;
+  list.assign(names);
+
+  for (size_t i = 0; i < names.size(); i++) {
+    if (names[i] != list.get(i)) {
+      fprintf(stderr, "name %zu differs: %s %s\n", i, names[i].c_str(), list.get(i));
+      return 1;
+    }
+  }
+  for (size_t i = names.size(); i-- > 0;) {
+    if (names[i] != list.get(i)) {
+      fprintf(stderr, "name %zu differs reading back: %s %s\n", i, names[i].c_str(), list.get(i));
+      return 1;
+    }
+  }
+
+  // A string holds up to 15 characters inside it, longer ones on the
+  // heap
+  size_t vectorBytes = sizeof(names) + names.capacity() * sizeof(std::string);
+  size_t characters = 0;
+  for (const std::string &name : names) {
+    characters += name.size();
+    if (name.size() > 15) {
+      vectorBytes += name.capacity() + 1;
+    }
+  }
+  size_t listBytes = sizeof(list) + list.bytes();
+  printf("%zu names, %zu characters\n", names.size(), characters);
+  printf("  vector of strings: %8zu bytes\n", vectorBytes);
+  printf("  front coded:       %8zu bytes  %.1f%%\n", listBytes, 100.0 * listBytes / vectorBytes);
+
+  const int reads = 1000000;
+  std::vector<uint32_t> picks;
+  for (int i = 0; i < reads / LISTBOX_LINES; i++) {
+    picks.push_back(halRandom(names.size() - LISTBOX_LINES));
+  }
+
+  size_t sum = 0;
+  uint32_t start = halTime.micros();
+  for (uint32_t i : picks) {
+    sum += names[i].size();
+  }
+  double vectorRandom = elapsedMs(start) * 1e6 / picks.size();
+  start = halTime.micros();
+  for (uint32_t i : picks) {
+    sum += strlen(list.get(i));
+  }
+  double listRandom = elapsedMs(start) * 1e6 / picks.size();
+
+  start = halTime.micros();
+  for (uint32_t i : picks) {
+    for (int l = 0; l < LISTBOX_LINES; l++) {
+      sum += names[i + l].size();
+    }
+  }
+  double vectorWindow = elapsedMs(start) * 1e6 / reads;
+  start = halTime.micros();
+  for (uint32_t i : picks) {
+    for (int l = 0; l < LISTBOX_LINES; l++) {
+      sum += strlen(list.get(i + l));
+    }
+  }
+  double listWindow = elapsedMs(start) * 1e6 / reads;
+
+  printf("  ns per name        random  window of %d\n", LISTBOX_LINES);
+  printf("  vector of strings  %6.1f  %6.1f\n", vectorRandom, vectorWindow);
+  printf("  front coded        %6.1f  %6.1f\n", listRandom, listWindow);
+  return (sum == 0) ? 1 : 0;
+}
+
+// The group a browse index lists a song under, as libprep makes them
+static std::string browseGroupOf(int mode, const LIBRARY_TRACK &track) {
+  if (mode == 0) {
+    return (track.genre[0] != '\0') ? track.genre : "Unknown";
+  }
+  if (mode == 1) {
+    return (track.year != 0) ? std::to_string(track.year / 10 * 10) + "s" : "Unknown";
+  }
+  time_t t = track.mtime;
+  char month[16];
+  strftime(month, sizeof(month), "%Y-%m", localtime(&t));
+  return month;
+}
+
+// Opening browse indexes and their groups against walking the library
+static int browseBench(MusicLibrary &library) {
+
+  static const char *const paths[] = { BROWSE_GENRE_PATH, BROWSE_DECADE_PATH, BROWSE_RECENT_PATH };
+  static LIBRARY_TRACK track;
+  LibraryIndex index;
+  if (!index.open(halFs)) {
+    fprintf(stderr, "no library index, run libprep first\n");
+    return 1;
+  }
+  printf("%u songs in the library index\n", index.getCount());
+  printf("  index        groups  open ms  entries/group  group avg ms  max ms\n");
+
+  int wrong = 0;
+  std::string largest;
+  size_t largestCount = 0;
+  for (int mode = 0; mode < 3; mode++) {
+    BrowseIndex browse;
+    FrontCodedList groups, entries;
+    uint32_t start = halTime.micros();
+    if (!browse.open(halFs, paths[mode], groups)) {
+      fprintf(stderr, "can't read %s\n", paths[mode]);
+      return 1;
+    }
+    double openMs = elapsedMs(start);
+
+    double total = 0, most = 0;
+    size_t entryCount = 0;
+    for (int g = 0; g < browse.getGroupCount(); g++) {
+      start = halTime.micros();
+      if (!browse.openGroup(g, entries)) {
+        fprintf(stderr, "%s: can't read group %d\n", paths[mode], g);
+        return 1;
+      }
+      double ms = elapsedMs(start);
+      total += ms;
+      most = std::max(most, ms);
+      entryCount += entries.size();
+      if ((mode == 0) && (entries.size() > largestCount)) {
+        largest = groups.get(g);
+        largestCount = entries.size();
+      }
+
+      // Every entry is a song of this group
+      std::string name = groups.get(g);
+      for (size_t e = 0; e < entries.size(); e++) {
+        char path[256];
+        if (!index.getPath(browse.getTrack(e), path) || !index.find(path, &track) ||
+            (browseGroupOf(mode, track) != name)) {
+          fprintf(stderr, "%s: entry %zu of %s is wrong\n", paths[mode], e, name.c_str());
+          wrong++;
+        }
+      }
+    }
+    int count = browse.getGroupCount();
+    printf("  %-11s  %6d  %7.2f  %13.0f  %12.2f  %6.2f\n", strrchr(paths[mode], '/') + 1, count,
+           openMs, count ? (double) entryCount / count : 0.0, count ? total / count : 0.0, most);
+    if (entryCount != index.getCount()) {
+      fprintf(stderr, "%s: %zu entries for %u songs\n", paths[mode], entryCount, index.getCount());
+      wrong++;
+    }
+  }
+
+  // The largest genre without the index: every folder listed and every
+  // song looked up
+  uint32_t start = halTime.micros();
+  size_t found = 0, looked = 0;
+  library.populateArtists();
+  std::vector<std::string> allArtists = artists.names();
+  for (const std::string &artist : allArtists) {
+    std::string artistPath = "/" + artist;
+    library.populateAlbums(artistPath.c_str());
+    std::vector<std::string> allAlbums = albums.names();
+    for (const std::string &album : allAlbums) {
+      std::string albumPath = artistPath + "/" + album;
+      library.populateSongs(albumPath.c_str());
+      for (size_t i = 0; i < songs.size(); i++) {
+        std::string path = albumPath + "/" + songs.get(i);
+        looked++;
+        if (index.find(path.c_str(), &track) && (browseGroupOf(0, track) == largest)) {
+          found++;
+        }
+      }
+    }
+  }
+  printf("\"%s\" by walking the library: %zu of %zu songs in %.1f ms\n", largest.c_str(), found,
+         looked, elapsedMs(start));
+  if (found != largestCount) {
+    fprintf(stderr, "the walk found %zu songs, the index lists %zu\n", found, largestCount);
+    wrong++;
+  }
+  return (wrong == 0) ? 0 : 1;
+}
+
+// Coverage and cost of album shuffle against song shuffle
+static int albumBench(MusicLibrary &library, int rounds) {
+
+  static LIBRARY_TRACK track;
+  static AlbumShuffle shuffle;
+  LibraryIndex index;
+  uint32_t start = halTime.micros();
+  if (!index.open(halFs) || !shuffle.open(halFs, &index)) {
+    fprintf(stderr, "no album index, run libprep first\n");
+    return 1;
+  }
+  double openMs = elapsedMs(start);
+  uint32_t albumCount = shuffle.getAlbumCount();
+  printf("%u songs in %u albums, open and shuffle %.2f ms, permutation %zu bytes\n",
+         index.getCount(), albumCount, openMs, albumCount * sizeof(uint32_t));
+
+  int wrong = 0;
+  std::vector<uint32_t> albumPlays(albumCount), songPlays(index.getCount());
+  double songMs = 0, albumMs = 0, prefetchMs = 0;
+  uint32_t songMoves = 0, albumMoves = 0;
+  uint32_t lastAlbum = UINT32_MAX;
+  int lastTrack = 0;
+  for (int r = 0; r < rounds; r++) {
+    uint32_t played = 0;
+    do {
+      boolean prefetched = shuffle.isPrefetched();
+      start = halTime.micros();
+      if (!shuffle.nextSong(&track)) {
+        fprintf(stderr, "can't move to the next song\n");
+        return 1;
+      }
+      double ms = elapsedMs(start);
+      char path[256];
+      if (index.getPath(shuffle.getTrackNumber(), path) && !strcmp(path, shuffle.getPath())) {
+        songPlays[shuffle.getTrackNumber()]++;
+      } else {
+        fprintf(stderr, "%s isn't track %u\n", shuffle.getPath(), shuffle.getTrackNumber());
+        wrong++;
+      }
+
+      if (shuffle.getSongNumber() == 0) {
+        // A new album
+        albumMs += ms;
+        albumMoves++;
+        if ((shuffle.getAlbum() == lastAlbum) && (albumCount > 1)) {
+          fprintf(stderr, "album %s played twice in a row\n", shuffle.getAlbumName());
+          wrong++;
+        }
+        if (!prefetched && (played + r > 0)) {
+          fprintf(stderr, "album %s wasn't prefetched\n", shuffle.getAlbumName());
+          wrong++;
+        }
+        lastAlbum = shuffle.getAlbum();
+        albumPlays[lastAlbum]++;
+        played++;
+      } else {
+        songMs += ms;
+        songMoves++;
+        if ((track.track != 0) && (track.track < lastTrack)) {
+          fprintf(stderr, "%s out of track order\n", shuffle.getPath());
+          wrong++;
+        }
+      }
+      lastTrack = track.track;
+
+      // Read the next album ahead during the last song
+      start = halTime.micros();
+      if (!shuffle.prefetch()) {
+        fprintf(stderr, "can't prefetch\n");
+        return 1;
+      }
+      if (shuffle.isPrefetched()) {
+        prefetchMs += elapsedMs(start);
+      }
+    } while ((played < albumCount) || !shuffle.isLastSong());
+
+    // Every album and every song once more
+    for (uint32_t a = 0; a < albumCount; a++) {
+      if (albumPlays[a] != (uint32_t) r + 1) {
+        fprintf(stderr, "round %d: album %u played %u times\n", r + 1, a, albumPlays[a]);
+        wrong++;
+      }
+    }
+    for (uint32_t i = 0; i < index.getCount(); i++) {
+      if (songPlays[i] != (uint32_t) r + 1) {
+        fprintf(stderr, "round %d: track %u played %u times\n", r + 1, i, songPlays[i]);
+        wrong++;
+      }
+    }
+  }
+  printf("%d rounds, every album and song once a round: %s\n", rounds, wrong ? "no" : "yes");
+  printf("  next song in album     %7.3f ms  %u moves\n", songMoves ? songMs / songMoves : 0.0, songMoves);
+  printf("  next album prefetched  %7.3f ms  %u moves\n", albumMoves ? albumMs / albumMoves : 0.0, albumMoves);
+  printf("  prefetch               %7.3f ms\n", albumMoves ? prefetchMs / albumMoves : 0.0);
+
+  // Song shuffle for as many picks
+  std::set<std::string> picked;
+  char songPath[120];
+  library.populateArtists();
+  start = halTime.micros();
+  for (uint32_t i = 0; i < index.getCount(); i++) {
+    if (library.pickShuffledSong(songPath, sizeof(songPath))) {
+      picked.insert(songPath);
+    }
+  }
+  double ms = elapsedMs(start);
+  printf("song shuffle: %u picks %.3f ms each, %zu songs (%.0f%%) covered\n", index.getCount(),
+         index.getCount() ? ms / index.getCount() : 0.0, picked.size(),
+         index.getCount() ? 100.0 * picked.size() / index.getCount() : 0.0);
+  return (wrong == 0) ? 0 : 1;
+}
+
+// Count a play or skip of track as the player does, compacting the log
+// when it's due
+static boolean smartCount(PlayStats &stats, SmartShuffle &smart, uint32_t track, boolean played) {
+  if (!stats.add(track, played ? PE_PLAY : PE_SKIP, played ? 65535 : 16384) || !smart.counted(track)) {
+    return false;
+  }
+  return !stats.isCompactDue() || stats.compact();
+}
+
+// Weighted picks and play statistics of smart shuffle
+static int smartBench(int count) {
+
+  int wrong = 0;
+  halRandomSeed(1);
+
+  // The tree against an array of the same weights
+  const uint32_t n = 1000;
+  WeightTree tree;
+  std::vector<uint32_t> weights(n);
+  tree.begin(n);
+  for (uint32_t i = 0; i < n; i++) {
+    weights[i] = 1 + halRandom(SMART_WEIGHT_MAX);
+    tree.put(i, weights[i]);
+  }
+  tree.build();
+  for (int c = 0; c < 100000; c++) {
+    uint32_t i = halRandom(n);
+    if (c % 2) {
+      weights[i] = 1 + halRandom(SMART_WEIGHT_MAX);
+      tree.set(i, weights[i]);
+    }
+    uint32_t total = 0;
+    for (uint32_t w : weights) {
+      total += w;
+    }
+    uint32_t r = halRandom(total);
+    uint32_t expected = 0;
+    for (uint32_t sum = weights[0]; sum <= r; sum += weights[++expected]) {
+    }
+    if ((tree.getTotal() != total) || (tree.get(i) != weights[i]) || (tree.find(r) != expected)) {
+      fprintf(stderr, "weight tree differs at change %d\n", c);
+      wrong++;
+      break;
+    }
+  }
+
+  // Picks in proportion to the weights
+  const int picks = 1000000;
+  std::vector<uint32_t> hits(n);
+  for (int p = 0; p < picks; p++) {
+    hits[tree.find(halRandom(tree.getTotal()))]++;
+  }
+  double chi2 = 0;
+  for (uint32_t i = 0; i < n; i++) {
+    double expected = (double) picks * weights[i] / tree.getTotal();
+    chi2 += (hits[i] - expected) * (hits[i] - expected) / expected;
+  }
+  // 999 degrees of freedom: 1.2x the mean is beyond the 99.9th percentile
+  printf("%d picks over %u weights: chi-squared %.0f for %u degrees of freedom\n", picks, n, chi2, n - 1);
+  if (chi2 > 1.2 * (n - 1)) {
+    fprintf(stderr, "picks don't follow the weights\n");
+    wrong++;
+  }
+
+  // Costs over count tracks
+  const char *path = "/smartbench.bin";
+  const char *logPath = "/smartbench.log";
+  PlayStats stats;
+  SmartShuffle smart;
+  halFs->remove(path);
+  halFs->remove(logPath);
+  uint32_t start = halTime.micros();
+  if (!stats.open(halFs, count, path, logPath) || !smart.open(&stats)) {
+    fprintf(stderr, "can't make %s\n", path);
+    return 1;
+  }
+  double firstOpenMs = elapsedMs(start);
+  start = halTime.micros();
+  smart.open(&stats);
+  double openMs = elapsedMs(start);
+
+  const int reps = 1000000;
+  uint32_t sum = 0;
+  start = halTime.micros();
+  for (int i = 0; i < reps; i++) {
+    sum += smart.pick();
+  }
+  double pickNs = elapsedMs(start) * 1e6 / reps;
+  WeightTree big;
+  big.begin(count);
+  big.build();
+  start = halTime.micros();
+  for (int i = 0; i < reps; i++) {
+    big.set(halRandom(count), 1 + (i & 1023));
+  }
+  double setNs = elapsedMs(start) * 1e6 / reps;
+  const int events = 20000;
+  start = halTime.micros();
+  for (int i = 0; i < events; i++) {
+    uint32_t t = smart.pick();
+    if (!smartCount(stats, smart, t, (i % 3) != 0)) {
+      fprintf(stderr, "can't count a play\n");
+      return 1;
+    }
+  }
+  double eventUs = elapsedMs(start) * 1e3 / events;
+  start = halTime.micros();
+  stats.open(halFs, count, path, logPath);
+  smart.open(&stats);
+  double reopenMs = elapsedMs(start);
+
+  printf("%d tracks, %zu bytes of weights\n", count, smart.bytes());
+  printf("  make statistics file  %8.2f ms\n", firstOpenMs);
+  printf("  open (load weights)   %8.2f ms\n", openMs);
+  printf("  open after plays      %8.2f ms  %d plays and skips\n", reopenMs, events);
+  printf("  pick                  %8.1f ns\n", pickNs);
+  printf("  change a weight       %8.1f ns\n", setNs);
+  printf("  play or skip          %8.2f us  logged, reweighed and compacted\n", eventUs);
+
+  // A library with a tenth of its songs always skipped
+  const uint32_t songs = 1000;
+  const int plays = 20000;
+  halFs->remove(path);
+  halFs->remove(logPath);
+  stats.open(halFs, songs, path, logPath);
+  smart.open(&stats);
+  int badPicks[2] = { 0, 0 }, lastBad[2] = { 0, 0 }, soon[2] = { 0, 0 };
+  for (int mode = 0; mode < 2; mode++) {
+    std::vector<int> lastPick(songs, -SMART_RECENT_PLAYS);
+    for (int p = 0; p < plays; p++) {
+      uint32_t t = mode ? smart.pick() : (uint32_t) halRandom(songs);
+      boolean bad = (t % 10) == 0;
+      badPicks[mode] += bad ? 1 : 0;
+      lastBad[mode] += (bad && (p >= plays - 2000)) ? 1 : 0;
+      soon[mode] += (p - lastPick[t] < SMART_RECENT_PLAYS) ? 1 : 0;
+      lastPick[t] = p;
+      if (mode) {
+        smartCount(stats, smart, t, !bad);
+      }
+    }
+  }
+  smart.close();
+  stats.close();
+  halFs->remove(path);
+  halFs->remove(logPath);
+  printf("%u songs, %u always skipped, %d plays   uniform  smart\n", songs, songs / 10, plays);
+  printf("  skipped songs picked                %5.1f%%  %4.1f%%\n", 100.0 * badPicks[0] / plays,
+         100.0 * badPicks[1] / plays);
+  printf("  in the last 2000 plays              %5.1f%%  %4.1f%%\n", 100.0 * lastBad[0] / 2000,
+         100.0 * lastBad[1] / 2000);
+  printf("  back within %d plays               %5.1f%%  %4.1f%%\n", SMART_RECENT_PLAYS,
+         100.0 * soon[0] / plays, 100.0 * soon[1] / plays);
+  if (lastBad[1] >= lastBad[0]) {
+    fprintf(stderr, "skipped songs aren't held back\n");
+    wrong++;
+  }
+  return ((wrong == 0) && (sum != 0)) ? 0 : 1;
+}
+
+// True if history holds the songs of model, oldest first, with the
+// cursor cursor songs back from the newest
+static boolean sameHistory(ShuffleHistory &history, const std::deque<uint32_t> &model, int cursor) {
+  if ((history.getCount() != (int) model.size()) || (history.getCursor() != cursor)) {
+    return false;
+  }
+  for (int i = 0; i < history.getCount(); i++) {
+    if (history.get(i) != model[model.size() - 1 - i]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Shuffle history moves and its file against a model
+static int historyTest(int steps) {
+
+  const char *path = "/historytest.bin";
+  const uint32_t tracks = 5000;
+  int wrong = 0;
+  halRandomSeed(1);
+  halFs->remove(path);
+
+  ShuffleHistory history;
+  history.begin(halFs, tracks, path);
+  std::deque<uint32_t> model;
+  int cursor = 0;
+  int moves[3] = { 0, 0, 0 };
+  uint32_t start = halTime.micros();
+  for (int s = 0; s < steps; s++) {
+
+    // Mostly back and forward again with a new song now and then, as
+    // - and + would
+    int op = halRandom(10);
+    uint32_t track = UINT32_MAX, expected = UINT32_MAX;
+    boolean moved;
+    if (op < 4) {
+      moved = history.back(&track);
+      if (cursor + 1 < (int) model.size()) {
+        expected = model[model.size() - 1 - ++cursor];
+      }
+    } else if (op < 8) {
+      moved = history.forward(&track);
+      if (cursor > 0) {
+        expected = model[model.size() - 1 - --cursor];
+      }
+    } else {
+      track = expected = halRandom(tracks);
+      history.add(track);
+      model.push_back(track);
+      if (model.size() > SHUFFLE_HISTORY_SIZE) {
+        model.pop_front();
+      }
+      cursor = 0;
+      moved = true;
+    }
+    moves[op < 4 ? 0 : (op < 8 ? 1 : 2)] += moved ? 1 : 0;
+    if ((moved != (expected != UINT32_MAX)) || (moved && (track != expected)) ||
+        !sameHistory(history, model, cursor)) {
+      fprintf(stderr, "history differs at move %d\n", s);
+      wrong++;
+      break;
+    }
+    if (s < 1000) {
+      ShuffleHistory reread;
+      reread.begin(halFs, tracks, path);
+      if (!sameHistory(reread, model, cursor)) {
+        fprintf(stderr, "history reads back differently at move %d\n", s);
+        wrong++;
+        break;
+      }
+    }
+  }
+  double moveUs = elapsedMs(start) * 1e3 / steps;
+  printf("%d moves: %d back, %d forward, %d songs added, %zu kept\n", steps, moves[0], moves[1],
+         moves[2], model.size());
+  printf("  move and write        %8.2f us\n", moveUs);
+  printf("  file                  %8d bytes\n", SHUFFLE_HISTORY_HEADER + 4 * history.getCount());
+
+  // Bad files are dropped
+  std::vector<uint8_t> good(SHUFFLE_HISTORY_HEADER + 4 * SHUFFLE_HISTORY_SIZE);
+  HalFile *file = halFs->open(path, HOM_READ);
+  int n = file->read(good.data(), good.size());
+  delete file;
+  good.resize(n);
+  struct {
+    const char *name;
+    int at;          // byte changed, -1 to cut the file short
+    uint8_t value;
+  } bad[] = {
+    { "cut short", -1, 0 },
+    { "bad magic", 0, 'X' },
+    { "other version", 4, SHUFFLE_HISTORY_VERSION + 1 },
+    { "other index", 8, (tracks + 1) & 0xFF },
+    { "too many songs", 12, SHUFFLE_HISTORY_SIZE + 1 },
+    { "cursor past the oldest", 13, SHUFFLE_HISTORY_SIZE },
+    { "track past the index", SHUFFLE_HISTORY_HEADER + 3, 0xFF },
+  };
+  int dropped = 0;
+  for (const auto &b : bad) {
+    std::vector<uint8_t> data = good;
+    if (b.at < 0) {
+      data.resize(data.size() - 1);
+    } else {
+      data[b.at] = b.value;
+    }
+    file = halFs->open(path, HOM_WRITE);
+    file->write(data.data(), data.size());
+    delete file;
+    ShuffleHistory reread;
+    reread.begin(halFs, tracks, path);
+    if ((reread.getCount() != 0) || reread.canGoBack()) {
+      fprintf(stderr, "%s history isn't dropped\n", b.name);
+      wrong++;
+    } else {
+      dropped++;
+    }
+  }
+  halFs->remove(path);
+  printf("%d of %d bad histories dropped\n", dropped, (int)(sizeof(bad) / sizeof(bad[0])));
+  return (wrong == 0) ? 0 : 1;
+}
+
+// Sectors the FAT file system on the card would write: each file's
+// sectors written since its last flush or close, its directory entry
+// when its size changed, and both copies of a FAT sector when it grows
+// into another cluster or is truncated. Reads count the calls and the
+// sectors read, a sector again only when the file's last read was of
+// another.
+#define MODEL_SECTOR 512
+#define MODEL_CLUSTER 32768
+#define MODEL_FATS 2
+
+static struct {
+  uint64_t data;
+  uint64_t directory;
+  uint64_t fat;
+} modelWrites;
+
+static struct {
+  uint64_t calls;
+  uint64_t sectors;
+} modelReads;
+
+class ModelFile : public HalFile {
+public:
+  ModelFile(HalFile *file, boolean append, boolean truncated) {
+    _file = file;
+    _size = file->size();
+    _position = append ? _size : 0;
+    _append = append;
+    _flushedSize = truncated ? UINT32_MAX : _size;
+    _lastRead = UINT32_MAX;
+  }
+
+  ~ModelFile() {
+    flush();
+    delete _file;
+  }
+
+  int read(void *buffer, size_t length) override {
+    int n = _file->read(buffer, length);
+    modelReads.calls++;
+    for (uint32_t s = _position / MODEL_SECTOR; (n > 0) && (s <= (_position + n - 1) / MODEL_SECTOR); s++) {
+      modelReads.sectors += (s != _lastRead);
+      _lastRead = s;
+    }
+    _position += (n > 0) ? n : 0;
+    return n;
+  }
+
+  size_t write(const void *data, size_t length) override {
+    if (_append) {
+      _position = _size;
+    }
+    size_t n = _file->write(data, length);
+    for (uint32_t s = _position / MODEL_SECTOR; (n > 0) && (s <= (_position + n - 1) / MODEL_SECTOR); s++) {
+      _dirty.insert(s);
+    }
+    _position += n;
+    _size = std::max(_size, _position);
+    return n;
+  }
+
+  // A truncated file's first flush frees its clusters
+  void flush() override {
+    modelWrites.data += _dirty.size();
+    _dirty.clear();
+    if (_size != _flushedSize) {
+      modelWrites.directory++;
+    }
+    if ((_flushedSize == UINT32_MAX) || (clusters(_size) != clusters(_flushedSize))) {
+      modelWrites.fat += MODEL_FATS;
+    }
+    _flushedSize = _size;
+    _file->flush();
+  }
+
+  boolean seek(uint32_t position) override {
+    _position = position;
+    return _file->seek(position);
+  }
+
+  uint32_t position() override {
+    return _position;
+  }
+
+  uint32_t size() override {
+    return _size;
+  }
+
+protected:
+  HalFile *_file;
+  uint32_t _size;
+  uint32_t _position;
+  boolean _append;
+  uint32_t _flushedSize;
+  uint32_t _lastRead;
+  std::set<uint32_t> _dirty;
+
+  static uint32_t clusters(uint32_t bytes) {
+    return (bytes + MODEL_CLUSTER - 1) / MODEL_CLUSTER;
+  }
+};
+
+class ModelFileSystem : public PosixFileSystem {
+public:
+  ModelFileSystem(const char *root) : PosixFileSystem(root) {
+  }
+
+  HalFile *open(const char *path, enum HAL_OPEN_MODE mode) override {
+    boolean truncated = (mode == HOM_WRITE) && exists(path);
+    HalFile *file = PosixFileSystem::open(path, mode);
+    return (file != NULL) ? new ModelFile(file, mode == HOM_APPEND, truncated) : NULL;
+  }
+};
+
+// Count an event into a model's play statistics
+static void modelEvent(PLAY_STATS *s, uint32_t sequence, boolean played, uint16_t completion) {
+  uint32_t heard = s->plays + s->skips;
+  s->completion = ((uint64_t) s->completion * heard + completion) / (heard + 1);
+  if (played) {
+    s->plays++;
+  } else {
+    s->skips++;
+  }
+  s->lastPlayed = sequence;
+}
+
+static boolean sameRecord(const PLAY_STATS *a, const PLAY_STATS *b) {
+  return (a->plays == b->plays) && (a->skips == b->skips) && (a->lastPlayed == b->lastPlayed) &&
+         (a->completion == b->completion);
+}
+
+// The first record that differs from the model's, -1 if none does and
+// -2 if they can't be read
+static int sameStats(PlayStats &stats, const std::vector<PLAY_STATS> &model) {
+  std::vector<PLAY_STATS> read(model.size());
+  if (!stats.read(0, read.data(), model.size())) {
+    return -2;
+  }
+  for (uint32_t i = 0; i < model.size(); i++) {
+    if (!sameRecord(&read[i], &model[i])) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+// Play statistics log and compaction against a model, and the writes
+// they take
+static int statsBench(const char *root, uint32_t tracks) {
+
+  const char *path = "/statsbench.bin";
+  const char *logPath = "/statsbench.log";
+  int wrong = 0;
+  halRandomSeed(1);
+  halFs->remove(path);
+  halFs->remove(logPath);
+
+  // Random events with compactions, reopens and torn events between
+  PlayStats stats;
+  if (!stats.open(halFs, tracks, path, logPath)) {
+    fprintf(stderr, "can't make %s\n", path);
+    return 1;
+  }
+  std::vector<PLAY_STATS> model(tracks);
+  memset(model.data(), 0, sizeof(PLAY_STATS) * tracks);
+  uint32_t sequence = 0;
+  int steps = 0, reopens = 0, torn = 0;
+  const int events = 20000;
+  for (int e = 0; e < events; e++) {
+    uint32_t t = halRandom(10) ? halRandom(tracks) : halRandom(tracks / 100 + 1);
+    uint16_t completion = halRandom(3) ? 65535 : halRandom(65536);
+    boolean played = completion >= PLAY_STATS_PLAYED;
+    if (!stats.add(t, played ? PE_PLAY : PE_SKIP, completion)) {
+      fprintf(stderr, "can't count event %d\n", e);
+      return 1;
+    }
+    modelEvent(&model[t], ++sequence, played, completion);
+
+    int r = halRandom(1000);
+    if (r < 100) {
+      stats.compact(1 + halRandom(4));
+      steps++;
+    } else if (r < 110) {
+      // Turned off, maybe during a compaction or writing an event
+      uint32_t next = stats.getLogged();
+      stats.close();
+      if ((r < 104) && (next < PLAY_LOG_MAX)) {
+        HalFile *log = halFs->open(logPath, HOM_UPDATE);
+        log->seek(PLAY_LOG_HEADER + PLAY_LOG_EVENT * next);
+        log->write("\x01\x02\x03\x04\x05", 5);
+        delete log;
+        torn++;
+      }
+      stats.open(halFs, tracks, path, logPath);
+      reopens++;
+    }
+    PLAY_STATS s;
+    if (!stats.read(t, &s, 1) || !sameRecord(&s, &model[t]) || (stats.getSequence() != sequence)) {
+      fprintf(stderr, "track %u differs after event %d\n", t, e);
+      wrong++;
+      break;
+    }
+  }
+  int differs = sameStats(stats, model);
+  stats.close();
+  stats.open(halFs, tracks, path, logPath);
+  if ((differs != -1) || ((differs = sameStats(stats, model)) != -1) || !stats.compact() ||
+      ((differs = sameStats(stats, model)) != -1)) {
+    fprintf(stderr, "record %d differs\n", differs);
+    wrong++;
+  }
+  stats.close();
+  halFs->remove(path);
+  halFs->remove(logPath);
+  printf("%d events over %u tracks, %d compaction steps, %d reopens, %d torn events: %s\n", events,
+         tracks, steps, reopens, torn, wrong ? "wrong" : "all match");
+
+  // Writes per event on the model of the card, for songs played
+  // uniformly and for four in five plays on a fiftieth of them
+  ModelFileSystem fs(root);
+  const int counted = 4096;
+  const uint32_t batches[] = { 0, 16, PLAY_LOG_COMPACT, PLAY_LOG_MAX };
+  for (int favorites = 0; favorites < 2; favorites++) {
+    printf("%u tracks, %d events%s   sectors per event       bytes to card   write\n", tracks, counted,
+           favorites ? ", favorites" : "           ");
+    printf("                          data   dir   FAT  total     per event  amplification\n");
+    for (uint32_t batch : batches) {
+      fs.remove(path);
+      fs.remove(logPath);
+      stats.open(&fs, tracks, path, logPath);
+      HalFile *table = (batch == 0) ? fs.open(path, HOM_UPDATE) : NULL;
+      memset(&modelWrites, 0, sizeof(modelWrites));
+      double compactUs = 0, stepUs = 0;
+      int compactions = 0, records = 0;
+      for (int e = 0; e < counted; e++) {
+        uint32_t t = (favorites && halRandom(5)) ? halRandom(tracks / 50 + 1) : halRandom(tracks);
+        if (batch == 0) {
+          // Written into its record as it happens
+          uint8_t b[PLAY_STATS_RECORD];
+          PLAY_STATS s;
+          table->seek(PLAY_STATS_HEADER + PLAY_STATS_RECORD * t);
+          table->read(b, sizeof(b));
+          PlayStats::decode(b, &s);
+          modelEvent(&s, e + 1, true, 65535);
+          PlayStats::encode(&s, b);
+          table->seek(PLAY_STATS_HEADER + PLAY_STATS_RECORD * t);
+          table->write(b, sizeof(b));
+          table->flush();
+          continue;
+        }
+        stats.add(t, PE_PLAY, 65535);
+        if (stats.getLogged() >= batch) {
+          // A record a step, as the background task does
+          records += stats.getPending();
+          uint32_t start = halTime.micros();
+          int n = 0;
+          do {
+            stats.compact(1);
+            n++;
+          } while (stats.isCompactDue());
+          double us = halTime.micros() - start;
+          compactUs += us;
+          stepUs += us / n;
+          compactions++;
+        }
+      }
+      delete table;
+      stats.close();
+      double sectors = (double)(modelWrites.data + modelWrites.directory + modelWrites.fat) / counted;
+      char name[32];
+      snprintf(name, sizeof(name), batch ? "  log, compact every %u" : "  in place", batch);
+      printf("%-24s %5.2f %5.2f %5.2f %6.2f %13.0f %13.0fx\n", name, (double) modelWrites.data / counted,
+             (double) modelWrites.directory / counted, (double) modelWrites.fat / counted, sectors,
+             sectors * MODEL_SECTOR, sectors * MODEL_SECTOR / PLAY_STATS_RECORD);
+      if (compactions > 0) {
+        printf("    %d compactions of %.1f records, %.1f us each, %.1f us a step\n", compactions,
+               (double) records / compactions, compactUs / compactions, stepUs / compactions);
+      }
+    }
+  }
+  fs.remove(path);
+  fs.remove(logPath);
+  return (wrong == 0) ? 0 : 1;
+}
+
+// Write data to path on the card
+static void writeCardFile(const char *path, const std::string &data) {
+  HalFile *file = halFs->open(path, HOM_WRITE);
+  file->write(data.data(), data.size());
+  delete file;
+}
+
+// Playlist parsing and path resolving edge cases
+static int playlistTest(void) {
+
+  static const struct {
+    const char *name;
+    const char *text;
+    const char *expected;  // path|title per entry, a line each
+    uint32_t skipped;
+  } cases[] = {
+    { "extinf.m3u", "#EXTM3U\n#EXTINF:123,Artist - Song\nA/B/01.mp3\n\nB/C/02.mp3\n",
+      "A/B/01.mp3|Artist - Song\nB/C/02.mp3|\n", 0 },
+    { "bom-crlf.m3u", "\xEF\xBB\xBF#EXTM3U\r\n#EXTINF:-1,Title\r\nsong.mp3\r\nlast.mp3",
+      "song.mp3|Title\nlast.mp3|\n", 0 },
+    { "bom-path.m3u8", "\xEF\xBB\xBF" "first.mp3\n", "first.mp3|\n", 0 },
+    { "cr.m3u", "a.mp3\rb.mp3\r\r", "a.mp3|\nb.mp3|\n", 0 },
+    { "quoted.m3u", "#EXTINF:-1 tvg-name=\"x,y\" logo=\"z\",Real Title\nsong.mp3\n",
+      "song.mp3|Real Title\n", 0 },
+    { "no-title.m3u", "#EXTINF:42\nsong.mp3\n", "song.mp3|\n", 0 },
+    { "trim.m3u", "  \t a.mp3 \t\n# comment\n#EXTGRP:x\n#EXTINF:1, T \n\nb.mp3\n",
+      "a.mp3|\nb.mp3|T\n", 0 },
+    { "latin1.m3u", "#EXTINF:1,Caf\xE9\nCaf\xE9.mp3\n", "Caf\xC3\xA9.mp3|Caf\xC3\xA9\n", 0 },
+    { "utf8.m3u", "Caf\xC3\xA9.mp3\n", "Caf\xC3\xA9.mp3|\n", 0 },
+    { "bytes.m3u8", "Caf\xE9.mp3\n", "Caf\xE9.mp3|\n", 0 },
+    { "empty.m3u", "", "", 0 },
+    { "comments.m3u", "#EXTM3U\n#EXTINF:1,orphan\n", "", 0 },
+    { "basic.pls", "[playlist]\nFile1=a.mp3\nTitle1=A\nLength1=1\nfile2=b.mp3\nTITLE2=B\n"
+                   "NumberOfEntries=2\nVersion=2\n", "a.mp3|A\nb.mp3|B\n", 0 },
+    { "order.pls", "[playlist]\r\nTitle1=A\r\nFile1=a.mp3\r\nTitle2=orphan\r\nFile3 = c.mp3\r\n"
+                   "Filex=bad.mp3\r\n", "a.mp3|A\nc.mp3|\n", 0 },
+    { "latin1.pls", "[playlist]\nFile1=\xC0.mp3\nTitle1=\xE0\n", "\xC3\x80.mp3|\xC3\xA0\n", 0 },
+  };
+
+  int wrong = 0;
+  PlaylistParser parser;
+  static PLAYLIST_ENTRY entry;
+  const char *path = "/playlisttest.tmp";
+  for (const auto &c : cases) {
+    writeCardFile(path, c.text);
+    HalFile *file = halFs->open(path, HOM_READ);
+    parser.begin(file, PlaylistParser::formatOf(c.name));
+    std::string got;
+    while (parser.next(&entry)) {
+      got += std::string(entry.path) + "|" + entry.title + "\n";
+    }
+    delete file;
+    if ((got != c.expected) || (parser.getSkipped() != c.skipped)) {
+      fprintf(stderr, "%s: read\n%s(%u skipped) not\n%s(%u skipped)\n", c.name, got.c_str(),
+              parser.getSkipped(), c.expected, c.skipped);
+      wrong++;
+    }
+  }
+
+  // Lines too long for the buffer and paths too long for an entry
+  std::string longLines = std::string(PLAYLIST_LINE_SIZE + 100, 'x') + "\nok.mp3\n" +
+                          std::string(300, 'y') + ".mp3\n" + std::string(251, 'z') + ".mp3\n";
+  writeCardFile(path, longLines);
+  HalFile *file = halFs->open(path, HOM_READ);
+  parser.begin(file, PF_M3U);
+  boolean longOk = parser.next(&entry) && !strcmp(entry.path, "ok.mp3") &&
+                   parser.next(&entry) && (strlen(entry.path) == 255) && !parser.next(&entry);
+  delete file;
+  if (!longOk || (parser.getSkipped() != 2)) {
+    fprintf(stderr, "long lines: %u skipped, not 2\n", parser.getSkipped());
+    wrong++;
+  }
+  halFs->remove(path);
+
+  static const struct {
+    const char *dir;
+    const char *path;
+    const char *expected;  // NULL if it doesn't resolve
+  } paths[] = {
+    { "", "Artist/Album/01.mp3", "/Artist/Album/01.mp3" },
+    { "/Lists", "../Artist/a.mp3", "/Artist/a.mp3" },
+    { "/Lists", "Artist\\Album\\a.mp3", "/Lists/Artist/Album/a.mp3" },
+    { "/Lists", "E:\\Artist\\a.mp3", "/Artist/a.mp3" },
+    { "/Lists", "/Artist/./b//a.mp3", "/Artist/b/a.mp3" },
+    { "", "file:///E:/My%20Music/a%c3%a9.mp3", "/My Music/a\xC3\xA9.mp3" },
+    { "", "FILE://localhost/Artist/a%2.mp3", "/Artist/a%2.mp3" },
+    { "/A/B", "../../x.mp3", "/x.mp3" },
+    { "", "..\\x.mp3", NULL },
+    { "/A/B", "../../../x.mp3", NULL },
+    { "", "http://radio.example/stream", NULL },
+    { "", "./.", NULL },
+  };
+  for (const auto &p : paths) {
+    char out[256];
+    boolean resolved = PlaylistParser::resolve(p.dir, p.path, out, sizeof(out));
+    if ((resolved != (p.expected != NULL)) || (resolved && strcmp(out, p.expected))) {
+      fprintf(stderr, "resolve %s in \"%s\": %s, not %s\n", p.path, p.dir, resolved ? out : "(none)",
+              p.expected ? p.expected : "(none)");
+      wrong++;
+    }
+  }
+  char small[16];
+  if (PlaylistParser::resolve("/Artist", "Album/song.mp3", small, sizeof(small))) {
+    fprintf(stderr, "resolve into a short buffer didn't fail\n");
+    wrong++;
+  }
+  printf("%d playlists and %d paths checked, %d wrong\n", (int)(sizeof(cases) / sizeof(cases[0])) + 1,
+         (int)(sizeof(paths) / sizeof(paths[0])) + 1, wrong);
+  return (wrong == 0) ? 0 : 1;
+}
+
+// Resolve a playlist of entries songs with a cold cache and open it
+// again from the cache, counting reads on a model of the card
+static int playlistBench(const char *root, int entries) {
+
+  ModelFileSystem fs(root);
+  LibraryIndex index;
+  if (!index.open(&fs)) {
+    fprintf(stderr, "no library index, run libprep first\n");
+    return 1;
+  }
+  uint32_t count = index.getCount();
+  entries = std::min((uint32_t) entries, count);
+  printf("%u songs in the library index, playlists of %d\n", count, entries);
+  printf("  playlist       open         ms  reads  sectors  found\n");
+
+  int wrong = 0;
+  halRandomSeed(1);
+  static LIBRARY_TRACK track;
+  const char *names[] = { "/playlistbench-albums.m3u", "/playlistbench-shuffled.m3u8",
+                          "/playlistbench.pls" };
+  for (int p = 0; p < 3; p++) {
+
+    // Runs of songs in index order as whole albums are, then random
+    // songs, then random songs as PLS with Windows paths
+    std::vector<uint32_t> expected;
+    std::string text = (p == 2) ? "[playlist]\n" : "#EXTM3U\n";
+    uint32_t next = halRandom(count);
+    for (int e = 0; e < entries; e++) {
+      uint32_t t = (p > 0) ? halRandom(count) : next;
+      next = ((e % 12) == 11) ? halRandom(count) : (t + 1) % count;
+      char path[256];
+      index.getPath(t, path);
+      expected.push_back(t);
+      if (p == 2) {
+        std::string windows = path + 1;
+        std::replace(windows.begin(), windows.end(), '/', '\\');
+        text += "File" + std::to_string(e + 1) + "=" + windows + "\n";
+      } else {
+        if ((e % 2) == 0) {
+          text += "#EXTINF:200,Title " + std::to_string(e) + "\n";
+        }
+        text += std::string(path + 1) + "\n";
+      }
+    }
+    text += (p == 2) ? "NumberOfEntries=" + std::to_string(entries) + "\n" : "http://radio.example/\n";
+    writeCardFile(names[p], text);
+
+    // Without findNear(): every entry a binary search reading its record
+    {
+      modelReads.calls = modelReads.sectors = 0;
+      uint32_t start = halTime.micros();
+      for (uint32_t t : expected) {
+        char path[256];
+        uint64_t calls = modelReads.calls, sectors = modelReads.sectors;
+        index.getPath(t, path);
+        modelReads.calls = calls;
+        modelReads.sectors = sectors;
+        index.find(path, &track);
+      }
+      printf("  %-13s  %-9s  %6.1f  %5llu  %7llu\n", strrchr(names[p], '.') + 1, "find",
+             elapsedMs(start), (unsigned long long) modelReads.calls,
+             (unsigned long long) modelReads.sectors);
+    }
+
+    char cache[PLAYLIST_CACHE_PATH_SIZE];
+    Playlist::cachePath(names[p], cache);
+    fs.remove(cache);
+    Playlist playlist;
+    FrontCodedList labels;
+    static const char *const opens[] = { "cold", "cached", "edited", "torn", "reordered" };
+    for (int o = 0; o < 5; o++) {
+      if (o == 2) {
+        // Another entry at the end is resolved again
+        text += (p == 2) ? "File0=missing.mp3\n" : "missing.mp3\n";
+        writeCardFile(names[p], text);
+      } else if (o == 3) {
+        // A cache cut short is made again
+        HalFile *file = fs.open(cache, HOM_READ);
+        std::vector<uint8_t> data(file->size() / 2);
+        file->read(data.data(), data.size());
+        delete file;
+        writeCardFile(cache, std::string(data.begin(), data.end()));
+      } else if (o == 4) {
+        // The first two songs swapped keep the playlist's size, so its
+        // cache is removed as a remote upload does
+        size_t a = text.find((p == 2) ? "File1=" : "\n", (p == 2) ? 0 : text.find("#EXTINF"));
+        a = text.find((p == 2) ? '=' : '\n', a) + 1;
+        size_t aEnd = text.find('\n', a);
+        size_t b = aEnd + 1;
+        b = (p == 2) ? text.find('=', b) + 1 : b;
+        size_t bEnd = text.find('\n', b);
+        text = text.substr(0, a) + text.substr(b, bEnd - b) + text.substr(aEnd, b - aEnd) +
+               text.substr(a, aEnd - a) + text.substr(bEnd);
+        writeCardFile(names[p], text);
+        Playlist::removeCache(&fs, names[p]);
+        std::swap(expected[0], expected[1]);
+      }
+      modelReads.calls = modelReads.sectors = 0;
+      uint32_t start = halTime.micros();
+      if (!playlist.open(&fs, names[p], &index, labels)) {
+        fprintf(stderr, "%s: can't open\n", names[p]);
+        return 1;
+      }
+      double ms = elapsedMs(start);
+      printf("  %-13s  %-9s  %6.1f  %5llu  %7llu  %d of %d\n", strrchr(names[p], '.') + 1, opens[o], ms,
+             (unsigned long long) modelReads.calls, (unsigned long long) modelReads.sectors,
+             playlist.getEntryCount(), playlist.getEntryCount() + (int) playlist.getMissing());
+
+      boolean same = (playlist.wasCached() == (o == 1)) && (playlist.getEntryCount() == entries) &&
+                     (labels.size() == (size_t) entries) && (playlist.getMissing() == (uint32_t)((p < 2) + (o >= 2)));
+      for (int e = 0; same && (e < entries); e++) {
+        same = (playlist.getTrack(e) == expected[e]);
+        if (same && (p < 2) && ((e % 2) == 0)) {
+          same = (labels.get(e) == "Title " + std::to_string(e));
+        }
+      }
+      if (!same) {
+        fprintf(stderr, "%s: %s open is wrong\n", names[p], opens[o]);
+        wrong++;
+      }
+    }
+    fs.remove(cache);
+    fs.remove(names[p]);
+  }
+  fs.rmdir(PLAYLIST_CACHE_DIR);
+  return (wrong == 0) ? 0 : 1;
+}
+
+// Scheduler clock, advanced by the test tasks themselves
+static uint32_t schedNowUs;
+static std::string schedOrder;
+static int schedSteps;
+
+static uint32_t schedClock(void) {
+  return schedNowUs;
+}
+
+static Scheduler *schedUnderTest;
+
+// Tasks log a letter and take a fixed time
+static void schedAudio(void) {
+  schedOrder += 'A';
+  schedNowUs += 100;
+}
+
+static void schedInput(void) {
+  schedOrder += 'I';
+  schedNowUs += 200;
+}
+
+static void schedUi(void) {
+  schedOrder += 'U';
+  schedNowUs += 500;
+}
+
+static void schedUi2(void) {
+  schedOrder += 'u';
+  schedNowUs += 500;
+}
+
+static void schedNetwork(void) {
+  schedOrder += 'N';
+  schedNowUs += 300;
+}
+
+// Works in 1 ms steps until its budget is used up, calling runCritical()
+// between steps as lengthy work in the player does
+static void schedYielding(void) {
+  schedOrder += 'Y';
+  do {
+    schedNowUs += 1000;
+    schedSteps++;
+    schedUnderTest->runCritical();
+  } while (!schedUnderTest->shouldYield());
+}
+
+// Runs for 30 ms without yielding
+static void schedBlocking(void) {
+  schedOrder += 'B';
+  schedNowUs += 30000;
+}
+
+static const TASK *schedTask(Scheduler &s, const char *name) {
+  for (int i = 0; i < s.getTaskCount(); i++) {
+    if (!strcmp(s.getTask(i)->name, name)) {
+      return s.getTask(i);
+    }
+  }
+  return NULL;
+}
+
+// Scheduler priority order, periods, budgets and deadline misses
+// against a virtual clock
+static int schedTest(void) {
+
+  int wrong = 0;
+  auto check = [&](bool ok, const char *what) {
+    if (!ok) {
+      fprintf(stderr, "%s\n", what);
+      wrong++;
+    }
+  };
+
+  // Added out of order, run by priority with the audio task before every
+  // other task. Equal priorities keep the order they were added in.
+  {
+    schedNowUs = 0;
+    Scheduler s(schedClock);
+    s.addTask("network", schedNetwork, TP_NETWORK, 0, 0, 0);
+    s.addTask("ui",      schedUi,      TP_UI,      0, 0, 0);
+    s.addTask("audio",   schedAudio,   TP_AUDIO,   0, 0, 0);
+    s.addTask("ui2",     schedUi2,     TP_UI,      0, 0, 0);
+    s.addTask("input",   schedInput,   TP_INPUT,   0, 0, 0);
+    schedOrder.clear();
+    s.runPass();
+    printf("one pass              %s\n", schedOrder.c_str());
+    check(schedOrder == "AAIAUAuAN", "tasks don't run in priority order");
+
+    // Disabled tasks don't run
+    s.setEnabled("ui", false);
+    schedOrder.clear();
+    s.runPass();
+    check(schedOrder == "AAIAuAN", "a disabled task runs");
+  }
+
+  // Periodic tasks run once per period, however often the loop passes
+  {
+    schedNowUs = 0;
+    Scheduler s(schedClock);
+    s.addTask("audio", schedAudio, TP_AUDIO, 0, 0, 0);
+    s.addTask("input", schedInput, TP_INPUT, 5000, 0, 0);
+    s.addTask("ui",    schedUi,    TP_UI,   20000, 0, 0);
+    while (schedNowUs < 1000000) {
+      s.runPass();
+      schedNowUs += 50;
+    }
+    uint32_t input = schedTask(s, "input")->runs;
+    uint32_t ui = schedTask(s, "ui")->runs;
+    printf("1 s of passes         input %u runs (period 5 ms), ui %u runs (period 20 ms)\n", input, ui);
+    // Both also run at the start
+    check(input == 201 && ui == 51, "periodic tasks don't run once per period");
+  }
+
+  // A task that yields when its budget is used up, with audio due every
+  // 2 ms run from its preemption points
+  {
+    schedNowUs = 0;
+    Scheduler s(schedClock);
+    schedUnderTest = &s;
+    s.addTask("audio",   schedAudio,    TP_AUDIO,      2000, 2500, 0);
+    s.addTask("yield",   schedYielding, TP_BACKGROUND, 0,    0,     5000);
+    schedSteps = 0;
+    for (int i = 0; i < 100; i++) {
+      s.runPass();
+    }
+    const TASK *yield = schedTask(s, "yield");
+    const TASK *audio = schedTask(s, "audio");
+    printf("budget 5 ms           %u runs, %.2f steps of 1 ms each, %u overruns\n",
+           yield->runs, (double) schedSteps / yield->runs, yield->overruns);
+    printf("                      audio %u runs, %u late, latest %u us\n",
+           audio->runs, audio->misses, audio->maxLateUs);
+    check(yield->runs == 100 && schedSteps == 500, "a task doesn't yield when its budget is used up");
+    check(yield->overruns == 0 && yield->maxRunUs == 5000, "audio run from a task counts against its budget");
+    check(audio->misses == 0 && audio->maxLateUs <= 1000, "audio doesn't run from preemption points");
+
+    // Without the yield it overruns and audio misses its deadline
+    s.addTask("block", schedBlocking, TP_BACKGROUND, 100000, 0, 5000);
+    s.resetStats();
+    check(s.getPasses() == 0 && audio->runs == 0 && audio->misses == 0, "statistics aren't reset");
+    const TASK *block = schedTask(s, "block");
+    uint32_t end = schedNowUs + 1000000;
+    while ((int32_t)(schedNowUs - end) < 0) {
+      s.runPass();
+    }
+    // Audio's run after the last block
+    s.runPass();
+    printf("30 ms blocking task   %u runs, %u overruns; audio %u late, latest %u us\n",
+           block->runs, block->overruns, audio->misses, audio->maxLateUs);
+    check(block->overruns == block->runs && block->runs >= 9, "overruns aren't counted");
+    check(audio->misses == block->runs, "audio deadline misses aren't counted once per block");
+    check(audio->maxLateUs >= 28000, "audio lateness isn't measured");
+  }
+
+  // Every pass tasks count a miss when the gap between runs is longer
+  // than their deadline. Time spent disabled isn't counted.
+  {
+    schedNowUs = 0;
+    Scheduler s(schedClock);
+    s.addTask("ui",    schedUi,       TP_UI,         0, 20000, 0);
+    s.addTask("block", schedBlocking, TP_BACKGROUND, 0, 0,     0);
+    for (int i = 0; i < 10; i++) {
+      s.runPass();
+    }
+    const TASK *ui = schedTask(s, "ui");
+    check(ui->misses == 9, "every pass task misses aren't counted");
+    s.setEnabled("ui", false);
+    schedNowUs += 1000000;
+    s.setEnabled("ui", true);
+    s.setEnabled("block", false);
+    s.runPass();
+    s.runPass();
+    check(ui->misses == 9, "time disabled counts as a miss");
+    printf("deadline 20 ms        ui %u misses in 10 passes behind a 30 ms task\n", ui->misses);
+  }
+
+  // A periodic task that fell several periods behind runs once, not in
+  // a burst to catch up
+  {
+    schedNowUs = 0;
+    Scheduler s(schedClock);
+    s.addTask("input", schedInput, TP_INPUT, 5000, 1000, 0);
+    s.runPass();
+    schedNowUs += 50000;
+    for (int i = 0; i < 10; i++) {
+      s.runPass();
+    }
+    const TASK *input = schedTask(s, "input");
+    check(input->runs == 2 && input->misses == 1, "a late periodic task runs a burst of catch up runs");
+  }
+
+  printf("%s\n", wrong ? "scheduler checks failed" : "scheduler checks passed");
+  return (wrong == 0) ? 0 : 1;
+}
+
+// Exact percentile of sorted samples, with the same rank rounding as
+// LatencyHistogram::percentile()
+static uint32_t exactPercentile(const std::vector<uint32_t> &sorted, uint32_t permille) {
+  uint32_t rank = (uint32_t)(((uint64_t) sorted.size() * permille + 999) / 1000);
+  return sorted[std::max(rank, (uint32_t) 1) - 1];
+}
+
+// LatencyHistogram bucket edges and percentiles and LoopStats worst
+// state tracking and reset
+static int loopStatsTest(void) {
+
+  int wrong = 0;
+  auto check = [&](bool ok, const char *what) {
+    if (!ok) {
+      fprintf(stderr, "%s\n", what);
+      wrong++;
+    }
+  };
+
+  // Bucket edges
+  check(LatencyHistogram::bucketOf(0) == 0 && LatencyHistogram::bucketUpper(0) == 0,
+        "0 us isn't bucket 0");
+  for (int n = 1; n < LATENCY_BUCKETS - 1; n++) {
+    uint32_t low = (uint32_t) 1 << (n - 1);
+    uint32_t high = ((uint32_t) 1 << n) - 1;
+    if ((LatencyHistogram::bucketOf(low) != n) || (LatencyHistogram::bucketOf(high) != n) ||
+        (LatencyHistogram::bucketUpper(n) != high)) {
+      fprintf(stderr, "bucket %d isn't %u .. %u us\n", n, low, high);
+      wrong++;
+    }
+  }
+  check(LatencyHistogram::bucketOf(1 << (LATENCY_BUCKETS - 2)) == LATENCY_BUCKETS - 1 &&
+        LatencyHistogram::bucketOf(UINT32_MAX) == LATENCY_BUCKETS - 1 &&
+        LatencyHistogram::bucketUpper(LATENCY_BUCKETS - 1) == UINT32_MAX,
+        "the last bucket doesn't take everything longer");
+
+  // Empty
+  LatencyHistogram h;
+  check(h.getCount() == 0 && h.getMax() == 0 && h.percentile(500) == 0 && h.percentile(1000) == 0,
+        "an empty histogram has samples");
+
+  // One sample is every percentile
+  h.record(700);
+  check(h.percentile(1) == 700 && h.percentile(500) == 700 && h.percentile(1000) == 700,
+        "one sample isn't every percentile");
+
+  // 100 short passes and one long one. p50 and p99 are the upper edge
+  // of the 8 .. 15 us bucket, p100 is capped at the max.
+  h.reset();
+  check(h.getCount() == 0 && h.getMax() == 0 && h.getBucket(LatencyHistogram::bucketOf(700)) == 0,
+        "reset leaves samples");
+  for (int i = 0; i < 100; i++) {
+    h.record(10);
+  }
+  h.record(5000);
+  printf("100 x 10 us, 5000 us  p50 %u, p99 %u, p100 %u, max %u\n",
+         h.percentile(500), h.percentile(990), h.percentile(1000), h.getMax());
+  check(h.getCount() == 101 && h.percentile(500) == 15 && h.percentile(990) == 15 &&
+        h.percentile(1000) == 5000 && h.getMax() == 5000,
+        "percentiles of 100 x 10 us and 5000 us are wrong");
+
+  // Longer than the last bucket's lower edge
+  h.record(2000000000);
+  check(h.getBucket(LATENCY_BUCKETS - 1) == 1 && h.percentile(1000) == 2000000000,
+        "a very long pass isn't in the last bucket");
+
+  // Random samples against the exact percentiles. The histogram's answer
+  // is in the same bucket as the exact one, no less and no more than the
+  // max.
+  halRandomSeed(1);
+  const uint32_t permilles[] = { 1, 100, 500, 900, 990, 999, 1000 };
+  for (int round = 0; round < 200; round++) {
+    h.reset();
+    std::vector<uint32_t> samples(1 + halRandom(5000));
+    for (uint32_t &us : samples) {
+      // Mostly short with a long tail, as loop passes are
+      us = (round & 1) ? halRandom(20000) : halRandom(1 << halRandom(23));
+      h.record(us);
+    }
+    std::sort(samples.begin(), samples.end());
+    if (h.getMax() != samples.back() || h.getCount() != samples.size()) {
+      fprintf(stderr, "round %d count or max is wrong\n", round);
+      wrong++;
+    }
+    for (uint32_t permille : permilles) {
+      uint32_t exact = exactPercentile(samples, permille);
+      uint32_t got = h.percentile(permille);
+      if ((got < exact) || (got > h.getMax()) ||
+          (LatencyHistogram::bucketOf(got) != LatencyHistogram::bucketOf(exact))) {
+        fprintf(stderr, "round %d p%.1f is %u us, exactly %u us\n", round, permille / 10.0, got, exact);
+        wrong++;
+      }
+    }
+  }
+
+  // Per state histograms and the worst pass
+  LoopStats<4> stats;
+  stats.record(-1, 100000);
+  stats.record(4, 100000);
+  check(stats.getWorstState() == -1 && stats.getWorstUs() == 0,
+        "out of range states are recorded");
+  stats.record(1, 100);
+  stats.record(2, 5000);
+  stats.record(3, 300);
+  stats.record(0, 5000);
+  printf("LoopStats             worst %u us in state %d\n", stats.getWorstUs(), stats.getWorstState());
+  check(stats.getWorstState() == 2 && stats.getWorstUs() == 5000,
+        "the worst pass isn't the first longest");
+  check(stats.get(0).getCount() == 1 && stats.get(1).getCount() == 1 &&
+        stats.get(2).getMax() == 5000 && stats.get(3).percentile(500) == 300,
+        "passes aren't recorded in their state");
+  stats.reset();
+  bool empty = true;
+  for (int i = 0; i < 4; i++) {
+    empty = empty && (stats.get(i).getCount() == 0) && (stats.get(i).percentile(990) == 0);
+  }
+  check(empty && stats.getWorstState() == -1 && stats.getWorstUs() == 0,
+        "reset leaves passes");
+  stats.record(3, 7);
+  check(stats.getWorstState() == 3 && stats.getWorstUs() == 7,
+        "the worst pass isn't tracked after a reset");
+
+  printf("%s\n", wrong ? "loop stats checks failed" : "loop stats checks passed");
+  return (wrong == 0) ? 0 : 1;
+}
+
+int main(int argc, char **argv) {
+
+  if (argc < 3) {
+    fprintf(stderr, "usage: hostplayer <music-dir> bench [picks] | cachebench [steps] | "
+                    "namebench [names] | browsebench | albumbench [rounds] | "
+                    "smartbench [tracks] | statsbench [tracks] | historytest [steps] | "
+                    "playlisttest | playlistbench [entries] | "
+                    "schedtest | loopstatstest | browse | "
+                    "replay <log> [-v]\n");
+    return 2;
+  }
+
+  halRandomSeed(time(NULL));
+
+  halFs = new PosixFileSystem(argv[1]);
+  MusicLibrary library(halFs);
+
+  hostPlayer = new SilentSongPlayer(&fsmClock, halFs, &halAudio);
+  hostHal = { &fsmClock, NULL, NULL, halFs, NULL, &halAudio, &halDisplay,
+              &hostInput, hostPlayer, &hostCard, &hostRemote, &hostSystem };
+  fsmBegin(&hostHal, NULL, NULL);
+
+  if (!strcmp(argv[2], "bench")) {
+    return bench(library, (argc > 3) ? atoi(argv[3]) : 1000);
+  }
+  if (!strcmp(argv[2], "cachebench")) {
+    return cacheBench((argc > 3) ? atoi(argv[3]) : 10000);
+  }
+  if (!strcmp(argv[2], "namebench")) {
+    return nameBench((argc > 3) ? atoi(argv[3]) : 50000);
+  }
+  if (!strcmp(argv[2], "browsebench")) {
+    return browseBench(library);
+  }
+  if (!strcmp(argv[2], "albumbench")) {
+    return albumBench(library, (argc > 3) ? atoi(argv[3]) : 3);
+  }
+  if (!strcmp(argv[2], "smartbench")) {
+    return smartBench((argc > 3) ? atoi(argv[3]) : 100000);
+  }
+  if (!strcmp(argv[2], "statsbench")) {
+    return statsBench(argv[1], (argc > 3) ? atoi(argv[3]) : 20000);
+  }
+  if (!strcmp(argv[2], "historytest")) {
+    return historyTest((argc > 3) ? atoi(argv[3]) : 100000);
+  }
+  if (!strcmp(argv[2], "playlisttest")) {
+    return playlistTest();
+  }
+  if (!strcmp(argv[2], "playlistbench")) {
+    return playlistBench(argv[1], (argc > 3) ? atoi(argv[3]) : 2000);
+  }
+  if (!strcmp(argv[2], "schedtest")) {
+    return schedTest();
+  }
+  if (!strcmp(argv[2], "loopstatstest")) {
+    return loopStatsTest();
+  }
+  if (!strcmp(argv[2], "browse")) {
+    return browse();
+  }
+  if (!strcmp(argv[2], "replay") && argc > 3) {
+    return replay(argv[3], (argc > 4) && !strcmp(argv[4], "-v"));
+  }
+  fprintf(stderr, "unknown command %s\n", argv[2]);
+  return 2;
+}
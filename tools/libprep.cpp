@@ -0,0 +1,982 @@
+/*
+   Builds the player's library index (see LibraryIndex.h) for a copy of
+   the SD card on a host
+
+   Every .mp3 below <music-dir> is read on a pool of threads: its ID3v2
+   (2.2, 2.3 or 2.4) or ID3v1 tags give the title, artist, album,
+   genre, year and track number, and walking its MP3 frames gives the
+   exact duration, sample rate, average bit rate and a seek table. The
+   index is written to <music-dir>/.library/index.bin with the same
+   encoder the player's reader decodes, then every song is looked up
+   through the reader to check it.
+
+   The browse indexes (see BrowseIndex.h) are written after it: songs
+   grouped by genre, by decade and by the month they were added, which
+   is their modification time, and by album folder in track order.
+
+   The player's play statistics (see PlayStats.h) and shuffle history
+   (see ShuffleHistory.h) are addressed by track number, so those of
+   the songs still on the card are moved to their new track numbers.
+
+   An existing index is read first and the records of songs with the
+   same size and modification time are kept, so only new and changed
+   songs are read again.
+
+   With -a the cover art embedded in each song read (the APIC or PIC
+   frame) is written as is to .library/art/<hash>.jpg or .png, hash
+   being halHash() of the song's path in hex. Waveform peaks and
+   loudness aren't made as the host build has no MP3 decoder.
+
+   Build:
+     g++ -O2 -std=c++11 -pthread -o libprep libprep.cpp
+
+   Usage:
+     libprep [options] <music-dir>
+
+   Options:
+     -j n  threads (default the number of cores)
+     -f    read every song, ignoring the existing index
+     -a    write cover art sidecars
+     -v    print each song read
+
+   Last Update: 10/18/2026
+*/
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../BrowseIndex.h"
+#include "../HalLinux.h"
+#include "../LibraryIndex.h"
+#include "../PlayStats.h"
+#include "../ShuffleHistory.h"
+
+static const char *const SONG_EXTENSIONS[] = { "mp3", NULL };
+
+// Genres of ID3v1 and of "(n)" references in ID3v2
+static const char *const GENRES[] = {
+  "Blues", "Classic Rock", "Country", "Dance", "Disco", "Funk", "Grunge", "Hip-Hop",
+  "Jazz", "Metal", "New Age", "Oldies", "Other", "Pop", "R&B", "Rap", "Reggae", "Rock",
+  "Techno", "Industrial", "Alternative", "Ska", "Death Metal", "Pranks", "Soundtrack",
+  "Euro-Techno", "Ambient", "Trip-Hop", "Vocal", "Jazz+Funk", "Fusion", "Trance",
+  "Classical", "Instrumental", "Acid", "House", "Game", "Sound Clip", "Gospel", "Noise",
+  "Alternative Rock", "Bass", "Soul", "Punk", "Space", "Meditative", "Instrumental Pop",
+  "Instrumental Rock", "Ethnic", "Gothic", "Darkwave", "Techno-Industrial", "Electronic",
+  "Pop-Folk", "Eurodance", "Dream", "Southern Rock", "Comedy", "Cult", "Gangsta",
+  "Top 40", "Christian Rap", "Pop/Funk", "Jungle", "Native American", "Cabaret",
+  "New Wave", "Psychedelic", "Rave", "Showtunes", "Trailer", "Lo-Fi", "Tribal",
+  "Acid Punk", "Acid Jazz", "Polka", "Retro", "Musical", "Rock & Roll", "Hard Rock"
+};
+#define GENRE_COUNT (int)(sizeof(GENRES) / sizeof(GENRES[0]))
+
+static inline uint16_t get16(const uint8_t *p) {
+  return p[0] | (p[1] << 8);
+}
+
+static inline uint32_t get32(const uint8_t *p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static inline uint32_t get32be(const uint8_t *p) {
+  return ((uint32_t) p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static void put32(std::vector<uint8_t> &out, uint32_t v) {
+  for (int i = 0; i < 4; i++) {
+    out.push_back(v >> (8 * i));
+  }
+}
+
+typedef struct {
+  std::string path;  // from the card's root
+  uint32_t size;
+  uint32_t mtime;
+  boolean reused;
+  boolean ok;
+  LIBRARY_TRACK track;
+} SONG;
+
+static std::string root;
+static boolean writeArt = false;
+static boolean verbose = false;
+static std::mutex printLock;
+
+// Songs below dir, as paths from the root
+static void findSongs(const std::string &dir, std::vector<SONG> &songs) {
+
+  DIR *d = opendir((root + dir).c_str());
+  if (d == NULL) {
+    return;
+  }
+  struct dirent *e;
+  while ((e = readdir(d)) != NULL) {
+    if (e->d_name[0] == '.') {
+      continue;
+    }
+    std::string path = dir + "/" + e->d_name;
+    struct stat st;
+    if (stat((root + path).c_str(), &st) != 0) {
+      continue;
+    }
+    if (S_ISDIR(st.st_mode)) {
+      findSongs(path, songs);
+    } else if (S_ISREG(st.st_mode) && halHasExtension(e->d_name, SONG_EXTENSIONS)) {
+      SONG song;
+      song.path = path;
+      song.size = st.st_size;
+      song.mtime = st.st_mtime;
+      song.reused = false;
+      song.ok = false;
+      songs.push_back(song);
+    }
+  }
+  closedir(d);
+}
+
+// Records of the existing index by path
+static std::map<std::string, LIBRARY_TRACK> readIndex(const std::string &path) {
+
+  std::map<std::string, LIBRARY_TRACK> tracks;
+  FILE *f = fopen(path.c_str(), "rb");
+  if (f == NULL) {
+    return tracks;
+  }
+  std::vector<uint8_t> data;
+  uint8_t buffer[65536];
+  size_t n;
+  while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0) {
+    data.insert(data.end(), buffer, buffer + n);
+  }
+  fclose(f);
+
+  if ((data.size() < LIBRARY_INDEX_HEADER) || (get32(&data[0]) != LIBRARY_INDEX_MAGIC) ||
+      (get32(&data[4]) != LIBRARY_INDEX_VERSION)) {
+    return tracks;
+  }
+  uint32_t count = get32(&data[8]);
+  for (uint32_t i = 0; (i < count) && (LIBRARY_INDEX_HEADER + 4 * (i + 1) <= data.size()); i++) {
+    uint32_t offset = get32(&data[LIBRARY_INDEX_HEADER + 4 * i]);
+    if (offset + 2 > data.size()) {
+      continue;
+    }
+    uint32_t length = get16(&data[offset]);
+    char name[256];
+    LIBRARY_TRACK track;
+    if ((offset + length <= data.size()) &&
+        LibraryIndex::decode(&data[offset], length, name, &track)) {
+      tracks[name] = track;
+    }
+  }
+  return tracks;
+}
+
+static void copyString(char *to, const std::string &from) {
+  size_t length = std::min(from.size(), (size_t)(HAL_NAME_SIZE - 1));
+  // Don't cut a UTF-8 character in two
+  while ((length < from.size()) && (length > 0) && ((from[length] & 0xC0) == 0x80)) {
+    length--;
+  }
+  memcpy(to, from.data(), length);
+  to[length] = '\0';
+}
+
+static void appendUtf8(std::string &out, uint32_t c) {
+  if (c < 0x80) {
+    out += (char) c;
+  } else if (c < 0x800) {
+    out += (char)(0xC0 | (c >> 6));
+    out += (char)(0x80 | (c & 0x3F));
+  } else if (c < 0x10000) {
+    out += (char)(0xE0 | (c >> 12));
+    out += (char)(0x80 | ((c >> 6) & 0x3F));
+    out += (char)(0x80 | (c & 0x3F));
+  } else {
+    out += (char)(0xF0 | (c >> 18));
+    out += (char)(0x80 | ((c >> 12) & 0x3F));
+    out += (char)(0x80 | ((c >> 6) & 0x3F));
+    out += (char)(0x80 | (c & 0x3F));
+  }
+}
+
+// An ID3 text frame's value in UTF-8, up to its first NUL
+static std::string id3Text(const uint8_t *p, size_t length) {
+
+  std::string out;
+  if (length == 0) {
+    return out;
+  }
+  uint8_t encoding = p[0];
+  p++;
+  length--;
+
+  if ((encoding == 1) || (encoding == 2)) {
+    // UTF-16 with a byte order mark, or big endian without one
+    boolean big = (encoding == 2);
+    size_t i = 0;
+    if ((encoding == 1) && (length >= 2)) {
+      big = (p[0] == 0xFE) && (p[1] == 0xFF);
+      i = 2;
+    }
+    for (; i + 1 < length; i += 2) {
+      uint32_t c = big ? ((p[i] << 8) | p[i + 1]) : (p[i] | (p[i + 1] << 8));
+      if (c == 0) {
+        break;
+      }
+      if ((c >= 0xD800) && (c < 0xDC00) && (i + 3 < length)) {
+        uint32_t low = big ? ((p[i + 2] << 8) | p[i + 3]) : (p[i + 2] | (p[i + 3] << 8));
+        c = 0x10000 + ((c - 0xD800) << 10) + (low - 0xDC00);
+        i += 2;
+      }
+      appendUtf8(out, c);
+    }
+  } else {
+    for (size_t i = 0; (i < length) && (p[i] != 0); i++) {
+      if (encoding == 3) {
+        out += (char) p[i];
+      } else {
+        appendUtf8(out, p[i]);  // ISO-8859-1
+      }
+    }
+  }
+  while (!out.empty() && (out.back() == ' ')) {
+    out.pop_back();
+  }
+  return out;
+}
+
+// Genre names for "(n)", "n" and ID3v1 numbers
+static std::string genreName(const std::string &genre) {
+
+  std::string g = genre;
+  if ((g.size() > 2) && (g[0] == '(') && isdigit((uint8_t) g[1])) {
+    size_t close = g.find(')');
+    if ((close != std::string::npos) && (close + 1 < g.size())) {
+      return g.substr(close + 1);  // "(17)Rock"
+    }
+    g = g.substr(1, close - 1);
+  }
+  if (!g.empty() && (g.find_first_not_of("0123456789") == std::string::npos)) {
+    int n = atoi(g.c_str());
+    return (n < GENRE_COUNT) ? GENRES[n] : "";
+  }
+  return g;
+}
+
+static uint32_t syncsafe(const uint8_t *p) {
+  return ((p[0] & 0x7F) << 21) | ((p[1] & 0x7F) << 14) | ((p[2] & 0x7F) << 7) | (p[3] & 0x7F);
+}
+
+typedef struct {
+  std::string title, artist, album, genre, year, track;
+  const uint8_t *art;
+  size_t artLength;
+  boolean png;
+} TAGS;
+
+// Read the ID3v2 tag at the start of data. Returns its length.
+static size_t readId3v2(const std::vector<uint8_t> &data, TAGS &tags) {
+
+  if ((data.size() < 10) || memcmp(&data[0], "ID3", 3) || (data[3] < 2) || (data[3] > 4)) {
+    return 0;
+  }
+  uint8_t version = data[3];
+  uint8_t flags = data[5];
+  size_t length = 10 + syncsafe(&data[6]) + ((flags & 0x10) ? 10 : 0);
+  size_t end = std::min(data.size(), (size_t)(10 + syncsafe(&data[6])));
+  size_t p = 10;
+  if ((flags & 0x40) && (version > 2) && (p + 4 <= end)) {
+    // Extended header
+    p += (version == 4) ? syncsafe(&data[p]) : 4 + get32be(&data[p]);
+  }
+
+  size_t header = (version == 2) ? 6 : 10;
+  while (p + header <= end) {
+    char id[5] = { 0 };
+    size_t size;
+    memcpy(id, &data[p], (version == 2) ? 3 : 4);
+    if (id[0] == 0) {
+      break;  // padding
+    }
+    if (version == 2) {
+      size = (data[p + 3] << 16) | (data[p + 4] << 8) | data[p + 5];
+    } else if (version == 4) {
+      size = syncsafe(&data[p + 4]);
+    } else {
+      size = get32be(&data[p + 4]);
+    }
+    p += header;
+    if (size > end - p) {
+      break;
+    }
+    const uint8_t *f = &data[p];
+    std::string name = id;
+    if ((name == "TIT2") || (name == "TT2")) {
+      tags.title = id3Text(f, size);
+    } else if ((name == "TPE1") || (name == "TP1")) {
+      tags.artist = id3Text(f, size);
+    } else if ((name == "TALB") || (name == "TAL")) {
+      tags.album = id3Text(f, size);
+    } else if ((name == "TCON") || (name == "TCO")) {
+      tags.genre = genreName(id3Text(f, size));
+    } else if ((name == "TYER") || (name == "TDRC") || (name == "TYE")) {
+      tags.year = id3Text(f, size);
+    } else if ((name == "TRCK") || (name == "TRK")) {
+      tags.track = id3Text(f, size);
+    } else if (((name == "APIC") || (name == "PIC")) && (tags.art == NULL) && (size > 4)) {
+      // Encoding, MIME type (or a 3 letter format), picture type and
+      // a description come before the image
+      size_t i = 1;
+      std::string mime;
+      if (version == 2) {
+        mime = std::string((const char *) f + 1, 3);
+        i = 4;
+      } else {
+        while ((i < size) && f[i]) {
+          mime += (char) tolower(f[i++]);
+        }
+        i++;
+      }
+      i++;  // picture type
+      boolean wide = (f[0] == 1) || (f[0] == 2);
+      while ((i < size) && (wide ? (f[i] || ((i + 1 < size) && f[i + 1])) : f[i])) {
+        i += wide ? 2 : 1;
+      }
+      i += wide ? 2 : 1;
+      if (i < size) {
+        tags.art = f + i;
+        tags.artLength = size - i;
+        tags.png = (mime.find("png") != std::string::npos) || (mime == "PNG");
+      }
+    }
+    p += size;
+  }
+  return std::min(length, data.size());
+}
+
+// ID3v1 tag at the end of data, filling in what ID3v2 didn't
+static boolean readId3v1(const std::vector<uint8_t> &data, TAGS &tags) {
+
+  if ((data.size() < 128) || memcmp(&data[data.size() - 128], "TAG", 3)) {
+    return false;
+  }
+  const uint8_t *t = &data[data.size() - 128];
+  if (tags.title.empty()) {
+    uint8_t b[31] = { 0 };
+    memcpy(b + 1, t + 3, 30);
+    tags.title = id3Text(b, 31);
+  }
+  if (tags.artist.empty()) {
+    uint8_t b[31] = { 0 };
+    memcpy(b + 1, t + 33, 30);
+    tags.artist = id3Text(b, 31);
+  }
+  if (tags.album.empty()) {
+    uint8_t b[31] = { 0 };
+    memcpy(b + 1, t + 63, 30);
+    tags.album = id3Text(b, 31);
+  }
+  if (tags.year.empty()) {
+    tags.year = std::string((const char *) t + 93, strnlen((const char *) t + 93, 4));
+  }
+  if (tags.track.empty() && (t[125] == 0) && (t[126] != 0)) {
+    tags.track = std::to_string(t[126]);
+  }
+  if (tags.genre.empty() && (t[127] < GENRE_COUNT)) {
+    tags.genre = GENRES[t[127]];
+  }
+  return true;
+}
+
+// Lower case ASCII without a leading "The "
+static std::string sortFold(const std::string &s) {
+  std::string out;
+  for (char c : s) {
+    out += tolower((uint8_t) c);
+  }
+  if (out.compare(0, 4, "the ") == 0) {
+    out.erase(0, 4);
+  }
+  return out;
+}
+
+// MPEG audio layer III frame header at p. Returns the frame length or
+// 0 if it isn't one, with its sample rate, samples and bit rate.
+static uint32_t frameHeader(const uint8_t *p, uint32_t *sampleRate, uint32_t *samples, uint32_t *kbps) {
+
+  static const uint16_t kbpsV1[16] = { 0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 0 };
+  static const uint16_t kbpsV2[16] = { 0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160, 0 };
+  static const uint16_t rates[3] = { 44100, 48000, 32000 };
+
+  if ((p[0] != 0xFF) || ((p[1] & 0xE0) != 0xE0)) {
+    return 0;
+  }
+  int version = (p[1] >> 3) & 3;  // 3 MPEG-1, 2 MPEG-2, 0 MPEG-2.5
+  int layer = (p[1] >> 1) & 3;    // 1 layer III
+  int rateIndex = (p[2] >> 2) & 3;
+  int kbpsIndex = p[2] >> 4;
+  if ((version == 1) || (layer != 1) || (rateIndex == 3) || (kbpsIndex == 0) || (kbpsIndex == 15)) {
+    return 0;
+  }
+  *kbps = (version == 3) ? kbpsV1[kbpsIndex] : kbpsV2[kbpsIndex];
+  *sampleRate = rates[rateIndex] >> ((version == 3) ? 0 : (version == 2) ? 1 : 2);
+  *samples = (version == 3) ? 1152 : 576;
+  uint32_t padding = (p[2] >> 1) & 1;
+  return ((version == 3) ? 144000 : 72000) * *kbps / *sampleRate + padding;
+}
+
+// True for a Xing or Info frame, which holds no audio
+static boolean isXingFrame(const uint8_t *p, uint32_t length) {
+  boolean mpeg1 = ((p[1] >> 3) & 3) == 3;
+  boolean mono = (p[3] >> 6) == 3;
+  uint32_t offset = 4 + (mpeg1 ? (mono ? 17 : 32) : (mono ? 9 : 17));
+  return (offset + 4 <= length) &&
+         (!memcmp(p + offset, "Xing", 4) || !memcmp(p + offset, "Info", 4));
+}
+
+// Walk the frames from start to end filling in the duration, rates and
+// seek table. Returns false if there are none.
+static boolean walkFrames(const std::vector<uint8_t> &data, size_t start, size_t end, LIBRARY_TRACK *track) {
+
+  uint64_t samples = 0;
+  uint64_t audioBytes = 0;
+  uint32_t sampleRate = 0;
+  uint32_t firstKbps = 0;
+  boolean vbr = false;
+  std::vector<uint32_t> perSecond;  // frame playing at each second
+  size_t p = start;
+  boolean synced = false;
+
+  while (p + 4 <= end) {
+    uint32_t rate, frameSamples, kbps;
+    uint32_t length = frameHeader(&data[p], &rate, &frameSamples, &kbps);
+    if ((length == 0) || (p + length > end) || (sampleRate && (rate != sampleRate))) {
+      p++;
+      synced = false;
+      continue;
+    }
+    if (!synced) {
+      // Only trust a header followed by another one
+      uint32_t r, s, k;
+      if ((p + length + 4 <= end) && (frameHeader(&data[p + length], &r, &s, &k) == 0)) {
+        p++;
+        continue;
+      }
+      synced = true;
+    }
+    if (sampleRate == 0) {
+      sampleRate = rate;
+      track->audioStart = p;
+      if (isXingFrame(&data[p], length)) {
+        p += length;
+        continue;
+      }
+    }
+    while ((uint64_t) perSecond.size() * sampleRate <= samples) {
+      perSecond.push_back(p);
+    }
+    if (firstKbps == 0) {
+      firstKbps = kbps;
+    } else if (kbps != firstKbps) {
+      vbr = true;
+    }
+    samples += frameSamples;
+    audioBytes += length;
+    p += length;
+  }
+  if (samples == 0) {
+    return false;
+  }
+
+  track->sampleRate = sampleRate;
+  track->durationMs = samples * 1000 / sampleRate;
+  track->kbps = (track->durationMs > 0) ? audioBytes * 8 / track->durationMs : firstKbps;
+  track->flags = vbr ? LTF_VBR : 0;
+  uint32_t seconds = perSecond.size();
+  uint32_t spacing = std::max((uint32_t) LIBRARY_SEEK_SECONDS, (seconds + LIBRARY_SEEK_MAX - 1) / LIBRARY_SEEK_MAX);
+  track->seekSeconds = std::min(spacing, (uint32_t) 255);
+  track->seekCount = 0;
+  for (uint32_t s = 0; (s < seconds) && (track->seekCount < LIBRARY_SEEK_MAX); s += track->seekSeconds) {
+    track->seek[track->seekCount++] = perSecond[s];
+  }
+  return true;
+}
+
+static void writeFile(const std::string &path, const uint8_t *data, size_t length) {
+  FILE *f = fopen(path.c_str(), "wb");
+  if (f != NULL) {
+    fwrite(data, 1, length, f);
+    fclose(f);
+  }
+}
+
+// Read the tags and frames of a song
+static boolean readSong(SONG &song) {
+
+  std::vector<uint8_t> data;
+  FILE *f = fopen((root + song.path).c_str(), "rb");
+  if (f == NULL) {
+    return false;
+  }
+  data.resize(song.size);
+  size_t n = fread(data.data(), 1, data.size(), f);
+  fclose(f);
+  data.resize(n);
+
+  LIBRARY_TRACK &track = song.track;
+  memset(&track, 0, sizeof(track));
+  track.size = song.size;
+  track.mtime = song.mtime;
+
+  TAGS tags;
+  tags.art = NULL;
+  tags.artLength = 0;
+  tags.png = false;
+  size_t start = readId3v2(data, tags);
+  size_t end = data.size();
+  if (readId3v1(data, tags)) {
+    end -= 128;
+  }
+  if ((end >= 32) && !memcmp(&data[end - 32], "APETAGEX", 8)) {
+    // APEv2 footer, and header if flagged
+    uint32_t ape = get32(&data[end - 20]) + ((get32(&data[end - 12]) & 0x80000000) ? 32 : 0);
+    end -= std::min(end, (size_t) ape);
+  }
+  if (!walkFrames(data, start, std::max(start, end), &track)) {
+    return false;
+  }
+
+  // The file's name stands in for a missing title
+  if (tags.title.empty()) {
+    std::string name = song.path.substr(song.path.find_last_of('/') + 1);
+    tags.title = name.substr(0, name.find_last_of('.'));
+  }
+  copyString(track.title, tags.title);
+  copyString(track.artist, tags.artist);
+  copyString(track.album, tags.album);
+  copyString(track.genre, tags.genre);
+  track.year = atoi(tags.year.c_str());
+  track.track = std::min(atoi(tags.track.c_str()), 255);
+
+  char number[8];
+  snprintf(number, sizeof(number), "%03d", track.track);
+  copyString(track.sortKey, sortFold(tags.artist) + "\x1F" + sortFold(tags.album) + "\x1F" +
+                            number + "\x1F" + sortFold(tags.title));
+
+  if (writeArt && (tags.art != NULL)) {
+    char name[32];
+    snprintf(name, sizeof(name), "/.library/art/%08x.%s", halHash(HAL_HASH_SEED, song.path.c_str()),
+             tags.png ? "png" : "jpg");
+    writeFile(root + name, tags.art, tags.artLength);
+  }
+  return true;
+}
+
+// The new track number of each song of the old index, UINT32_MAX for
+// those gone, or none if there's no old index. Read before the old
+// index is replaced.
+static std::vector<uint32_t> moveTracks(const std::vector<SONG> &songs) {
+
+  std::vector<uint32_t> moved;
+  PosixFileSystem fs(root.c_str());
+  LibraryIndex index;
+  if (!index.open(&fs)) {
+    return moved;
+  }
+  std::map<std::string, uint32_t> newTracks;
+  uint32_t count = 0;
+  for (const SONG &song : songs) {
+    if (song.ok) {
+      newTracks[song.path] = count++;
+    }
+  }
+  moved.assign(index.getCount(), UINT32_MAX);
+  for (uint32_t i = 0; i < index.getCount(); i++) {
+    char path[256];
+    std::map<std::string, uint32_t>::iterator it;
+    if (index.getPath(i, path) && ((it = newTracks.find(path)) != newTracks.end())) {
+      moved[i] = it->second;
+    }
+  }
+  return moved;
+}
+
+static std::vector<uint8_t> readAll(const std::string &path) {
+  std::vector<uint8_t> data;
+  FILE *f = fopen(path.c_str(), "rb");
+  if (f == NULL) {
+    return data;
+  }
+  uint8_t b[4096];
+  size_t n;
+  while ((n = fread(b, 1, sizeof(b), f)) > 0) {
+    data.insert(data.end(), b, b + n);
+  }
+  fclose(f);
+  return data;
+}
+
+// The play statistics of the songs still on the card at their new
+// track numbers, empty if there are none. Their log is compacted into
+// them first, leaving it empty for the player to start again.
+static std::vector<uint8_t> remapStats(const std::vector<uint32_t> &moved, uint32_t count, uint32_t *kept) {
+
+  std::vector<uint8_t> out;
+  *kept = 0;
+  PosixFileSystem fs(root.c_str());
+  PlayStats stats;
+  if (moved.empty() || !fs.exists(PLAY_STATS_PATH) || !stats.open(&fs, moved.size()) || !stats.compact()) {
+    return out;
+  }
+  stats.close();
+  std::vector<uint8_t> old = readAll(root + PLAY_STATS_PATH);
+  if ((old.size() < PLAY_STATS_HEADER) || (get32(&old[0]) != PLAY_STATS_MAGIC) ||
+      (get32(&old[4]) != PLAY_STATS_VERSION) || (get32(&old[8]) != moved.size()) ||
+      (old.size() < PLAY_STATS_HEADER + (size_t) PLAY_STATS_RECORD * moved.size())) {
+    return out;
+  }
+
+  put32(out, PLAY_STATS_MAGIC);
+  put32(out, PLAY_STATS_VERSION);
+  put32(out, count);
+  put32(out, get32(&old[12]));
+  out.resize(PLAY_STATS_HEADER + (size_t) PLAY_STATS_RECORD * count, 0);
+  for (uint32_t i = 0; i < moved.size(); i++) {
+    if (moved[i] != UINT32_MAX) {
+      const uint8_t *record = &old[PLAY_STATS_HEADER + PLAY_STATS_RECORD * i];
+      std::copy(record, record + PLAY_STATS_RECORD, &out[PLAY_STATS_HEADER + PLAY_STATS_RECORD * moved[i]]);
+      (*kept)++;
+    }
+  }
+  return out;
+}
+
+// The shuffle history without the songs gone and at the new track
+// numbers, empty if there's none. The cursor stays on the song it was
+// on, or the one before if that's gone.
+static std::vector<uint8_t> remapHistory(const std::vector<uint32_t> &moved, uint32_t count, uint32_t *kept) {
+
+  std::vector<uint8_t> out;
+  *kept = 0;
+  std::vector<uint8_t> old = readAll(root + SHUFFLE_HISTORY_PATH);
+  if (moved.empty() || (old.size() < SHUFFLE_HISTORY_HEADER) || (get32(&old[0]) != SHUFFLE_HISTORY_MAGIC) ||
+      (get32(&old[4]) != SHUFFLE_HISTORY_VERSION) || (get32(&old[8]) != moved.size()) ||
+      (old[12] > SHUFFLE_HISTORY_SIZE) || (old[13] >= std::max((int) old[12], 1)) ||
+      (old.size() < SHUFFLE_HISTORY_HEADER + 4 * (size_t) old[12])) {
+    return out;
+  }
+
+  // Oldest first, so the song under the cursor is old[12] - 1 - cursor
+  std::vector<uint32_t> tracks;
+  int cursor = 0;
+  for (int i = 0; i < old[12]; i++) {
+    uint32_t track = get32(&old[SHUFFLE_HISTORY_HEADER + 4 * i]);
+    if ((track < moved.size()) && (moved[track] != UINT32_MAX)) {
+      tracks.push_back(moved[track]);
+      cursor += (i > old[12] - 1 - old[13]) ? 1 : 0;
+    }
+  }
+  *kept = tracks.size();
+  put32(out, SHUFFLE_HISTORY_MAGIC);
+  put32(out, SHUFFLE_HISTORY_VERSION);
+  put32(out, count);
+  out.push_back(tracks.size());
+  out.push_back(std::min(cursor, std::max((int) tracks.size() - 1, 0)));
+  for (uint32_t track : tracks) {
+    put32(out, track);
+  }
+  return out;
+}
+
+// What the list box shows for a song: "Artist - Title", or the file
+// name if it isn't tagged
+static std::string songLabel(const SONG &song) {
+  std::string title = song.track.title;
+  if (title.empty()) {
+    size_t slash = song.path.rfind('/');
+    title = song.path.substr(slash + 1, song.path.rfind('.') - slash - 1);
+  }
+  return (song.track.artist[0] != '\0') ? std::string(song.track.artist) + " - " + title : title;
+}
+
+// Write songs grouped by key, given each song's index track number.
+// Groups and the songs in them are ordered by groupOrder and songOrder.
+static boolean writeBrowseIndex(const std::string &path, const std::vector<const SONG *> &indexed,
+                                std::string (*key)(const SONG &),
+                                boolean (*groupOrder)(const std::string &, const std::string &),
+                                boolean (*songOrder)(const SONG &, const SONG &),
+                                std::string (*label)(const SONG &)) {
+
+  std::map<std::string, std::vector<uint32_t>> grouped;
+  for (uint32_t i = 0; i < indexed.size(); i++) {
+    grouped[key(*indexed[i])].push_back(i);
+  }
+  std::vector<BROWSE_GROUP> groups;
+  for (std::map<std::string, std::vector<uint32_t>>::value_type &g : grouped) {
+    BROWSE_GROUP group;
+    group.name = g.first;
+    group.tracks = g.second;
+    std::stable_sort(group.tracks.begin(), group.tracks.end(),
+                     [&](uint32_t a, uint32_t b) { return songOrder(*indexed[a], *indexed[b]); });
+    for (uint32_t t : group.tracks) {
+      group.labels.push_back(label(*indexed[t]));
+    }
+    groups.push_back(group);
+  }
+  std::stable_sort(groups.begin(), groups.end(),
+                   [&](const BROWSE_GROUP &a, const BROWSE_GROUP &b) { return groupOrder(a.name, b.name); });
+
+  std::vector<uint8_t> file;
+  BrowseIndex::encode(groups, file);
+  std::string tmpPath = path + ".tmp";
+  writeFile(tmpPath, file.data(), file.size());
+  if (rename(tmpPath.c_str(), path.c_str()) != 0) {
+    fprintf(stderr, "can't write %s\n", path.c_str());
+    return false;
+  }
+  printf("%s: %zu groups, %zu bytes\n", path.c_str(), groups.size(), file.size());
+  return true;
+}
+
+// Group orders: by name ignoring case with "Unknown" last, and newest first
+static boolean byName(const std::string &a, const std::string &b) {
+  if ((a == "Unknown") || (b == "Unknown")) {
+    return b == "Unknown" && a != "Unknown";
+  }
+  return sortFold(a) < sortFold(b);
+}
+
+static boolean newestFirst(const std::string &a, const std::string &b) {
+  return a > b;
+}
+
+static std::string genreKey(const SONG &song) {
+  return (song.track.genre[0] != '\0') ? song.track.genre : "Unknown";
+}
+
+static std::string decadeKey(const SONG &song) {
+  return (song.track.year != 0) ? std::to_string(song.track.year / 10 * 10) + "s" : "Unknown";
+}
+
+static std::string monthKey(const SONG &song) {
+  time_t t = song.mtime;
+  char month[16];
+  strftime(month, sizeof(month), "%Y-%m", localtime(&t));
+  return month;
+}
+
+static boolean bySortKey(const SONG &a, const SONG &b) {
+  return strcmp(a.track.sortKey, b.track.sortKey) < 0;
+}
+
+static boolean byYear(const SONG &a, const SONG &b) {
+  return (a.track.year != b.track.year) ? a.track.year < b.track.year : bySortKey(a, b);
+}
+
+static boolean byNewest(const SONG &a, const SONG &b) {
+  return (a.mtime != b.mtime) ? a.mtime > b.mtime : bySortKey(a, b);
+}
+
+static std::string albumKey(const SONG &song) {
+  return song.path.substr(0, song.path.rfind('/'));
+}
+
+static boolean byPath(const std::string &a, const std::string &b) {
+  return a < b;
+}
+
+static boolean byTrack(const SONG &a, const SONG &b) {
+  return (a.track.track != b.track.track) ? a.track.track < b.track.track : a.path < b.path;
+}
+
+static std::string titleLabel(const SONG &song) {
+  return (song.track.title[0] != '\0') ? song.track.title : song.path.substr(song.path.rfind('/') + 1);
+}
+
+static std::string yearLabel(const SONG &song) {
+  return (song.track.year != 0) ? std::to_string(song.track.year) + " " + songLabel(song) : songLabel(song);
+}
+
+int main(int argc, char **argv) {
+
+  int threads = std::thread::hardware_concurrency();
+  boolean full = false;
+  int opt;
+  while ((opt = getopt(argc, argv, "j:fav")) != -1) {
+    switch (opt) {
+      case 'j': threads = atoi(optarg); break;
+      case 'f': full = true; break;
+      case 'a': writeArt = true; break;
+      case 'v': verbose = true; break;
+      default:
+        fprintf(stderr, "usage: libprep [-j threads] [-f] [-a] [-v] <music-dir>\n");
+        return 2;
+    }
+  }
+  if (optind != argc - 1) {
+    fprintf(stderr, "usage: libprep [-j threads] [-f] [-a] [-v] <music-dir>\n");
+    return 2;
+  }
+  root = argv[optind];
+  while ((root.size() > 1) && (root.back() == '/')) {
+    root.pop_back();
+  }
+  threads = std::max(threads, 1);
+  std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+
+  std::vector<SONG> songs;
+  findSongs("", songs);
+  std::sort(songs.begin(), songs.end(), [](const SONG &a, const SONG &b) { return a.path < b.path; });
+
+  mkdir((root + "/.library").c_str(), 0777);
+  if (writeArt) {
+    mkdir((root + "/.library/art").c_str(), 0777);
+  }
+  std::string indexPath = root + LIBRARY_INDEX_PATH;
+
+  // Keep the records of unchanged songs
+  std::vector<size_t> work;
+  std::map<std::string, LIBRARY_TRACK> old;
+  if (!full) {
+    old = readIndex(indexPath);
+  }
+  for (size_t i = 0; i < songs.size(); i++) {
+    std::map<std::string, LIBRARY_TRACK>::iterator it = old.find(songs[i].path);
+    if ((it != old.end()) && (it->second.size == songs[i].size) && (it->second.mtime == songs[i].mtime)) {
+      songs[i].track = it->second;
+      songs[i].reused = true;
+      songs[i].ok = true;
+    } else {
+      work.push_back(i);
+    }
+  }
+
+  // Read the rest on every core
+  std::atomic<size_t> next(0);
+  std::vector<std::thread> pool;
+  for (int t = 0; t < threads; t++) {
+    pool.push_back(std::thread([&]() {
+      size_t w;
+      while ((w = next++) < work.size()) {
+        SONG &song = songs[work[w]];
+        song.ok = readSong(song);
+        if (verbose || !song.ok) {
+          std::lock_guard<std::mutex> lock(printLock);
+          if (song.ok) {
+            printf("%s  %u:%02u  %u kbps%s\n", song.path.c_str(), song.track.durationMs / 60000,
+                   song.track.durationMs / 1000 % 60, song.track.kbps,
+                   (song.track.flags & LTF_VBR) ? " VBR" : "");
+          } else {
+            fprintf(stderr, "%s: no MP3 frames\n", song.path.c_str());
+          }
+        }
+      }
+    }));
+  }
+  for (std::thread &t : pool) {
+    t.join();
+  }
+
+  // Write the index next to the old one and replace it
+  std::vector<uint8_t> records;
+  std::vector<uint32_t> offsets;
+  uint32_t count = 0, failed = 0;
+  for (const SONG &song : songs) {
+    count += song.ok ? 1 : 0;
+    failed += song.ok ? 0 : 1;
+  }
+  std::vector<uint32_t> moved = moveTracks(songs);
+  uint32_t statsKept, historyKept;
+  std::vector<uint8_t> stats = remapStats(moved, count, &statsKept);
+  std::vector<uint8_t> history = remapHistory(moved, count, &historyKept);
+  uint32_t base = LIBRARY_INDEX_HEADER + 4 * count;
+  for (const SONG &song : songs) {
+    if (song.ok) {
+      offsets.push_back(base + records.size());
+      LibraryIndex::encode(song.path.c_str(), &song.track, records);
+    }
+  }
+  std::vector<uint8_t> file;
+  put32(file, LIBRARY_INDEX_MAGIC);
+  put32(file, LIBRARY_INDEX_VERSION);
+  put32(file, count);
+  for (uint32_t offset : offsets) {
+    put32(file, offset);
+  }
+  file.insert(file.end(), records.begin(), records.end());
+  std::string tmpPath = indexPath + ".tmp";
+  writeFile(tmpPath, file.data(), file.size());
+  if (rename(tmpPath.c_str(), indexPath.c_str()) != 0) {
+    fprintf(stderr, "can't write %s\n", indexPath.c_str());
+    return 1;
+  }
+  if (!stats.empty()) {
+    std::string statsPath = root + PLAY_STATS_PATH;
+    writeFile(statsPath + ".tmp", stats.data(), stats.size());
+    if (rename((statsPath + ".tmp").c_str(), statsPath.c_str()) != 0) {
+      fprintf(stderr, "can't write %s\n", statsPath.c_str());
+      return 1;
+    }
+    printf("play statistics of %u songs kept\n", statsKept);
+  }
+  if (!history.empty()) {
+    std::string historyPath = root + SHUFFLE_HISTORY_PATH;
+    writeFile(historyPath + ".tmp", history.data(), history.size());
+    if (rename((historyPath + ".tmp").c_str(), historyPath.c_str()) != 0) {
+      fprintf(stderr, "can't write %s\n", historyPath.c_str());
+      return 1;
+    }
+    printf("shuffle history of %u songs kept\n", historyKept);
+  }
+  double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+
+  // Look every song up as the player would
+  PosixFileSystem fs(root.c_str());
+  LibraryIndex index;
+  uint32_t mismatches = 0;
+  if (!index.open(&fs)) {
+    fprintf(stderr, "can't read back %s\n", indexPath.c_str());
+    return 1;
+  }
+  static LIBRARY_TRACK found;
+  for (const SONG &song : songs) {
+    if (song.ok && (!index.find(song.path.c_str(), &found) || (found.size != song.size) ||
+                    (found.durationMs != song.track.durationMs) ||
+                    (found.seekCount != song.track.seekCount) || strcmp(found.title, song.track.title))) {
+      fprintf(stderr, "%s: read back differs\n", song.path.c_str());
+      mismatches++;
+    }
+  }
+
+  printf("%u songs: %zu kept, %zu read on %d threads, %u without frames\n", count + failed,
+         (size_t)(songs.size() - work.size()), work.size(), threads, failed);
+  printf("%s: %zu bytes in %.0f ms\n", indexPath.c_str(), file.size(), ms);
+
+  // Browse indexes by track number, the song's place in the index
+  startTime = std::chrono::steady_clock::now();
+  std::vector<const SONG *> indexed;
+  for (const SONG &song : songs) {
+    if (song.ok) {
+      indexed.push_back(&song);
+    }
+  }
+  boolean browsed = writeBrowseIndex(root + BROWSE_GENRE_PATH, indexed, genreKey, byName, bySortKey, songLabel) &&
+                    writeBrowseIndex(root + BROWSE_DECADE_PATH, indexed, decadeKey, byName, byYear, yearLabel) &&
+                    writeBrowseIndex(root + BROWSE_RECENT_PATH, indexed, monthKey, newestFirst, byNewest, songLabel) &&
+                    writeBrowseIndex(root + BROWSE_ALBUM_PATH, indexed, albumKey, byPath, byTrack, titleLabel);
+  ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+  printf("browse indexes in %.0f ms\n", ms);
+  return ((mismatches == 0) && browsed) ? 0 : 1;
+}
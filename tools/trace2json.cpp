@@ -0,0 +1,114 @@
+/*
+   Convert a CYD Music Player trace dump to Chrome trace_event JSON
+
+   Build:
+     g++ -O2 -std=c++11 -o trace2json trace2json.cpp
+
+   Usage:
+     trace2json trace.bin > trace.json
+
+   Load the result in chrome://tracing or https://ui.perfetto.dev.
+   Timestamps are microseconds from the first record. The 32 bit cycle
+   counter is unwrapped by assuming records are in time order and no gap
+   between neighbors is longer than one counter period. Records of FSM
+   state changes are labeled with the state names stored in the dump.
+
+   Last Update: 10/18/2026
+*/
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include "../Trace.h"
+
+// Escape a string for JSON
+static std::string quote(const std::string &s) {
+  std::string out = "\"";
+  for (char c : s) {
+    if (c == '"' || c == '\\') {
+      out += '\\';
+    }
+    if ((unsigned char) c >= 0x20) {
+      out += c;
+    }
+  }
+  return out + "\"";
+}
+
+int main(int argc, char **argv) {
+  if (argc != 2) {
+    fprintf(stderr, "usage: trace2json <trace.bin>\n");
+    return 2;
+  }
+
+  FILE *in = fopen(argv[1], "rb");
+  if (in == NULL) {
+    perror(argv[1]);
+    return 1;
+  }
+
+  TRACE_FILE_HEADER header;
+  if (fread(&header, sizeof(header), 1, in) != 1 ||
+      memcmp(header.magic, TRACE_MAGIC, 4) != 0 || header.version != TRACE_VERSION) {
+    fprintf(stderr, "%s: not a version %d trace dump\n", argv[1], TRACE_VERSION);
+    return 1;
+  }
+  if (header.ticksPerUs == 0) {
+    fprintf(stderr, "%s: bad tick rate\n", argv[1]);
+    return 1;
+  }
+
+  std::vector<TRACE_RECORD> records(header.recordCount);
+  if (header.recordCount > 0 &&
+      fread(records.data(), sizeof(TRACE_RECORD), header.recordCount, in) != header.recordCount) {
+    fprintf(stderr, "%s: truncated\n", argv[1]);
+    return 1;
+  }
+
+  std::vector<std::string> stateNames;
+  for (int i = 0; i < header.nameCount; i++) {
+    std::string name;
+    int c;
+    while ((c = fgetc(in)) != EOF && c != 0) {
+      name += (char) c;
+    }
+    stateNames.push_back(name);
+  }
+  fclose(in);
+
+  if (header.lost > 0) {
+    fprintf(stderr, "note: %u older records were overwritten\n", header.lost);
+  }
+
+  printf("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+
+  uint64_t base = records.empty() ? 0 : records[0].ticks;
+  uint64_t wraps = 0;
+  uint32_t previous = records.empty() ? 0 : records[0].ticks;
+
+  for (size_t i = 0; i < records.size(); i++) {
+    const TRACE_RECORD &r = records[i];
+
+    // Unwrap the cycle counter
+    if (r.ticks < previous && (previous - r.ticks) > 0x80000000u) {
+      wraps += 0x100000000ULL;
+    }
+    previous = r.ticks;
+    double us = (double)(wraps + r.ticks - base) / header.ticksPerUs;
+
+    std::string name = (r.event < TE_COUNT) ? TRACE_EVENT_NAMES[r.event] : "unknown";
+    std::string args = "{\"arg\":" + std::to_string(r.arg) + "}";
+    if (r.event == TE_FSM_STATE) {
+      name = (r.arg < stateNames.size()) ? stateNames[r.arg] : "state " + std::to_string(r.arg);
+      args = "{\"state\":" + std::to_string(r.arg) + "}";
+    }
+
+    printf("%s{\"name\":%s,\"ph\":\"%c\",\"ts\":%.3f,\"pid\":1,\"tid\":1,%s\"args\":%s}\n",
+           i ? "," : "", quote(name).c_str(), r.phase, us,
+           r.phase == TRACE_PHASE_INSTANT ? "\"s\":\"g\"," : "", args.c_str());
+  }
+
+  printf("]}\n");
+  return 0;
+}
@@ -0,0 +1,372 @@
+/*
+   Host test of the HTTP/WebDAV server
+
+   Runs WebDAVServer.h on Linux, with the Arduino, WiFi and SdFat
+   stand-ins in tools/arduino, against <scratch-dir>/card and checks it
+   with curl: authentication, OPTIONS, PUT with a length, chunked and
+   cut off, GET whole files, ranges and HEAD, keep-alive, MKCOL,
+   PROPFIND and HTML listings of a large folder, MOVE (renames,
+   replacing files and folders, and the moves that are refused) and
+   DELETE.
+
+   The server runs in its own thread and every handleHTTP() call is
+   timed. Accepted sockets get a 16 KB send buffer and big downloads are
+   read at a limited rate, so the server's sends find the buffer full.
+   Folder removals are made slow by a 200 us model card write time.
+   The longest call must stay under MAX_CALL_MS, so neither a slow
+   reader nor a big tree blocks the player's loop.
+
+   Build:
+     g++ -O2 -std=c++11 -Wall -Wextra -pthread -I arduino -o webdavtest webdavtest.cpp
+
+   Usage:
+     webdavtest <scratch-dir>
+
+   <scratch-dir>/card is deleted and made again. Exits with 1 if a check
+   fails.
+
+   Last Update: 10/18/2026
+*/
+
+#include <atomic>
+#include <mutex>
+#include <signal.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define HTTP_PORT 0
+#include "../WebDAVServer.h"
+
+#define USER "craig"
+#define PASSWORD "music"
+#define MAX_CALL_MS 60
+#define SEND_BUFFER 16384
+
+static WebDAVServer dav;
+static SdFs card;
+static std::atomic<bool> running(true);
+static std::atomic<uint32_t> maxCallUs(0);
+static std::mutex changedLock;
+static std::vector<std::string> changed;
+
+static std::string scratch;
+static std::string base;
+static int failures = 0;
+
+static void check(bool ok, const char *what) {
+  printf("%s %s\n", ok ? "ok  " : "FAIL", what);
+  if (!ok) {
+    failures++;
+  }
+}
+
+static void pathChanged(const char *path) {
+  std::lock_guard<std::mutex> lock(changedLock);
+  changed.push_back(path);
+}
+
+static bool wasChanged(const char *path) {
+  std::lock_guard<std::mutex> lock(changedLock);
+  for (const std::string &p : changed) {
+    if (p == path) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static void serve() {
+  while (running) {
+    uint64_t start = hostNowUs();
+    dav.handleHTTP();
+    uint32_t us = hostNowUs() - start;
+    if (us > maxCallUs) {
+      maxCallUs = us;
+    }
+    usleep(100);
+  }
+}
+
+// Run a shell command and return what it printed
+static std::string run(const std::string &cmd) {
+  std::string out;
+  FILE *p = popen(cmd.c_str(), "r");
+  if (p == NULL) {
+    return out;
+  }
+  char buf[4096];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), p)) > 0) {
+    out.append(buf, n);
+  }
+  pclose(p);
+  return out;
+}
+
+static std::string readFile(const std::string &path) {
+  std::string data;
+  FILE *f = fopen(path.c_str(), "rb");
+  if (f != NULL) {
+    char buf[65536];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+      data.append(buf, n);
+    }
+    fclose(f);
+  }
+  return data;
+}
+
+static void writeFile(const std::string &path, const std::string &data) {
+  FILE *f = fopen(path.c_str(), "wb");
+  fwrite(data.data(), 1, data.size(), f);
+  fclose(f);
+}
+
+static std::string cardPath(const char *path) {
+  return hostCardPath(path);
+}
+
+static std::string pattern(size_t size, uint32_t seed) {
+  std::string data(size, 0);
+  halRandomSeed(seed);
+  for (size_t i = 0; i < size; i++) {
+    data[i] = (char) halRandom(256);
+  }
+  return data;
+}
+
+// Run curl with options and a path on the server. Returns the status
+// code, the body in *body and the response headers in *headers.
+static int http(const std::string &options, const char *path,
+                std::string *body = NULL, std::string *headers = NULL) {
+  std::string out = scratch + "/body";
+  std::string hdr = scratch + "/headers";
+  unlink(out.c_str());
+  std::string code = run("curl -s --max-time 60 -u " USER ":" PASSWORD " -o " + out +
+                         " -D " + hdr + " -w '%{http_code}' " + options + " '" + base + path + "'");
+  if (body != NULL) {
+    *body = readFile(out);
+  }
+  if (headers != NULL) {
+    *headers = readFile(hdr);
+  }
+  return atoi(code.c_str());
+}
+
+static int countOf(const std::string &text, const char *what) {
+  int n = 0;
+  for (size_t at = text.find(what); at != std::string::npos; at = text.find(what, at + 1)) {
+    n++;
+  }
+  return n;
+}
+
+// Files below a host directory
+static int countFiles(const std::string &dir) {
+  return atoi(run("find '" + dir + "' -type f 2>/dev/null | wc -l").c_str());
+}
+
+static bool hostExists(const std::string &path) {
+  struct stat st;
+  return stat(path.c_str(), &st) == 0;
+}
+
+// folders x files tree of small files, with a subfolder in each folder
+static void makeTree(const char *path, int folders, int files) {
+  std::string top = cardPath(path);
+  ::mkdir(top.c_str(), 0755);
+  for (int d = 0; d < folders; d++) {
+    std::string dir = top + "/folder " + std::to_string(d);
+    ::mkdir(dir.c_str(), 0755);
+    ::mkdir((dir + "/sub").c_str(), 0755);
+    for (int f = 0; f < files; f++) {
+      writeFile(dir + "/song " + std::to_string(f) + ".mp3", "x");
+    }
+    writeFile(dir + "/sub/cover.jpg", "y");
+  }
+}
+
+static std::string moveTo(const char *path) {
+  return "-X MOVE -H 'Destination: " + base + path + "'";
+}
+
+static void testBasics() {
+  std::string body, headers;
+
+  check(atoi(run("curl -s -o /dev/null -w '%{http_code}' '" + base + "/'").c_str()) == 401,
+        "GET without credentials is 401");
+  check(http("-X OPTIONS", "/", NULL, &headers) == 200 &&
+          headers.find("DAV: 1") != std::string::npos,
+        "OPTIONS reports DAV");
+  check(http("--path-as-is", "/../etc/passwd") == 400, "paths above the root are 400");
+}
+
+static void testPutGet() {
+  std::string body, headers;
+
+  std::string small = pattern(1000, 1);
+  writeFile(scratch + "/small", small);
+  check(http("-T " + scratch + "/small", "/small.bin") == 201, "PUT a new file is 201");
+  check(http("-T " + scratch + "/small", "/small.bin") == 204, "PUT over a file is 204");
+  check(readFile(cardPath("/small.bin")) == small, "PUT content");
+  check(wasChanged("/small.bin"), "PUT reports the changed path");
+  check(http("-T " + scratch + "/small", "/nofolder/small.bin") == 409, "PUT into a missing folder is 409");
+
+  // curl sends stdin chunked
+  std::string big = pattern(4 * 1024 * 1024 + 123, 2);
+  writeFile(scratch + "/big", big);
+  check(http("-T - < " + scratch + "/big", "/big.bin") == 201, "chunked PUT is 201");
+  check(readFile(cardPath("/big.bin")) == big, "chunked PUT content");
+
+  // curl gives up a quarter of the way through a slow upload
+  run("curl -s --max-time 1 --limit-rate 1M -u " USER ":" PASSWORD " -T " + scratch +
+      "/big -o /dev/null '" + base + "/small.bin'");
+  for (int i = 0; i < 100 && hostExists(cardPath("/small.bin.~0")); i++) {
+    usleep(10000);
+  }
+  check(readFile(cardPath("/small.bin")) == small && !hostExists(cardPath("/small.bin.~0")),
+        "a cut off PUT leaves the old file and no partial upload");
+
+  maxCallUs = 0;
+  check(http("--limit-rate 1M", "/big.bin", &body) == 200 && body == big, "GET of a 4 MB file read at 1 MB/s");
+  printf("     longest handleHTTP() call %.1f ms\n", maxCallUs / 1000.0);
+  check(maxCallUs < MAX_CALL_MS * 1000, "a slow reader doesn't block handleHTTP()");
+
+  check(http("-r 100-199", "/big.bin", &body, &headers) == 206 && body == big.substr(100, 100) &&
+          headers.find("Content-Range: bytes 100-199/") != std::string::npos,
+        "GET a range");
+  check(http("-r -10", "/big.bin", &body) == 206 && body == big.substr(big.size() - 10), "GET a suffix range");
+  check(http("-r 9999999-", "/big.bin") == 416, "GET a range past the end is 416");
+  check(http("-I", "/big.bin", NULL, &headers) == 200 &&
+          headers.find("Content-Length: " + std::to_string(big.size())) != std::string::npos,
+        "HEAD reports the length");
+  check(http("", "/missing.bin") == 404, "GET a missing file is 404");
+
+  // Two requests in one curl call share the connection
+  std::string connects = run("curl -s -u " USER ":" PASSWORD " -o /dev/null -o /dev/null -w '%{num_connects} ' '" +
+                             base + "/small.bin' '" + base + "/small.bin'");
+  check(connects == "1 0 ", "keep-alive reuses the connection");
+}
+
+static void testFolders() {
+  std::string body;
+
+  check(http("-X MKCOL", "/new") == 201, "MKCOL is 201");
+  check(http("-X MKCOL", "/new") == 405, "MKCOL of an existing folder is 405");
+  check(http("-X MKCOL", "/none/new") == 409, "MKCOL in a missing folder is 409");
+
+  ::mkdir(cardPath("/list").c_str(), 0755);
+  for (int i = 0; i < 300; i++) {
+    writeFile(cardPath(("/list/track & " + std::to_string(i) + ".mp3").c_str()), "z");
+  }
+  maxCallUs = 0;
+  check(http("--limit-rate 100k -X PROPFIND -H 'Depth: 1'", "/list", &body) == 207 &&
+          countOf(body, "<D:response>") == 301 && countOf(body, "track &amp; ") == 300 &&
+          body.find("</D:multistatus>") != std::string::npos,
+        "PROPFIND of a 300 file folder");
+  check(http("-X PROPFIND -H 'Depth: 0'", "/list", &body) == 207 && countOf(body, "<D:response>") == 1,
+        "PROPFIND depth 0");
+  check(http("--limit-rate 100k", "/list/", &body) == 200 && countOf(body, "<li>") == 300 &&
+          body.find("</ul></body></html>") != std::string::npos,
+        "HTML listing of a 300 file folder");
+  check(maxCallUs < MAX_CALL_MS * 1000, "listings don't block handleHTTP()");
+}
+
+static void testMove() {
+  std::string one = pattern(500, 3);
+  std::string two = pattern(700, 4);
+  writeFile(cardPath("/one.bin"), one);
+  writeFile(cardPath("/two.bin"), two);
+
+  check(http(moveTo("/three.bin"), "/one.bin") == 201 && !hostExists(cardPath("/one.bin")) &&
+          readFile(cardPath("/three.bin")) == one,
+        "MOVE to a new name is 201");
+  check(http(moveTo("/two.bin") + " -H 'Overwrite: F'", "/three.bin") == 412 &&
+          readFile(cardPath("/three.bin")) == one && readFile(cardPath("/two.bin")) == two,
+        "MOVE onto a file without Overwrite is 412");
+  check(http(moveTo("/two.bin"), "/three.bin") == 204 && !hostExists(cardPath("/three.bin")) &&
+          readFile(cardPath("/two.bin")) == one && !hostExists(cardPath("/two.bin.~0")),
+        "MOVE replacing a file is 204");
+  check(wasChanged("/three.bin") && wasChanged("/two.bin"), "MOVE reports both paths");
+
+  // Moves that would remove the source or the card
+  makeTree("/tree", 3, 5);
+  int files = countFiles(cardPath("/tree"));
+  check(http(moveTo("/"), "/tree") == 403, "MOVE onto the root is 403");
+  check(http(moveTo("/tree"), "/tree") == 403, "MOVE onto itself is 403");
+  check(http(moveTo("/TREE/"), "/tree") == 403, "MOVE onto itself in other case is 403");
+  check(http(moveTo("/tree/folder 0/moved"), "/tree") == 403, "MOVE into itself is 403");
+  check(http(moveTo("/tree"), "/tree/folder%200") == 403, "MOVE onto a folder holding it is 403");
+  check(http(moveTo("/anywhere"), "/") == 403, "MOVE of the root is 403");
+  check(countFiles(cardPath("/tree")) == files && files == 18, "refused moves leave the tree alone");
+
+  // Replace a big tree. It is removed over many calls.
+  makeTree("/old", 40, 25);
+  makeTree("/young", 2, 2);
+  hostCardDelayUs = 200;
+  maxCallUs = 0;
+  check(http(moveTo("/old"), "/young") == 204, "MOVE replacing a 1080 file folder is 204");
+  hostCardDelayUs = 0;
+  printf("     longest handleHTTP() call %.1f ms\n", maxCallUs / 1000.0);
+  check(maxCallUs < MAX_CALL_MS * 1000, "removing the old folder doesn't block handleHTTP()");
+  check(!hostExists(cardPath("/young")) && countFiles(cardPath("/old")) == 6 &&
+          !hostExists(cardPath("/old.~0")),
+        "the old folder is gone and the new one in its place");
+}
+
+static void testDelete() {
+  check(http("-X DELETE", "/") == 403, "DELETE of the root is 403");
+  check(http("-X DELETE", "/nothing") == 404, "DELETE of a missing file is 404");
+  check(http("-X DELETE", "/two.bin") == 204 && !hostExists(cardPath("/two.bin")), "DELETE a file");
+
+  makeTree("/gone", 50, 40);
+  hostCardDelayUs = 200;
+  maxCallUs = 0;
+  check(http("-X DELETE", "/gone") == 204, "DELETE of a 2050 file folder is 204");
+  hostCardDelayUs = 0;
+  printf("     longest handleHTTP() call %.1f ms\n", maxCallUs / 1000.0);
+  check(maxCallUs < MAX_CALL_MS * 1000, "DELETE of a big folder doesn't block handleHTTP()");
+  check(!hostExists(cardPath("/gone")) && wasChanged("/gone"), "the folder is gone and reported");
+  check(http("", "/small.bin") == 200, "the server answers after the removals");
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: webdavtest <scratch-dir>\n");
+    return 2;
+  }
+  if (system("curl --version > /dev/null 2>&1") != 0) {
+    fprintf(stderr, "curl is needed\n");
+    return 2;
+  }
+  signal(SIGPIPE, SIG_IGN);
+  setvbuf(stdout, NULL, _IOLBF, 0);
+
+  scratch = argv[1];
+  hostCardRoot = scratch + "/card";
+  run("rm -rf '" + hostCardRoot + "'");
+  ::mkdir(scratch.c_str(), 0755);
+  if (::mkdir(hostCardRoot.c_str(), 0755) != 0) {
+    perror(hostCardRoot.c_str());
+    return 2;
+  }
+
+  hostSendBuffer = SEND_BUFFER;
+  setPathChangedCallback(pathChanged);
+  dav.begin(USER, PASSWORD, &card);
+  base = "http://127.0.0.1:" + std::to_string(httpServer.port());
+  std::thread server(serve);
+
+  testBasics();
+  testPutGet();
+  testFolders();
+  testMove();
+  testDelete();
+
+  running = false;
+  server.join();
+  printf("%s: %d check(s) failed\n", failures ? "FAILED" : "passed", failures);
+  return failures ? 1 : 0;
+}